@@ -23,14 +23,18 @@ MODULE_DIR := prog/dump
 PROGDUMPDIR := $(MODULE_DIR)
 
 PROGDUMPMAN8DIR := $(MANDIR)/man8
-PROGDUMPMAN8FILES := $(MODULE_DIR)/isadump.8 $(MODULE_DIR)/isaset.8
+PROGDUMPMAN8FILES := $(MODULE_DIR)/isadump.8 $(MODULE_DIR)/isaset.8 \
+		     $(MODULE_DIR)/isasnap.8
 
 # Regrettably, even 'simply expanded variables' will not put their currently
 # defined value verbatim into the command-list of rules...
-PROGDUMPTARGETS := $(MODULE_DIR)/isadump $(MODULE_DIR)/isaset
+PROGDUMPTARGETS := $(MODULE_DIR)/isadump $(MODULE_DIR)/isaset \
+		   $(MODULE_DIR)/isasnap
 PROGDUMPSOURCES := $(MODULE_DIR)/util.c $(MODULE_DIR)/isadump.c \
-		   $(MODULE_DIR)/isaset.c $(MODULE_DIR)/superio.c
-PROGDUMPBININSTALL := $(MODULE_DIR)/isadump $(MODULE_DIR)/isaset
+		   $(MODULE_DIR)/isaset.c $(MODULE_DIR)/superio.c \
+		   $(MODULE_DIR)/snapshot.c $(MODULE_DIR)/isasnap.c
+PROGDUMPBININSTALL := $(MODULE_DIR)/isadump $(MODULE_DIR)/isaset \
+		      $(MODULE_DIR)/isasnap
 
 # Include all dependency files. We use '.rd' to indicate this will create
 # executables.
@@ -42,10 +46,16 @@ REMOVEDUMPMAN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(PROGDUMPMAN8DIR)/%,$(PRO
 all-prog-dump: $(PROGDUMPTARGETS)
 user :: all-prog-dump
 
-$(MODULE_DIR)/isadump: $(MODULE_DIR)/isadump.ro $(MODULE_DIR)/superio.ro $(MODULE_DIR)/util.ro
+$(MODULE_DIR)/isadump: $(MODULE_DIR)/isadump.ro $(MODULE_DIR)/superio.ro $(MODULE_DIR)/util.ro \
+		       $(MODULE_DIR)/snapshot.ro
 	$(CC) $(EXLDFLAGS) -o $@ $^
 
-$(MODULE_DIR)/isaset: $(MODULE_DIR)/isaset.ro $(MODULE_DIR)/util.ro
+$(MODULE_DIR)/isasnap: $(MODULE_DIR)/isasnap.ro $(MODULE_DIR)/snapshot.ro $(MODULE_DIR)/superio.ro \
+		       $(MODULE_DIR)/util.ro
+	$(CC) $(EXLDFLAGS) -o $@ $^
+
+$(MODULE_DIR)/isaset: $(MODULE_DIR)/isaset.ro $(MODULE_DIR)/superio.ro $(MODULE_DIR)/util.ro \
+		      $(MODULE_DIR)/snapshot.ro
 	$(CC) $(EXLDFLAGS) -o $@ $^
 
 install-prog-dump: all-prog-dump
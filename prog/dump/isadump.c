@@ -20,40 +20,98 @@
     MA 02110-1301 USA.
 */
 
+
 /*
 	Typical usage:
 	isadump 0x295 0x296		Basic winbond dump using address/data registers
 	isadump 0x295 0x296 2		Winbond dump, bank 2
+	isadump 0x295 0x296 0-4		Winbond dump, banks 0 to 4
 	isadump 0x2e 0x2f 0x09		Super-I/O, logical device 9
 	isadump -f 0x5000		Flat address space dump like for Via 686a
 	isadump -f 0xecf0 0x10 1	PC87366, temperature channel 2
+	isadump -b dumps.txt		All the dumps listed in dumps.txt
+	isadump -w 0.001 0x295 0x296	Report the registers which change, at 1 kHz
+	isadump -s 0x295 0x296 0-4 > f	Snapshot of banks 0 to 4, see isasnap
 */
 
-#include <sys/io.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <signal.h>
+#include <time.h>
 #include "util.h"
 #include "superio.h"
+#include "snapshot.h"
 
 #ifdef __powerpc__
 unsigned long isa_io_base = 0; /* XXX for now */
 #endif /* __powerpc__ */
 
+#define MAX_SPECS	64	/* dumps in a batch */
+#define MAX_ARGS	16	/* words on a batch line */
+
+/* One dump, as given on the command line or on a line of a batch */
+struct spec {
+	int flat;
+	int addrreg;		/* address in flat mode */
+	int datareg;		/* unused in flat mode */
+	int range;		/* can be changed only in flat mode */
+	int width;
+	unsigned long banks;	/* bit mask, 0 means no bank operation */
+	int bankreg;
+	unsigned char enter_key[SUPERIO_MAX_KEY+1];
+};
+
+enum format {
+	FORMAT_TABLE,
+	FORMAT_LINES,		/* one register per line */
+	FORMAT_RAW,		/* binary, little-endian */
+	FORMAT_SNAPSHOT,	/* for isasnap */
+};
+
+/* Options which apply to the whole run */
+struct options {
+	int yes;
+	enum format format;
+	const char *batch;	/* file listing the dumps */
+	const char *simulate;	/* snapshot to read instead of the chips */
+	double interval;	/* seconds between samples in watch mode */
+	unsigned long count;	/* samples in watch mode, 0 for no limit */
+};
+
+/* The registers of one bank, as read */
+struct block {
+	int bank;		/* -1 if no bank operation */
+	int range;		/* can be shorter than the spec's */
+	unsigned long regs[256];	/* by offset, every width bytes */
+};
+
 static void help(void)
 {
 	fprintf(stderr,
 	        "Syntax for I2C-like access:\n"
-	        "  isadump [OPTIONS] [-k V1,V2...] ADDRREG DATAREG [BANK [BANKREG]]\n"
+	        "  isadump [OPTIONS] [-k V1,V2...] ADDRREG DATAREG [BANKS [BANKREG]]\n"
 	        "Syntax for flat address space:\n"
-	        "  isadump -f [OPTIONS] ADDRESS [RANGE [BANK [BANKREG]]]\n"
+	        "  isadump -f [OPTIONS] ADDRESS [RANGE [BANKS [BANKREG]]]\n"
+	        "Syntax for batch mode:\n"
+	        "  isadump -b FILE [-y] [-m|-r|-s] [-w INTERVAL [-c COUNT]] [-S FILE]\n"
 		"Options:\n"
 		"  -k	Super-I/O configuration access key\n"
 		"  -f	Enable flat address space mode\n"
 		"  -y	Assume affirmative answer to all questions\n"
 		"  -W	Read and display word (16-bit) values\n"
-		"  -L	Read and display long (32-bit) values\n");
+		"  -L	Read and display long (32-bit) values\n"
+		"  -b	Read the dumps from FILE, one per line (- for stdin)\n"
+		"  -m	Machine-readable output, one register per line\n"
+		"  -r	Raw binary output, little-endian\n"
+		"  -s	Snapshot output, for isasnap\n"
+		"  -w	Watch mode, sample every INTERVAL seconds and report "
+		"changes\n"
+		"  -c	Stop watching after COUNT samples\n"
+		"  -S	Read the registers from snapshot FILE, not the chips\n"
+		"BANKS is a bank number, or a list of numbers and ranges "
+		"like 0-3,5\n");
 }
 
 static int default_bankreg(int flat, int addrreg, int datareg)
@@ -76,247 +134,781 @@ static int set_bank(int flat, int addrreg, int datareg, int bank, int bankreg)
 	int oldbank;
 
 	if (flat) {
-		oldbank = inb(addrreg+bankreg);
-		outb(bank, addrreg+bankreg);
+		oldbank = inx(addrreg+bankreg, 1);
+		outx(bank, addrreg+bankreg, 1);
 	} else {
-		outb(bankreg, addrreg);
-		oldbank = inb(datareg);
-		outb(bank, datareg);
+		outx(bankreg, addrreg, 1);
+		oldbank = inx(datareg, 1);
+		outx(bank, datareg, 1);
 	}
 
 	return oldbank;
 }
 
-int main(int argc, char *argv[])
+/* Parse a list of banks like 0-3,5 into a bit mask */
+static int parse_banks(const char *s, unsigned long *banks)
+{
+	long first, last;
+	char *end;
+
+	*banks = 0;
+	while (1) {
+		first = last = strtol(s, &end, 0);
+		if (end != s && *end == '-') {
+			s = end + 1;
+			last = strtol(s, &end, 0);
+		}
+		if (end == s || (*end && *end != ','))
+			return -1;
+		if (first < 0 || last > 31 || first > last)
+			return -2;
+		while (first <= last)
+			*banks |= 1UL << first++;
+		if (!*end)
+			return 0;
+		s = end + 1;
+	}
+}
+
+static void print_banks(FILE *f, unsigned long banks)
+{
+	int first, last;
+	const char *sep = "";
+
+	for (first = 0; first < 32; first = last + 1) {
+		last = first;
+		if (!(banks & (1UL << first)))
+			continue;
+		while (last < 31 && (banks & (1UL << (last + 1))))
+			last++;
+		if (last == first)
+			fprintf(f, "%s%d", sep, first);
+		else
+			fprintf(f, "%s%d-%d", sep, first, last);
+		sep = ",";
+	}
+}
+
+/* Parse an option of the whole run, and its argument if it takes one */
+static int parse_option(int argc, char *argv[], int *flags,
+			struct options *opts)
+{
+	char opt = argv[1+*flags][1], *end;
+	const char *arg = NULL;
+
+	if (opt == 'b' || opt == 'w' || opt == 'c' || opt == 'S') {
+		if (2+*flags >= argc) {
+			fprintf(stderr, "Error: Missing argument to -%c\n", opt);
+			return -1;
+		}
+		arg = argv[2+*flags];
+		(*flags)++;
+	}
+
+	switch (opt) {
+	case 'y':
+		opts->yes = 1;
+		break;
+	case 'm':
+		opts->format = FORMAT_LINES;
+		break;
+	case 'r':
+		opts->format = FORMAT_RAW;
+		break;
+	case 's':
+		opts->format = FORMAT_SNAPSHOT;
+		break;
+	case 'b':
+		opts->batch = arg;
+		break;
+	case 'S':
+		opts->simulate = arg;
+		break;
+	case 'w':
+		opts->interval = strtod(arg, &end);
+		if (*end || !(opts->interval >= 0.00001)
+		 || opts->interval > 3600) {
+			fprintf(stderr, "Error: Invalid interval!\n");
+			return -1;
+		}
+		break;
+	case 'c':
+		opts->count = strtoul(arg, &end, 0);
+		if (*end || !opts->count || arg[0] == '-') {
+			fprintf(stderr, "Error: Invalid count!\n");
+			return -1;
+		}
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Parse the arguments of one dump. opts is NULL on the lines of a batch,
+ * where the options of the whole run are not allowed.
+ */
+static int parse_spec(int argc, char *argv[], struct spec *spec,
+		      struct options *opts)
 {
-	int addrreg;        /* address in flat mode */
-	int datareg = 0;    /* unused in flat mode */
-	int range = 256;    /* can be changed only in flat mode */
-	int bank = -1;      /* -1 means no bank operation */
-	int bankreg;
-	int oldbank = 0;
-	int i, j;
-	unsigned long res;
 	int flags = 0;
-	int flat = 0, yes = 0, width = 1;
 	char *end;
-	unsigned char enter_key[SUPERIO_MAX_KEY+1];
+	int ret;
 
-	enter_key[0] = 0;
+	memset(spec, 0, sizeof(*spec));
+	spec->range = 256;
+	spec->width = 1;
 
 	/* handle (optional) flags first */
 	while (1+flags < argc && argv[1+flags][0] == '-') {
 		switch (argv[1+flags][1]) {
-		case 'f': flat = 1; break;
-		case 'y': yes = 1; break;
+		case 'f': spec->flat = 1; break;
 		case 'k':
 			if (2+flags >= argc
-			 || superio_parse_key(enter_key, argv[2+flags]) < 0) {
+			 || superio_parse_key(spec->enter_key,
+					      argv[2+flags]) < 0) {
 				fprintf(stderr, "Invalid or missing key\n");
-				help();
-				exit(1);
+				return -1;
 			}
 			flags++;
 			break;
-		case 'W': width = 2; break;
-		case 'L': width = 4; break;
+		case 'W': spec->width = 2; break;
+		case 'L': spec->width = 4; break;
+		case 'y':
+		case 'm':
+		case 'r':
+		case 's':
+		case 'b':
+		case 'w':
+		case 'c':
+		case 'S':
+			if (opts && parse_option(argc, argv, &flags, opts) < 0)
+				return -1;
+			if (opts)
+				break;
+			/* fall through */
 		default:
 			fprintf(stderr, "Warning: Unsupported flag "
 				"\"-%c\"!\n", argv[1+flags][1]);
-			help();
-			exit(1);
+			return -1;
 		}
 		flags++;
 	}
 
+	/* the dumps are in the batch file */
+	if (opts && opts->batch) {
+		if (1+flags < argc || spec->flat || spec->width != 1
+		 || spec->enter_key[0]) {
+			fprintf(stderr, "Error: Only -y, -m, -r, -s, -w, -c "
+				"and -S can be used with -b\n");
+			return -1;
+		}
+		return 0;
+	}
+
 	/* key is never needed in flat mode */
-	if (flat && enter_key[0]) {
+	if (spec->flat && spec->enter_key[0]) {
 		fprintf(stderr, "Error: Cannot use key in flat mode\n");
-		exit(1);
+		return -1;
 	}
 
 	/* verify that the argument count is correct */
-	if ((!flat && argc < 1+flags+2)
-	 || (flat && argc < 1+flags+1)) {
-		help();
-		exit(1);
+	if ((!spec->flat && argc < 1+flags+2)
+	 || (spec->flat && argc < 1+flags+1)
+	 || argc > 1+flags+4) {
+		fprintf(stderr, "Error: Wrong number of arguments\n");
+		return -1;
 	}
 
-	addrreg = strtol(argv[1+flags], &end, 0);
+	spec->addrreg = strtol(argv[1+flags], &end, 0);
 	if (*end) {
 		fprintf(stderr, "Error: Invalid address!\n");
-		help();
-		exit(1);
+		return -1;
 	}
-	if (addrreg < 0 || addrreg > (flat?0xffff:0x3fff)) {
+	if (spec->addrreg < 0 || spec->addrreg > (spec->flat?0xffff:0x3fff)) {
 		fprintf(stderr, "Error: Address out of range "
-		        "(0x0000-0x%04x)!\n", flat?0xffff:0x3fff);
-		help();
-		exit(1);
+		        "(0x0000-0x%04x)!\n", spec->flat?0xffff:0x3fff);
+		return -1;
 	}
 
-	if (flat) {
+	if (spec->flat) {
 		if (1+flags+1 < argc) {
-			range = strtol(argv[1+flags+1], &end, 0);
-			if (*end || range <= 0 || range > 0x100
-			 || range & 0xf) {
+			spec->range = strtol(argv[1+flags+1], &end, 0);
+			if (*end || spec->range <= 0 || spec->range > 0x100
+			 || spec->range & 0xf) {
 				fprintf(stderr, "Error: Invalid range!\n"
 				        "Hint: Must be a multiple of 16 no "
 				        "greater than 256.\n");
-				help();
-				exit(1);
+				return -1;
 			}
 		} else {
-			addrreg &= 0xff00; /* Force alignment */
+			spec->addrreg &= 0xff00; /* Force alignment */
 		}
 	} else {
-		datareg = strtol(argv[1+flags+1], &end, 0);
+		spec->datareg = strtol(argv[1+flags+1], &end, 0);
 		if (*end) {
 			fprintf(stderr, "Error: Invalid data register!\n");
-			help();
-			exit(1);
+			return -1;
 		}
-		if (datareg < 0 || datareg > 0x3fff) {
+		if (spec->datareg < 0 || spec->datareg > 0x3fff) {
 			fprintf(stderr, "Error: Data register out of range "
 			        "(0x0000-0x3fff)!\n");
-			help();
-			exit(1);
+			return -1;
 		}
 	}
 
-	bankreg = default_bankreg(flat, addrreg, datareg);
+	spec->bankreg = default_bankreg(spec->flat, spec->addrreg,
+					spec->datareg);
 
 	if (1+flags+2 < argc) {
-		bank = strtol(argv[1+flags+2], &end, 0);
-		if (*end) {
+		ret = parse_banks(argv[1+flags+2], &spec->banks);
+		if (ret == -1) {
 			fprintf(stderr, "Error: Invalid bank number!\n");
-			help();
-			exit(1);
+			return -1;
 		}
-		if ((bank < 0) || (bank > 31)) {
+		if (ret) {
 			fprintf(stderr, "Error: bank out of range (0-31)!\n");
-			help();
-			exit(1);
+			return -1;
 		}
 
 		if (1+flags+3 < argc) {
-			bankreg = strtol(argv[1+flags+3], &end, 0);
+			spec->bankreg = strtol(argv[1+flags+3], &end, 0);
 			if (*end) {
 				fprintf(stderr, "Error: Invalid bank "
 				        "register!\n");
-				help();
-				exit(1);
+				return -1;
 			}
-			if (bankreg < 0 || bankreg >= range) {
+			if (spec->bankreg < 0 || spec->bankreg >= spec->range) {
 				fprintf(stderr, "Error: bank out of range "
-				        "(0x00-0x%02x)!\n", range-1);
-				help();
-				exit(1);
+				        "(0x00-0x%02x)!\n", spec->range-1);
+				return -1;
 			}
 		}
 	}
 
-	if (geteuid()) {
-		fprintf(stderr, "Error: Can only be run as root (or make it "
-		        "suid root)\n");
-		exit(1);
-	}
+	return 0;
+}
 
-	if (!yes) {
-		fprintf(stderr, "WARNING! Running this program can cause "
-		        "system crashes, data loss and worse!\n");
+/* Read the dumps of a batch file, one per line. Returns their number. */
+static int read_batch(const char *file, struct spec *specs)
+{
+	static char name[] = "isadump";
+	char line[256], *args[MAX_ARGS];
+	int n = 0, num = 0, argc;
+	FILE *f;
+
+	f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Error: Could not open %s!\n", file);
+		return -1;
+	}
 
-		if (flat)
-			fprintf(stderr, "I will probe address range 0x%x to "
-			        "0x%x.\n", addrreg, addrreg + range - 1);
-		else
-			fprintf(stderr, "I will probe address register 0x%x "
-			        "and data register 0x%x.\n", addrreg, datareg);
+	while (fgets(line, sizeof(line), f)) {
+		num++;
+		/* parse_spec() skips the program name */
+		args[0] = name;
+		argc = split_args(line, args, MAX_ARGS);
+		if (argc == 1)
+			continue;
+
+		if (n == MAX_SPECS) {
+			fprintf(stderr, "Error: More than %d dumps!\n",
+				MAX_SPECS);
+			n = -1;
+			break;
+		}
+		if (argc < 0
+		 || parse_spec(argc, args, &specs[n], NULL) < 0) {
+			fprintf(stderr, "Error: Invalid dump at line %d of "
+				"%s\n", num, file);
+			n = -1;
+			break;
+		}
+		n++;
+	}
 
-		if (bank>=0) 	
-			fprintf(stderr, "Probing bank %d using bank register "
-			        "0x%02x.\n", bank, bankreg);
+	if (f != stdin)
+		fclose(f);
+	if (!n) {
+		fprintf(stderr, "Error: No dump in %s!\n", file);
+		return -1;
+	}
+	return n;
+}
 
-		fprintf(stderr, "Continue? [Y/n] ");
-		fflush(stderr);
-		if (!user_ack(1)) {
-			fprintf(stderr, "Aborting on user request.\n");
-			exit(0);
-		}
+static void describe(const struct spec *spec)
+{
+	if (spec->flat)
+		fprintf(stderr, "I will probe address range 0x%x to "
+		        "0x%x.\n", spec->addrreg,
+			spec->addrreg + spec->range - 1);
+	else
+		fprintf(stderr, "I will probe address register 0x%x "
+		        "and data register 0x%x.\n", spec->addrreg,
+			spec->datareg);
+
+	if (spec->banks) {
+		fprintf(stderr, "Probing bank%s ", spec->banks &
+			(spec->banks - 1) ? "s" : "");
+		print_banks(stderr, spec->banks);
+		fprintf(stderr, " using bank register 0x%02x.\n",
+			spec->bankreg);
 	}
+}
+
+/* Get access to the I/O ports of all the dumps, once */
+static int setup_io(const struct spec *specs, int n)
+{
+	int i, need_iopl = 0;
 
-#ifndef __powerpc__
-	if ((datareg < 0x400) && (addrreg < 0x400) && !flat) {
-		if (ioperm(datareg, 1, 1)) {
+	for (i = 0; i < n; i++) {
+		if (specs[i].flat || specs[i].datareg >= 0x400
+		 || specs[i].addrreg >= 0x400) {
+			need_iopl = 1;
+			continue;
+		}
+		if (io_permit(specs[i].datareg)) {
 			fprintf(stderr, "Error: Could not ioperm() data "
 			        "register!\n");
-			exit(1);
+			return -1;
 		}
-		if (ioperm(addrreg, 1, 1)) {
+		if (io_permit(specs[i].addrreg)) {
 			fprintf(stderr, "Error: Could not ioperm() address "
 			        "register!\n");
-			exit(1);
-		}
-	} else {
-		if (iopl(3)) {
-			fprintf(stderr, "Error: Could not do iopl(3)!\n");
-			exit(1);
+			return -1;
 		}
 	}
-#endif
-
-	/* Enter Super-I/O configuration mode */
-	if (enter_key[0])
-		superio_write_key(addrreg, enter_key);
-
-	if (bank >= 0)
-		oldbank = set_bank(flat, addrreg, datareg, bank, bankreg);
-
-	/* print column headers */
-	printf("%*s", flat ? 5 : 3, "");
-	for (j = 0; j < 16; j += width)
-		printf(" %*x", width * 2, j);
-	printf("\n");
+	if (need_iopl && io_permit_all()) {
+		fprintf(stderr, "Error: Could not do iopl(3)!\n");
+		return -1;
+	}
+	return 0;
+}
 
-	for (i = 0; i < range; i += 16) {
-		if (flat)
-			printf("%04x: ", addrreg + i);
-		else
-			printf("%02x: ", i);
+/*
+ * Read the registers of the current bank. Nothing is printed here, so
+ * that the chip is accessed with no system call in between.
+ */
+static void read_bank(const struct spec *spec, struct block *b)
+{
+	int addrreg = spec->addrreg, datareg = spec->datareg;
+	int width = spec->width;
+	int i, j;
 
+	b->range = spec->range;
+	for (i = 0; i < b->range; i += 16) {
 		/* It was noticed that Winbond Super-I/O chips
 		   would leave the configuration mode after
 		   an arbitrary number of register reads,
 		   causing any subsequent read attempt to
 		   silently fail. Repeating the key every 16 reads
 		   prevents that. */
-		if (enter_key[0])
-			superio_write_key(addrreg, enter_key);
+		if (spec->enter_key[0])
+			superio_write_key(addrreg, spec->enter_key);
 
 		for (j = 0; j < 16; j += width) {
-			fflush(stdout);
-			if (flat) {
-				res = inx(addrreg + i + j, width);
+			if (spec->flat) {
+				b->regs[i+j] = inx(addrreg + i + j, width);
 			} else {	
-				outb(i+j, addrreg);
-				if (i+j == 0 && inb(addrreg) == 0x80) {
+				outx(i+j, addrreg, 1);
+				if (i+j == 0 && inx(addrreg, 1) == 0x80) {
 					/* Bit 7 appears to be a busy flag */
-					range = 128;
+					b->range = 128;
 				}
-				res = inx(datareg, width);
+				b->regs[i+j] = inx(datareg, width);
 			}
-			printf("%0*lx ", width * 2, res);
 		}
+	}
+}
+
+static void print_table(const struct spec *spec, const struct block *b,
+			int title)
+{
+	int width = spec->width;
+	int i, j;
+
+	if (title) {
+		if (spec->flat)
+			printf("Address 0x%x", spec->addrreg);
+		else
+			printf("Address register 0x%x, data register 0x%x",
+			       spec->addrreg, spec->datareg);
+		if (b->bank >= 0)
+			printf(", bank %d", b->bank);
+		printf(":\n");
+	}
+
+	/* print column headers */
+	printf("%*s", spec->flat ? 5 : 3, "");
+	for (j = 0; j < 16; j += width)
+		printf(" %*x", width * 2, j);
+	printf("\n");
+
+	for (i = 0; i < b->range; i += 16) {
+		if (spec->flat)
+			printf("%04x: ", spec->addrreg + i);
+		else
+			printf("%02x: ", i);
+		for (j = 0; j < 16; j += width)
+			printf("%0*lx ", width * 2, b->regs[i+j]);
 		printf("\n");
 	}
+}
+
+/* address, data register, bank, offset, value */
+static void print_lines(const struct spec *spec, const struct block *b)
+{
+	char datareg[12], bank[12];
+	int i;
+
+	if (spec->flat)
+		strcpy(datareg, "-");
+	else
+		sprintf(datareg, "%04x", spec->datareg);
+	if (b->bank >= 0)
+		sprintf(bank, "%02x", b->bank);
+	else
+		strcpy(bank, "-");
+
+	for (i = 0; i < b->range; i += spec->width)
+		printf("%04x %s %s %02x %0*lx\n", spec->addrreg, datareg, bank,
+		       i, spec->width * 2, b->regs[i]);
+}
+
+/* The bytes of a block, little-endian */
+static void block_bytes(const struct spec *spec, const struct block *b,
+			unsigned char *buf)
+{
+	int i, k;
+
+	for (i = 0; i < b->range; i += spec->width)
+		for (k = 0; k < spec->width; k++)
+			buf[i+k] = b->regs[i] >> (8 * k);
+}
+
+static void print_raw(const struct spec *spec, const struct block *b)
+{
+	unsigned char buf[256];
+
+	block_bytes(spec, b, buf);
+	fwrite(buf, 1, b->range, stdout);
+}
+
+static void print_snapshot(const struct spec *spec, const struct block *b)
+{
+	struct snapshot_block sb;
+
+	sb.flat = spec->flat;
+	sb.addrreg = spec->addrreg;
+	sb.datareg = spec->datareg;
+	sb.bank = b->bank;
+	sb.bankreg = spec->bankreg;
+	sb.width = spec->width;
+	memcpy(sb.key, spec->enter_key, sizeof(sb.key));
+	sb.size = b->range;
+	block_bytes(spec, b, sb.data);
+	sb.chip = snapshot_chip_id(&sb);
+	snapshot_write_block(stdout, &sb);
+}
+
+/*
+ * Read all the banks of a spec, restore the original bank, then print
+ * them. Returns the number of blocks.
+ */
+static int dump_spec(const struct spec *spec, struct block *blocks)
+{
+	int bank, oldbank = -1, old, n = 0;
+
+	/* Enter Super-I/O configuration mode */
+	if (spec->enter_key[0])
+		superio_write_key(spec->addrreg, spec->enter_key);
+
+	if (!spec->banks) {
+		blocks[n].bank = -1;
+		read_bank(spec, &blocks[n++]);
+	}
+	for (bank = 0; bank < 32; bank++) {
+		if (!(spec->banks & (1UL << bank)))
+			continue;
+		old = set_bank(spec->flat, spec->addrreg, spec->datareg, bank,
+			       spec->bankreg);
+		if (oldbank < 0)
+			oldbank = old;
+		blocks[n].bank = bank;
+		read_bank(spec, &blocks[n++]);
+	}
 
 	/* Restore the original bank value */
-	if (bank >= 0)
-		set_bank(flat, addrreg, datareg, oldbank, bankreg);
+	if (oldbank >= 0)
+		set_bank(spec->flat, spec->addrreg, spec->datareg, oldbank,
+			 spec->bankreg);
 
 	/* Exit Super-I/O configuration mode */
-	if (enter_key[0])
-		superio_reset(addrreg, datareg);
+	if (spec->enter_key[0])
+		superio_reset(spec->addrreg, spec->datareg);
+
+	return n;
+}
+
+static void print_blocks(const struct spec *spec, const struct block *blocks,
+			 int n, enum format format, int title)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		switch (format) {
+		case FORMAT_TABLE:
+			if (title && i)
+				printf("\n");
+			print_table(spec, &blocks[i], title);
+			break;
+		case FORMAT_LINES:
+			print_lines(spec, &blocks[i]);
+			break;
+		case FORMAT_RAW:
+			print_raw(spec, &blocks[i]);
+			break;
+		case FORMAT_SNAPSHOT:
+			print_snapshot(spec, &blocks[i]);
+			break;
+		}
+	}
+}
+
+static volatile sig_atomic_t stop;
+
+/* How many blocks dump_spec() reads */
+static int spec_blocks(const struct spec *spec)
+{
+	unsigned long banks;
+	int n;
+
+	if (!spec->banks)
+		return 1;
+	for (banks = spec->banks, n = 0; banks; banks &= banks - 1)
+		n++;
+	return n;
+}
+
+static void watch_signal(int sig)
+{
+	(void)sig;
+	stop = 1;
+}
+
+static void timespec_add(struct timespec *ts, const struct timespec *step)
+{
+	ts->tv_sec += step->tv_sec;
+	ts->tv_nsec += step->tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static double timespec_diff(const struct timespec *a,
+			    const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+/* Print the registers which differ between two reads of a bank */
+static unsigned long print_changes(const struct spec *spec,
+				   const struct block *old,
+				   const struct block *new,
+				   const struct timespec *ts)
+{
+	unsigned long changes = 0;
+	int i;
+
+	/* nothing changed, the usual case */
+	if (!memcmp(old->regs, new->regs, new->range * sizeof(new->regs[0])))
+		return 0;
+
+	for (i = 0; i < new->range; i += spec->width) {
+		if (old->regs[i] == new->regs[i])
+			continue;
+		/* time, address, data register, bank, offset, old, new */
+		printf("%ld.%06ld %04x ", (long)ts->tv_sec, ts->tv_nsec / 1000,
+		       spec->addrreg);
+		if (spec->flat)
+			printf("- ");
+		else
+			printf("%04x ", spec->datareg);
+		if (new->bank >= 0)
+			printf("%02x ", new->bank);
+		else
+			printf("- ");
+		printf("%02x %0*lx %0*lx\n", i, spec->width * 2, old->regs[i],
+		       spec->width * 2, new->regs[i]);
+		changes++;
+	}
+	return changes;
+}
+
+/*
+ * Read all the dumps every interval, and print the registers which
+ * changed since the previous sample. The blocks of both samples are
+ * allocated once, and the two buffers are swapped after every sample.
+ */
+static int watch(const struct spec *specs, int n, const struct options *opts)
+{
+	struct block *prev, *cur, *tmp;
+	struct timespec start, next, now, ts, step;
+	unsigned long samples, changes = 0, reported = 0, missed = 0;
+	int i, j, num, blocks, total, title;
+
+	/* long is 32-bit on i386, too short for nanoseconds */
+	step.tv_sec = opts->interval;
+	step.tv_nsec = (opts->interval - step.tv_sec) * 1e9;
+
+	for (i = 0, total = 0; i < n; i++)
+		total += spec_blocks(&specs[i]);
+	/* zeroed, as only every width-th register below range is read */
+	prev = calloc(total, sizeof(struct block));
+	cur = calloc(total, sizeof(struct block));
+	if (!prev || !cur) {
+		fprintf(stderr, "Error: Out of memory!\n");
+		return -1;
+	}
+
+	signal(SIGINT, watch_signal);
+	signal(SIGTERM, watch_signal);
+
+	/* the first sample is printed in full */
+	title = n > 1 || total > 1;
+	for (i = 0, num = 0; i < n; i++) {
+		blocks = dump_spec(&specs[i], prev + num);
+		if (title && i && opts->format == FORMAT_TABLE)
+			printf("\n");
+		print_blocks(&specs[i], prev + num, blocks, opts->format,
+			     title);
+		num += blocks;
+	}
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+	for (samples = 1; !stop && (!opts->count || samples < opts->count);
+	     samples++) {
+		timespec_add(&next, &step);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		/* too late for the next samples, skip them */
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while (timespec_diff(&now, &next) >= opts->interval) {
+			timespec_add(&next, &step);
+			missed++;
+		}
+
+		/* the changes only go to the stdio buffer meanwhile */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		for (i = 0, num = 0; i < n; i++) {
+			blocks = dump_spec(&specs[i], cur + num);
+			for (j = 0; j < blocks; j++, num++)
+				changes += print_changes(&specs[i], prev + num,
+							 cur + num, &ts);
+		}
+		/* only when there is something new, to keep up the rate */
+		if (changes != reported) {
+			fflush(stdout);
+			reported = changes;
+		}
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(stderr, "%lu samples in %.3f s, %lu changes, %lu samples "
+		"missed\n", samples, timespec_diff(&now, &start), changes,
+		missed);
+	free(prev);
+	free(cur);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct spec specs[MAX_SPECS];
+	static struct block blocks[32];
+	struct options opts = { 0, FORMAT_TABLE, NULL, NULL, 0, 0 };
+	struct timespec ts;
+	int i, n = 1, num, title;
+
+	if (parse_spec(argc, argv, &specs[0], &opts) < 0) {
+		help();
+		exit(1);
+	}
+	if (opts.batch) {
+		/* the answer would be read from the batch */
+		if (!strcmp(opts.batch, "-") && !opts.yes) {
+			fprintf(stderr, "Error: -b - needs -y\n");
+			exit(1);
+		}
+		n = read_batch(opts.batch, specs);
+		if (n < 0)
+			exit(1);
+	}
+
+	if (opts.count && !opts.interval) {
+		fprintf(stderr, "Error: -c needs -w\n");
+		exit(1);
+	}
+	if (opts.interval && (opts.format == FORMAT_RAW
+			   || opts.format == FORMAT_SNAPSHOT)) {
+		fprintf(stderr, "Error: Cannot use -r or -s in watch mode\n");
+		exit(1);
+	}
+	if (opts.format == FORMAT_RAW && isatty(STDOUT_FILENO)) {
+		fprintf(stderr, "Error: Refusing to write binary data to a "
+			"terminal\n");
+		exit(1);
+	}
+
+	if (opts.simulate) {
+		if (io_simulate(opts.simulate))
+			exit(1);
+	} else if (geteuid()) {
+		fprintf(stderr, "Error: Can only be run as root (or make it "
+		        "suid root)\n");
+		exit(1);
+	}
+
+	if (!opts.yes) {
+		fprintf(stderr, "WARNING! Running this program can cause "
+		        "system crashes, data loss and worse!\n");
+
+		for (i = 0; i < n; i++)
+			describe(&specs[i]);
+
+		fprintf(stderr, "Continue? [Y/n] ");
+		fflush(stderr);
+		if (!user_ack(1)) {
+			fprintf(stderr, "Aborting on user request.\n");
+			exit(0);
+		}
+	}
+
+	if (setup_io(specs, n))
+		exit(1);
+
+	if (opts.interval)
+		exit(watch(specs, n, &opts) ? 1 : 0);
+
+	if (opts.format == FORMAT_SNAPSHOT) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		snapshot_write_header(stdout, ts.tv_sec + ts.tv_nsec / 1e9);
+	}
+
+	/* name the dumps if there are several */
+	title = n > 1 || (specs[0].banks & (specs[0].banks - 1));
+	for (i = 0; i < n; i++) {
+		num = dump_spec(&specs[i], blocks);
+		if (title && i && opts.format == FORMAT_TABLE)
+			printf("\n");
+		print_blocks(&specs[i], blocks, num, opts.format, title);
+	}
 
 	exit(0);
 }
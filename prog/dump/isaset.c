@@ -20,165 +20,466 @@
     MA 02110-1301 USA.
 */
 
+
 /*
 	Typical usage:
 	isaset 0x295 0x296 0x10 0x12	Write 0x12 to address 0x10 using address/data registers
 	isaset -f 0x5010 0x12		Write 0x12 to location 0x5010
+	isaset -r -b writes.txt		All the writes listed in writes.txt, undone
+					if any of them fails
 */
 
-#include <sys/io.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include "util.h"
+#include "superio.h"
 
 #ifdef __powerpc__
 unsigned long isa_io_base = 0; /* XXX for now */
 #endif /* __powerpc__ */
 
+#define MAX_OPS		256	/* writes in a batch */
+#define MAX_ARGS	16	/* words on a batch line */
+
+/* One write, as given on the command line or on a line of a batch */
+struct op {
+	int flat;
+	int addrreg;		/* address in flat mode */
+	int datareg;		/* unused in flat mode */
+	int addr;		/* unused in flat mode */
+	int width;
+	unsigned long value;
+	unsigned long vmask;	/* 0 for all bits */
+	unsigned char enter_key[SUPERIO_MAX_KEY+1];
+	int line;		/* in the batch file, 0 on the command line */
+	unsigned long old;	/* the value before the write */
+};
+
+/* Options which apply to the whole run */
+struct options {
+	int yes;
+	int rollback;		/* undo all the writes if one fails */
+	const char *batch;	/* file listing the writes */
+	const char *simulate;	/* snapshot to write to instead of the chips */
+};
+
 static void help(void)
 {
 	fprintf(stderr,
 	        "Syntax for I2C-like access:\n"
-	        "  isaset [OPTIONS] ADDRREG DATAREG ADDRESS VALUE [MASK]\n"
+	        "  isaset [OPTIONS] [-k V1,V2...] ADDRREG DATAREG ADDRESS VALUE [MASK]\n"
 	        "Syntax for flat address space:\n"
 	        "  isaset -f [OPTIONS] ADDRESS VALUE [MASK]\n"
+	        "Syntax for batch mode:\n"
+	        "  isaset -b FILE [-y] [-r] [-S FILE]\n"
 		"Options:\n"
 		"  -f	Enable flat address space mode\n"
+		"  -k	Super-I/O configuration access key\n"
 		"  -y	Assume affirmative answer to all questions\n"
 		"  -W	Write a word (16-bit) value\n"
-		"  -L	Write a long (32-bit) value\n");
+		"  -L	Write a long (32-bit) value\n"
+		"  -b	Do the writes listed in FILE, one per line (- for stdin)\n"
+		"  -r	Restore the original values if a write fails\n"
+		"  -S	Write to the registers of snapshot FILE, not the chips\n");
 }
 
-int main(int argc, char *argv[])
+/*
+ * Parse the arguments of one write. opts is NULL on the lines of a batch,
+ * where the options of the whole run are not allowed.
+ */
+static int parse_op(int argc, char *argv[], struct op *op,
+		    struct options *opts)
 {
-	int addrreg, datareg = 0, addr = 0;
-	unsigned long value, vmask = 0, maxval = 0xff, res;
+	unsigned long maxval = 0xff;
 	int flags = 0;
-	int flat = 0, yes = 0, width = 1;
 	char *end;
 
+	memset(op, 0, sizeof(*op));
+	op->width = 1;
+
 	/* handle (optional) flags first */
 	while (1+flags < argc && argv[1+flags][0] == '-') {
+		/* options of the whole run */
+		if (!opts && strchr("yrbS", argv[1+flags][1])) {
+			fprintf(stderr, "Warning: Unsupported flag "
+				"\"-%c\"!\n", argv[1+flags][1]);
+			return -1;
+		}
+
 		switch (argv[1+flags][1]) {
-		case 'f': flat = 1; break;
-		case 'y': yes = 1; break;
-		case 'W': width = 2; maxval = 0xffff; break;
-		case 'L': width = 4; maxval = 0xffffffff; break;
+		case 'f': op->flat = 1; break;
+		case 'k':
+			if (2+flags >= argc
+			 || superio_parse_key(op->enter_key,
+					      argv[2+flags]) < 0) {
+				fprintf(stderr, "Invalid or missing key\n");
+				return -1;
+			}
+			flags++;
+			break;
+		case 'W': op->width = 2; maxval = 0xffff; break;
+		case 'L': op->width = 4; maxval = 0xffffffff; break;
+		case 'y':
+			opts->yes = 1;
+			break;
+		case 'r':
+			opts->rollback = 1;
+			break;
+		case 'b':
+		case 'S':
+			if (2+flags >= argc) {
+				fprintf(stderr, "Error: Missing argument to "
+					"-%c\n", argv[1+flags][1]);
+				return -1;
+			}
+			if (argv[1+flags][1] == 'b')
+				opts->batch = argv[2+flags];
+			else
+				opts->simulate = argv[2+flags];
+			flags++;
+			break;
 		default:
 			fprintf(stderr, "Warning: Unsupported flag "
 				"\"-%c\"!\n", argv[1+flags][1]);
-			help();
-			exit(1);
+			return -1;
 		}
 		flags++;
 	}
 
+	/* the writes are in the batch file */
+	if (opts && opts->batch) {
+		if (1+flags < argc || op->flat || op->width != 1
+		 || op->enter_key[0]) {
+			fprintf(stderr, "Error: Only -y, -r and -S can be "
+				"used with -b\n");
+			return -1;
+		}
+		return 0;
+	}
+	if (opts && opts->rollback) {
+		fprintf(stderr, "Error: -r needs -b\n");
+		return -1;
+	}
+
+	/* key is never needed in flat mode */
+	if (op->flat && op->enter_key[0]) {
+		fprintf(stderr, "Error: Cannot use key in flat mode\n");
+		return -1;
+	}
+
 	/* verify that the argument count is correct */
-	if ((!flat && (argc < 1+flags+4 || argc > 1+flags+5))
-	 || (flat && (argc < 1+flags+2 || argc > 1+flags+3))) {
-		help();
-		exit(1);
+	if ((!op->flat && (argc < 1+flags+4 || argc > 1+flags+5))
+	 || (op->flat && (argc < 1+flags+2 || argc > 1+flags+3))) {
+		fprintf(stderr, "Error: Wrong number of arguments\n");
+		return -1;
 	}
 
-	addrreg = strtol(argv[1+flags], &end, 0);
+	op->addrreg = strtol(argv[1+flags], &end, 0);
 	if (*end) {
 		fprintf(stderr, "Error: Invalid address!\n");
-		help();
-		exit(1);
+		return -1;
 	}
-	if (addrreg < 0 || addrreg > (flat?0xffff:0x3fff)) {
+	if (op->addrreg < 0 || op->addrreg > (op->flat?0xffff:0x3fff)) {
 		fprintf(stderr,
 		        "Error: Address out of range (0x0000-0x%04x)!\n",
-			flat?0xffff:0x3fff);
-		help();
-		exit(1);
+			op->flat?0xffff:0x3fff);
+		return -1;
 	}
 
-	if (!flat) {
-		datareg = strtol(argv[1+flags+1], &end, 0);
+	if (!op->flat) {
+		op->datareg = strtol(argv[1+flags+1], &end, 0);
 		if (*end) {
 			fprintf(stderr, "Error: Invalid data register!\n");
-			help();
-			exit(1);
+			return -1;
 		}
-		if (datareg < 0 || datareg > 0x3fff) {
+		if (op->datareg < 0 || op->datareg > 0x3fff) {
 			fprintf(stderr, "Error: Data register out of range "
 			        "(0x0000-0x3fff)!\n");
-			help();
-			exit(1);
+			return -1;
 		}
 
-		addr = strtol(argv[1+flags+2], &end, 0);
+		op->addr = strtol(argv[1+flags+2], &end, 0);
 		if (*end) {
 			fprintf(stderr, "Error: Invalid address!\n");
-			help();
-			exit(1);
+			return -1;
 		}
-		if (addr < 0 || addr > 0xff) {
+		if (op->addr < 0 || op->addr > 0xff) {
 			fprintf(stderr, "Error: Address out of range "
 			        "(0x00-0xff)!\n");
-			help();
-			exit(1);
+			return -1;
 		}
 	}
 
 	/* rest is the same for both modes so we cheat on flags */
-	if (!flat)
+	if (!op->flat)
 		flags += 2;
 
-	value = strtoul(argv[flags+2], &end, 0);
+	op->value = strtoul(argv[flags+2], &end, 0);
 	if (*end) {
 		fprintf(stderr, "Error: Invalid value!\n");
-		help();
-		exit(1);
+		return -1;
 	}
-	if (value > maxval) {
+	if (op->value > maxval) {
 		fprintf(stderr, "Error: Value out of range "
-			"(0x%0*u-%0*lu)!\n", width * 2, 0, width * 2, maxval);
-		help();
-		exit(1);
+			"(0x%0*u-%0*lu)!\n", op->width * 2, 0,
+			op->width * 2, maxval);
+		return -1;
 	}
 
 	if (flags+3 < argc) {
-		vmask = strtoul(argv[flags+3], &end, 0);
+		op->vmask = strtoul(argv[flags+3], &end, 0);
 		if (*end) {
 			fprintf(stderr, "Error: Invalid mask!\n");
-			help();
-			exit(1);
+			return -1;
 		}
-		if (vmask > maxval) {
+		if (op->vmask > maxval) {
 			fprintf(stderr, "Error: Mask out of range "
-				"(0x%0*u-%0*lu)!\n", width * 2, 0,
-				width * 2, maxval);
-			help();
+				"(0x%0*u-%0*lu)!\n", op->width * 2, 0,
+				op->width * 2, maxval);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Read the writes of a batch file, one per line. Returns their number. */
+static int read_batch(const char *file, struct op *ops)
+{
+	static char name[] = "isaset";
+	char line[256], *args[MAX_ARGS];
+	int n = 0, num = 0, argc;
+	FILE *f;
+
+	f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Error: Could not open %s!\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		num++;
+		/* parse_op() skips the program name */
+		args[0] = name;
+		argc = split_args(line, args, MAX_ARGS);
+		if (argc == 1)
+			continue;
+
+		if (n == MAX_OPS) {
+			fprintf(stderr, "Error: More than %d writes!\n",
+				MAX_OPS);
+			n = -1;
+			break;
+		}
+		if (argc < 0 || parse_op(argc, args, &ops[n], NULL) < 0) {
+			fprintf(stderr, "Error: Invalid write at line %d of "
+				"%s\n", num, file);
+			n = -1;
+			break;
+		}
+		ops[n++].line = num;
+	}
+
+	if (f != stdin)
+		fclose(f);
+	if (!n) {
+		fprintf(stderr, "Error: No write in %s!\n", file);
+		return -1;
+	}
+	return n;
+}
+
+static void describe(const struct op *op)
+{
+	if (op->flat)
+		fprintf(stderr,
+			"I will write value 0x%0*lx%s to address "
+	                "0x%x.\n", op->width * 2, op->value,
+			op->vmask ? " (masked)" : "", op->addrreg);
+	else
+		fprintf(stderr,
+			"I will write value 0x%0*lx%s to address "
+	                "0x%02x of chip with address register 0x%x\n"
+	                "and data register 0x%x.\n", op->width * 2,
+	                op->value, op->vmask ? " (masked)" : "", op->addr,
+		        op->addrreg, op->datareg);
+}
+
+/* Get access to the I/O ports of all the writes, once */
+static int setup_io(const struct op *ops, int n)
+{
+	int i, need_iopl = 0;
+
+	for (i = 0; i < n; i++) {
+		if (ops[i].flat || ops[i].datareg >= 0x400
+		 || ops[i].addrreg >= 0x400) {
+			need_iopl = 1;
+			continue;
+		}
+		if (io_permit(ops[i].datareg)) {
+			fprintf(stderr, "Error: Could not ioperm() data "
+			        "register!\n");
+			return -1;
+		}
+		if (io_permit(ops[i].addrreg)) {
+			fprintf(stderr, "Error: Could not ioperm() address "
+		        	"register!\n");
+			return -1;
+		}
+	}
+	if (need_iopl && io_permit_all()) {
+		fprintf(stderr, "Error: Could not do iopl(3)!\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Enter (or, if leave is set, leave) the Super-I/O configuration mode
+ * of every chip, once per address register.
+ */
+static void superio_all(const struct op *ops, int n, int leave)
+{
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		if (!ops[i].enter_key[0])
+			continue;
+		for (j = 0; j < i; j++)
+			if (ops[j].enter_key[0]
+			 && ops[j].addrreg == ops[i].addrreg)
+				break;
+		if (j < i)
+			continue;
+		if (leave)
+			superio_reset(ops[i].addrreg, ops[i].datareg);
+		else
+			superio_write_key(ops[i].addrreg, ops[i].enter_key);
+	}
+}
+
+static unsigned long read_reg(const struct op *op)
+{
+	if (op->flat)
+		return inx(op->addrreg, op->width);
+	outx(op->addr, op->addrreg, 1);
+	return inx(op->datareg, op->width);
+}
+
+/* Write a value and read it back */
+static unsigned long write_reg(const struct op *op, unsigned long value)
+{
+	if (op->flat) {
+		outx(value, op->addrreg, op->width);
+		return inx(op->addrreg, op->width);
+	}
+	outx(op->addr, op->addrreg, 1);
+	outx(value, op->datareg, op->width);
+	return inx(op->datareg, op->width);
+}
+
+static void report_mismatch(const struct op *op, unsigned long value,
+			    unsigned long res)
+{
+	if (op->line)
+		fprintf(stderr, "Line %d: ", op->line);
+	fprintf(stderr, "Data mismatch, wrote 0x%0*lx, "
+	        "read 0x%0*lx back.\n", op->width * 2, value,
+		op->width * 2, res);
+}
+
+/*
+ * Do all the writes of a batch, checking each of them. Returns the
+ * number of writes done, the last one possibly mismatched.
+ */
+static int apply_batch(struct op *ops, int n, int rollback, int *failed)
+{
+	unsigned long value, res, check;
+	int i;
+
+	*failed = 0;
+	for (i = 0; i < n; i++) {
+		/* the old value is only read when needed, reads can have
+		   side effects */
+		if (ops[i].vmask || rollback)
+			ops[i].old = read_reg(&ops[i]);
+
+		value = ops[i].value;
+		if (ops[i].vmask)
+			value = (value & ops[i].vmask)
+			      | (ops[i].old & ~ops[i].vmask);
+		res = write_reg(&ops[i], value);
+
+		/* only the written bits matter in a masked write */
+		check = ops[i].vmask ? ops[i].vmask : ~0UL;
+		if ((res & check) != (value & check)) {
+			report_mismatch(&ops[i], value, res);
+			*failed = 1;
+			return i + 1;
+		}
+	}
+	return n;
+}
+
+/* Restore the values from before the writes, the last write first */
+static int undo_batch(const struct op *ops, int n)
+{
+	unsigned long res;
+	int i, ret = 0;
+
+	for (i = n - 1; i >= 0; i--) {
+		res = write_reg(&ops[i], ops[i].old);
+		if (res != ops[i].old) {
+			report_mismatch(&ops[i], ops[i].old, res);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct op ops[MAX_OPS];
+	struct options opts = { 0, 0, NULL, NULL };
+	struct op *op = &ops[0];
+	unsigned long value, res;
+	int i, n = 1, done, failed;
+
+	if (parse_op(argc, argv, op, &opts) < 0) {
+		help();
+		exit(1);
+	}
+	if (opts.batch) {
+		/* the answer would be read from the batch */
+		if (!strcmp(opts.batch, "-") && !opts.yes) {
+			fprintf(stderr, "Error: -b - needs -y\n");
 			exit(1);
 		}
+		n = read_batch(opts.batch, ops);
+		if (n < 0)
+			exit(1);
 	}
 
-	if (geteuid()) {
+	if (opts.simulate) {
+		if (io_simulate(opts.simulate))
+			exit(1);
+	} else if (geteuid()) {
 		fprintf(stderr, "Error: Can only be run as root "
 		        "(or make it suid root)\n");
 		exit(1);
 	}
 
-	if (!yes) {
+	if (!opts.yes) {
 		fprintf(stderr, "WARNING! Running this program can cause "
 		        "system crashes, data loss and worse!\n");
 
-		if (flat)
-			fprintf(stderr,
-				"I will write value 0x%0*lx%s to address "
-		                "0x%x.\n", width * 2, value,
-				vmask ? " (masked)" : "", addrreg);
-		else
-			fprintf(stderr,
-				"I will write value 0x%0*lx%s to address "
-		                "0x%02x of chip with address register 0x%x\n"
-		                "and data register 0x%x.\n", width * 2,
-		                value, vmask ? " (masked)" : "", addr,
-			        addrreg, datareg);
+		for (i = 0; i < n; i++)
+			describe(&ops[i]);
+		if (opts.rollback)
+			fprintf(stderr, "If a write fails, I will restore "
+				"the original values.\n");
 
 		fprintf(stderr, "Continue? [Y/n] ");
 		fflush(stderr);
@@ -188,74 +489,57 @@ int main(int argc, char *argv[])
 		}
 	}
 
-#ifndef __powerpc__
-	if (!flat && datareg < 0x400 && addrreg < 0x400) {
-		if (ioperm(datareg, 1, 1)) {
-			fprintf(stderr, "Error: Could not ioperm() data "
-			        "register!\n");
-			exit(1);
-		}
-		if (ioperm(addrreg, 1, 1)) {
-			fprintf(stderr, "Error: Could not ioperm() address "
-		        	"register!\n");
-			exit(1);
-		}
-	} else {
-		if (iopl(3)) {
-			fprintf(stderr, "Error: Could not do iopl(3)!\n");
-			exit(1);
-		}
-	}
-#endif
+	if (setup_io(ops, n))
+		exit(1);
 
-	if (vmask) {
-		unsigned long oldvalue;
+	/* Enter Super-I/O configuration mode */
+	superio_all(ops, n, 0);
 
-		if (flat) {
-			oldvalue = inx(addrreg, width);
-		} else {	
-			outb(addr, addrreg);
-			oldvalue = inx(datareg, width);
+	if (opts.batch) {
+		done = apply_batch(ops, n, opts.rollback, &failed);
+		if (failed && opts.rollback) {
+			fprintf(stderr, "Restoring the original values of "
+				"%d register%s.\n", done, done > 1 ? "s" : "");
+			if (undo_batch(ops, done))
+				fprintf(stderr, "Warning: Some registers "
+					"could not be restored!\n");
+		} else if (failed) {
+			fprintf(stderr, "Stopped after %d of %d writes.\n",
+				done, n);
 		}
+		superio_all(ops, n, 1);
+		exit(failed ? 1 : 0);
+	}
 
-		value = (value & vmask) | (oldvalue & ~vmask);
+	value = op->value;
+	if (op->vmask) {
+		op->old = read_reg(op);
+		value = (value & op->vmask) | (op->old & ~op->vmask);
 
-		if (!yes) {
+		if (!opts.yes) {
 			fprintf(stderr, "Old value 0x%0*lx, write mask "
 				"0x%0*lx: Will write 0x%0*lx to %s "
-				"0x%02x\n", width * 2, oldvalue,
-				width * 2, vmask, width * 2, value,
-				flat ? "address" : "register",
-				flat ? addrreg : addr);
+				"0x%02x\n", op->width * 2, op->old,
+				op->width * 2, op->vmask, op->width * 2,
+				value, op->flat ? "address" : "register",
+				op->flat ? op->addrreg : op->addr);
 
 			fprintf(stderr, "Continue? [Y/n] ");
 			fflush(stderr);
 			if (!user_ack(1)) {
 				fprintf(stderr, "Aborting on user request.\n");
+				superio_all(ops, n, 1);
 				exit(0);
 			}
 		}
 	}
 
 	/* do the real thing */
-	if (flat) {
-		/* write */
-		outx(value, addrreg, width);
-		/* readback */
-		res = inx(addrreg, width);
-	} else {	
-		/* write */
-		outb(addr, addrreg);
-		outx(value, datareg, width);
-		/* readback */
-		res = inx(datareg, width);
-	}
-
-	if (res != value) {
-		fprintf(stderr, "Data mismatch, wrote 0x%0*lx, "
-		        "read 0x%0*lx back.\n", width * 2, value,
-			width * 2, res);
-	}
+	res = write_reg(op, value);
+	if (res != value)
+		report_mismatch(op, value, res);
 
+	/* Exit Super-I/O configuration mode */
+	superio_all(ops, n, 1);
 	exit(0);
 }
@@ -0,0 +1,438 @@
+/*
+    isasnap.c - isasnap, a user-space program to diff and decode the
+                register snapshots taken by isadump
+    Copyright (C) 2004-2011  Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+	Typical usage:
+	isasnap board1.snap			Print a snapshot
+	isasnap -m it87.map board1.snap		Decode it with a register map
+	isasnap -m it87.map old.snap new.snap	Differences between snapshots
+
+	isasnap works on files only, so it needs neither root nor the
+	hardware.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "snapshot.h"
+
+#define MAX_MAPS	16
+#define NAME_LENGTH	32
+#define DESC_LENGTH	80
+
+#define BANK_ANY	-2	/* in fields, -1 is no bank operation */
+#define CHIP_ANY	-2	/* any Super-I/O chip */
+
+/* A register, a group of registers or a bit field */
+struct field {
+	int bank;
+	int first, last;	/* registers, first is the most significant */
+	int hibit, lobit;	/* hibit is -1 for the whole registers */
+	char name[NAME_LENGTH];
+	char desc[DESC_LENGTH];
+};
+
+/* The fields of the blocks of a chip, or at an address */
+struct map {
+	int chip;		/* -1 to match on the address */
+	int addrreg;
+	int num_fields;
+	struct field *fields;
+};
+
+static struct map maps[MAX_MAPS];
+static int num_maps;
+
+static void help(void)
+{
+	fprintf(stderr,
+		"Syntax: isasnap [-m MAP]... SNAPSHOT [SNAPSHOT]\n"
+		"Options:\n"
+		"  -m	Decode the registers with the map in file MAP\n"
+		"  -h	Display this help text\n"
+		"With one snapshot, print it, with two, print their "
+		"differences.\n");
+}
+
+static int parse_int(const char *s, int max)
+{
+	char *end;
+	long val;
+
+	val = strtol(s, &end, 0);
+	if (end == s || *end || val < 0 || val > max)
+		return -1;
+	return val;
+}
+
+/* "chip=0x8728", "chip=*" or "addr=0x295" */
+static int parse_selector(const char *s, struct map *m)
+{
+	m->chip = -1;
+	m->addrreg = -1;
+
+	if (!strcmp(s, "chip=*")) {
+		m->chip = CHIP_ANY;
+		return 0;
+	}
+	if (!strncmp(s, "chip=", 5)) {
+		m->chip = parse_int(s + 5, 0xffff);
+		return m->chip < 0 ? -1 : 0;
+	}
+	if (!strncmp(s, "addr=", 5)) {
+		m->addrreg = parse_int(s + 5, 0xffff);
+		return m->addrreg < 0 ? -1 : 0;
+	}
+	return -1;
+}
+
+/* BANK REG[-REG] [HIBIT[:LOBIT]] NAME [DESCRIPTION] */
+static int parse_field(char *line, struct field *f)
+{
+	char *word, *end;
+
+	word = strtok(line, " \t\n");
+	if (!word)
+		return -1;
+	if (!strcmp(word, "*"))
+		f->bank = BANK_ANY;
+	else if (!strcmp(word, "-"))
+		f->bank = -1;
+	else if ((f->bank = parse_int(word, 31)) < 0)
+		return -1;
+
+	word = strtok(NULL, " \t\n");
+	if (!word)
+		return -1;
+	f->first = f->last = strtol(word, &end, 0);
+	if (*end == '-')
+		f->last = strtol(end + 1, &end, 0);
+	if (*end || f->first < 0 || f->last > 0xff || f->first > f->last
+	 || f->last - f->first >= (int)sizeof(unsigned long))
+		return -1;
+
+	word = strtok(NULL, " \t\n");
+	if (!word)
+		return -1;
+	f->hibit = -1;
+	if (word[0] >= '0' && word[0] <= '9') {
+		f->hibit = f->lobit = strtol(word, &end, 10);
+		if (*end == ':')
+			f->lobit = strtol(end + 1, &end, 10);
+		if (*end || f->lobit < 0 || f->hibit < f->lobit
+		 || f->hibit >= 8 * (f->last - f->first + 1))
+			return -1;
+		word = strtok(NULL, " \t\n");
+		if (!word)
+			return -1;
+	}
+	snprintf(f->name, sizeof(f->name), "%s", word);
+
+	/* the rest of the line */
+	word = strtok(NULL, "\n");
+	while (word && (*word == ' ' || *word == '\t'))
+		word++;
+	snprintf(f->desc, sizeof(f->desc), "%s", word ? word : "");
+	return 0;
+}
+
+/*
+	A map file:
+
+	# comment
+	map chip=0x8728
+	* 0x07 ldn Logical device
+	* 0x20-0x21 devid Device ID
+	0x04 0x30 0 active Activated
+
+	"map" starts the fields of the chip with the given Super-I/O device
+	ID, of all Super-I/O chips (chip=*), or of the chip at an address
+	(addr=0x295).
+*/
+static int read_map(const char *file)
+{
+	char line[256], *p;
+	struct map *m = NULL;
+	struct field *fields;
+	int num = 0, ret = -1;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		fprintf(stderr, "Error: Could not open %s!\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		num++;
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		if (!strncmp(p, "map ", 4)) {
+			if (num_maps == MAX_MAPS) {
+				fprintf(stderr, "Error: More than %d maps!\n",
+					MAX_MAPS);
+				goto exit;
+			}
+			m = &maps[num_maps++];
+			p = strtok(p + 4, " \t\n");
+			if (!p || parse_selector(p, m) < 0)
+				goto invalid;
+			continue;
+		}
+
+		if (!m)
+			goto invalid;
+		fields = realloc(m->fields, (m->num_fields + 1) *
+				 sizeof(struct field));
+		if (!fields) {
+			fprintf(stderr, "Error: Out of memory!\n");
+			goto exit;
+		}
+		m->fields = fields;
+		if (parse_field(p, &m->fields[m->num_fields]) < 0)
+			goto invalid;
+		m->num_fields++;
+	}
+	ret = 0;
+	goto exit;
+
+invalid:
+	fprintf(stderr, "Error: Invalid line %d of %s\n", num, file);
+exit:
+	fclose(f);
+	return ret;
+}
+
+static int map_matches(const struct map *m, const struct snapshot_block *b)
+{
+	if (m->chip == CHIP_ANY)
+		return b->chip >= 0;
+	if (m->chip >= 0)
+		return b->chip == m->chip;
+	return b->addrreg == m->addrreg;
+}
+
+/* The value of a field in a block, -1 if not in the block */
+static int field_value(const struct field *f, const struct snapshot_block *b,
+		       unsigned long *value)
+{
+	int i;
+
+	if ((f->bank != BANK_ANY && f->bank != b->bank) || f->last >= b->size)
+		return -1;
+
+	*value = 0;
+	for (i = f->first; i <= f->last; i++)
+		*value = (*value << 8) | b->data[i];
+	if (f->hibit >= 0)
+		*value = (*value >> f->lobit) &
+			 ((2UL << (f->hibit - f->lobit)) - 1);
+	return 0;
+}
+
+static void print_field(const struct field *f)
+{
+	if (f->first == f->last)
+		printf("  %02x", f->first);
+	else
+		printf("  %02x-%02x", f->first, f->last);
+	if (f->hibit > f->lobit)
+		printf(" [%d:%d]", f->hibit, f->lobit);
+	else if (f->hibit >= 0)
+		printf(" [%d]", f->hibit);
+	printf(" %s", f->name);
+}
+
+static void print_desc(const struct field *f)
+{
+	if (f->desc[0])
+		printf("  (%s)", f->desc);
+	printf("\n");
+}
+
+/* Print the fields of a block, or its bytes if no map knows it */
+static void print_block(const struct snapshot_block *b)
+{
+	const struct field *f;
+	unsigned long value;
+	int i, j, decoded = 0;
+
+	printf("block ");
+	snapshot_print_block(stdout, b);
+	printf("\n");
+
+	for (i = 0; i < num_maps; i++) {
+		if (!map_matches(&maps[i], b))
+			continue;
+		for (j = 0; j < maps[i].num_fields; j++) {
+			f = &maps[i].fields[j];
+			if (field_value(f, b, &value) < 0)
+				continue;
+			print_field(f);
+			printf(" = 0x%lx", value);
+			print_desc(f);
+			decoded = 1;
+		}
+	}
+	if (decoded)
+		return;
+
+	for (i = 0; i < b->size; i++) {
+		if (!(i % 16))
+			printf("%02x:", i);
+		printf(" %02x", b->data[i]);
+		if (i % 16 == 15 || i == b->size - 1)
+			printf("\n");
+	}
+}
+
+/* Print the differences between two reads of a block, return how many */
+static int diff_block(const struct snapshot_block *a,
+		      const struct snapshot_block *b)
+{
+	const struct field *f;
+	unsigned long va, vb;
+	int i, j, diffs = 0, size;
+
+	size = a->size > b->size ? a->size : b->size;
+	for (i = 0; i < size; i++) {
+		if (i < a->size && i < b->size && a->data[i] == b->data[i])
+			continue;
+		if (!diffs++) {
+			printf("@@ ");
+			snapshot_print_block(stdout, b);
+			printf("\n");
+			if (a->chip != b->chip)
+				printf("  chip 0x%04x -> 0x%04x\n", a->chip,
+				       b->chip);
+		}
+		if (i >= a->size)
+			printf("  %02x: -- -> %02x\n", i, b->data[i]);
+		else if (i >= b->size)
+			printf("  %02x: %02x -> --\n", i, a->data[i]);
+		else
+			printf("  %02x: %02x -> %02x\n", i, a->data[i],
+			       b->data[i]);
+	}
+
+	/* the fields which changed, with the maps of the new block */
+	for (i = 0; i < num_maps && diffs; i++) {
+		if (!map_matches(&maps[i], b))
+			continue;
+		for (j = 0; j < maps[i].num_fields; j++) {
+			f = &maps[i].fields[j];
+			if (field_value(f, a, &va) < 0
+			 || field_value(f, b, &vb) < 0 || va == vb)
+				continue;
+			print_field(f);
+			printf(": 0x%lx -> 0x%lx", va, vb);
+			print_desc(f);
+		}
+	}
+	return diffs;
+}
+
+static const struct snapshot_block *find_block(const struct snapshot *snap,
+					       const struct snapshot_block *b)
+{
+	int i;
+
+	for (i = 0; i < snap->num_blocks; i++)
+		if (snapshot_same_block(&snap->blocks[i], b))
+			return &snap->blocks[i];
+	return NULL;
+}
+
+/* Print the differences between two snapshots, return how many */
+static int diff_snapshots(const struct snapshot *a, const struct snapshot *b)
+{
+	const struct snapshot_block *other;
+	int i, diffs = 0;
+
+	for (i = 0; i < a->num_blocks; i++) {
+		other = find_block(b, &a->blocks[i]);
+		if (other) {
+			diffs += diff_block(&a->blocks[i], other);
+			continue;
+		}
+		printf("-block ");
+		snapshot_print_block(stdout, &a->blocks[i]);
+		printf("\n");
+		diffs++;
+	}
+	for (i = 0; i < b->num_blocks; i++) {
+		if (find_block(a, &b->blocks[i]))
+			continue;
+		printf("+block ");
+		snapshot_print_block(stdout, &b->blocks[i]);
+		printf("\n");
+		diffs++;
+	}
+	return diffs;
+}
+
+int main(int argc, char *argv[])
+{
+	struct snapshot snap[2];
+	int c, i, n, ret;
+
+	while ((c = getopt(argc, argv, "m:h")) != -1) {
+		switch (c) {
+		case 'm':
+			if (read_map(optarg) < 0)
+				exit(2);
+			break;
+		case 'h':
+			help();
+			exit(0);
+		default:
+			help();
+			exit(2);
+		}
+	}
+
+	n = argc - optind;
+	if (n < 1 || n > 2) {
+		fprintf(stderr, "Error: Wrong number of arguments\n");
+		help();
+		exit(2);
+	}
+	for (i = 0; i < n; i++)
+		if (snapshot_read(argv[optind + i], &snap[i]) < 0)
+			exit(2);
+
+	if (n == 1) {
+		for (i = 0; i < snap[0].num_blocks; i++)
+			print_block(&snap[0].blocks[i]);
+		ret = 0;
+	} else {
+		/* like diff(1), 1 if there are differences */
+		ret = diff_snapshots(&snap[0], &snap[1]) ? 1 : 0;
+	}
+
+	for (i = 0; i < n; i++)
+		snapshot_free(&snap[i]);
+	exit(ret);
+}
@@ -0,0 +1,308 @@
+/*
+    snapshot: Register snapshot files, written by isadump and read by
+              isasnap
+
+    Copyright (C) 2005-2008  Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+	A snapshot is a text file:
+
+	isadump-snapshot 1 time=1792360548.698214
+	block method=isa addr=0x002e data=0x002f bank=0x07 bankreg=0x07
+	      width=1 chip=0x8728 key=0x87,0x01,0x55,0x55 size=256
+	00: 87 01 55 55 ...
+	...
+
+	with one "block" line (on a single line) per bank of a chip, followed
+	by its bytes, 16 per line. method is isa (address and data registers)
+	or flat; data is missing in flat mode, bank is - when there was no
+	bank operation, chip and key are missing when unknown or unused.
+	Empty lines and lines starting with # are ignored.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+
+/* The device ID of a Super-I/O configuration space dump, or -1 */
+int snapshot_chip_id(const struct snapshot_block *b)
+{
+	int id;
+
+	if (b->flat || b->width != 1 || b->size < 0x22)
+		return -1;
+	if (!b->key[0]
+	 && !((b->addrreg == 0x2e && b->datareg == 0x2f)
+	   || (b->addrreg == 0x4e && b->datareg == 0x4f)))
+		return -1;
+
+	id = (b->data[0x20] << 8) | b->data[0x21];
+	if (id == 0x0000 || id == 0xffff)
+		return -1;
+	return id;
+}
+
+/* Whether two blocks are the same registers, on two boards or dates */
+int snapshot_same_block(const struct snapshot_block *a,
+			const struct snapshot_block *b)
+{
+	return a->flat == b->flat && a->addrreg == b->addrreg
+	    && (a->flat || a->datareg == b->datareg)
+	    && a->bank == b->bank;
+}
+
+void snapshot_write_header(FILE *f, double time)
+{
+	fprintf(f, "isadump-snapshot %d time=%.6f\n", SNAPSHOT_VERSION, time);
+}
+
+/* The "block" line, without the keyword and the new line */
+void snapshot_print_block(FILE *f, const struct snapshot_block *b)
+{
+	int i;
+
+	if (b->flat)
+		fprintf(f, "method=flat addr=0x%04x", b->addrreg);
+	else
+		fprintf(f, "method=isa addr=0x%04x data=0x%04x", b->addrreg,
+			b->datareg);
+	if (b->bank >= 0)
+		fprintf(f, " bank=0x%02x bankreg=0x%02x", b->bank, b->bankreg);
+	else
+		fprintf(f, " bank=-");
+	fprintf(f, " width=%d", b->width);
+	if (b->chip >= 0)
+		fprintf(f, " chip=0x%04x", b->chip);
+	for (i = 1; i <= b->key[0]; i++)
+		fprintf(f, "%s0x%02x", i == 1 ? " key=" : ",", b->key[i]);
+	fprintf(f, " size=%d", b->size);
+}
+
+void snapshot_write_block(FILE *f, const struct snapshot_block *b)
+{
+	int i;
+
+	fprintf(f, "block ");
+	snapshot_print_block(f, b);
+	fprintf(f, "\n");
+	for (i = 0; i < b->size; i++) {
+		if (!(i % 16))
+			fprintf(f, "%02x:", i);
+		fprintf(f, " %02x", b->data[i]);
+		if (i % 16 == 15 || i == b->size - 1)
+			fprintf(f, "\n");
+	}
+}
+
+/* Parse an integer field, returns -1 if invalid */
+static int parse_value(const char *s, int max)
+{
+	char *end;
+	long val;
+
+	val = strtol(s, &end, 0);
+	if (end == s || *end || val < 0 || val > max)
+		return -1;
+	return val;
+}
+
+static int parse_block(char *line, struct snapshot_block *b)
+{
+	char *word, *value;
+	int have_addr = 0, have_data = 0;
+
+	memset(b, 0, sizeof(*b));
+	b->bank = -1;
+	b->width = 1;
+	b->chip = -1;
+	b->size = -1;
+
+	for (word = strtok(line, " \t\n"); word; word = strtok(NULL, " \t\n")) {
+		value = strchr(word, '=');
+		if (!value)
+			return -1;
+		*value++ = '\0';
+
+		if (!strcmp(word, "method")) {
+			if (!strcmp(value, "flat"))
+				b->flat = 1;
+			else if (strcmp(value, "isa"))
+				return -1;
+		} else if (!strcmp(word, "addr")) {
+			b->addrreg = parse_value(value, 0xffff);
+			if (b->addrreg < 0)
+				return -1;
+			have_addr = 1;
+		} else if (!strcmp(word, "data")) {
+			b->datareg = parse_value(value, 0xffff);
+			if (b->datareg < 0)
+				return -1;
+			have_data = 1;
+		} else if (!strcmp(word, "bank")) {
+			if (strcmp(value, "-")) {
+				b->bank = parse_value(value, 31);
+				if (b->bank < 0)
+					return -1;
+			}
+		} else if (!strcmp(word, "bankreg")) {
+			b->bankreg = parse_value(value, 0xff);
+			if (b->bankreg < 0)
+				return -1;
+		} else if (!strcmp(word, "width")) {
+			b->width = parse_value(value, 4);
+			if (b->width != 1 && b->width != 2 && b->width != 4)
+				return -1;
+		} else if (!strcmp(word, "chip")) {
+			b->chip = parse_value(value, 0xffff);
+			if (b->chip < 0)
+				return -1;
+		} else if (!strcmp(word, "key")) {
+			if (superio_parse_key(b->key, value) < 0)
+				return -1;
+		} else if (!strcmp(word, "size")) {
+			b->size = parse_value(value, 256);
+			if (b->size <= 0 || b->size % b->width)
+				return -1;
+		}
+		/* ignore unknown fields, for later versions */
+	}
+
+	if (!have_addr || b->size < 0 || have_data == b->flat)
+		return -1;
+	return 0;
+}
+
+/* Parse a line of bytes, returns how many bytes it held or -1 */
+static int parse_bytes(char *line, struct snapshot_block *b, int expected)
+{
+	char *end;
+	long offset, val;
+	int n = 0;
+
+	offset = strtol(line, &end, 16);
+	if (end == line || *end != ':' || offset != expected)
+		return -1;
+
+	line = end + 1;
+	while (1) {
+		while (*line == ' ' || *line == '\t')
+			line++;
+		if (*line == '\n' || !*line)
+			break;
+		val = strtol(line, &end, 16);
+		if (end == line || val < 0 || val > 0xff
+		 || offset + n >= b->size)
+			return -1;
+		b->data[offset + n++] = val;
+		line = end;
+	}
+	return n;
+}
+
+int snapshot_read(const char *file, struct snapshot *snap)
+{
+	char line[512], *p;
+	struct snapshot_block *b = NULL, *blocks;
+	int num = 0, version, filled = 0, n, ret = -1;
+	FILE *f;
+
+	memset(snap, 0, sizeof(*snap));
+	f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!f) {
+		fprintf(stderr, "Error: Could not open %s!\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		num++;
+		for (p = line; *p == ' ' || *p == '\t'; p++)
+			;
+		if (*p == '#' || *p == '\n' || !*p)
+			continue;
+
+		if (!snap->time) {
+			if (sscanf(p, "isadump-snapshot %d time=%lf", &version,
+				   &snap->time) != 2 || snap->time <= 0) {
+				fprintf(stderr, "Error: %s is not a snapshot\n",
+					file);
+				goto exit;
+			}
+			if (version != SNAPSHOT_VERSION) {
+				fprintf(stderr, "Error: %s: Unsupported "
+					"snapshot version %d\n", file, version);
+				goto exit;
+			}
+			continue;
+		}
+
+		if (!strncmp(p, "block ", 6)) {
+			if (b && filled < b->size)
+				goto short_block;
+			blocks = realloc(snap->blocks, (snap->num_blocks + 1) *
+					 sizeof(struct snapshot_block));
+			if (!blocks) {
+				fprintf(stderr, "Error: Out of memory!\n");
+				goto exit;
+			}
+			snap->blocks = blocks;
+			b = &snap->blocks[snap->num_blocks++];
+			if (parse_block(p + 6, b) < 0)
+				goto invalid;
+			filled = 0;
+			continue;
+		}
+
+		if (!b)
+			goto invalid;
+		n = parse_bytes(p, b, filled);
+		if (n < 0)
+			goto invalid;
+		filled += n;
+	}
+
+	if (!snap->time) {
+		fprintf(stderr, "Error: %s is not a snapshot\n", file);
+		goto exit;
+	}
+	if (b && filled < b->size)
+		goto short_block;
+	ret = 0;
+	goto exit;
+
+short_block:
+	fprintf(stderr, "Error: Missing bytes before line %d of %s\n", num,
+		file);
+	goto exit;
+invalid:
+	fprintf(stderr, "Error: Invalid line %d of %s\n", num, file);
+exit:
+	if (f != stdin)
+		fclose(f);
+	if (ret)
+		snapshot_free(snap);
+	return ret;
+}
+
+void snapshot_free(struct snapshot *snap)
+{
+	free(snap->blocks);
+	snap->blocks = NULL;
+	snap->num_blocks = 0;
+}
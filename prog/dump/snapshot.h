@@ -0,0 +1,60 @@
+/*
+    snapshot: Register snapshot files, written by isadump and read by
+              isasnap
+
+    Copyright (C) 2005-2008  Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdio.h>
+#include "superio.h"
+
+#define SNAPSHOT_VERSION	1
+
+/* The registers of one bank of one chip, as raw bytes */
+struct snapshot_block {
+	int flat;
+	int addrreg;		/* address in flat mode */
+	int datareg;		/* unused in flat mode */
+	int bank;		/* -1 if no bank operation */
+	int bankreg;
+	int width;		/* of the reads, the bytes are little-endian */
+	int chip;		/* Super-I/O device ID, -1 if unknown */
+	unsigned char key[SUPERIO_MAX_KEY+1];
+	int size;		/* in bytes */
+	unsigned char data[256];
+};
+
+struct snapshot {
+	double time;		/* seconds since the epoch */
+	int num_blocks;
+	struct snapshot_block *blocks;
+};
+
+int snapshot_chip_id(const struct snapshot_block *b);
+int snapshot_same_block(const struct snapshot_block *a,
+			const struct snapshot_block *b);
+void snapshot_write_header(FILE *f, double time);
+void snapshot_write_block(FILE *f, const struct snapshot_block *b);
+void snapshot_print_block(FILE *f, const struct snapshot_block *b);
+int snapshot_read(const char *file, struct snapshot *snap);
+void snapshot_free(struct snapshot *snap);
+
+#endif /* _SNAPSHOT_H */
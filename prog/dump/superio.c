@@ -19,9 +19,9 @@
     MA 02110-1301 USA.
 */
 
-#include <sys/io.h>
 #include <stdlib.h>
 #include "superio.h"
+#include "util.h"
 
 int superio_parse_key(unsigned char *key, const char *s)
 {
@@ -51,20 +51,20 @@ int superio_parse_key(unsigned char *key, const char *s)
 	return -1;
 }
 
-void superio_write_key(int addrreg, unsigned char *key)
+void superio_write_key(int addrreg, const unsigned char *key)
 {
 	int i;
 
 	for (i = 1; i <= key[0]; i++)
-		outb(key[i], addrreg);
+		outx(key[i], addrreg, 1);
 }
 
 void superio_reset(int addrreg, int datareg)
 {
 	/* Some chips (SMSC, Winbond) want this */
-	outb(0xaa, addrreg);
+	outx(0xaa, addrreg, 1);
 
 	/* Return to "Wait For Key" state (PNP-ISA spec) */
-	outb(0x02, addrreg);
-	outb(0x02, datareg);
+	outx(0x02, addrreg, 1);
+	outx(0x02, datareg, 1);
 }
@@ -25,7 +25,7 @@
 #define SUPERIO_MAX_KEY	8
 
 int superio_parse_key(unsigned char *key, const char *s);
-void superio_write_key(int addrreg, unsigned char *key);
+void superio_write_key(int addrreg, const unsigned char *key);
 void superio_reset(int addrreg, int datareg);
 
 #endif /* _SUPERIO_H */
@@ -0,0 +1,115 @@
+#!/usr/bin/perl -w
+
+# test-dump.pl - test script for isadump, isaset and isasnap, run on
+# the simulated I/O ports of a snapshot, so that neither root nor the
+# hardware are needed
+#
+#    This program is free software; you can redistribute it and/or modify
+#    it under the terms of the GNU General Public License as published by
+#    the Free Software Foundation; version 2 of the License.
+#
+#    This program is distributed in the hope that it will be useful,
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#    GNU General Public License for more details.
+#
+#    You should have received a copy of the GNU General Public License
+#    along with this program; if not, write to the Free Software
+#    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+#    MA 02110-1301 USA.
+#
+# Run from this directory. The programs are taken from the parent
+# directory, or from $PROGDUMPDIR.
+
+require 5.004;
+
+use strict;
+use Test::More;
+use File::Temp qw(tempdir);
+
+my $key = '0x87,0x01,0x55,0x55';
+my ($scenario, $tmpdir);
+my @scenarios = (
+	{ base => 'dump-key', status => 0,
+		cmd => "isadump -S board1.snap -y -k $key 0x2e 0x2f 4",
+		desc => 'Super-I/O logical device, with the key' },
+	{ base => 'dump-nokey', status => 0,
+		cmd => 'isadump -S board1.snap -y 0x2e 0x2f 4',
+		desc => 'Super-I/O logical device, without the key' },
+	{ base => 'dump-word', status => 0,
+		cmd => 'isadump -S board1.snap -y -W 0x295 0x296 1',
+		desc => '16-bit reads in a bank' },
+	{ base => 'dump-flat', status => 0,
+		cmd => 'isadump -S board1.snap -y -m -f 0x0a30 16',
+		desc => 'flat dump, one register per line' },
+	{ base => 'dump-snapshot', status => 0,
+		cmd => 'isadump -S board1.snap -y -s -b dumps.txt > $TMPDIR/out.snap'
+		     . ' && isasnap board1.snap $TMPDIR/out.snap',
+		desc => 'snapshot of a snapshot, and back' },
+	{ base => 'dump-watch', status => 0,
+		cmd => 'isadump -S board1.snap -y -m -w 0.001 -c 5 -f 0x0a30 16'
+		     . ' 2> /dev/null',
+		desc => 'watch mode, nothing changes' },
+	{ base => 'set-batch', status => 0,
+		cmd => 'isaset -S board1.snap -y -b writes-ok.txt',
+		desc => 'batch of writes, with a key and masks' },
+	{ base => 'set-stop', status => 1,
+		cmd => 'isaset -S board1.snap -y -b writes-fail.txt',
+		desc => 'batch of writes, stopping on a failed write' },
+	{ base => 'set-rollback', status => 1,
+		cmd => 'isaset -S board1.snap -y -r -b writes-fail.txt',
+		desc => 'batch of writes, rolled back on a failed write' },
+	{ base => 'snap-decode', status => 0,
+		cmd => 'isasnap -m it8728.map board1.snap',
+		desc => 'decoding a snapshot with a map' },
+	{ base => 'snap-diff', status => 1,
+		cmd => 'isasnap -m it8728.map board1.snap board2.snap',
+		desc => 'differences between two snapshots' },
+	{ base => 'snap-same', status => 0,
+		cmd => 'isasnap board1.snap board1.snap',
+		desc => 'no differences' },
+	{ base => 'snap-invalid', status => 2,
+		cmd => 'isasnap writes-ok.txt',
+		desc => 'not a snapshot' },
+);
+
+plan tests => ($#scenarios + 1) * 3;
+
+$ENV{PATH} = ($ENV{PROGDUMPDIR} || '..') . ":$ENV{PATH}";
+$tmpdir = tempdir(CLEANUP => 1);
+$ENV{TMPDIR} = $tmpdir;
+
+sub read_file
+{
+	my ($filename) = @_;
+	my $contents = '';
+
+	# if the file is not present, assume nothing is expected
+	if (open INPUT, "< $filename") {
+		local $/;
+		$contents = <INPUT>;
+		close INPUT or die "Cannot close $filename: $!";
+	}
+	return $contents;
+}
+
+foreach $scenario (@scenarios) {
+	my ($status, $desc);
+
+	$desc = $scenario->{"desc"};
+	system("sh", "-c", $scenario->{"cmd"} . " > $tmpdir/stdout"
+		. ($scenario->{"cmd"} =~ /2>/ ? '' : " 2> $tmpdir/stderr"));
+	$status = $? >> 8;
+
+	# test return status
+	is($status, $scenario->{"status"}, "status: $desc");
+
+	# test stdout
+	is(read_file("$tmpdir/stdout"),
+		read_file($scenario->{"base"} . ".stdout"), "stdout: $desc");
+
+	# test stderr
+	is(read_file("$tmpdir/stderr"),
+		read_file($scenario->{"base"} . ".stderr"), "stderr: $desc");
+	unlink "$tmpdir/stderr";
+}
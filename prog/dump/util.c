@@ -10,7 +10,38 @@
 
 #include <sys/io.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "util.h"
+#include "snapshot.h"
+
+#define SIM_MAX_CHIPS	16
+
+/*
+ * A chip of the simulated backend, built from the blocks of a snapshot
+ * with the same registers. It has an image of each bank it was dumped
+ * with, which the writes modify.
+ */
+struct sim_chip {
+	int flat;
+	int addrreg;		/* base address in flat mode */
+	int datareg;
+	int size;		/* ports in flat mode */
+	int bankreg;
+	struct snapshot_block *banks[32];
+	struct snapshot_block *nobank;	/* dumped without bank operation */
+	int bank;		/* the selected bank, -1 for nobank */
+	const unsigned char *key;	/* NULL if no key is needed */
+	int key_pos;		/* bytes of the key written so far */
+	int locked;		/* not in configuration mode */
+	int index;		/* last value written to the address register */
+};
+
+static struct snapshot sim_snapshot;
+static struct sim_chip sim_chips[SIM_MAX_CHIPS];
+static int sim_num_chips;
+static int simulated;
 
 /* Return 1 if we should continue, 0 if we should abort */
 int user_ack(int def)
@@ -47,9 +78,285 @@ int user_ack(int def)
 	return ret;
 }
 
+/*
+ * Split a line of a batch file into words, from args[1] on, up to a #.
+ * args[0] is left to the caller, so that the result looks like the
+ * command line. Returns the number of arguments (1 for an empty line),
+ * or -1 if there are more than max.
+ */
+int split_args(char *line, char *args[], int max)
+{
+	char *word;
+	int argc = 1;
+
+	for (word = strtok(line, " \t\n"); word && word[0] != '#';
+	     word = strtok(NULL, " \t\n")) {
+		if (argc == max)
+			return -1;
+		args[argc++] = word;
+	}
+	return argc;
+}
+
+/* Build the chips of the simulated backend from the blocks of a snapshot */
+static int sim_add_block(struct snapshot_block *b)
+{
+	struct sim_chip *c;
+	int i;
+
+	for (i = 0; i < sim_num_chips; i++) {
+		c = &sim_chips[i];
+		if (c->flat == b->flat && c->addrreg == b->addrreg
+		 && (c->flat || c->datareg == b->datareg))
+			break;
+	}
+	if (i == SIM_MAX_CHIPS)
+		return -1;
+	c = &sim_chips[i];
+	if (i == sim_num_chips) {
+		sim_num_chips++;
+		c->flat = b->flat;
+		c->addrreg = b->addrreg;
+		c->datareg = b->datareg;
+		c->bank = -1;
+	}
+
+	if (b->size > c->size)
+		c->size = b->size;
+	if (b->bank < 0) {
+		c->nobank = b;
+	} else {
+		c->banks[b->bank] = b;
+		c->bankreg = b->bankreg;
+		/* the lowest bank, unless a dump without bank says */
+		if (c->bank < 0 || b->bank < c->bank)
+			c->bank = b->bank;
+	}
+	if (b->key[0]) {
+		c->key = b->key;
+		c->locked = 1;
+	}
+	return 0;
+}
+
+/*
+ * Use the registers of a snapshot instead of the I/O ports. Privileges
+ * are dropped first, as they are not needed.
+ */
+int io_simulate(const char *file)
+{
+	struct sim_chip *c;
+	int i;
+
+	if (setuid(getuid())) {
+		perror("setuid");
+		return -1;
+	}
+	if (snapshot_read(file, &sim_snapshot) < 0)
+		return -1;
+
+	for (i = 0; i < sim_snapshot.num_blocks; i++) {
+		if (sim_add_block(&sim_snapshot.blocks[i]) < 0) {
+			fprintf(stderr, "Error: More than %d chips in %s!\n",
+				SIM_MAX_CHIPS, file);
+			return -1;
+		}
+	}
+
+	/* the bank selected when the snapshot was taken, if known */
+	for (i = 0; i < sim_num_chips; i++) {
+		c = &sim_chips[i];
+		if (c->nobank && c->bank >= 0 && c->bankreg < c->nobank->size
+		 && c->nobank->data[c->bankreg] < 32)
+			c->bank = c->nobank->data[c->bankreg];
+	}
+
+	simulated = 1;
+	return 0;
+}
+
+int io_simulated(void)
+{
+	return simulated;
+}
+
+/* Get access to one I/O port */
+int io_permit(int port)
+{
+#ifndef __powerpc__
+	if (!simulated)
+		return ioperm(port, 1, 1);
+#endif
+	(void)port;
+	return 0;
+}
+
+/* Get access to all the I/O ports */
+int io_permit_all(void)
+{
+#ifndef __powerpc__
+	if (!simulated)
+		return iopl(3);
+#endif
+	return 0;
+}
+
+/* The image of the selected bank, NULL if there is none */
+static struct snapshot_block *sim_block(const struct sim_chip *c)
+{
+	if (c->bank < 0)
+		return c->nobank;
+	return c->banks[c->bank];
+}
+
+static struct sim_chip *sim_find(int port, int *offset)
+{
+	struct sim_chip *c;
+	int i;
+
+	for (i = 0; i < sim_num_chips; i++) {
+		c = &sim_chips[i];
+		if (c->flat) {
+			if (port >= c->addrreg && port < c->addrreg + c->size) {
+				*offset = port - c->addrreg;
+				return c;
+			}
+		} else if (port == c->addrreg || port == c->datareg) {
+			*offset = -1;
+			return c;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A register of the selected bank, 0xff where nothing was dumped. The
+ * bank register reads as it was dumped in that bank, as it can hold
+ * more than the bank number.
+ */
+static unsigned char sim_read_reg(const struct sim_chip *c, int reg)
+{
+	const struct snapshot_block *b;
+
+	b = sim_block(c);
+	if (!b || reg >= b->size)
+		return 0xff;
+	return b->data[reg];
+}
+
+static void sim_write_reg(struct sim_chip *c, int reg, unsigned char value)
+{
+	struct snapshot_block *b;
+
+	if (c->bank >= 0 && reg == c->bankreg) {
+		c->bank = value & 0x1f;
+		return;
+	}
+	/* back to "Wait For Key" state (PNP-ISA spec) */
+	if (c->key && reg == 0x02 && (value & 0x02)) {
+		c->locked = 1;
+		c->key_pos = 0;
+		return;
+	}
+	b = sim_block(c);
+	if (b && reg < b->size)
+		b->data[reg] = value;
+}
+
+static unsigned char sim_inb(int port)
+{
+	struct sim_chip *c;
+	int offset;
+
+	c = sim_find(port, &offset);
+	if (!c)
+		return 0xff;		/* nothing on the bus */
+	if (c->flat)
+		return sim_read_reg(c, offset);
+	if (port == c->addrreg)
+		return c->index;
+	if (c->locked)
+		return 0xff;
+	return sim_read_reg(c, c->index);
+}
+
+static void sim_outb(unsigned char value, int port)
+{
+	struct sim_chip *c;
+	int offset;
+
+	c = sim_find(port, &offset);
+	if (!c)
+		return;
+	if (c->flat) {
+		sim_write_reg(c, offset, value);
+	} else if (port == c->addrreg) {
+		c->index = value;
+		if (!c->locked)
+			return;
+		/* a wrong byte restarts the key */
+		if (value != c->key[c->key_pos + 1])
+			c->key_pos = 0;
+		if (value == c->key[c->key_pos + 1]
+		 && ++c->key_pos == c->key[0])
+			c->locked = 0;
+	} else if (!c->locked) {
+		sim_write_reg(c, c->index, value);
+	}
+}
+
+/*
+ * Wider accesses to a data register go to consecutive registers, the
+ * way isadump -W stores them in snapshots, little-endian.
+ */
+static unsigned long sim_inx(int addr, int width)
+{
+	struct sim_chip *c;
+	unsigned long value = 0;
+	int offset, k, index;
+
+	c = sim_find(addr, &offset);
+	if (width == 1 || !c || c->flat || addr == c->addrreg) {
+		for (k = 0; k < width; k++)
+			value |= (unsigned long)sim_inb(addr + k) << (8 * k);
+		return value;
+	}
+
+	index = c->index;
+	for (k = 0; k < width; k++) {
+		value |= (unsigned long)sim_inb(addr) << (8 * k);
+		c->index++;
+	}
+	c->index = index;
+	return value;
+}
+
+static void sim_outx(unsigned long value, int addr, int width)
+{
+	struct sim_chip *c;
+	int offset, k, index;
+
+	c = sim_find(addr, &offset);
+	if (width == 1 || !c || c->flat || addr == c->addrreg) {
+		for (k = 0; k < width; k++)
+			sim_outb(value >> (8 * k), addr + k);
+		return;
+	}
+
+	index = c->index;
+	for (k = 0; k < width; k++) {
+		sim_outb(value >> (8 * k), addr);
+		c->index++;
+	}
+	c->index = index;
+}
+
 /* I/O read of specified size */
 unsigned long inx(int addr, int width)
 {
+	if (simulated)
+		return sim_inx(addr, width);
+
 	switch (width) {
 	case 2:
 		return inw(addr);
@@ -65,6 +372,11 @@ unsigned long inx(int addr, int width)
 /* I/O write of specified size */
 void outx(unsigned long value, int addr, int width)
 {
+	if (simulated) {
+		sim_outx(value, addr, width);
+		return;
+	}
+
 	switch (width) {
 	case 2:
 		outw(value, addr);
@@ -12,6 +12,11 @@
 #define _UTIL_H
 
 extern int user_ack(int def);
+extern int split_args(char *line, char *args[], int max);
+extern int io_simulate(const char *file);
+extern int io_simulated(void);
+extern int io_permit(int port);
+extern int io_permit_all(void);
 extern unsigned long inx(int addr, int width);
 extern void outx(unsigned long value, int addr, int width);
 
@@ -20,10 +20,21 @@ MODULE_DIR := prog/pwm
 PROGPWMDIR := $(MODULE_DIR)
 
 PROGPWMMAN8DIR := $(MANDIR)/man8
-PROGPWMMAN8FILES := $(MODULE_DIR)/fancontrol.8 $(MODULE_DIR)/pwmconfig.8
+PROGPWMMAN8FILES := $(MODULE_DIR)/fancontrol.8 $(MODULE_DIR)/pwmconfig.8 \
+                    $(MODULE_DIR)/fancontrold.8 $(MODULE_DIR)/pwmprobe.8
 
 PROGPWMTARGETS := $(MODULE_DIR)/fancontrol \
-                  $(MODULE_DIR)/pwmconfig
+                  $(MODULE_DIR)/pwmconfig \
+                  $(MODULE_DIR)/fancontrold \
+                  $(MODULE_DIR)/pwmprobe
+PROGPWMDAEMON := $(MODULE_DIR)/fancontrold
+PROGPWMSOURCES := $(MODULE_DIR)/fancontrold.c $(MODULE_DIR)/config.c \
+                  $(MODULE_DIR)/sysfs.c $(MODULE_DIR)/control.c \
+                  $(MODULE_DIR)/mpc.c $(MODULE_DIR)/fanmon.c \
+                  $(MODULE_DIR)/telemetry.c
+# pwmprobe shares the sysfs code of the daemon
+PROGPWMPROBE := $(MODULE_DIR)/pwmprobe
+PROGPWMPROBESOURCES := $(MODULE_DIR)/pwmprobe.c $(MODULE_DIR)/sysfs.c
 
 # The vt1211_pwm script is not installed by default, pass VT1211_PWM=1
 # to get it 
@@ -32,9 +43,22 @@ PROGPWMMAN8FILES += $(MODULE_DIR)/vt1211_pwm.8
 PROGPWMTARGETS += $(MODULE_DIR)/vt1211_pwm
 endif
 
+# Include all dependency files. We use '.rd' to indicate this will create
+# executables.
+INCLUDEFILES += $(PROGPWMSOURCES:.c=.rd) $(MODULE_DIR)/pwmprobe.rd
+
 REMOVEPWMBIN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(SBINDIR)/%,$(PROGPWMTARGETS))
 REMOVEPWMMAN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(PROGPWMMAN8DIR)/%,$(PROGPWMMAN8FILES))
 
+all-prog-pwm: $(PROGPWMDAEMON) $(PROGPWMPROBE)
+user :: all-prog-pwm
+
+$(PROGPWMDAEMON): $(PROGPWMSOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $^ -lm
+
+$(PROGPWMPROBE): $(PROGPWMPROBESOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $^
+
 install-prog-pwm: $(PROGPWMTARGETS)
 	$(MKDIR) $(DESTDIR)$(SBINDIR) $(DESTDIR)$(PROGPWMMAN8DIR)
 	$(INSTALL) -m 755 $(PROGPWMTARGETS) $(DESTDIR)$(SBINDIR)
@@ -45,3 +69,8 @@ user_install :: install-prog-pwm
 user_uninstall::
 	$(RM) $(REMOVEPWMBIN)
 	$(RM) $(REMOVEPWMMAN)
+
+clean-prog-pwm:
+	$(RM) $(PROGPWMDIR)/*.rd $(PROGPWMDIR)/*.ro $(PROGPWMDAEMON) \
+	      $(PROGPWMPROBE)
+clean :: clean-prog-pwm
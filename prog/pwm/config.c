@@ -0,0 +1,811 @@
+/*
+    config.c - Part of fancontrold, a daemon for temperature dependent fan
+               speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * The configuration file is the one of the fancontrol script, as written
+ * by pwmconfig: one VARIABLE=pwm=value pwm2=value2 ... line per setting.
+ * Unlike the script, a fractional INTERVAL is accepted.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "fancontrold.h"
+
+#define LINE_MAX_LEN	4096
+#define CURVE_MAX_POINTS	32
+
+/* The variables of the file, unparsed */
+enum {
+	VAR_INTERVAL,
+	VAR_MAXINTERVAL,
+	VAR_SLOPE,
+	VAR_MPCHORIZON,
+	VAR_DEVPATH,
+	VAR_DEVNAME,
+	VAR_FCTEMPS,
+	VAR_FCFANS,
+	VAR_MINTEMP,
+	VAR_MAXTEMP,
+	VAR_MINSTART,
+	VAR_MINSTOP,
+	VAR_MINPWM,
+	VAR_MAXPWM,
+	VAR_CONTROL,
+	VAR_SETPOINT,
+	VAR_KP,
+	VAR_KI,
+	VAR_KD,
+	VAR_DFILTER,
+	VAR_SLEWRATE,
+	VAR_FFINPUT,
+	VAR_FFGAIN,
+	VAR_FFBASE,
+	VAR_CURVE,
+	VAR_CURVEDOWN,
+	VAR_COMBINE,
+	VAR_WEIGHTS,
+	VAR_ZONE,
+	VAR_COUNT
+};
+
+static const char *var_names[VAR_COUNT] = {
+	[VAR_INTERVAL]	= "INTERVAL",
+	[VAR_MAXINTERVAL] = "MAXINTERVAL",
+	[VAR_SLOPE]	= "SLOPE",
+	[VAR_MPCHORIZON] = "MPCHORIZON",
+	[VAR_DEVPATH]	= "DEVPATH",
+	[VAR_DEVNAME]	= "DEVNAME",
+	[VAR_FCTEMPS]	= "FCTEMPS",
+	[VAR_FCFANS]	= "FCFANS",
+	[VAR_MINTEMP]	= "MINTEMP",
+	[VAR_MAXTEMP]	= "MAXTEMP",
+	[VAR_MINSTART]	= "MINSTART",
+	[VAR_MINSTOP]	= "MINSTOP",
+	[VAR_MINPWM]	= "MINPWM",
+	[VAR_MAXPWM]	= "MAXPWM",
+	[VAR_CONTROL]	= "CONTROL",
+	[VAR_SETPOINT]	= "SETPOINT",
+	[VAR_KP]	= "KP",
+	[VAR_KI]	= "KI",
+	[VAR_KD]	= "KD",
+	[VAR_DFILTER]	= "DFILTER",
+	[VAR_SLEWRATE]	= "SLEWRATE",
+	[VAR_FFINPUT]	= "FFINPUT",
+	[VAR_FFGAIN]	= "FFGAIN",
+	[VAR_FFBASE]	= "FFBASE",
+	[VAR_CURVE]	= "CURVE",
+	[VAR_CURVEDOWN]	= "CURVEDOWN",
+	[VAR_COMBINE]	= "COMBINE",
+	[VAR_WEIGHTS]	= "WEIGHTS",
+	[VAR_ZONE]	= "ZONE",
+};
+
+static char *strip(char *s)
+{
+	char *end;
+
+	while (*s == ' ' || *s == '\t')
+		s++;
+	end = s + strlen(s);
+	while (end > s && (end[-1] == '\n' || end[-1] == '\r' ||
+			   end[-1] == ' ' || end[-1] == '\t'))
+		*--end = '\0';
+	return s;
+}
+
+/*
+ * Find the value for pwm in a list of pwm=value pairs. Returns a pointer
+ * to a static copy, or NULL if there is none.
+ */
+static const char *lookup(const char *list, const char *pwm)
+{
+	static char value[LINE_MAX_LEN];
+	size_t len = strlen(pwm), n;
+	const char *p = list;
+
+	while (p && *p) {
+		p += strspn(p, " \t");
+		n = strcspn(p, " \t");
+		if (n > len && !strncmp(p, pwm, len) && p[len] == '=') {
+			memcpy(value, p + len + 1, n - len - 1);
+			value[n - len - 1] = '\0';
+			return value;
+		}
+		p += n;
+	}
+	return NULL;
+}
+
+static int lookup_int(const char *list, const char *pwm, const char *var,
+		      int def, int *value)
+{
+	const char *s = list ? lookup(list, pwm) : NULL;
+	char *end;
+
+	if (!s) {
+		if (def < 0) {
+			fc_log(LOG_ERR, "Error in configuration file (%s): "
+			       "%s is missing", pwm, var);
+			return -1;
+		}
+		*value = def;
+		return 0;
+	}
+	*value = strtol(s, &end, 10);
+	if (end == s || *end) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "%s value `%s' is not a number", pwm, var, s);
+		return -1;
+	}
+	return 0;
+}
+
+/* Same as lookup_int, for real values */
+static int lookup_double(const char *list, const char *pwm, const char *var,
+			 double def, double *value)
+{
+	const char *s = list ? lookup(list, pwm) : NULL;
+	char *end;
+
+	if (!s) {
+		if (def < 0) {
+			fc_log(LOG_ERR, "Error in configuration file (%s): "
+			       "%s is missing", pwm, var);
+			return -1;
+		}
+		*value = def;
+		return 0;
+	}
+	*value = strtod(s, &end);
+	if (end == s || *end) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "%s value `%s' is not a number", pwm, var, s);
+		return -1;
+	}
+	return 0;
+}
+
+static int add_attr(struct attr *attr, const char *path)
+{
+	attr->path = strdup(path);
+	attr->fd = -1;
+	if (!attr->path) {
+		fc_log(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Split a copy of value on '+' into at most max parts. Returns the
+ * number of parts, or -1 if there are too many.
+ */
+static int split(char *buf, size_t size, const char *value, char **parts,
+		 int max)
+{
+	char *save, *part;
+	int n = 0;
+
+	snprintf(buf, size, "%s", value);
+	for (part = strtok_r(buf, "+", &save); part;
+	     part = strtok_r(NULL, "+", &save)) {
+		if (n == max)
+			return -1;
+		parts[n++] = part;
+	}
+	return n;
+}
+
+/*
+ * Parse a curve, a comma-separated list of temp:pwm points, and
+ * precompute the PWM value for every CURVE_STEP in its range.
+ */
+static int load_curve(struct curve *curve, const char *spec, const char *pwm,
+		      const char *var)
+{
+	double t[CURVE_MAX_POINTS], x;
+	int v[CURVE_MAX_POINTS], n = 0, i, j;
+	const char *p = spec;
+	char *end;
+	long tmax;
+
+	while (*p) {
+		if (n == CURVE_MAX_POINTS)
+			goto invalid;
+		t[n] = strtod(p, &end);
+		if (end == p || *end != ':')
+			goto invalid;
+		p = end + 1;
+		v[n] = strtol(p, &end, 10);
+		if (end == p || (*end && *end != ','))
+			goto invalid;
+		if (v[n] < 0 || v[n] > MAX_PWM ||
+		    (n && t[n] <= t[n - 1]))
+			goto invalid;
+		n++;
+		p = *end ? end + 1 : end;
+	}
+	if (!n)
+		goto invalid;
+
+	curve->tmin = t[0] * 1000;
+	tmax = t[n - 1] * 1000;
+	curve->size = (tmax - curve->tmin) / CURVE_STEP + 1;
+	if (curve->size > CURVE_MAX_SIZE) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "%s spans more than %d degrees", pwm, var,
+		       CURVE_MAX_SIZE * CURVE_STEP / 1000);
+		return -1;
+	}
+	curve->table = malloc(curve->size);
+	if (!curve->table) {
+		fc_log(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	for (i = 0, j = 0; i < curve->size; i++) {
+		x = (curve->tmin + (long)i * CURVE_STEP) / 1000.0;
+		while (j < n - 2 && x > t[j + 1])
+			j++;
+		if (n == 1 || x <= t[j])
+			curve->table[i] = v[j];
+		else if (x >= t[j + 1])
+			curve->table[i] = v[j + 1];
+		else
+			curve->table[i] = v[j] + (v[j + 1] - v[j]) *
+					  (x - t[j]) / (t[j + 1] - t[j]) + 0.5;
+	}
+	return 0;
+
+invalid:
+	fc_log(LOG_ERR, "Error in configuration file (%s): "
+	       "%s value `%s' is not a list of increasing temp:pwm points",
+	       pwm, var, spec);
+	return -1;
+}
+
+/* One curve for all temperature inputs, or one per input */
+static int load_curves(struct channel *ch, char **vars, const char *pwm,
+		       int var)
+{
+	char buf[LINE_MAX_LEN], *parts[MAX_TEMPS];
+	const char *value;
+	struct curve *curve;
+	int n, i;
+
+	value = vars[var] ? lookup(vars[var], pwm) : NULL;
+	if (!value) {
+		if (var == VAR_CURVEDOWN)
+			return 0;
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "%s is missing", pwm, var_names[var]);
+		return -1;
+	}
+	n = split(buf, sizeof(buf), value, parts, MAX_TEMPS);
+	if (n != 1 && n != ch->num_temps) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "%s must have one curve, or one per temperature",
+		       pwm, var_names[var]);
+		return -1;
+	}
+	for (i = 0; i < ch->num_temps; i++) {
+		curve = var == VAR_CURVE ? &ch->temps[i].rising :
+					   &ch->temps[i].falling;
+		if (load_curve(curve, parts[n == 1 ? 0 : i], pwm,
+			       var_names[var]))
+			return -1;
+	}
+	return 0;
+}
+
+/* How the temperature inputs are combined */
+static int load_combine(struct channel *ch, char **vars, const char *pwm)
+{
+	char buf[LINE_MAX_LEN], *parts[MAX_TEMPS], *end;
+	const char *value;
+	int n, i;
+
+	for (i = 0; i < ch->num_temps; i++)
+		ch->temps[i].weight = 1;
+
+	value = vars[VAR_COMBINE] ? lookup(vars[VAR_COMBINE], pwm) : NULL;
+	if (!value || !strcmp(value, "max")) {
+		ch->combine = COMBINE_MAX;
+		return 0;
+	}
+	if (strcmp(value, "weighted")) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "COMBINE must be max or weighted", pwm);
+		return -1;
+	}
+	ch->combine = COMBINE_WEIGHTED;
+
+	value = vars[VAR_WEIGHTS] ? lookup(vars[VAR_WEIGHTS], pwm) : NULL;
+	if (!value)
+		return 0;
+	n = split(buf, sizeof(buf), value, parts, MAX_TEMPS);
+	if (n != ch->num_temps)
+		goto invalid;
+	for (i = 0; i < n; i++) {
+		ch->temps[i].weight = strtod(parts[i], &end);
+		if (end == parts[i] || *end || ch->temps[i].weight <= 0)
+			goto invalid;
+	}
+	return 0;
+
+invalid:
+	fc_log(LOG_ERR, "Error in configuration file (%s): "
+	       "WEIGHTS must have one positive weight per temperature", pwm);
+	return -1;
+}
+
+/* The feed-forward input of the PID mode, or the power of an MPC zone */
+static int load_feedforward(struct channel *ch, char **vars, const char *pwm)
+{
+	struct feedforward *ff = &ch->ff;
+	const char *input;
+
+	input = vars[VAR_FFINPUT] ? lookup(vars[VAR_FFINPUT], pwm) : NULL;
+	if (!input)
+		return 0;
+	ff->cpu = !strcmp(input, "cpu");
+	if (add_attr(&ff->input, ff->cpu ? "/proc/stat" : input))
+		return -1;
+	if (lookup_double(vars[VAR_FFGAIN], pwm, "FFGAIN", -1, &ff->gain) ||
+	    lookup_double(vars[VAR_FFBASE], pwm, "FFBASE", 0, &ff->base))
+		return -1;
+	return 0;
+}
+
+/* By default, aim at the middle of the ramp */
+static int load_setpoint(struct channel *ch, char **vars, const char *pwm)
+{
+	if (lookup_double(vars[VAR_SETPOINT], pwm, "SETPOINT",
+			  (ch->min_temp + ch->max_temp) / 2.0,
+			  &ch->pid.setpoint))
+		return -1;
+	if (ch->pid.setpoint <= ch->min_temp ||
+	    ch->pid.setpoint >= ch->max_temp) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "SETPOINT must be between MINTEMP and MAXTEMP", pwm);
+		return -1;
+	}
+	return 0;
+}
+
+/* The settings of the PID mode */
+static int load_pid(struct channel *ch, char **vars, const char *pwm,
+		    double interval)
+{
+	struct pid *pid = &ch->pid;
+
+	if (load_setpoint(ch, vars, pwm) ||
+	    lookup_double(vars[VAR_KP], pwm, "KP", -1, &pid->kp) ||
+	    lookup_double(vars[VAR_KI], pwm, "KI", 0, &pid->ki) ||
+	    lookup_double(vars[VAR_KD], pwm, "KD", 0, &pid->kd) ||
+	    lookup_double(vars[VAR_DFILTER], pwm, "DFILTER", 2 * interval,
+			  &pid->dfilter) ||
+	    lookup_double(vars[VAR_SLEWRATE], pwm, "SLEWRATE", 0,
+			  &pid->slewrate))
+		return -1;
+	if (pid->kp < 0 || pid->ki < 0 || pid->kd < 0 || pid->dfilter < 0 ||
+	    pid->slewrate < 0) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "KP, KI, KD, DFILTER and SLEWRATE must not be negative",
+		       pwm);
+		return -1;
+	}
+	return load_feedforward(ch, vars, pwm);
+}
+
+static int load_channel(struct channel *ch, char **vars, const char *pair,
+			double interval)
+{
+	char pwm[LINE_MAX_LEN], buf[LINE_MAX_LEN], *temps[MAX_TEMPS];
+	char *temp, *fans, *fan;
+	const char *list, *mode;
+	int i, n, curve;
+
+	if (!strchr(pair, '=')) {
+		fc_log(LOG_ERR, "Error in configuration file: "
+		       "FCTEMPS value is improperly formatted");
+		return -1;
+	}
+	snprintf(pwm, sizeof(pwm), "%s", pair);
+	temp = strchr(pwm, '=');
+	*temp++ = '\0';
+
+	ch->enable.fd = -1;
+	ch->ff.input.fd = -1;
+	if (add_attr(&ch->pwm, pwm))
+		return -1;
+
+	/* Several temperatures can control a given PWM output */
+	n = split(buf, sizeof(buf), temp, temps, MAX_TEMPS);
+	if (n <= 0) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "Too many temperatures", pwm);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		if (add_attr(&ch->temps[ch->num_temps++].attr, temps[i]))
+			return -1;
+
+	mode = vars[VAR_CONTROL] ? lookup(vars[VAR_CONTROL], pwm) : NULL;
+	if (!mode || !strcmp(mode, "ramp"))
+		ch->mode = MODE_RAMP;
+	else if (!strcmp(mode, "pid"))
+		ch->mode = MODE_PID;
+	else if (!strcmp(mode, "curve"))
+		ch->mode = MODE_CURVE;
+	else if (!strcmp(mode, "mpc"))
+		ch->mode = MODE_MPC;
+	else {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "CONTROL must be ramp, pid, curve or mpc", pwm);
+		return -1;
+	}
+	/* MINTEMP and MAXTEMP are replaced by the curves */
+	curve = ch->mode == MODE_CURVE;
+
+	/* A given PWM output can control several fans */
+	list = vars[VAR_FCFANS] ? lookup(vars[VAR_FCFANS], pwm) : NULL;
+	if (list) {
+		fans = strdup(list);
+		if (!fans) {
+			fc_log(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		for (fan = strtok(fans, "+"); fan; fan = strtok(NULL, "+")) {
+			if (ch->num_fans == MAX_FANS) {
+				fc_log(LOG_ERR, "Error in configuration file "
+				       "(%s): Too many fans", pwm);
+				free(fans);
+				return -1;
+			}
+			if (add_attr(&ch->fans[ch->num_fans++], fan)) {
+				free(fans);
+				return -1;
+			}
+		}
+		free(fans);
+	}
+
+	if (lookup_int(vars[VAR_MINTEMP], pwm, "MINTEMP", curve ? 0 : -1,
+		       &ch->min_temp) ||
+	    lookup_int(vars[VAR_MAXTEMP], pwm, "MAXTEMP", curve ? 0 : -1,
+		       &ch->max_temp) ||
+	    lookup_int(vars[VAR_MINSTART], pwm, "MINSTART", -1,
+		       &ch->min_start) ||
+	    lookup_int(vars[VAR_MINSTOP], pwm, "MINSTOP", -1,
+		       &ch->min_stop) ||
+	    lookup_int(vars[VAR_MINPWM], pwm, "MINPWM", 0, &ch->min_pwm) ||
+	    lookup_int(vars[VAR_MAXPWM], pwm, "MAXPWM", MAX_PWM,
+		       &ch->max_pwm))
+		return -1;
+
+	/* verify the validity of the settings */
+	if (!curve && ch->min_temp >= ch->max_temp) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "MINTEMP must be less than MAXTEMP", pwm);
+		return -1;
+	}
+	if (ch->max_pwm > MAX_PWM) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "MAXPWM must be at most 255", pwm);
+		return -1;
+	}
+	if (ch->min_stop >= ch->max_pwm) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "MINSTOP must be less than MAXPWM", pwm);
+		return -1;
+	}
+	if (ch->min_stop < ch->min_pwm) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "MINSTOP must be greater than or equal to MINPWM", pwm);
+		return -1;
+	}
+	if (ch->min_pwm < 0) {
+		fc_log(LOG_ERR, "Error in configuration file (%s): "
+		       "MINPWM must be at least 0", pwm);
+		return -1;
+	}
+
+	if (load_combine(ch, vars, pwm))
+		return -1;
+	if (ch->mode == MODE_PID)
+		return load_pid(ch, vars, pwm, interval);
+	if (ch->mode == MODE_MPC)
+		return load_setpoint(ch, vars, pwm) ||
+		       load_feedforward(ch, vars, pwm) ? -1 : 0;
+	if (ch->mode == MODE_CURVE)
+		return load_curves(ch, vars, pwm, VAR_CURVE) ||
+		       load_curves(ch, vars, pwm, VAR_CURVEDOWN) ? -1 : 0;
+	return 0;
+}
+
+static int share_input(const struct channel *a, const struct channel *b)
+{
+	int i, j;
+
+	for (i = 0; i < a->num_temps; i++)
+		for (j = 0; j < b->num_temps; j++)
+			if (!strcmp(a->temps[i].attr.path,
+				    b->temps[j].attr.path))
+				return 1;
+	return 0;
+}
+
+/*
+ * Group the outputs which cool the same parts: those with the same ZONE,
+ * or without one, those sharing a temperature input.
+ */
+static void assign_zones(struct config *config, char **vars)
+{
+	char names[MAX_CHANNELS][64];
+	const char *name;
+	struct channel *ch, *other;
+	int i, j, k, old;
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		name = vars[VAR_ZONE] ? lookup(vars[VAR_ZONE], ch->pwm.path) :
+					NULL;
+		snprintf(names[i], sizeof(names[i]), "%s", name ? name : "");
+		ch->zone = i;
+		for (j = 0; j < i; j++) {
+			other = &config->channels[j];
+			if (names[i][0] || names[j][0] ?
+			    strcmp(names[i], names[j]) :
+			    !share_input(ch, other))
+				continue;
+			if (ch->zone == i) {
+				ch->zone = other->zone;
+				continue;
+			}
+			/* merge the zones */
+			old = other->zone;
+			for (k = 0; k <= i; k++)
+				if (config->channels[k].zone == old)
+					config->channels[k].zone = ch->zone;
+		}
+	}
+}
+
+static void print_channel(const struct channel *ch)
+{
+	int i;
+
+	fc_log(LOG_INFO, "Settings for %s:", ch->pwm.path);
+	for (i = 0; i < ch->num_temps; i++)
+		fc_log(LOG_INFO, "  Depends on %s", ch->temps[i].attr.path);
+	for (i = 0; i < ch->num_fans; i++)
+		fc_log(LOG_INFO, "  Controls %s", ch->fans[i].path);
+	if (ch->num_temps > 1)
+		fc_log(LOG_INFO, "  COMBINE=%s", ch->combine == COMBINE_MAX ?
+		       "max" : "weighted");
+	if (ch->mode == MODE_CURVE) {
+		fc_log(LOG_INFO, "  CONTROL=curve%s", ch->temps[0].falling.table ?
+		       ", with hysteresis" : "");
+	} else {
+		fc_log(LOG_INFO, "  MINTEMP=%d", ch->min_temp);
+		fc_log(LOG_INFO, "  MAXTEMP=%d", ch->max_temp);
+	}
+	fc_log(LOG_INFO, "  MINSTART=%d", ch->min_start);
+	fc_log(LOG_INFO, "  MINSTOP=%d", ch->min_stop);
+	fc_log(LOG_INFO, "  MINPWM=%d", ch->min_pwm);
+	fc_log(LOG_INFO, "  MAXPWM=%d", ch->max_pwm);
+	if (ch->mode == MODE_MPC) {
+		fc_log(LOG_INFO, "  CONTROL=mpc");
+		fc_log(LOG_INFO, "  SETPOINT=%g", ch->pid.setpoint);
+		if (ch->ff.input.path)
+			fc_log(LOG_INFO, "  Power from %s, FFGAIN=%g FFBASE=%g",
+			       ch->ff.cpu ? "cpu" : ch->ff.input.path,
+			       ch->ff.gain, ch->ff.base);
+		return;
+	}
+	if (ch->mode != MODE_PID)
+		return;
+	fc_log(LOG_INFO, "  CONTROL=pid");
+	fc_log(LOG_INFO, "  SETPOINT=%g", ch->pid.setpoint);
+	fc_log(LOG_INFO, "  KP=%g KI=%g KD=%g", ch->pid.kp, ch->pid.ki,
+	       ch->pid.kd);
+	fc_log(LOG_INFO, "  DFILTER=%g", ch->pid.dfilter);
+	fc_log(LOG_INFO, "  SLEWRATE=%g", ch->pid.slewrate);
+	if (ch->ff.input.path)
+		fc_log(LOG_INFO, "  Feed-forward from %s, FFGAIN=%g FFBASE=%g",
+		       ch->ff.cpu ? "cpu" : ch->ff.input.path, ch->ff.gain,
+		       ch->ff.base);
+}
+
+int load_config(struct config *config, const char *file)
+{
+	char line[LINE_MAX_LEN], *vars[VAR_COUNT] = { NULL };
+	char *pair, *save, *end;
+	size_t len;
+	FILE *f;
+	int i, ret = -1;
+
+	memset(config, 0, sizeof(*config));
+	fc_log(LOG_INFO, "Loading configuration from %s ...", file);
+	f = fopen(file, "r");
+	if (!f) {
+		fc_log(LOG_ERR, "Error: Can't read configuration file: %s",
+		       strerror(errno));
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		for (i = 0; i < VAR_COUNT; i++) {
+			len = strlen(var_names[i]);
+			if (!strncmp(line, var_names[i], len) &&
+			    line[len] == '=')
+				break;
+		}
+		if (i == VAR_COUNT)
+			continue;
+		/* the last definition wins */
+		free(vars[i]);
+		vars[i] = strdup(strip(line + len + 1));
+		if (!vars[i]) {
+			fc_log(LOG_ERR, "Out of memory");
+			goto exit;
+		}
+	}
+	fclose(f);
+	f = NULL;
+
+	/* Check whether all mandatory settings are set */
+	if (!vars[VAR_INTERVAL] || !vars[VAR_FCTEMPS] ||
+	    !vars[VAR_MINSTART] || !vars[VAR_MINSTOP]) {
+		fc_log(LOG_ERR, "Some mandatory settings missing, please check "
+		       "your config file!");
+		goto exit;
+	}
+	config->interval = strtod(vars[VAR_INTERVAL], &end);
+	if (end == vars[VAR_INTERVAL] || *end || config->interval <= 0) {
+		fc_log(LOG_ERR, "Error in configuration file: "
+		       "INTERVAL must be a positive number of seconds");
+		goto exit;
+	}
+
+	/* Optional, the period only gets longer when things are stable */
+	config->max_interval = config->interval;
+	if (vars[VAR_MAXINTERVAL]) {
+		config->max_interval = strtod(vars[VAR_MAXINTERVAL], &end);
+		if (end == vars[VAR_MAXINTERVAL] || *end ||
+		    config->max_interval < config->interval) {
+			fc_log(LOG_ERR, "Error in configuration file: "
+			       "MAXINTERVAL must be at least INTERVAL");
+			goto exit;
+		}
+	}
+	if (vars[VAR_SLOPE]) {
+		config->slope = strtod(vars[VAR_SLOPE], &end);
+		if (end == vars[VAR_SLOPE] || *end || config->slope < 0) {
+			fc_log(LOG_ERR, "Error in configuration file: "
+			       "SLOPE must be a positive number of degrees C "
+			       "per second");
+			goto exit;
+		}
+	}
+	config->devpath = vars[VAR_DEVPATH];
+	config->devname = vars[VAR_DEVNAME];
+	vars[VAR_DEVPATH] = vars[VAR_DEVNAME] = NULL;
+
+	fc_log(LOG_INFO, "Common settings:");
+	fc_log(LOG_INFO, "  INTERVAL=%g", config->interval);
+	if (config->max_interval > config->interval)
+		fc_log(LOG_INFO, "  MAXINTERVAL=%g", config->max_interval);
+	if (config->slope > 0)
+		fc_log(LOG_INFO, "  SLOPE=%g", config->slope);
+
+	for (pair = strtok_r(vars[VAR_FCTEMPS], " \t", &save); pair;
+	     pair = strtok_r(NULL, " \t", &save)) {
+		if (config->num_channels == MAX_CHANNELS) {
+			fc_log(LOG_ERR, "Error in configuration file: "
+			       "Too many PWM outputs");
+			goto exit;
+		}
+		if (load_channel(&config->channels[config->num_channels++],
+				 vars, pair, config->interval))
+			goto exit;
+		print_channel(&config->channels[config->num_channels - 1]);
+	}
+	if (!config->num_channels) {
+		fc_log(LOG_ERR, "Error in configuration file: "
+		       "FCTEMPS has no PWM output");
+		goto exit;
+	}
+	assign_zones(config, vars);
+
+	/* by default, look one minute ahead */
+	config->mpc.horizon = 60;
+	if (vars[VAR_MPCHORIZON]) {
+		config->mpc.horizon = strtod(vars[VAR_MPCHORIZON], &end);
+		if (end == vars[VAR_MPCHORIZON] || *end ||
+		    config->mpc.horizon < config->interval) {
+			fc_log(LOG_ERR, "Error in configuration file: "
+			       "MPCHORIZON must be at least INTERVAL");
+			goto exit;
+		}
+	}
+	for (i = 0; i < config->num_channels; i++) {
+		if (config->channels[i].mode != MODE_MPC)
+			continue;
+		if (config->mpc.num_zones == MPC_MAX_ZONES) {
+			fc_log(LOG_ERR, "Error in configuration file: "
+			       "Too many PWM outputs with CONTROL=mpc");
+			goto exit;
+		}
+		config->mpc.zones[config->mpc.num_zones++].channel = i;
+	}
+	if (config->mpc.num_zones) {
+		fc_log(LOG_INFO, "  MPCHORIZON=%g", config->mpc.horizon);
+		mpc_init(config);
+	}
+	ret = 0;
+
+exit:
+	if (f)
+		fclose(f);
+	for (i = 0; i < VAR_COUNT; i++)
+		free(vars[i]);
+	if (ret)
+		free_config(config);
+	return ret;
+}
+
+static void free_attr(struct attr *attr)
+{
+	free(attr->path);
+	attr->path = NULL;
+}
+
+void free_config(struct config *config)
+{
+	struct channel *ch;
+	int i, j;
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		free_attr(&ch->pwm);
+		free_attr(&ch->enable);
+		for (j = 0; j < ch->num_temps; j++) {
+			free_attr(&ch->temps[j].attr);
+			free(ch->temps[j].rising.table);
+			free(ch->temps[j].falling.table);
+		}
+		free_attr(&ch->ff.input);
+		for (j = 0; j < ch->num_fans; j++)
+			free_attr(&ch->fans[j]);
+	}
+	for (i = 0; i < config->num_alarms; i++)
+		free_attr(&config->alarms[i]);
+	config->num_alarms = 0;
+	free(config->devpath);
+	free(config->devname);
+	config->devpath = config->devname = NULL;
+	config->num_channels = 0;
+}
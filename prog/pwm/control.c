@@ -0,0 +1,390 @@
+/*
+    control.c - Part of fancontrold, a daemon for temperature dependent fan
+                speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * The control law of the fancontrol script: a linear ramp from MINSTOP
+ * at MINTEMP to MAXPWM at MAXTEMP, MINPWM below and MAXPWM above. A
+ * stopped fan is first kicked with MINSTART for SPINUP_TIME, then gets
+ * the computed value; the script slept meanwhile, here the other outputs
+ * keep being controlled.
+ *
+ * With CONTROL=pid, a PID controller holding SETPOINT replaces the ramp,
+ * optionally with a feed-forward term from a load or power input, so
+ * that the fans react before the temperature does.
+ *
+ * With CONTROL=curve, every temperature input has its own curve, looked
+ * up in a table precomputed at load time, and the demands of all inputs
+ * are combined. In the other modes, the temperatures are combined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "fancontrold.h"
+
+#define SPINUP_TIME	1.0	/* seconds */
+/* an unchanged value is written again after this many seconds */
+#define REFRESH_TIME	10.0
+
+static int set_pwm(struct channel *ch, int value, double now)
+{
+	if (value == ch->pwm_value && now - ch->written < REFRESH_TIME)
+		return 0;
+	if (attr_write(&ch->pwm, value)) {
+		fc_log(LOG_ERR, "Error writing PWM value to %s", ch->pwm.path);
+		return -1;
+	}
+	if (value != ch->pwm_value)
+		ch->busy = 1;
+	if (FAN_BUCKET(value) != FAN_BUCKET(ch->pwm_value)) {
+		ch->prev_pwm = ch->pwm_value;
+		ch->changed = now;
+	}
+	ch->pwm_value = value;
+	ch->written = now;
+	return 0;
+}
+
+/* The CPU load in %, since the previous call, from /proc/stat */
+static int cpu_load(struct feedforward *ff)
+{
+	char buf[512], *p, *end;
+	unsigned long long v, busy = 0, total = 0;
+	ssize_t n;
+	int i;
+
+	n = pread(ff->input.fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0 || strncmp(buf, "cpu ", 4))
+		return -1;
+	buf[n] = '\0';
+	/* user nice system idle iowait irq softirq steal */
+	for (p = buf + 4, i = 0; i < 8; i++, p = end) {
+		v = strtoull(p, &end, 10);
+		if (end == p)
+			break;
+		total += v;
+		if (i != 3 && i != 4)
+			busy += v;
+	}
+	if (ff->total && total > ff->total)
+		ff->load = 100.0 * (busy - ff->busy) / (total - ff->total);
+	ff->busy = busy;
+	ff->total = total;
+	return 0;
+}
+
+int read_feedforward(struct channel *ch, double *term)
+{
+	struct feedforward *ff = &ch->ff;
+	long value;
+
+	if (ff->cpu) {
+		if (cpu_load(ff))
+			goto error;
+		*term = ff->gain * (ff->load - ff->base);
+		return 0;
+	}
+	if (attr_read(&ff->input, &value))
+		goto error;
+	*term = ff->gain * (value - ff->base);
+	return 0;
+
+error:
+	fc_log(LOG_ERR, "Error reading feed-forward input from %s",
+	       ff->input.path);
+	return -1;
+}
+
+/*
+ * One step of the PID controller. The output is limited to the range
+ * MINSTOP..MAXPWM, in which the fan is known to spin; the integral term
+ * is frozen while the output is saturated (anti-windup), the derivative
+ * is taken on the temperature rather than on the error so that it does
+ * not kick when the setpoint is crossed, and low-pass filtered.
+ */
+static int pid_value(struct channel *ch, long temp, double now, int *value)
+{
+	struct pid *pid = &ch->pid;
+	double t = temp / 1000.0, lo = ch->min_stop, hi = ch->max_pwm;
+	double ff = 0, dt, e, integral, u, step;
+
+	if (ch->ff.input.fd >= 0 && read_feedforward(ch, &ff))
+		return -1;
+
+	e = t - pid->setpoint;
+	if (!pid->started) {
+		/* Start from the current output, without a bump */
+		pid->started = 1;
+		pid->last = now;
+		pid->prev_temp = t;
+		pid->output = ch->pwm_value;
+		if (pid->ki > 0)
+			pid->integral = ch->pwm_value - ff - pid->kp * e;
+	}
+
+	dt = now - pid->last;
+	if (dt > 0)
+		pid->deriv += dt / (pid->dfilter + dt) *
+			      ((t - pid->prev_temp) / dt - pid->deriv);
+
+	integral = pid->integral + pid->ki * e * dt;
+	u = ff + pid->kp * e + integral + pid->kd * pid->deriv;
+	if (!(u > hi && e > 0) && !(u < lo && e < 0))
+		pid->integral = integral;
+	u = ff + pid->kp * e + pid->integral + pid->kd * pid->deriv;
+
+	if (u < lo)
+		u = lo;
+	if (u > hi)
+		u = hi;
+	if (pid->slewrate > 0) {
+		step = pid->slewrate * dt;
+		if (u > pid->output + step)
+			u = pid->output + step;
+		if (u < pid->output - step)
+			u = pid->output - step;
+	}
+
+	if (debug)
+		fc_log(LOG_DEBUG, "%s: error=%.2f P=%.1f I=%.1f D=%.1f FF=%.1f "
+		       "output=%.1f", ch->pwm.path, e, pid->kp * e,
+		       pid->integral, pid->kd * pid->deriv, ff, u);
+
+	pid->output = u;
+	pid->last = now;
+	pid->prev_temp = t;
+	*value = u + 0.5;
+	return 0;
+}
+
+static int curve_lookup(const struct curve *curve, long temp)
+{
+	long i = (temp - curve->tmin + CURVE_STEP / 2) / CURVE_STEP;
+
+	if (temp <= curve->tmin)
+		return curve->table[0];
+	if (i >= curve->size)
+		return curve->table[curve->size - 1];
+	return curve->table[i];
+}
+
+/*
+ * The PWM value asked for by one input. With hysteresis, the fan speeds
+ * up along the rising curve and slows down along the falling one, and
+ * holds its speed in between.
+ */
+static int input_demand(struct input *in, long temp)
+{
+	int up = curve_lookup(&in->rising, temp), down;
+
+	if (!in->falling.table)
+		return in->demand = up;
+	down = curve_lookup(&in->falling, temp);
+	if (down < up) {
+		int tmp = up;
+
+		up = down;
+		down = tmp;
+	}
+	if (in->demand < up)
+		in->demand = up;
+	else if (in->demand > down)
+		in->demand = down;
+	return in->demand;
+}
+
+/* Combine the values of the inputs: the highest, or a weighted average */
+static long combine(const struct channel *ch, const long *values)
+{
+	double sum = 0, weights = 0;
+	long max = values[0];
+	int i;
+
+	if (ch->combine == COMBINE_MAX) {
+		for (i = 1; i < ch->num_temps; i++)
+			if (values[i] > max)
+				max = values[i];
+		return max;
+	}
+	for (i = 0; i < ch->num_temps; i++) {
+		sum += ch->temps[i].weight * values[i];
+		weights += ch->temps[i].weight;
+	}
+	return sum / weights + 0.5;
+}
+
+/* Read the inputs of a PWM output */
+static int sense_channel(struct channel *ch, double now, double slope)
+{
+	long temps[MAX_TEMPS], temp, fan;
+	int i;
+
+	for (i = 0; i < ch->num_temps; i++) {
+		if (attr_read(&ch->temps[i].attr, &ch->temps[i].value)) {
+			fc_log(LOG_ERR, "Error reading temperature from %s",
+			       ch->temps[i].attr.path);
+			return -1;
+		}
+		temps[i] = ch->temps[i].value;
+	}
+	temp = combine(ch, temps);
+
+	/* A fast change calls for the shortest period */
+	ch->busy = 0;
+	if (slope > 0 && ch->last_update > 0 && now > ch->last_update &&
+	    labs(temp - ch->temp) / 1000.0 >=
+	    slope * (now - ch->last_update)) {
+		fc_log(LOG_DEBUG, "%s: temperature changing fast",
+		       ch->pwm.path);
+		ch->busy = 1;
+	}
+	ch->temp = temp;
+	ch->last_update = now;
+
+	/* If fanspeed-sensor output shall be used, do it */
+	ch->min_fan = 1;
+	for (i = 0; i < ch->num_fans; i++) {
+		if (attr_read(&ch->fans[i], &fan)) {
+			fc_log(LOG_ERR, "Error reading Fan value from %s",
+			       ch->fans[i].path);
+			return -1;
+		}
+		ch->fan_state[i].value = fan;
+		/* Remember the minimum, it only matters if it is 0 */
+		if (!i || fan < ch->min_fan)
+			ch->min_fan = fan;
+	}
+
+	if (debug)
+		fc_log(LOG_DEBUG, "%s: temp=%ld pwm=%d fan=%ld", ch->pwm.path,
+		       temp, ch->pwm_value, ch->num_fans ? ch->min_fan : -1);
+	return 0;
+}
+
+/* Compute and write the new PWM value of an output */
+static int control_channel(struct channel *ch, double now)
+{
+	long demands[MAX_TEMPS], temp = ch->temp;
+	long mint = ch->min_temp * 1000L, maxt = ch->max_temp * 1000L;
+	int i, value, stopped;
+
+	/* a fan of the zone failed, the others take over */
+	if (ch->failover) {
+		ch->busy = 1;
+		return set_pwm(ch, ch->max_pwm, now);
+	}
+
+	/* still getting the fan to spin */
+	if (now < ch->spin_until) {
+		ch->busy = 1;
+		return 0;
+	}
+	/*
+	 * A fan reading 0 RPM while the output is on is only kicked once:
+	 * a dead fan or a broken tachometer would otherwise hold the other
+	 * fans of the output at MINSTART.
+	 */
+	if (ch->min_fan > 0)
+		ch->kicked = 0;
+	stopped = ch->pwm_value == 0 || (ch->min_fan == 0 && !ch->kicked);
+
+	if (ch->mode == MODE_CURVE) {
+		for (i = 0; i < ch->num_temps; i++)
+			demands[i] = input_demand(&ch->temps[i],
+						  ch->temps[i].value);
+		value = combine(ch, demands);
+		if (stopped && value > 0)
+			goto spinup;
+	} else if (ch->mode == MODE_PID ||
+		   (ch->mode == MODE_MPC && ch->mpc_value >= 0)) {
+		if (ch->mode == MODE_MPC)
+			value = ch->mpc_value;
+		else if (pid_value(ch, temp, now, &value))
+			return -1;
+		/* MINTEMP and MAXTEMP still apply, MAXTEMP as a safety */
+		if (temp >= maxt)
+			value = ch->max_pwm;
+		else if (temp <= mint && value <= ch->min_stop)
+			value = ch->min_pwm;
+		else if (stopped && value > 0)
+			goto spinup;
+	} else if (temp <= mint)
+		value = ch->min_pwm;
+	else if (temp >= maxt)
+		value = ch->max_pwm;
+	else {
+		value = (temp - mint) * (ch->max_pwm - ch->min_stop) /
+			(maxt - mint) + ch->min_stop;
+		if (stopped)
+			goto spinup;
+	}
+
+	/* see mpc.c, never outside of the range where the fan spins */
+	if (ch->mode == MODE_MPC && value >= ch->min_stop &&
+	    value < ch->max_pwm) {
+		value += ch->mpc_dither;
+		if (value < ch->min_stop)
+			value = ch->min_stop;
+		if (value > ch->max_pwm)
+			value = ch->max_pwm;
+	}
+
+	if (debug && value != ch->pwm_value)
+		fc_log(LOG_DEBUG, "%s: new pwmval=%d", ch->pwm.path, value);
+	return set_pwm(ch, value, now);
+
+spinup:
+	/* if fan was stopped start it using a safe value */
+	ch->spin_until = now + SPINUP_TIME;
+	ch->kicked = 1;
+	return set_pwm(ch, ch->min_start, now);
+}
+
+/*
+ * Run one control step on all PWM outputs. busy is set if any of them
+ * changed, or saw its temperature change faster than slope, so that the
+ * caller keeps the shortest period.
+ */
+int update_fan_speeds(struct config *config, int *busy)
+{
+	double now = fc_now();
+	int i;
+
+	*busy = 0;
+	for (i = 0; i < config->num_channels; i++)
+		if (sense_channel(&config->channels[i], now, config->slope))
+			return -1;
+	check_fans(config, now);
+	/* all the MPC outputs are chosen at once */
+	if (config->mpc.num_zones && mpc_update(config, now))
+		return -1;
+	for (i = 0; i < config->num_channels; i++) {
+		if (control_channel(&config->channels[i], now))
+			return -1;
+		if (config->channels[i].busy)
+			*busy = 1;
+	}
+	return 0;
+}
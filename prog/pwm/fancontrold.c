@@ -0,0 +1,402 @@
+/*
+    fancontrold.c - Part of fancontrold, a daemon for temperature dependent
+                    fan speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * A native replacement for the fancontrol script: same configuration
+ * file, same control law, but every sysfs file is opened once and the
+ * loop runs at any period, down to a fraction of a second, without
+ * spawning a single process.
+ *
+ * The loop runs every INTERVAL seconds, and up to MAXINTERVAL when
+ * nothing moves. It also wakes up as soon as the driver signals a change
+ * of one of the alarm attributes of the inputs.
+ *
+ * On exit, and on a crash, the fans are handed back to the hardware or
+ * set to full speed, as fancontrol does.
+ */
+
+/* for ppoll() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fancontrold.h"
+#include "version.h"
+
+#define PROGRAM			"fancontrold"
+#define VERSION			LM_VERSION
+#define DEFAULT_CONFIG		"/etc/fancontrol"
+#define DEFAULT_PIDFILE		"/var/run/fancontrol.pid"
+
+/* long options without a short one */
+enum {
+	OPT_DUMP_TELEMETRY = 256,
+};
+
+int debug;
+static int use_syslog;
+static const char *pidfile = DEFAULT_PIDFILE;
+static struct config config;
+static volatile sig_atomic_t stop_signal;
+/* the signal mask to wait with, the stop signals are blocked otherwise */
+static sigset_t wait_mask;
+
+void fc_log(int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (priority == LOG_DEBUG && !debug)
+		return;
+	va_start(ap, fmt);
+	if (use_syslog) {
+		vsyslog(priority, fmt, ap);
+	} else {
+		vfprintf(priority <= LOG_WARNING ? stderr : stdout, fmt, ap);
+		fputc('\n', priority <= LOG_WARNING ? stderr : stdout);
+		fflush(stdout);
+	}
+	va_end(ap);
+}
+
+double fc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Async-signal-safe */
+static int restore_fans(int quiet)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < config.num_channels; i++)
+		if (config.channels[i].pwm.fd >= 0 &&
+		    pwm_disable(&config.channels[i], quiet))
+			ret = -1;
+	return ret;
+}
+
+static void stop_handler(int sig)
+{
+	stop_signal = sig;
+}
+
+/* Never leave the fans at a low speed behind */
+static void crash_handler(int sig)
+{
+	static const char msg[] = PROGRAM ": crashed, restoring fans\n";
+
+	if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+		/* nothing to do about it */
+	}
+	restore_fans(1);
+	unlink(pidfile);
+	/* the default action, now that the handler is reset */
+	raise(sig);
+}
+
+static void install_handlers(void)
+{
+	static const int stop_signals[] = {
+		SIGQUIT, SIGTERM, SIGHUP, SIGINT
+	};
+	static const int crash_signals[] = {
+		SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT
+	};
+	struct sigaction sa;
+	sigset_t block;
+	unsigned int i;
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sigemptyset(&block);
+	/* interrupt the wait */
+	sa.sa_handler = stop_handler;
+	for (i = 0; i < sizeof(stop_signals) / sizeof(stop_signals[0]); i++) {
+		sigaction(stop_signals[i], &sa, NULL);
+		sigaddset(&block, stop_signals[i]);
+	}
+	/* only deliver them while waiting, so that none gets lost */
+	sigprocmask(SIG_BLOCK, &block, &wait_mask);
+
+	sa.sa_handler = crash_handler;
+	sa.sa_flags = SA_RESETHAND;
+	for (i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++)
+		sigaction(crash_signals[i], &sa, NULL);
+}
+
+static int write_pidfile(void)
+{
+	char buf[16];
+	int fd, len;
+
+	fd = open(pidfile, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		if (errno == EEXIST)
+			fc_log(LOG_ERR, "File %s exists, is fancontrol already "
+			       "running?", pidfile);
+		else
+			fc_log(LOG_ERR, "Error creating %s: %s", pidfile,
+			       strerror(errno));
+		return -1;
+	}
+	len = snprintf(buf, sizeof(buf), "%d\n", (int)getpid());
+	if (write(fd, buf, len) != len) {
+		fc_log(LOG_ERR, "Error writing %s", pidfile);
+		close(fd);
+		unlink(pidfile);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+/*
+ * Wait until deadline, a stop signal, or an alarm event. Returns 1 on an
+ * alarm event, 0 otherwise.
+ */
+static int wait_until(double deadline, struct pollfd *fds, int nfds)
+{
+	struct timespec ts;
+	double left;
+	long value;
+	int i, n;
+
+	while (!stop_signal) {
+		left = deadline - fc_now();
+		if (left <= 0)
+			return 0;
+		ts.tv_sec = left;
+		ts.tv_nsec = (left - ts.tv_sec) * 1e9;
+		n = ppoll(fds, nfds, &ts, &wait_mask);
+		if (n <= 0)
+			continue;
+
+		for (i = 0; i < nfds; i++) {
+			if (!(fds[i].revents & (POLLPRI | POLLERR)))
+				continue;
+			value = alarm_rearm(&config.alarms[i]);
+			if (value > 0)
+				fc_log(LOG_WARNING, "Alarm %s raised",
+				       config.alarms[i].path);
+			else
+				fc_log(LOG_DEBUG, "Alarm %s cleared",
+				       config.alarms[i].path);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static int run(void)
+{
+	struct pollfd fds[MAX_ALARMS];
+	double next, period, start;
+	unsigned long missed = 0;
+	int i, nfds, busy;
+
+	fc_log(LOG_INFO, "Enabling PWM on fans...");
+	for (i = 0; i < config.num_channels; i++) {
+		if (pwm_enable(&config.channels[i])) {
+			fc_log(LOG_ERR, "Error enabling PWM on %s",
+			       config.channels[i].pwm.path);
+			return 1;
+		}
+	}
+
+	/* the fds of the alarms that could not be opened are -1, ignored */
+	nfds = config.num_alarms;
+	for (i = 0; i < nfds; i++) {
+		fds[i].fd = config.alarms[i].fd;
+		fds[i].events = POLLPRI;
+	}
+
+	fc_log(LOG_INFO, "Starting automatic fan control...");
+	period = config.interval;
+	next = fc_now();
+	while (!stop_signal) {
+		start = fc_now();
+		if (update_fan_speeds(&config, &busy))
+			return 1;
+
+		/* back off while nothing moves */
+		if (busy)
+			period = config.interval;
+		else if (period < config.max_interval) {
+			period *= 2;
+			if (period > config.max_interval)
+				period = config.max_interval;
+		}
+		next += period;
+		/* do not try to catch up after a suspend */
+		if (next < fc_now()) {
+			next = fc_now() + period;
+			missed++;
+		}
+		telemetry_update(&config, fc_now() - start, missed);
+
+		if (wait_until(next, fds, nfds)) {
+			period = config.interval;
+			next = fc_now();
+		}
+	}
+	/* SIGQUIT and SIGTERM are a normal stop */
+	return stop_signal == SIGHUP || stop_signal == SIGINT;
+}
+
+static void print_short_help(void)
+{
+	printf("Try `%s -h' for more information\n", PROGRAM);
+}
+
+static void print_long_help(void)
+{
+	printf("Usage: %s [OPTION]... [CONFIGFILE]\n", PROGRAM);
+	puts("  -p, --pid-file FILE   PID file (default " DEFAULT_PIDFILE ")\n"
+	     "  -s, --syslog          Log to syslog instead of the terminal\n"
+	     "  -d, --debug           Log every reading and new PWM value\n"
+	     "  -t, --telemetry FILE  Keep the recent runs of the loop in FILE\n"
+	     "  -c, --csv FILE        Append every run of the loop to FILE\n"
+	     "      --dump-telemetry  Print the runs in the telemetry file\n"
+	     "  -h, --help            Display this help text\n"
+	     "  -v, --version         Display the program version\n"
+	     "\n"
+	     "The configuration file is the one of fancontrol(8), by default\n"
+	     DEFAULT_CONFIG ".");
+}
+
+static void print_version(void)
+{
+	printf("%s version %s\n", PROGRAM, VERSION);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *file = DEFAULT_CONFIG;
+	const char *telemetry = NULL, *csv = NULL;
+	int c, ret, dump = 0;
+	struct option long_opts[] = {
+		{ "pid-file", required_argument, NULL, 'p' },
+		{ "syslog", no_argument, NULL, 's' },
+		{ "debug", no_argument, NULL, 'd' },
+		{ "telemetry", required_argument, NULL, 't' },
+		{ "csv", required_argument, NULL, 'c' },
+		{ "dump-telemetry", no_argument, NULL, OPT_DUMP_TELEMETRY },
+		{ "help", no_argument, NULL, 'h' },
+		{ "version", no_argument, NULL, 'v' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "p:sdt:c:hv", long_opts,
+				NULL)) != -1) {
+		switch (c) {
+		case 'p':
+			pidfile = optarg;
+			break;
+		case 's':
+			use_syslog = 1;
+			break;
+		case 'd':
+			debug = 1;
+			break;
+		case 't':
+			telemetry = optarg;
+			break;
+		case 'c':
+			csv = optarg;
+			break;
+		case OPT_DUMP_TELEMETRY:
+			dump = 1;
+			break;
+		case 'h':
+			print_long_help();
+			exit(0);
+		case 'v':
+			print_version();
+			exit(0);
+		default:
+			print_short_help();
+			exit(1);
+		}
+	}
+	if (optind < argc - 1) {
+		print_short_help();
+		exit(1);
+	}
+	if (optind < argc)
+		file = argv[optind];
+
+	if (dump) {
+		if (!telemetry) {
+			fprintf(stderr, "Error: --dump-telemetry needs "
+				"--telemetry\n");
+			exit(1);
+		}
+		exit(telemetry_dump(telemetry) ? 1 : 0);
+	}
+
+	if (use_syslog)
+		openlog(PROGRAM, LOG_PID, LOG_DAEMON);
+
+	if (load_config(&config, file) || setup_files(&config) ||
+	    write_pidfile()) {
+		close_files(&config);
+		free_config(&config);
+		exit(1);
+	}
+	/* only now, not to replace the files of a daemon already running */
+	if (telemetry_init(&config, telemetry, csv)) {
+		unlink(pidfile);
+		telemetry_close();
+		close_files(&config);
+		free_config(&config);
+		exit(1);
+	}
+	install_handlers();
+
+	ret = run();
+
+	fc_log(LOG_INFO, "Aborting, restoring fans...");
+	if (restore_fans(0))
+		ret = 1;
+	fc_log(LOG_INFO, "Verify fans have returned to full speed");
+	unlink(pidfile);
+	telemetry_close();
+	close_files(&config);
+	free_config(&config);
+	if (use_syslog)
+		closelog();
+	return ret;
+}
@@ -0,0 +1,246 @@
+/*
+    fancontrold.h - Part of fancontrold, a daemon for temperature dependent
+                    fan speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+#ifndef PROG_PWM_FANCONTROLD_H
+#define PROG_PWM_FANCONTROLD_H
+
+#define MAX_CHANNELS		32
+#define MAX_FANS		8	/* per PWM output */
+#define MAX_TEMPS		8	/* per PWM output */
+#define MAX_ALARMS		64
+#define MAX_PWM			255
+
+/* A sysfs attribute, kept open for the life of the daemon */
+struct attr {
+	char *path;
+	int fd;			/* -1 if not open */
+};
+
+enum control_mode {
+	MODE_RAMP,		/* the linear law of fancontrol */
+	MODE_PID,
+	MODE_CURVE,
+	MODE_MPC,
+};
+
+enum combine {
+	COMBINE_MAX,		/* the hottest sensor, or highest demand */
+	COMBINE_WEIGHTED,	/* weighted average */
+};
+
+/*
+ * A piecewise-linear temperature to PWM curve, precomputed at load time:
+ * table[i] is the PWM value at temperature tmin + i * CURVE_STEP.
+ */
+#define CURVE_STEP		250	/* millidegrees */
+#define CURVE_MAX_SIZE		2048
+
+struct curve {
+	long tmin;		/* millidegrees */
+	int size;
+	unsigned char *table;	/* NULL if no curve */
+};
+
+/* A temperature input of a PWM output */
+struct input {
+	struct attr attr;
+	double weight;
+	struct curve rising, falling;	/* falling.table may be NULL */
+	int demand;		/* PWM value asked for by this input */
+	long value;		/* last reading */
+};
+
+struct pid {
+	/* settings */
+	double setpoint;	/* degrees C */
+	double kp, ki, kd;	/* PWM units per degree C, per second */
+	double dfilter;		/* derivative filter time constant, seconds */
+	double slewrate;	/* PWM units per second, 0 for no limit */
+
+	/* state */
+	int started;
+	double last;		/* time of the last update */
+	double integral;	/* PWM units */
+	double prev_temp;
+	double deriv;		/* filtered derivative, degrees C per second */
+	double output;		/* last output, before rounding */
+};
+
+/* Feed-forward term: gain * (input - base) */
+struct feedforward {
+	struct attr input;	/* fd is -1 if none */
+	int cpu;		/* input is the CPU load, in %, from /proc/stat */
+	double gain, base;
+
+	/* state, for the CPU load */
+	unsigned long long busy, total;
+	double load;
+};
+
+/*
+ * What is known about a fan: the RPM it reaches at each range of PWM
+ * values, learned while it works, and whether it is failing.
+ */
+#define FAN_BUCKETS		16
+#define FAN_BUCKET(pwm)		((pwm) * FAN_BUCKETS / (MAX_PWM + 1))
+
+struct fan_state {
+	long value;		/* last reading, RPM */
+	double rpm[FAN_BUCKETS];
+	int samples[FAN_BUCKETS];
+	int suspect;		/* consecutive bad readings */
+	int failed;
+};
+
+struct channel {
+	struct attr pwm;
+	struct attr enable;	/* fd is -1 if there is no enable file */
+	int num_temps;
+	struct input temps[MAX_TEMPS];
+	enum combine combine;
+	int num_fans;
+	struct attr fans[MAX_FANS];
+	struct fan_state fan_state[MAX_FANS];
+	int zone;		/* outputs cooling the same parts */
+
+	/* settings, temperatures in degrees C */
+	int min_temp, max_temp;
+	int min_start, min_stop;
+	int min_pwm, max_pwm;
+	enum control_mode mode;
+	struct pid pid;
+	struct feedforward ff;
+
+	/* state */
+	int pwm_value;		/* last value written */
+	double written;		/* when */
+	int prev_pwm;		/* before the last change of FAN_BUCKET */
+	double changed;		/* when */
+	int failover;		/* a fan of the zone failed, run at MAXPWM */
+	double spin_until;	/* holding min_start to get the fan spinning */
+	int kicked;		/* and no fan seen spinning since */
+	long temp;		/* combined temperature at the last update */
+	long min_fan;		/* slowest fan at the last update */
+	double last_update;	/* 0 before the first update */
+	int busy;		/* changed the PWM value, or fast change */
+	int mpc_value;		/* chosen by the MPC, -1 for the ramp */
+	int mpc_dither;		/* added to the value, to keep learning */
+};
+
+/*
+ * Model-predictive control of several PWM outputs (zones) at once. The
+ * temperature of every zone follows a linear model, in incremental form
+ * so that constant unmeasured heat sources do not bias it, learned
+ * online by recursive least squares:
+ *   dt(k+1) = a * dt(k) + sum(b_i * du_i(k)) + g * dp(k)
+ * with u_i the duty cycle of each MPC output (0 to 1) and p the power of
+ * the zone, from its feed-forward input if it has one.
+ */
+#define MPC_MAX_ZONES		8
+#define MPC_MAX_PARAMS		(MPC_MAX_ZONES + 2)
+
+struct zone_model {
+	int channel;		/* index in channels */
+	int num_params;		/* a, b_i and g if there is a power */
+	double theta[MPC_MAX_PARAMS];
+	double cov[MPC_MAX_PARAMS][MPC_MAX_PARAMS];
+	double prev_temp;	/* degrees C, at the previous step */
+	double prev_dtemp;	/* change over the step before */
+	double prev_power;
+	double prev_duty;	/* of this zone's output, at the previous step */
+	double dpower;		/* changes over the last step */
+	double dduty;
+};
+
+struct mpc {
+	double horizon;		/* seconds */
+	int num_zones;
+	struct zone_model zones[MPC_MAX_ZONES];
+	double last;		/* time of the previous step, 0 at first */
+	int samples;		/* model updates so far */
+	unsigned int seed;	/* of the dither */
+};
+
+struct config {
+	double interval;	/* seconds */
+	double max_interval;	/* longest period when stable */
+	double slope;		/* degrees C per second, 0 to ignore */
+	char *devpath;		/* unparsed DEVPATH and DEVNAME */
+	char *devname;
+	int num_channels;
+	struct channel channels[MAX_CHANNELS];
+
+	struct mpc mpc;
+
+	/* alarm attributes of the inputs, polled for immediate wakeups */
+	int num_alarms;
+	struct attr alarms[MAX_ALARMS];
+};
+
+/* from fancontrold.c, and pwmprobe.c */
+
+extern int debug;
+extern void fc_log(int priority, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+extern double fc_now(void);
+
+/* from config.c */
+
+extern int load_config(struct config *config, const char *file);
+extern void free_config(struct config *config);
+
+/* from sysfs.c */
+
+extern int device_path(const char *dev, char *buf, size_t size);
+extern void device_name(const char *dev, char *buf, size_t size);
+extern int setup_files(struct config *config);
+extern void close_files(struct config *config);
+extern int attr_read(const struct attr *attr, long *value);
+extern int attr_write(const struct attr *attr, long value);
+extern int pwm_enable(struct channel *ch);
+extern int pwm_disable(struct channel *ch, int quiet);
+extern int alarm_rearm(const struct attr *attr);
+
+/* from control.c */
+
+extern int read_feedforward(struct channel *ch, double *term);
+extern int update_fan_speeds(struct config *config, int *busy);
+
+/* from fanmon.c */
+
+extern void check_fans(struct config *config, double now);
+
+/* from telemetry.c */
+
+extern int telemetry_init(const struct config *config, const char *ring_file,
+			  const char *csv_file);
+extern void telemetry_update(const struct config *config, double loop_time,
+			     unsigned long missed);
+extern void telemetry_close(void);
+extern int telemetry_dump(const char *file);
+
+/* from mpc.c */
+
+extern void mpc_init(struct config *config);
+extern int mpc_update(struct config *config, double now);
+
+#endif /* PROG_PWM_FANCONTROLD_H */
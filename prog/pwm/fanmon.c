@@ -0,0 +1,147 @@
+/*
+    fanmon.c - Part of fancontrold, a daemon for temperature dependent fan
+               speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * Stalled and failing fan detection, on the fan speeds the control loop
+ * reads anyway.
+ *
+ * The speed every fan reaches is learned for each range of PWM values
+ * while the fan works. A fan that stops while driven at MINSTOP or more,
+ * or runs much slower than it used to at the same PWM value, for
+ * FAN_CONFIRM readings in a row, is reported as failed. All the outputs
+ * of its zone then run at MAXPWM, until it is back to the speed learned
+ * at that very range of PWM values.
+ *
+ * A fan speed is only compared with the PWM value it had time to
+ * settle to. Right after a change, it may still be anywhere between the
+ * speeds of the old and new values.
+ */
+
+#include <stdio.h>
+#include <syslog.h>
+
+#include "fancontrold.h"
+
+#define FAN_SETTLE_TIME		3.0	/* seconds */
+#define FAN_CONFIRM		2	/* bad readings in a row */
+#define FAN_LEARN_MIN		5	/* readings before a range is known */
+#define FAN_LEARN_RATE		0.1
+/* fractions of the learned speed */
+#define FAN_DEGRADED		0.6
+#define FAN_RECOVERED		0.8
+
+/*
+ * The speed expected at a PWM value, or 0 if unknown. Fans go faster
+ * with higher values, so the closest known range below will do.
+ */
+static double expected_rpm(const struct fan_state *st, int pwm)
+{
+	int b;
+
+	for (b = FAN_BUCKET(pwm); b >= 0; b--)
+		if (st->samples[b] >= FAN_LEARN_MIN)
+			return st->rpm[b];
+	return 0;
+}
+
+static void check_fan(struct channel *ch, int i, double now)
+{
+	struct fan_state *st = &ch->fan_state[i];
+	int settled = now - ch->changed >= FAN_SETTLE_TIME, bad, b;
+	double expected, prev;
+
+	/* the fan may be meant to stop, or be starting */
+	if (ch->pwm_value == 0 || ch->pwm_value < ch->min_stop ||
+	    now < ch->spin_until) {
+		st->suspect = 0;
+		return;
+	}
+
+	expected = expected_rpm(st, ch->pwm_value);
+	if (!settled) {
+		prev = expected_rpm(st, ch->prev_pwm);
+		if (prev < expected)
+			expected = prev;
+	}
+	bad = (settled && st->value == 0) ||
+	      st->value < FAN_DEGRADED * expected;
+
+	if (bad) {
+		if (++st->suspect >= FAN_CONFIRM && !st->failed) {
+			st->failed = 1;
+			fc_log(LOG_ALERT, "Fan %s %s (%ld RPM at PWM %d, "
+			       "expected %.0f), raising the fans of its zone",
+			       ch->fans[i].path, st->value ? "failing" :
+			       "stalled", st->value, ch->pwm_value, expected);
+		}
+		return;
+	}
+	st->suspect = 0;
+
+	if (st->failed) {
+		/*
+		 * At MAXPWM, a degraded fan could reach the speed of a lower
+		 * range, and the zone would flap in and out of failover:
+		 * only a speed learned at this range tells.
+		 */
+		if (!settled ||
+		    st->samples[FAN_BUCKET(ch->pwm_value)] < FAN_LEARN_MIN ||
+		    st->value < FAN_RECOVERED * expected)
+			return;
+		st->failed = 0;
+		fc_log(LOG_NOTICE, "Fan %s back to speed (%ld RPM)",
+		       ch->fans[i].path, st->value);
+	}
+
+	/* learn from a working fan */
+	if (settled && st->value > 0) {
+		b = FAN_BUCKET(ch->pwm_value);
+		if (st->samples[b]++)
+			st->rpm[b] += FAN_LEARN_RATE * (st->value - st->rpm[b]);
+		else
+			st->rpm[b] = st->value;
+	}
+}
+
+void check_fans(struct config *config, double now)
+{
+	struct channel *ch;
+	int failed[MAX_CHANNELS] = { 0 };
+	int i, j;
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		for (j = 0; j < ch->num_fans; j++) {
+			check_fan(ch, j, now);
+			if (ch->fan_state[j].failed)
+				failed[ch->zone] = 1;
+		}
+	}
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		if (ch->failover != failed[ch->zone] && !failed[ch->zone])
+			fc_log(LOG_NOTICE, "%s: back to normal control",
+			       ch->pwm.path);
+		ch->failover = failed[ch->zone];
+	}
+}
@@ -0,0 +1,377 @@
+/*
+    mpc.c - Part of fancontrold, a daemon for temperature dependent fan
+            speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * Model-predictive control of several fan zones whose airflows overlap.
+ *
+ * Every step, the model of each zone is updated with the temperature
+ * change it actually saw, then the duty cycles are chosen so that the
+ * temperatures predicted MPCHORIZON seconds ahead, for constant duty
+ * cycles, stay at or below the SETPOINT of each zone, with the lowest
+ * total duty. This is a linear program of at most MPC_MAX_ZONES
+ * variables, solved with a bounded number of dual simplex pivots.
+ *
+ * Until the models are trained and make sense (a stable zone that at
+ * least one fan cools), the outputs follow the fancontrol ramp. Either
+ * way, a small independent pseudo-random dither is added to every
+ * output: without it, the outputs move together or not at all, and the
+ * effect of each fan on each zone cannot be told apart.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "fancontrold.h"
+
+#define MPC_FORGET	0.995	/* forgetting factor of the least squares */
+#define MPC_COV_INIT	1000.0
+#define MPC_MAX_TRACE	1e5	/* stop forgetting beyond, against windup */
+#define MPC_WARMUP	50	/* model updates before the models are used */
+#define MPC_ITERATIONS	64	/* simplex pivots, greedy steps */
+#define MPC_DITHER	6	/* PWM units */
+
+void mpc_init(struct config *config)
+{
+	struct mpc *mpc = &config->mpc;
+	struct zone_model *zone;
+	struct channel *ch;
+	int z, i;
+
+	for (z = 0; z < mpc->num_zones; z++) {
+		zone = &mpc->zones[z];
+		ch = &config->channels[zone->channel];
+		ch->mpc_value = -1;
+		zone->num_params = 1 + mpc->num_zones +
+				   (ch->ff.input.path ? 1 : 0);
+		memset(zone->theta, 0, sizeof(zone->theta));
+		memset(zone->cov, 0, sizeof(zone->cov));
+		for (i = 0; i < zone->num_params; i++)
+			zone->cov[i][i] = MPC_COV_INIT;
+	}
+	mpc->last = 0;
+	mpc->samples = 0;
+	mpc->seed = 0x2545f491;
+}
+
+/* xorshift, plenty for a dither */
+static int dither(struct mpc *mpc)
+{
+	mpc->seed ^= mpc->seed << 13;
+	mpc->seed ^= mpc->seed >> 17;
+	mpc->seed ^= mpc->seed << 5;
+	return mpc->seed & 0x100 ? MPC_DITHER : -MPC_DITHER;
+}
+
+/*
+ * The regressor of the last step: the temperature change over the step
+ * before, and the changes of the duty cycles and power over the step
+ */
+static void regressor(const struct mpc *mpc, const struct zone_model *zone,
+		      double *phi)
+{
+	int i;
+
+	phi[0] = zone->prev_dtemp;
+	for (i = 0; i < mpc->num_zones; i++)
+		phi[1 + i] = mpc->zones[i].dduty;
+	if (zone->num_params > 1 + mpc->num_zones)
+		phi[1 + mpc->num_zones] = zone->dpower;
+}
+
+/* One step of recursive least squares with exponential forgetting */
+static void rls_update(struct zone_model *zone, const double *phi, double y)
+{
+	double pphi[MPC_MAX_PARAMS], den = MPC_FORGET, err = y, trace = 0;
+	double forget = MPC_FORGET;
+	int n = zone->num_params, i, j;
+
+	for (i = 0; i < n; i++) {
+		pphi[i] = 0;
+		for (j = 0; j < n; j++)
+			pphi[i] += zone->cov[i][j] * phi[j];
+		den += phi[i] * pphi[i];
+		err -= zone->theta[i] * phi[i];
+		trace += zone->cov[i][i];
+	}
+	/* without excitation, forgetting makes the covariance explode */
+	if (trace > MPC_MAX_TRACE)
+		forget = 1;
+
+	for (i = 0; i < n; i++)
+		zone->theta[i] += pphi[i] / den * err;
+	for (i = 0; i < n; i++)
+		for (j = 0; j <= i; j++) {
+			zone->cov[i][j] = (zone->cov[i][j] -
+					   pphi[i] * pphi[j] / den) / forget;
+			zone->cov[j][i] = zone->cov[i][j];
+		}
+}
+
+/*
+ * The temperature of the zone after steps steps, if the duty cycles are
+ * changed from their current values u to x and then held, is
+ * d + sum(e_i * x_i). Returns -1 if the model is not usable.
+ */
+static int predict(const struct mpc *mpc, const struct zone_model *zone,
+		   double steps, const double *u, double *d, double *e)
+{
+	double a = zone->theta[0], sum;
+	int i, cools = 0;
+
+	if (!(a >= 0 && a < 1))
+		return -1;
+	sum = (1 - pow(a, steps)) / (1 - a);
+	/* where the zone is heading anyway */
+	*d = zone->prev_temp + a * sum * zone->prev_dtemp;
+	for (i = 0; i < mpc->num_zones; i++) {
+		/* a fan that seems to heat the zone is noise */
+		e[i] = zone->theta[1 + i] < 0 ? sum * zone->theta[1 + i] : 0;
+		*d -= e[i] * u[i];
+		if (e[i] < 0)
+			cools = 1;
+	}
+	return cools ? 0 : -1;
+}
+
+/*
+ * Minimize sum(x) subject to d + e.x <= target and lo <= x <= hi, as
+ * y = x - lo: minimize sum(y) subject to -e.y >= d + e.lo - target and
+ * -y >= lo - hi. The slack basis is dual feasible (all costs are 1), so
+ * the dual simplex method applies directly. Returns -1 if the targets
+ * cannot all be met.
+ */
+static int solve_lp(int n, const double *d, double e[][MPC_MAX_ZONES],
+		    const double *target, const double *lo, const double *hi,
+		    double *x)
+{
+	/* 2n rows, n + 2n columns and the right-hand side */
+	double t[2 * MPC_MAX_ZONES][3 * MPC_MAX_ZONES + 1];
+	double cost[3 * MPC_MAX_ZONES], ratio, best, f;
+	int basis[2 * MPC_MAX_ZONES], rows = 2 * n, cols = 3 * n;
+	int iter, i, j, r, pr, pc;
+
+	memset(t, 0, sizeof(t));
+	for (j = 0; j < n; j++) {
+		/* -(-e.y) + s = -(d + e.lo - target) */
+		t[j][cols] = target[j] - d[j];
+		for (i = 0; i < n; i++) {
+			t[j][i] = e[j][i];
+			t[j][cols] -= e[j][i] * lo[i];
+		}
+		/* y - s = hi - lo */
+		t[n + j][j] = 1;
+		t[n + j][cols] = hi[j] - lo[j];
+	}
+	for (r = 0; r < rows; r++) {
+		t[r][n + r] = 1;
+		basis[r] = n + r;
+	}
+	for (j = 0; j < cols; j++)
+		cost[j] = j < n ? 1 : 0;
+
+	for (iter = 0; iter < MPC_ITERATIONS; iter++) {
+		/* leaving row: the most negative basic value */
+		pr = -1;
+		best = -1e-9;
+		for (r = 0; r < rows; r++)
+			if (t[r][cols] < best) {
+				best = t[r][cols];
+				pr = r;
+			}
+		if (pr < 0)
+			break;	/* optimal */
+
+		/* entering column: keep the reduced costs non-negative */
+		pc = -1;
+		best = 0;
+		for (j = 0; j < cols; j++) {
+			if (t[pr][j] >= -1e-9)
+				continue;
+			ratio = cost[j] / -t[pr][j];
+			if (pc < 0 || ratio < best) {
+				best = ratio;
+				pc = j;
+			}
+		}
+		if (pc < 0)
+			return -1;	/* infeasible */
+
+		f = t[pr][pc];
+		for (j = 0; j <= cols; j++)
+			t[pr][j] /= f;
+		for (r = 0; r < rows; r++) {
+			if (r == pr || !t[r][pc])
+				continue;
+			f = t[r][pc];
+			for (j = 0; j <= cols; j++)
+				t[r][j] -= f * t[pr][j];
+		}
+		f = cost[pc];
+		for (j = 0; j < cols; j++)
+			cost[j] -= f * t[pr][j];
+		basis[pr] = pc;
+	}
+	if (iter == MPC_ITERATIONS)
+		return -1;
+
+	for (i = 0; i < n; i++)
+		x[i] = lo[i];
+	for (r = 0; r < rows; r++)
+		if (basis[r] < n)
+			x[basis[r]] += t[r][cols];
+	return 0;
+}
+
+/*
+ * When the targets cannot all be met, raise the fans that help the
+ * violated zones the most, as far as needed or possible.
+ */
+static void solve_greedy(int n, const double *d, double e[][MPC_MAX_ZONES],
+			 const double *target, const double *lo,
+			 const double *hi, double *x)
+{
+	double slack[MPC_MAX_ZONES], score, best, step;
+	int iter, i, j, pick;
+
+	for (i = 0; i < n; i++)
+		x[i] = lo[i];
+
+	for (iter = 0; iter < MPC_ITERATIONS; iter++) {
+		for (j = 0; j < n; j++) {
+			slack[j] = target[j] - d[j];
+			for (i = 0; i < n; i++)
+				slack[j] -= e[j][i] * x[i];
+		}
+
+		pick = -1;
+		best = 0;
+		for (i = 0; i < n; i++) {
+			if (x[i] >= hi[i])
+				continue;
+			for (score = 0, j = 0; j < n; j++)
+				if (slack[j] < 0)
+					score -= e[j][i];
+			if (score > best) {
+				best = score;
+				pick = i;
+			}
+		}
+		if (pick < 0)
+			break;	/* nothing more can be done */
+
+		for (step = 0, j = 0; j < n; j++)
+			if (slack[j] < 0 && e[j][pick] < 0 &&
+			    slack[j] / e[j][pick] > step)
+				step = slack[j] / e[j][pick];
+		x[pick] += step;
+		if (x[pick] > hi[pick])
+			x[pick] = hi[pick];
+	}
+}
+
+int mpc_update(struct config *config, double now)
+{
+	struct mpc *mpc = &config->mpc;
+	struct zone_model *zone;
+	struct channel *ch;
+	double phi[MPC_MAX_PARAMS], power[MPC_MAX_ZONES], temp[MPC_MAX_ZONES];
+	double d[MPC_MAX_ZONES], e[MPC_MAX_ZONES][MPC_MAX_ZONES];
+	double target[MPC_MAX_ZONES], lo[MPC_MAX_ZONES], hi[MPC_MAX_ZONES];
+	double u[MPC_MAX_ZONES], x[MPC_MAX_ZONES], dt = now - mpc->last;
+	int n = mpc->num_zones, z, usable;
+
+	for (z = 0; z < n; z++) {
+		zone = &mpc->zones[z];
+		ch = &config->channels[zone->channel];
+		/* the model assumes a fixed period */
+		ch->busy = 1;
+		ch->mpc_dither = dither(mpc);
+		temp[z] = ch->temp / 1000.0;
+		/* what was applied during the last step */
+		u[z] = ch->pwm_value / (double)MAX_PWM;
+		power[z] = 0;
+		if (ch->ff.input.fd >= 0 && read_feedforward(ch, &power[z]))
+			return -1;
+	}
+
+	if (mpc->last > 0) {
+		for (z = 0; z < n; z++) {
+			zone = &mpc->zones[z];
+			zone->dduty = u[z] - zone->prev_duty;
+			zone->dpower = power[z] - zone->prev_power;
+		}
+		/*
+		 * Learn from the last step, unless the period was irregular
+		 * (an alarm, or a suspend)
+		 */
+		if (dt > config->interval / 2 && dt < config->interval * 1.5) {
+			for (z = 0; z < n; z++) {
+				zone = &mpc->zones[z];
+				regressor(mpc, zone, phi);
+				rls_update(zone, phi, temp[z] - zone->prev_temp);
+			}
+			mpc->samples++;
+		}
+		for (z = 0; z < n; z++)
+			mpc->zones[z].prev_dtemp = temp[z] -
+						   mpc->zones[z].prev_temp;
+	}
+	mpc->last = now;
+	for (z = 0; z < n; z++) {
+		zone = &mpc->zones[z];
+		zone->prev_temp = temp[z];
+		zone->prev_power = power[z];
+		zone->prev_duty = u[z];
+	}
+
+	usable = mpc->samples >= MPC_WARMUP;
+	for (z = 0; usable && z < n; z++) {
+		zone = &mpc->zones[z];
+		ch = &config->channels[zone->channel];
+		if (predict(mpc, zone, mpc->horizon / config->interval, u,
+			    &d[z], e[z]))
+			usable = 0;
+		target[z] = ch->pid.setpoint;
+		lo[z] = ch->min_stop / (double)MAX_PWM;
+		hi[z] = ch->max_pwm / (double)MAX_PWM;
+	}
+	if (!usable) {
+		for (z = 0; z < n; z++)
+			config->channels[mpc->zones[z].channel].mpc_value = -1;
+		return 0;
+	}
+
+	if (solve_lp(n, d, e, target, lo, hi, x)) {
+		fc_log(LOG_DEBUG, "MPC targets out of reach");
+		solve_greedy(n, d, e, target, lo, hi, x);
+	}
+	for (z = 0; z < n; z++) {
+		ch = &config->channels[mpc->zones[z].channel];
+		ch->mpc_value = x[z] * MAX_PWM + 0.5;
+		if (debug)
+			fc_log(LOG_DEBUG, "%s: a=%.3f duty %.2f", ch->pwm.path,
+			       mpc->zones[z].theta[0], x[z]);
+	}
+	return 0;
+}
@@ -0,0 +1,994 @@
+/*
+    pwmprobe.c - Part of fancontrold, a daemon for temperature dependent fan
+                 speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * A fast, non-interactive pwmconfig: finds the fans every PWM output
+ * drives, measures their PWM to RPM curves down to the value at which
+ * they stop, then the value they need to start again, and writes a
+ * configuration file for fancontrol and fancontrold.
+ *
+ * All the outputs are tested at once. Output number i (from 1) is
+ * stopped in every round whose bit is set in i, so log2(outputs + 1)
+ * rounds tell which output drives each fan, and the outputs are then
+ * ramped down together. Instead of sleeping a fixed time after every
+ * change, the fan inputs are read every PROBE_SAMPLE seconds until they
+ * have settled.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fancontrold.h"
+#include "version.h"
+
+#define PROGRAM			"pwmprobe"
+#define VERSION			LM_VERSION
+#define DEFAULT_ROOT		"/sys/class/hwmon"
+
+#define MAX_DEVICES		16
+#define MAX_INPUTS		64	/* fan inputs, all devices */
+#define MAX_POINTS		64	/* per curve */
+
+/* Settling of the fan speeds, in seconds */
+#define PROBE_SAMPLE		0.1
+#define SETTLE_MIN		1.0
+#define SETTLE_WINDOW		1.0	/* stable for that long */
+#define SETTLE_QUIET		2.5	/* if the speed did not move at all */
+#define SETTLE_TIMEOUT		5.0	/* the DELAY of pwmconfig */
+#define SETTLE_TOLERANCE	0.03
+#define SETTLE_NOISE		30	/* RPM */
+#define HISTORY			16	/* > SETTLE_WINDOW / PROBE_SAMPLE */
+
+/* The steps of pwmconfig, but coarser where fans hardly ever stop */
+#define STEP_COARSE		30
+#define STEP_COARSE_ABOVE	135
+#define STEP			15
+#define STEP2			2
+#define STEP2_BELOW		31
+#define START_STEP		10
+#define START_MARGIN		20
+
+/* pwmconfig defaults, for the settings which cannot be measured */
+#define DEFAULT_INTERVAL	10
+#define DEFAULT_MINTEMP		20
+#define DEFAULT_MAXTEMP		60
+
+struct device {
+	char *dir;		/* relative to the root, maybe with /device */
+	char *temp;		/* its first temperature input, or NULL */
+};
+
+enum phase {
+	PHASE_RAMP,		/* going down until a fan stops */
+	PHASE_START,		/* going up until it starts again */
+	PHASE_DONE,
+};
+
+struct output {
+	struct channel ch;	/* for pwm and enable */
+	int device;
+	int enabled;
+	int moved;		/* its fans must settle */
+	int num_fans;
+	enum phase phase;
+	int value;
+	int last;		/* the last value all its fans spun at */
+};
+
+struct fan {
+	struct attr input;
+	int device;
+	int output;		/* the output driving it, or -1 */
+	long full;		/* RPM at full speed, 0 if not working */
+	long rpm;		/* last reading */
+	/* settling */
+	long before;		/* the reading before the change */
+	long history[HISTORY];
+	int count;
+	int moved;
+	/* the curve, from MAX_PWM down */
+	int num_points;
+	unsigned char pwm[MAX_POINTS];
+	long rpms[MAX_POINTS];
+};
+
+int debug;
+static const char *root = DEFAULT_ROOT;
+static size_t root_len;
+static struct device devices[MAX_DEVICES];
+static int num_devices;
+static struct output outputs[MAX_CHANNELS];
+static int num_outputs;
+static struct fan fans[MAX_INPUTS];
+static int num_fans;
+static volatile sig_atomic_t stop_signal;
+
+void fc_log(int priority, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (priority == LOG_DEBUG && !debug)
+		return;
+	/* the configuration goes to stdout */
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	fputc('\n', stderr);
+	va_end(ap);
+}
+
+double fc_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Relative to the root, as in the configuration file */
+static const char *rel(const struct attr *attr)
+{
+	return attr->path + root_len + 1;
+}
+
+/* Async-signal-safe */
+static void restore_fans(int quiet)
+{
+	int i;
+
+	for (i = 0; i < num_outputs; i++)
+		if (outputs[i].enabled)
+			pwm_disable(&outputs[i].ch, quiet);
+}
+
+static void stop_handler(int sig)
+{
+	stop_signal = sig;
+}
+
+static void crash_handler(int sig)
+{
+	static const char msg[] = PROGRAM ": crashed, restoring fans\n";
+
+	if (write(STDERR_FILENO, msg, sizeof(msg) - 1) < 0) {
+		/* nothing to do about it */
+	}
+	restore_fans(1);
+	raise(sig);
+}
+
+static void install_handlers(void)
+{
+	static const int stop_signals[] = {
+		SIGQUIT, SIGTERM, SIGHUP, SIGINT
+	};
+	static const int crash_signals[] = {
+		SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT
+	};
+	struct sigaction sa;
+	unsigned int i;
+
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	/* no SA_RESTART, interrupt the sleeps */
+	sa.sa_handler = stop_handler;
+	for (i = 0; i < sizeof(stop_signals) / sizeof(stop_signals[0]); i++)
+		sigaction(stop_signals[i], &sa, NULL);
+
+	sa.sa_handler = crash_handler;
+	sa.sa_flags = SA_RESETHAND;
+	for (i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++)
+		sigaction(crash_signals[i], &sa, NULL);
+}
+
+static char *join(const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, name) >=
+	    (int)sizeof(path)) {
+		fc_log(LOG_ERR, "Path too long: %s/%s", dir, name);
+		return NULL;
+	}
+	return strdup(path);
+}
+
+/* Whether name is prefix, a number, then suffix */
+static int match(const char *name, const char *prefix, const char *suffix)
+{
+	size_t len = strlen(prefix), n;
+
+	if (strncmp(name, prefix, len))
+		return 0;
+	n = strspn(name + len, "0123456789");
+	return n && !strcmp(name + len + n, suffix);
+}
+
+static int add_output(int dev, const char *dir, const char *name)
+{
+	struct output *out;
+	char *enable;
+
+	if (num_outputs == MAX_CHANNELS) {
+		fc_log(LOG_WARNING, "Too many PWM outputs, ignoring %s/%s",
+		       dir, name);
+		return 0;
+	}
+	out = &outputs[num_outputs];
+	out->ch.pwm.path = join(dir, name);
+	out->ch.pwm.fd = -1;
+	out->ch.enable.fd = -1;
+	out->device = dev;
+	if (!out->ch.pwm.path)
+		return -1;
+	num_outputs++;
+
+	out->ch.pwm.fd = open(out->ch.pwm.path, O_RDWR | O_CLOEXEC);
+	if (out->ch.pwm.fd < 0) {
+		fc_log(LOG_WARNING, "Can't write to %s, skipping",
+		       rel(&out->ch.pwm));
+		return 0;
+	}
+	enable = malloc(strlen(out->ch.pwm.path) + 8);
+	if (!enable)
+		return -1;
+	sprintf(enable, "%s_enable", out->ch.pwm.path);
+	out->ch.enable.path = enable;
+	/* no enable file is fine, the output is then always on */
+	if (!access(enable, F_OK)) {
+		out->ch.enable.fd = open(enable, O_RDWR | O_CLOEXEC);
+		if (out->ch.enable.fd < 0) {
+			fc_log(LOG_WARNING, "Can't write to %s, skipping",
+			       rel(&out->ch.enable));
+			close(out->ch.pwm.fd);
+			out->ch.pwm.fd = -1;
+		}
+	}
+	return 0;
+}
+
+static int add_fan(int dev, const char *dir, const char *name)
+{
+	struct fan *fan;
+
+	if (num_fans == MAX_INPUTS) {
+		fc_log(LOG_WARNING, "Too many fan inputs, ignoring %s/%s",
+		       dir, name);
+		return 0;
+	}
+	fan = &fans[num_fans];
+	fan->input.path = join(dir, name);
+	if (!fan->input.path)
+		return -1;
+	fan->device = dev;
+	fan->output = -1;
+	fan->full = -1;
+	fan->input.fd = open(fan->input.path, O_RDONLY | O_CLOEXEC);
+	if (fan->input.fd < 0) {
+		fc_log(LOG_WARNING, "Can't read %s, skipping",
+		       rel(&fan->input));
+		free(fan->input.path);
+		return 0;
+	}
+	num_fans++;
+	return 0;
+}
+
+/* Find the outputs and fan inputs of a hwmon device */
+static int scan_device(const char *name)
+{
+	struct device *dev;
+	struct dirent **list;
+	char path[PATH_MAX];
+	const char *entry;
+	int i, n, ret = 0;
+
+	if (num_devices == MAX_DEVICES) {
+		fc_log(LOG_WARNING, "Too many devices, ignoring %s", name);
+		return 0;
+	}
+	dev = &devices[num_devices];
+
+	/* the attributes may still live in the hardware device */
+	snprintf(path, sizeof(path), "%s/%s/name", root, name);
+	snprintf(path, sizeof(path), access(path, R_OK) ? "%s/device" : "%s",
+		 name);
+	dev->dir = strdup(path);
+	if (!dev->dir)
+		return -1;
+	num_devices++;
+
+	snprintf(path, sizeof(path), "%s/%s", root, dev->dir);
+	n = scandir(path, &list, NULL, alphasort);
+	if (n < 0)
+		return 0;
+	for (i = 0; i < n; i++) {
+		entry = list[i]->d_name;
+		if (!ret && match(entry, "pwm", ""))
+			ret = add_output(num_devices - 1, path, entry);
+		else if (!ret && match(entry, "fan", "_input"))
+			ret = add_fan(num_devices - 1, path, entry);
+		else if (!ret && !dev->temp && match(entry, "temp", "_input")) {
+			dev->temp = join(dev->dir, entry);
+			if (!dev->temp)
+				ret = -1;
+		}
+		free(list[i]);
+	}
+	free(list);
+	return ret;
+}
+
+static int scan_devices(void)
+{
+	struct dirent **list;
+	int i, n, ret = 0;
+
+	n = scandir(root, &list, NULL, alphasort);
+	if (n < 0) {
+		fc_log(LOG_ERR, "No sensors found! (modprobe sensor "
+		       "modules?)");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (!ret && list[i]->d_name[0] != '.')
+			ret = scan_device(list[i]->d_name);
+		free(list[i]);
+	}
+	free(list);
+	if (ret)
+		return -1;
+
+	if (!num_outputs) {
+		fc_log(LOG_ERR, "There are no pwm-capable sensor modules "
+		       "installed");
+		return -1;
+	}
+	if (!num_fans) {
+		fc_log(LOG_ERR, "There are no fan-capable sensor modules "
+		       "installed");
+		return -1;
+	}
+	return 0;
+}
+
+static void free_devices(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++) {
+		free(devices[i].dir);
+		free(devices[i].temp);
+	}
+	for (i = 0; i < num_outputs; i++) {
+		if (outputs[i].ch.pwm.fd >= 0)
+			close(outputs[i].ch.pwm.fd);
+		if (outputs[i].ch.enable.fd >= 0)
+			close(outputs[i].ch.enable.fd);
+		free(outputs[i].ch.pwm.path);
+		free(outputs[i].ch.enable.path);
+	}
+	for (i = 0; i < num_fans; i++) {
+		close(fans[i].input.fd);
+		free(fans[i].input.path);
+	}
+}
+
+static void set_output(struct output *out, int value, int moved)
+{
+	out->value = value;
+	out->moved = moved;
+	if (attr_write(&out->ch.pwm, value))
+		fc_log(LOG_WARNING, "Error writing %s", rel(&out->ch.pwm));
+}
+
+static void sleep_for(double seconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec = seconds;
+	ts.tv_nsec = (seconds - ts.tv_sec) * 1e9;
+	nanosleep(&ts, NULL);
+}
+
+/*
+ * A fan has settled once its speed has not moved for SETTLE_WINDOW,
+ * after it moved at all: drivers only update their readings every
+ * second or two, so an unchanged reading may just be an old one.
+ */
+static int settled(const struct fan *fan, double elapsed)
+{
+	int n = SETTLE_WINDOW / PROBE_SAMPLE + 1, i;
+	long min, max, v;
+
+	if (elapsed < SETTLE_MIN || fan->count < n)
+		return 0;
+	if (!fan->moved && elapsed < SETTLE_QUIET)
+		return 0;
+	min = max = fan->rpm;
+	for (i = 1; i < n; i++) {
+		v = fan->history[(fan->count - 1 - i) % HISTORY];
+		if (v < min)
+			min = v;
+		if (v > max)
+			max = v;
+	}
+	return max - min <= SETTLE_NOISE || max - min <= SETTLE_TOLERANCE * max;
+}
+
+enum wait {
+	WAIT_ALL,		/* all the working fans */
+	WAIT_MOVED,		/* only those of the outputs which moved */
+	WAIT_DROPPED,		/* all, but a fan which dropped is done */
+};
+
+/* A fan driven by a stopped output, below 3/4 of its full speed */
+static int dropped(const struct fan *fan, long rpm)
+{
+	return rpm < 3 * fan->full / 4;
+}
+
+/*
+ * Read all the fans until the working ones have settled. Returns -1 if
+ * interrupted.
+ */
+static int wait_settled(enum wait what)
+{
+	double start = fc_now(), elapsed;
+	struct fan *fan;
+	int i, pending;
+
+	for (i = 0; i < num_fans; i++) {
+		fans[i].before = fans[i].rpm;
+		fans[i].count = 0;
+		fans[i].moved = 0;
+	}
+	do {
+		sleep_for(PROBE_SAMPLE);
+		if (stop_signal)
+			return -1;
+		elapsed = fc_now() - start;
+		pending = 0;
+		for (i = 0; i < num_fans; i++) {
+			fan = &fans[i];
+			/* a fan which can't be read is stopped */
+			if (attr_read(&fan->input, &fan->rpm) || fan->rpm < 0)
+				fan->rpm = 0;
+			fan->history[fan->count++ % HISTORY] = fan->rpm;
+			if (fan->rpm != fan->before)
+				fan->moved = 1;
+			if (fan->full == 0 || (what == WAIT_MOVED &&
+			    (fan->output < 0 || !outputs[fan->output].moved)))
+				continue;
+			/* no need to wait for it to stop completely */
+			if (what == WAIT_DROPPED && !dropped(fan, fan->before) &&
+			    dropped(fan, fan->rpm))
+				continue;
+			if (!settled(fan, elapsed))
+				pending++;
+		}
+	} while (pending && elapsed < SETTLE_TIMEOUT);
+	fc_log(LOG_DEBUG, "Settled in %.1f s%s", elapsed,
+	       pending ? " (timeout)" : "");
+	return 0;
+}
+
+static int enable_outputs(void)
+{
+	struct output *out;
+	int i, n = 0;
+
+	for (i = 0; i < num_outputs; i++) {
+		out = &outputs[i];
+		if (out->ch.pwm.fd < 0)
+			continue;
+		if (pwm_enable(&out->ch)) {
+			fc_log(LOG_WARNING, "Manual control mode not supported "
+			       "on %s, skipping", rel(&out->ch.pwm));
+			/* the enable file may have been written */
+			pwm_disable(&out->ch, 1);
+			continue;
+		}
+		out->enabled = 1;
+		out->value = MAX_PWM;
+		n++;
+	}
+	if (!n) {
+		fc_log(LOG_ERR, "There are no usable PWM outputs.");
+		return -1;
+	}
+
+	fc_log(LOG_INFO, "Giving the fans some time to reach full speed...");
+	if (wait_settled(WAIT_ALL))
+		return -1;
+	n = 0;
+	for (i = 0; i < num_fans; i++) {
+		fans[i].full = fans[i].rpm;
+		if (fans[i].full) {
+			fc_log(LOG_INFO, "   %s     current speed: %ld RPM",
+			       rel(&fans[i].input), fans[i].full);
+			n++;
+		} else {
+			fc_log(LOG_INFO, "   %s     current speed: 0 ... "
+			       "skipping!", rel(&fans[i].input));
+		}
+	}
+	if (!n) {
+		fc_log(LOG_ERR, "There are no working fan sensors, all "
+		       "readings are 0.");
+		return -1;
+	}
+	return 0;
+}
+
+/* Which output drives each fan, in log2(outputs + 1) rounds */
+static int identify(void)
+{
+	int code[MAX_INPUTS] = { 0 };
+	int bit, i, n = 0;
+
+	for (bit = 1; bit <= num_outputs; bit <<= 1) {
+		for (i = 0; i < num_outputs; i++)
+			if (outputs[i].enabled)
+				set_output(&outputs[i],
+					   (i + 1) & bit ? 0 : MAX_PWM, 1);
+		if (wait_settled(WAIT_DROPPED))
+			return -1;
+		for (i = 0; i < num_fans; i++)
+			if (fans[i].full > 0 && dropped(&fans[i], fans[i].rpm))
+				code[i] |= bit;
+	}
+
+	for (i = 0; i < num_outputs; i++)
+		if (outputs[i].enabled)
+			set_output(&outputs[i], MAX_PWM, 1);
+	if (wait_settled(WAIT_ALL))
+		return -1;
+
+	for (i = 0; i < num_fans; i++) {
+		if (!code[i])
+			continue;
+		if (code[i] > num_outputs || !outputs[code[i] - 1].enabled) {
+			fc_log(LOG_WARNING, "Fan %s does not follow any single "
+			       "PWM output, skipping", rel(&fans[i].input));
+			continue;
+		}
+		fans[i].output = code[i] - 1;
+		outputs[code[i] - 1].num_fans++;
+		fc_log(LOG_INFO, "It appears that fan %s is controlled by pwm "
+		       "%s", rel(&fans[i].input),
+		       rel(&outputs[code[i] - 1].ch.pwm));
+		if (dropped(&fans[i], fans[i].rpm))
+			fc_log(LOG_WARNING, "Fan %s has not returned to speed, "
+			       "please investigate!", rel(&fans[i].input));
+		n++;
+	}
+	if (!n) {
+		fc_log(LOG_ERR, "No correlations were detected.");
+		return -1;
+	}
+	return 0;
+}
+
+static void add_point(struct fan *fan, int pwm)
+{
+	if (fan->num_points == MAX_POINTS)
+		return;
+	fan->pwm[fan->num_points] = pwm;
+	fan->rpms[fan->num_points] = fan->rpm;
+	fan->num_points++;
+}
+
+static int step_down(int value)
+{
+	if (value > STEP_COARSE_ABOVE)
+		return value - STEP_COARSE > STEP_COARSE_ABOVE ?
+		       value - STEP_COARSE : STEP_COARSE_ABOVE;
+	if (value >= STEP2_BELOW)
+		return value - STEP;
+	return value > STEP2 ? value - STEP2 : 0;
+}
+
+/*
+ * One step of an output: record the speeds of its fans and pick its next
+ * value. Below MINSTOP, the first of its fans stops; at MINSTART, they
+ * all start again.
+ */
+static void step_output(int o)
+{
+	struct output *out = &outputs[o];
+	struct channel *ch = &out->ch;
+	int i, stopped = 0;
+
+	for (i = 0; i < num_fans; i++) {
+		if (fans[i].output != o)
+			continue;
+		if (out->phase == PHASE_RAMP)
+			add_point(&fans[i], out->value);
+		if (!fans[i].rpm)
+			stopped = 1;
+	}
+
+	if (out->phase == PHASE_RAMP) {
+		if (stopped) {
+			/* with the margin of pwmconfig in the finest steps */
+			ch->min_stop = out->last + (out->last < STEP2_BELOW ?
+						    STEP2 : 0);
+			out->phase = PHASE_START;
+			set_output(out, out->value > 240 ? MAX_PWM :
+				   out->value + START_STEP, 1);
+		} else if (out->value == 0) {
+			/* this one never stops */
+			ch->min_stop = ch->min_start = 0;
+			out->phase = PHASE_DONE;
+			set_output(out, MAX_PWM, 0);
+		} else {
+			out->last = out->value;
+			set_output(out, step_down(out->value), 1);
+		}
+		return;
+	}
+
+	/* PHASE_START */
+	if (stopped && out->value < MAX_PWM) {
+		set_output(out, out->value > 240 ? MAX_PWM :
+			   out->value + START_STEP, 1);
+		return;
+	}
+	/* the margin of pwmconfig */
+	ch->min_start = out->value + START_MARGIN;
+	if (stopped || ch->min_start > 240)
+		ch->min_start = MAX_PWM;
+	out->phase = PHASE_DONE;
+	set_output(out, MAX_PWM, 0);
+}
+
+/* Ramp all the outputs down together, then back up */
+static int characterize(void)
+{
+	struct output *out;
+	int i, pending;
+
+	for (i = 0; i < num_outputs; i++) {
+		out = &outputs[i];
+		out->phase = out->num_fans ? PHASE_RAMP : PHASE_DONE;
+		out->last = MAX_PWM;
+		out->moved = 0;
+	}
+
+	do {
+		/* MAX_PWM first, as left by identify() */
+		if (wait_settled(WAIT_MOVED))
+			return -1;
+		pending = 0;
+		for (i = 0; i < num_outputs; i++) {
+			out = &outputs[i];
+			out->moved = 0;
+			if (out->phase == PHASE_DONE)
+				continue;
+			step_output(i);
+			if (out->phase != PHASE_DONE)
+				pending++;
+		}
+		if (!pending)
+			break;
+		if (debug)
+			for (i = 0; i < num_outputs; i++)
+				if (outputs[i].moved)
+					fc_log(LOG_DEBUG, "%s -> %d",
+					       rel(&outputs[i].ch.pwm),
+					       outputs[i].value);
+	} while (1);
+	return 0;
+}
+
+/* The device with the temperature input guessed for dev, or -1 */
+static int temp_device(int dev)
+{
+	int i;
+
+	if (devices[dev].temp)
+		return dev;
+	for (i = 0; i < num_devices; i++)
+		if (devices[i].temp)
+			return i;
+	return -1;
+}
+
+/* DEVPATH or DEVNAME, for the devices referenced by the configuration */
+static void write_devices(FILE *f, const char *var, const int *used)
+{
+	char path[PATH_MAX], found[PATH_MAX];
+	const char *sep = "";
+	int i, len;
+
+	fprintf(f, "%s=", var);
+	for (i = 0; i < num_devices; i++) {
+		if (!used[i])
+			continue;
+		len = strcspn(devices[i].dir, "/");
+		snprintf(path, sizeof(path), "%s/%.*s", root, len,
+			 devices[i].dir);
+		if (!strcmp(var, "DEVPATH"))
+			device_path(path, found, sizeof(found));
+		else
+			device_name(path, found, sizeof(found));
+		fprintf(f, "%s%.*s=%s", sep, len, devices[i].dir, found);
+		sep = " ";
+	}
+	fputc('\n', f);
+}
+
+/* One of the per-output variables */
+static void write_var(FILE *f, const char *var)
+{
+	const struct output *out;
+	const char *sep = "";
+	int i, j, t, first;
+
+	fprintf(f, "%s=", var);
+	for (i = 0; i < num_outputs; i++) {
+		out = &outputs[i];
+		if (!out->num_fans)
+			continue;
+		t = temp_device(out->device);
+		if (!strcmp(var, "FCTEMPS") && t < 0)
+			continue;
+		fprintf(f, "%s%s=", sep, rel(&out->ch.pwm));
+		sep = " ";
+
+		if (!strcmp(var, "FCTEMPS")) {
+			fputs(devices[t].temp, f);
+		} else if (!strcmp(var, "FCFANS")) {
+			for (j = 0, first = 1; j < num_fans; j++) {
+				if (fans[j].output != i)
+					continue;
+				fprintf(f, "%s%s", first ? "" : "+",
+					rel(&fans[j].input));
+				first = 0;
+			}
+		} else if (!strcmp(var, "MINTEMP")) {
+			fprintf(f, "%d", DEFAULT_MINTEMP);
+		} else if (!strcmp(var, "MAXTEMP")) {
+			fprintf(f, "%d", DEFAULT_MAXTEMP);
+		} else if (!strcmp(var, "MINSTART")) {
+			fprintf(f, "%d", out->ch.min_start);
+		} else {
+			fprintf(f, "%d", out->ch.min_stop);
+		}
+	}
+	fputc('\n', f);
+}
+
+static void write_config(FILE *f)
+{
+	int used[MAX_DEVICES] = { 0 };
+	int i, t;
+
+	for (i = 0; i < num_outputs; i++) {
+		if (!outputs[i].num_fans)
+			continue;
+		used[outputs[i].device] = 1;
+		t = temp_device(outputs[i].device);
+		if (t >= 0)
+			used[t] = 1;
+	}
+	for (i = 0; i < num_fans; i++)
+		if (fans[i].output >= 0)
+			used[fans[i].device] = 1;
+
+	fprintf(f, "# Configuration file generated by %s\n", PROGRAM);
+	fprintf(f, "# FCTEMPS, MINTEMP and MAXTEMP are defaults, check them\n");
+	fprintf(f, "INTERVAL=%d\n", DEFAULT_INTERVAL);
+	write_devices(f, "DEVPATH", used);
+	write_devices(f, "DEVNAME", used);
+	write_var(f, "FCTEMPS");
+	write_var(f, "FCFANS");
+	write_var(f, "MINTEMP");
+	write_var(f, "MAXTEMP");
+	write_var(f, "MINSTART");
+	write_var(f, "MINSTOP");
+}
+
+/* One block per fan, as a gnuplot data file */
+static void write_curves(FILE *f)
+{
+	const struct fan *fan;
+	int i, j;
+
+	fprintf(f, "# PWM to RPM curves measured by %s\n", PROGRAM);
+	for (i = 0; i < num_fans; i++) {
+		fan = &fans[i];
+		if (fan->output < 0)
+			continue;
+		fprintf(f, "\n# %s %s\n", rel(&outputs[fan->output].ch.pwm),
+			rel(&fan->input));
+		for (j = 0; j < fan->num_points; j++)
+			fprintf(f, "%d %ld\n", fan->pwm[j], fan->rpms[j]);
+		fputc('\n', f);
+	}
+}
+
+static int write_file(const char *file, void (*fn)(FILE *f))
+{
+	FILE *f = stdout;
+
+	if (file && strcmp(file, "-")) {
+		f = fopen(file, "w");
+		if (!f) {
+			fc_log(LOG_ERR, "Error creating %s: %s", file,
+			       strerror(errno));
+			return -1;
+		}
+	}
+	fn(f);
+	if (ferror(f) || (f != stdout ? fclose(f) : fflush(f))) {
+		fc_log(LOG_ERR, "Error writing %s", file ? file : "output");
+		return -1;
+	}
+	return 0;
+}
+
+static void print_summary(void)
+{
+	const struct output *out;
+	int i;
+
+	for (i = 0; i < num_outputs; i++) {
+		out = &outputs[i];
+		if (out->enabled && !out->num_fans)
+			fc_log(LOG_INFO, "%s: no correlation",
+			       rel(&out->ch.pwm));
+		else if (out->num_fans)
+			fc_log(LOG_INFO, "%s: MINSTOP=%d MINSTART=%d",
+			       rel(&out->ch.pwm), out->ch.min_stop,
+			       out->ch.min_start);
+	}
+}
+
+static int confirm(void)
+{
+	char line[16];
+
+	fc_log(LOG_WARNING, "Warning!!! This program will stop your fans, "
+	       "possibly all of them at the same\ntime, for a few seconds "
+	       "each!!! This may cause your processor temperature to "
+	       "rise!!!\n"
+	       "If you do not want to do this hit control-C now!!!");
+	fprintf(stderr, "Hit return to continue: ");
+	return fgets(line, sizeof(line), stdin) ? 0 : -1;
+}
+
+static void print_short_help(void)
+{
+	printf("Try `%s -h' for more information\n", PROGRAM);
+}
+
+static void print_long_help(void)
+{
+	printf("Usage: %s [OPTION]...\n", PROGRAM);
+	puts("  -o, --output FILE     Write the configuration to FILE\n"
+	     "  -c, --curves FILE     Write the PWM to RPM curves to FILE\n"
+	     "  -r, --root DIR        Look for devices in DIR (default "
+	     DEFAULT_ROOT ")\n"
+	     "  -y, --yes             Do not ask for confirmation\n"
+	     "  -d, --debug           Log every step\n"
+	     "  -h, --help            Display this help text\n"
+	     "  -v, --version         Display the program version\n"
+	     "\n"
+	     "The configuration, for fancontrol(8), goes to the standard output\n"
+	     "by default.");
+}
+
+static void print_version(void)
+{
+	printf("%s version %s\n", PROGRAM, VERSION);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL, *curves = NULL;
+	int c, yes = 0, ret = 1;
+	double start;
+	struct option long_opts[] = {
+		{ "output", required_argument, NULL, 'o' },
+		{ "curves", required_argument, NULL, 'c' },
+		{ "root", required_argument, NULL, 'r' },
+		{ "yes", no_argument, NULL, 'y' },
+		{ "debug", no_argument, NULL, 'd' },
+		{ "help", no_argument, NULL, 'h' },
+		{ "version", no_argument, NULL, 'v' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while ((c = getopt_long(argc, argv, "o:c:r:ydhv", long_opts,
+				NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			curves = optarg;
+			break;
+		case 'r':
+			root = optarg;
+			break;
+		case 'y':
+			yes = 1;
+			break;
+		case 'd':
+			debug = 1;
+			break;
+		case 'h':
+			print_long_help();
+			exit(0);
+		case 'v':
+			print_version();
+			exit(0);
+		default:
+			print_short_help();
+			exit(1);
+		}
+	}
+	if (optind < argc) {
+		print_short_help();
+		exit(1);
+	}
+	root_len = strlen(root);
+
+	if (scan_devices() || (!yes && confirm()))
+		goto exit;
+	install_handlers();
+
+	start = fc_now();
+	if (!enable_outputs() && !identify() && !characterize())
+		ret = 0;
+	restore_fans(0);
+	if (stop_signal) {
+		fc_log(LOG_ERR, "Signal received, fans restored, aborting...");
+		goto exit;
+	}
+	if (ret)
+		goto exit;
+
+	fc_log(LOG_INFO, "Testing is complete in %.0f seconds.",
+	       fc_now() - start);
+	fc_log(LOG_INFO, "Please verify that all fans have returned to "
+	       "their normal speed.");
+	print_summary();
+	if (write_file(output, write_config) ||
+	    (curves && write_file(curves, write_curves)))
+		ret = 1;
+exit:
+	free_devices();
+	return ret;
+}
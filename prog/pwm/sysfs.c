@@ -0,0 +1,484 @@
+/*
+    sysfs.c - Part of fancontrold, a daemon for temperature dependent fan
+              speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * The sysfs side: checking that the configuration still matches the
+ * devices, then opening every attribute once. The control loop only
+ * does pread() and pwrite() on the open descriptors, and so does the
+ * failsafe restore, which may run from a signal handler: the functions
+ * it calls are async-signal-safe.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fancontrold.h"
+
+/* What pwmN must at least read back when restored to full speed */
+#define PWM_FULL_MIN	190
+
+/* Path to sensors, as found from the first PWM output */
+static const char *base_dir;
+
+static int join(char *buf, size_t size, const char *dir, const char *path)
+{
+	if (snprintf(buf, size, "%s/%s", dir, path) >= (int)size) {
+		fc_log(LOG_ERR, "Path too long: %s/%s", dir, path);
+		return -1;
+	}
+	return 0;
+}
+
+/* The device path of the hwmon device dev, relative to /sys */
+int device_path(const char *dev, char *buf, size_t size)
+{
+	char link[PATH_MAX], *real;
+	struct stat st;
+
+	buf[0] = '\0';
+	if (join(link, sizeof(link), dev, "device") ||
+	    lstat(link, &st) || !S_ISLNK(st.st_mode))
+		return 0;
+	real = realpath(link, NULL);
+	if (!real)
+		return 0;
+	snprintf(buf, size, "%s", strncmp(real, "/sys/", 5) ? real : real + 5);
+	free(real);
+	return 0;
+}
+
+/* The name of the hwmon device dev, as pwmconfig recorded it */
+void device_name(const char *dev, char *buf, size_t size)
+{
+	char path[PATH_MAX], *p;
+	FILE *f;
+
+	buf[0] = '\0';
+	if (join(path, sizeof(path), dev, "name"))
+		return;
+	f = fopen(path, "r");
+	if (!f) {
+		if (join(path, sizeof(path), dev, "device/name"))
+			return;
+		f = fopen(path, "r");
+	}
+	if (!f)
+		return;
+	if (!fgets(buf, size, f))
+		buf[0] = '\0';
+	fclose(f);
+
+	buf[strcspn(buf, "\n")] = '\0';
+	for (p = buf; *p; p++)
+		if (*p == ' ' || *p == '\t' || *p == '=')
+			*p = '_';
+}
+
+/*
+ * Call fn for every device=value entry of list. Returns the number of
+ * entries for which fn failed.
+ */
+static int foreach_entry(const char *list, const char *what,
+			 int (*fn)(const char *dev, const char *value,
+				   const char *what))
+{
+	char entry[PATH_MAX], *value;
+	const char *p = list;
+	size_t n;
+	int failed = 0;
+
+	while (p && *p) {
+		p += strspn(p, " \t");
+		n = strcspn(p, " \t");
+		if (!n)
+			break;
+		snprintf(entry, sizeof(entry), "%.*s", (int)n, p);
+		p += n;
+		value = strchr(entry, '=');
+		if (!value)
+			continue;
+		*value++ = '\0';
+		if (fn(entry, value, what))
+			failed++;
+	}
+	return failed;
+}
+
+static int check_device(const char *dev, const char *value, const char *what)
+{
+	char path[PATH_MAX], found[PATH_MAX];
+
+	if (join(path, sizeof(path), base_dir, dev))
+		return -1;
+	if (!strcmp(what, "path"))
+		device_path(path, found, sizeof(found));
+	else
+		device_name(path, found, sizeof(found));
+	if (strcmp(found, value)) {
+		fc_log(LOG_ERR, "Device %s of %s has changed", what, dev);
+		return -1;
+	}
+	return 0;
+}
+
+/* Replace the prefix dev/device/ of path by dev/ */
+static void fixup_path(struct attr *attr, const char *dev)
+{
+	size_t len = strlen(dev);
+
+	if (strncmp(attr->path, dev, len) || strncmp(attr->path + len,
+						     "/device/", 8))
+		return;
+	fc_log(LOG_INFO, "Adjusting %s -> %.*s%s", attr->path, (int)len,
+	       attr->path, attr->path + len + 7);
+	memmove(attr->path + len, attr->path + len + 7,
+		strlen(attr->path + len + 7) + 1);
+}
+
+static struct config *fixup_config;
+
+/* Some drivers moved their attributes from hard device to class device */
+static int fixup_device(const char *dev, const char *value, const char *what)
+{
+	char path[PATH_MAX], name[PATH_MAX];
+	struct channel *ch;
+	int i, j;
+
+	(void)value;
+	(void)what;
+	if (join(path, sizeof(path), base_dir, dev) ||
+	    join(name, sizeof(name), path, "name") || access(name, F_OK))
+		return 0;
+
+	for (i = 0; i < fixup_config->num_channels; i++) {
+		ch = &fixup_config->channels[i];
+		fixup_path(&ch->pwm, dev);
+		for (j = 0; j < ch->num_temps; j++)
+			fixup_path(&ch->temps[j].attr, dev);
+		if (ch->ff.input.path)
+			fixup_path(&ch->ff.input, dev);
+		for (j = 0; j < ch->num_fans; j++)
+			fixup_path(&ch->fans[j], dev);
+	}
+	return 0;
+}
+
+static int open_attr(struct attr *attr, int flags, const char *what)
+{
+	char path[PATH_MAX];
+	char *full;
+
+	if (attr->path[0] != '/') {
+		if (join(path, sizeof(path), base_dir, attr->path))
+			return -1;
+		full = strdup(path);
+		if (!full) {
+			fc_log(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		free(attr->path);
+		attr->path = full;
+	}
+	attr->fd = open(attr->path, flags | O_CLOEXEC);
+	if (attr->fd < 0) {
+		fc_log(LOG_ERR, "Error: %s file %s: %s", what, attr->path,
+		       strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Open the alarm attributes of an input, if the driver has any: for
+ * temp1_input, temp1_alarm, temp1_max_alarm and so on. Drivers call
+ * sysfs_notify() when these change, which wakes up poll().
+ */
+static int open_alarms(struct config *config, const char *input)
+{
+	static const char *suffixes[] = {
+		"_alarm", "_min_alarm", "_max_alarm", "_crit_alarm",
+		"_emergency_alarm", "_fault",
+	};
+	char path[PATH_MAX];
+	struct attr *attr;
+	size_t len = strlen(input);
+	unsigned int i;
+	int j;
+
+	if (len < 6 || strcmp(input + len - 6, "_input"))
+		return 0;
+	len -= 6;
+	for (i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		snprintf(path, sizeof(path), "%.*s%s", (int)len, input,
+			 suffixes[i]);
+		if (access(path, R_OK))
+			continue;
+		/* An input may be shared by several PWM outputs */
+		for (j = 0; j < config->num_alarms; j++)
+			if (!strcmp(config->alarms[j].path, path))
+				break;
+		if (j < config->num_alarms)
+			continue;
+		if (config->num_alarms == MAX_ALARMS) {
+			fc_log(LOG_WARNING, "Too many alarms, not watching %s",
+			       path);
+			return 0;
+		}
+		attr = &config->alarms[config->num_alarms];
+		attr->path = strdup(path);
+		if (!attr->path) {
+			fc_log(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		config->num_alarms++;
+		attr->fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (attr->fd < 0) {
+			fc_log(LOG_WARNING, "Can't open %s: %s", path,
+			       strerror(errno));
+			continue;
+		}
+		alarm_rearm(attr);
+	}
+	return 0;
+}
+
+/*
+ * Find the path to sensors, check that the configuration is up to date
+ * and open all the referenced files.
+ */
+int setup_files(struct config *config)
+{
+	const char *first = config->channels[0].pwm.path;
+	char enable[PATH_MAX];
+	struct channel *ch;
+	struct stat st;
+	int i, j, outdated = 0;
+
+	if (first[0] == '/')
+		base_dir = "/";
+	else if (!strncmp(first, "hwmon", 5) && first[5] >= '0' &&
+		 first[5] <= '9')
+		base_dir = "/sys/class/hwmon";
+	else if (strspn(first, "0123456789") && strchr(first, '-') &&
+		 strspn(strchr(first, '-') + 1, "0123456789abcdef") >= 4)
+		base_dir = "/sys/bus/i2c/devices";
+	else {
+		fc_log(LOG_ERR, "Invalid path to sensors");
+		return -1;
+	}
+	if (stat(base_dir, &st) || !S_ISDIR(st.st_mode)) {
+		fc_log(LOG_ERR, "No sensors found! (did you load the necessary "
+		       "modules?)");
+		return -1;
+	}
+
+	/* Check for configuration change */
+	if (strcmp(base_dir, "/") && (!config->devpath || !config->devname)) {
+		fc_log(LOG_ERR, "Configuration is too old, please run "
+		       "pwmconfig again");
+		return -1;
+	}
+	if (!strcmp(base_dir, "/") && config->devpath && *config->devpath) {
+		fc_log(LOG_ERR, "Unneeded DEVPATH with absolute device paths");
+		return -1;
+	}
+	if (foreach_entry(config->devpath, "path", check_device) +
+	    foreach_entry(config->devname, "name", check_device)) {
+		fc_log(LOG_ERR, "Configuration appears to be outdated, please "
+		       "run pwmconfig again");
+		return -1;
+	}
+	if (!strcmp(base_dir, "/sys/class/hwmon")) {
+		fixup_config = config;
+		foreach_entry(config->devpath, NULL, fixup_device);
+	}
+
+	/* Check that all referenced sysfs files exist, and open them */
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		if (open_attr(&ch->pwm, O_RDWR, "PWM output"))
+			outdated = 1;
+		for (j = 0; j < ch->num_temps; j++)
+			if (open_attr(&ch->temps[j].attr, O_RDONLY,
+				      "temperature input"))
+				outdated = 1;
+		for (j = 0; j < ch->num_fans; j++)
+			if (open_attr(&ch->fans[j], O_RDONLY, "fan input"))
+				outdated = 1;
+		if (ch->ff.input.path &&
+		    open_attr(&ch->ff.input, O_RDONLY, "feed-forward input"))
+			outdated = 1;
+		if (ch->pwm.fd < 0)
+			continue;
+
+		/* No enable file is fine, the output is then always on */
+		snprintf(enable, sizeof(enable), "%s_enable", ch->pwm.path);
+		ch->enable.path = strdup(enable);
+		if (!ch->enable.path) {
+			fc_log(LOG_ERR, "Out of memory");
+			return -1;
+		}
+		if (access(enable, F_OK))
+			continue;
+		if (open_attr(&ch->enable, O_RDWR, "PWM enable"))
+			outdated = 1;
+	}
+	if (outdated) {
+		fc_log(LOG_ERR, "At least one referenced file is missing. "
+		       "Either some required kernel modules haven't been "
+		       "loaded, or your configuration file is outdated. In "
+		       "the latter case, you should run pwmconfig again.");
+		return -1;
+	}
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		for (j = 0; j < ch->num_temps; j++)
+			if (open_alarms(config, ch->temps[j].attr.path))
+				return -1;
+		for (j = 0; j < ch->num_fans; j++)
+			if (open_alarms(config, ch->fans[j].path))
+				return -1;
+	}
+	if (config->num_alarms)
+		fc_log(LOG_INFO, "Watching %d alarm attributes",
+		       config->num_alarms);
+	return 0;
+}
+
+static void close_attr(struct attr *attr)
+{
+	if (attr->fd >= 0)
+		close(attr->fd);
+	attr->fd = -1;
+}
+
+void close_files(struct config *config)
+{
+	struct channel *ch;
+	int i, j;
+
+	for (i = 0; i < config->num_channels; i++) {
+		ch = &config->channels[i];
+		close_attr(&ch->pwm);
+		close_attr(&ch->enable);
+		for (j = 0; j < ch->num_temps; j++)
+			close_attr(&ch->temps[j].attr);
+		close_attr(&ch->ff.input);
+		for (j = 0; j < ch->num_fans; j++)
+			close_attr(&ch->fans[j]);
+	}
+	for (i = 0; i < config->num_alarms; i++)
+		close_attr(&config->alarms[i]);
+}
+
+/* Async-signal-safe, as are all the functions below */
+int attr_read(const struct attr *attr, long *value)
+{
+	char buf[32];
+	ssize_t n, i = 0;
+	int neg = 0;
+
+	n = pread(attr->fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	if (buf[0] == '-') {
+		neg = 1;
+		i++;
+	}
+	if (buf[i] < '0' || buf[i] > '9')
+		return -1;
+	for (*value = 0; buf[i] >= '0' && buf[i] <= '9'; i++)
+		*value = *value * 10 + buf[i] - '0';
+	if (neg)
+		*value = -*value;
+	return 0;
+}
+
+int attr_write(const struct attr *attr, long value)
+{
+	char buf[32], *p = buf + sizeof(buf);
+	unsigned long v = value < 0 ? -value : value;
+
+	*--p = '\n';
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	if (value < 0)
+		*--p = '-';
+	return pwrite(attr->fd, p, buf + sizeof(buf) - p, 0) < 0 ? -1 : 0;
+}
+
+/*
+ * sysfs only reports a new event to poll() once the attribute has been
+ * read since the previous one. Returns the value, or -1.
+ */
+int alarm_rearm(const struct attr *attr)
+{
+	long value;
+
+	return attr_read(attr, &value) ? -1 : value;
+}
+
+int pwm_enable(struct channel *ch)
+{
+	if (ch->enable.fd >= 0 && attr_write(&ch->enable, 1))
+		return -1;
+	ch->pwm_value = MAX_PWM;
+	return attr_write(&ch->pwm, MAX_PWM);
+}
+
+/* Hand the fan back to the hardware, or at least to full speed */
+int pwm_disable(struct channel *ch, int quiet)
+{
+	long enable = -1, pwm;
+
+	/* No enable file? Just set to max */
+	if (ch->enable.fd < 0)
+		return attr_write(&ch->pwm, MAX_PWM);
+
+	/* Try pwmN_enable=0 */
+	if (!attr_write(&ch->enable, 0) && !attr_read(&ch->enable, &enable) &&
+	    enable == 0)
+		return 0;
+
+	/* It didn't work, try pwmN_enable=1 pwmN=255 */
+	attr_write(&ch->enable, 1);
+	attr_write(&ch->pwm, MAX_PWM);
+	if (!attr_read(&ch->enable, &enable) && enable == 1 &&
+	    !attr_read(&ch->pwm, &pwm) && pwm >= PWM_FULL_MIN)
+		return 0;
+
+	/* Nothing worked */
+	if (!quiet)
+		fc_log(LOG_ERR, "%s stuck to %ld", ch->enable.path, enable);
+	return -1;
+}
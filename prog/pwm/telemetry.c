@@ -0,0 +1,363 @@
+/*
+    telemetry.c - Part of fancontrold, a daemon for temperature dependent
+                  fan speed control
+    Copyright 2003 Marius Reiner <marius.reiner@hdev.de>
+    Copyright (C) 2007-2014 Jean Delvare <jdelvare@suse.de>
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+    MA 02110-1301 USA.
+*/
+
+/*
+ * What the control loop does, run after run: for every output the
+ * setpoint, the temperature, the PWM value and the speed of the slowest
+ * fan, and for the loop its duration and the deadlines it missed.
+ *
+ * The runs go to a fixed-size memory-mapped ring file, in the layout of
+ * the history file of sensord: a header, the names of the outputs, then
+ * TELEMETRY_SLOTS slots. A slot is written with plain stores, its time
+ * stamp last and the run counter incremented after it, so that another
+ * process can map the file and read it at any time without locking,
+ * and the loop makes no system call for it. They can also be appended
+ * to a CSV file, through the stdio buffer.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fancontrold.h"
+
+#define TELEMETRY_MAGIC		"fanctlrg"
+#define TELEMETRY_VERSION	1
+#define TELEMETRY_SLOTS		4096
+#define TELEMETRY_NAME_LENGTH	64
+#define TELEMETRY_VALUES	4	/* per output */
+/* seconds between two flushes of the mapping and of the CSV file */
+#define TELEMETRY_FLUSH_TIME	10
+
+struct telemetry_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;	/* offset of the first slot */
+	uint32_t num_channels;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	uint32_t reserved;
+	uint64_t count;		/* runs written since creation */
+};
+
+struct telemetry_slot {
+	int64_t time;		/* microseconds since the epoch, 0 if unset */
+	double loop_time;	/* seconds */
+	uint64_t missed;	/* deadlines missed since startup */
+	/* setpoint, temperature (degrees C), PWM value, RPM per output */
+	double values[];
+};
+
+static const char *value_names[TELEMETRY_VALUES] = {
+	"setpoint", "temp", "pwm", "rpm",
+};
+
+static struct telemetry_header *header;
+static size_t map_size;
+static FILE *csv;
+static double last_flush;
+
+static size_t header_size(uint32_t count)
+{
+	size_t size = sizeof(struct telemetry_header) +
+		count * TELEMETRY_NAME_LENGTH;
+
+	/* keep the slots aligned */
+	return (size + 7) & ~(size_t)7;
+}
+
+static size_t slot_size(uint32_t count)
+{
+	return sizeof(struct telemetry_slot) +
+		count * TELEMETRY_VALUES * sizeof(double);
+}
+
+static char *channel_name(struct telemetry_header *h, uint32_t i)
+{
+	return (char *)(h + 1) + i * TELEMETRY_NAME_LENGTH;
+}
+
+static struct telemetry_slot *slot(struct telemetry_header *h, uint64_t n)
+{
+	return (struct telemetry_slot *)((char *)h + h->header_size +
+					 (n % h->num_slots) * h->slot_size);
+}
+
+static int valid(const struct telemetry_header *h, size_t size)
+{
+	if (size < sizeof(struct telemetry_header) ||
+	    memcmp(h->magic, TELEMETRY_MAGIC, sizeof(h->magic)) ||
+	    h->version != TELEMETRY_VERSION || !h->num_slots ||
+	    h->num_channels > MAX_CHANNELS ||
+	    h->header_size != header_size(h->num_channels) ||
+	    h->slot_size != slot_size(h->num_channels))
+		return 0;
+	return size >= h->header_size + (size_t)h->num_slots * h->slot_size;
+}
+
+static void *map(const char *path, int writable, size_t *size)
+{
+	struct stat sb;
+	void *addr;
+	int fd;
+
+	fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &sb)) {
+		close(fd);
+		return NULL;
+	}
+	addr = mmap(NULL, sb.st_size, PROT_READ | (writable ? PROT_WRITE : 0),
+		    MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return NULL;
+	*size = sb.st_size;
+	return addr;
+}
+
+/* A new ring for the outputs of config, switched in atomically */
+static int create_ring(const struct config *config, const char *file)
+{
+	uint32_t n = config->num_channels, i;
+	size_t size = header_size(n) + TELEMETRY_SLOTS * slot_size(n);
+	char *tmp;
+	int fd, ret = -1;
+
+	tmp = malloc(strlen(file) + 5);
+	if (!tmp) {
+		fc_log(LOG_ERR, "Out of memory");
+		return -1;
+	}
+	sprintf(tmp, "%s.new", file);
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, size)) {
+		fc_log(LOG_ERR, "Error creating %s: %s", tmp, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		goto exit;
+	}
+	close(fd);
+	header = map(tmp, 1, &map_size);
+	if (!header) {
+		fc_log(LOG_ERR, "Error mapping %s: %s", tmp, strerror(errno));
+		goto exit;
+	}
+
+	header->version = TELEMETRY_VERSION;
+	header->header_size = header_size(n);
+	header->num_channels = n;
+	header->num_slots = TELEMETRY_SLOTS;
+	header->slot_size = slot_size(n);
+	for (i = 0; i < n; i++)
+		snprintf(channel_name(header, i), TELEMETRY_NAME_LENGTH, "%s",
+			 config->channels[i].pwm.path);
+	/* magic last, so that a half-initialized file is not valid */
+	memcpy(header->magic, TELEMETRY_MAGIC, sizeof(header->magic));
+
+	if (rename(tmp, file)) {
+		fc_log(LOG_ERR, "Error renaming %s: %s", tmp, strerror(errno));
+		munmap(header, map_size);
+		header = NULL;
+		unlink(tmp);
+		goto exit;
+	}
+	ret = 0;
+exit:
+	free(tmp);
+	return ret;
+}
+
+static void print_names(FILE *f, const char **names, uint32_t n)
+{
+	uint32_t i, j;
+
+	fprintf(f, "time,loop_ms,missed");
+	for (i = 0; i < n; i++)
+		for (j = 0; j < TELEMETRY_VALUES; j++)
+			fprintf(f, ",%s.%s", names[i], value_names[j]);
+	fputc('\n', f);
+}
+
+static void print_row(FILE *f, int64_t time, double loop_time,
+		      uint64_t missed, const double *values, uint32_t n)
+{
+	uint32_t i;
+
+	fprintf(f, "%lld.%06lld,%.3f,%llu", (long long)(time / 1000000),
+		(long long)(time % 1000000), loop_time * 1000,
+		(unsigned long long)missed);
+	for (i = 0; i < n * TELEMETRY_VALUES; i++) {
+		if (isnan(values[i]))
+			fputs(",U", f);
+		else
+			fprintf(f, ",%g", values[i]);
+	}
+	fputc('\n', f);
+}
+
+int telemetry_init(const struct config *config, const char *ring_file,
+		   const char *csv_file)
+{
+	const char *names[MAX_CHANNELS];
+	int i;
+
+	if (ring_file && create_ring(config, ring_file))
+		return -1;
+
+	if (csv_file) {
+		csv = fopen(csv_file, "ae");
+		if (!csv) {
+			fc_log(LOG_ERR, "Error opening %s: %s", csv_file,
+			       strerror(errno));
+			return -1;
+		}
+		/* a new file, or the outputs may have changed */
+		for (i = 0; i < config->num_channels; i++)
+			names[i] = config->channels[i].pwm.path;
+		print_names(csv, names, config->num_channels);
+	}
+	last_flush = fc_now();
+	return 0;
+}
+
+/* Record a run of the loop, which took loop_time seconds */
+void telemetry_update(const struct config *config, double loop_time,
+		      unsigned long missed)
+{
+	double values[MAX_CHANNELS * TELEMETRY_VALUES], *v;
+	const struct channel *ch;
+	struct telemetry_slot *dst;
+	struct timespec ts;
+	int64_t now;
+	int i, n = config->num_channels;
+
+	if (!header && !csv)
+		return;
+
+	for (i = 0; i < n; i++) {
+		ch = &config->channels[i];
+		v = values + i * TELEMETRY_VALUES;
+		v[0] = ch->mode == MODE_PID || ch->mode == MODE_MPC ?
+		       ch->pid.setpoint : NAN;
+		v[1] = ch->temp / 1000.0;
+		v[2] = ch->pwm_value;
+		v[3] = ch->num_fans ? ch->min_fan : NAN;
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	now = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+
+	if (header) {
+		dst = slot(header, header->count);
+		dst->time = 0;
+		__sync_synchronize();
+		dst->loop_time = loop_time;
+		dst->missed = missed;
+		memcpy(dst->values, values, n * TELEMETRY_VALUES *
+		       sizeof(double));
+		__sync_synchronize();
+		dst->time = now;
+		__sync_synchronize();
+		header->count++;
+	}
+	if (csv)
+		print_row(csv, now, loop_time, missed, values, n);
+
+	if (fc_now() - last_flush >= TELEMETRY_FLUSH_TIME) {
+		if (header && msync(header, map_size, MS_ASYNC))
+			fc_log(LOG_ERR, "Error flushing telemetry: %s",
+			       strerror(errno));
+		if (csv && fflush(csv))
+			fc_log(LOG_ERR, "Error writing telemetry: %s",
+			       strerror(errno));
+		last_flush = fc_now();
+	}
+}
+
+void telemetry_close(void)
+{
+	if (header) {
+		msync(header, map_size, MS_SYNC);
+		munmap(header, map_size);
+		header = NULL;
+	}
+	if (csv) {
+		fclose(csv);
+		csv = NULL;
+	}
+}
+
+/* Print the runs in a telemetry file as CSV, oldest first */
+int telemetry_dump(const char *file)
+{
+	struct telemetry_header *h;
+	const struct telemetry_slot *s;
+	const char *names[MAX_CHANNELS];
+	uint64_t n, first, count;
+	uint32_t i;
+	size_t size;
+
+	h = map(file, 0, &size);
+	if (!h) {
+		fprintf(stderr, "Error opening telemetry file %s: %s\n", file,
+			strerror(errno));
+		return -1;
+	}
+	if (!valid(h, size)) {
+		fprintf(stderr, "Error: %s is not a valid telemetry file\n",
+			file);
+		munmap(h, size);
+		return -1;
+	}
+
+	count = h->count;
+	printf("# version %u, %u outputs, %u slots, %llu runs written\n",
+	       h->version, h->num_channels,
+	       h->num_slots, (unsigned long long)count);
+	for (i = 0; i < h->num_channels; i++)
+		names[i] = channel_name(h, i);
+	print_names(stdout, names, h->num_channels);
+	first = count > h->num_slots ?
+		count - h->num_slots : 0;
+	for (n = first; n < count; n++) {
+		s = slot(h, n);
+		/* never written, or being written right now */
+		if (!s->time)
+			continue;
+		print_row(stdout, s->time, s->loop_time, s->missed, s->values,
+			  h->num_channels);
+	}
+
+	munmap(h, size);
+	return 0;
+}
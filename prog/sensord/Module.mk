@@ -27,26 +27,61 @@ MODULE_DIR := prog/sensord
 PROGSENSORDDIR := $(MODULE_DIR)
 
 PROGSENSORDMAN8DIR := $(MANDIR)/man8
-PROGSENSORDMAN8FILES := $(MODULE_DIR)/sensord.8
+PROGSENSORDMAN8FILES := $(MODULE_DIR)/sensord.8 $(MODULE_DIR)/sensord-collector.8
 
 # Regrettably, even 'simply expanded variables' will not put their currently
 # defined value verbatim into the command-list of rules...
-PROGSENSORDTARGETS := $(MODULE_DIR)/sensord
-PROGSENSORDSOURCES := $(MODULE_DIR)/args.c $(MODULE_DIR)/chips.c $(MODULE_DIR)/lib.c $(MODULE_DIR)/rrd.c $(MODULE_DIR)/sense.c $(MODULE_DIR)/sensord.c
+PROGSENSORDTARGETS := $(MODULE_DIR)/sensord $(MODULE_DIR)/sensord-collector
+PROGSENSORDSOURCES := $(MODULE_DIR)/args.c $(MODULE_DIR)/chips.c $(MODULE_DIR)/lib.c $(MODULE_DIR)/rrd.c $(MODULE_DIR)/sense.c $(MODULE_DIR)/sensord.c \
+		      $(MODULE_DIR)/series.c $(MODULE_DIR)/ring.c \
+		      $(MODULE_DIR)/stats.c $(MODULE_DIR)/query.c \
+		      $(MODULE_DIR)/frame.c $(MODULE_DIR)/anomaly.c \
+		      $(MODULE_DIR)/host.c $(MODULE_DIR)/buffer.c
+PROGCOLLECTORSOURCES := $(MODULE_DIR)/collector.c $(MODULE_DIR)/frame.c \
+			$(MODULE_DIR)/buffer.c
+# Not installed: a throughput benchmark of the streaming protocol
+PROGFRAMEBENCH := $(MODULE_DIR)/frame-bench
+PROGFRAMEBENCHSOURCES := $(MODULE_DIR)/frame-bench.c $(MODULE_DIR)/frame.c
+# Not installed either: the end-to-end benchmark and soak test, which runs
+# sensord with sensord-soak.so preloaded against a synthetic hwmon tree
+PROGSOAK := $(MODULE_DIR)/sensord-soak
+PROGSOAKSOURCES := $(MODULE_DIR)/soak.c $(MODULE_DIR)/frame.c
+PROGSOAKPRELOAD := $(MODULE_DIR)/sensord-soak.so
 
 # Include all dependency files. We use '.rd' to indicate this will create
 # executables.
-INCLUDEFILES += $(PROGSENSORDSOURCES:.c=.rd)
+INCLUDEFILES += $(PROGSENSORDSOURCES:.c=.rd) $(MODULE_DIR)/collector.rd \
+		$(MODULE_DIR)/frame-bench.rd $(MODULE_DIR)/soak.rd \
+		$(MODULE_DIR)/soak-preload.ld
 
 REMOVESENSORDBIN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(SBINDIR)/%,$(PROGSENSORDTARGETS))
 REMOVESENSORDMAN := $(patsubst $(MODULE_DIR)/%,$(DESTDIR)$(PROGSENSORDMAN8DIR)/%,$(PROGSENSORDMAN8FILES))
 
-$(PROGSENSORDTARGETS): $(PROGSENSORDSOURCES:.c=.ro) lib/$(LIBSHBASENAME)
-	$(CC) $(EXLDFLAGS) -o $@ $(PROGSENSORDSOURCES:.c=.ro) -Llib -lsensors -lrrd
+$(MODULE_DIR)/sensord: $(PROGSENSORDSOURCES:.c=.ro) lib/$(LIBSHBASENAME)
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGSENSORDSOURCES:.c=.ro) -Llib -lsensors -lrrd -lm
+
+$(MODULE_DIR)/sensord-collector: $(PROGCOLLECTORSOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGCOLLECTORSOURCES:.c=.ro) -lm
+
+$(PROGFRAMEBENCH): $(PROGFRAMEBENCHSOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGFRAMEBENCHSOURCES:.c=.ro) -lm
+
+$(PROGSOAK): $(PROGSOAKSOURCES:.c=.ro)
+	$(CC) $(EXLDFLAGS) -o $@ $(PROGSOAKSOURCES:.c=.ro)
+
+$(PROGSOAKPRELOAD): $(MODULE_DIR)/soak-preload.lo
+	$(CC) -shared -o $@ $< -ldl
 
 all-prog-sensord: $(PROGSENSORDTARGETS)
 user :: all-prog-sensord
 
+# A minute with 200 chips; run sensord-soak directly for longer soaks
+bench-prog-sensord: all-prog-sensord $(PROGFRAMEBENCH) $(PROGSOAK) \
+		    $(PROGSOAKPRELOAD)
+	$(PROGFRAMEBENCH)
+	LD_LIBRARY_PATH=lib $(PROGSOAK) --duration 60
+bench :: bench-prog-sensord
+
 install-prog-sensord: all-prog-sensord
 	$(MKDIR) $(DESTDIR)$(SBINDIR) $(DESTDIR)$(PROGSENSORDMAN8DIR)
 	$(INSTALL) -m 755 $(PROGSENSORDTARGETS) $(DESTDIR)$(SBINDIR)
@@ -59,5 +94,7 @@ user_uninstall::
 
 clean-prog-sensord:
 	$(RM) $(PROGSENSORDDIR)/*.rd $(PROGSENSORDDIR)/*.ro 
-	$(RM) $(PROGSENSORDTARGETS)
+	$(RM) $(PROGSENSORDDIR)/*.ld $(PROGSENSORDDIR)/*.lo
+	$(RM) $(PROGSENSORDTARGETS) $(PROGFRAMEBENCH) $(PROGSOAK) \
+	      $(PROGSOAKPRELOAD)
 clean :: clean-prog-sensord
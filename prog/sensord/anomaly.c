@@ -0,0 +1,277 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Anomaly detection: alarms for values which are still within their
+ * limits but behave unlike they used to, such as a fan slowly losing
+ * speed to a worn bearing, or a CPU getting hotter relative to the inlet
+ * air as a filter clogs.
+ *
+ * Every series, and every configured residual (the difference of two
+ * series), keeps an exponentially weighted moving mean, variance and
+ * slope, updated in constant time and space per sample. A value more than
+ * --anomaly-z deviations off the mean, or a slope beyond an
+ * --anomaly-slope rule, raises an alert, logged like the chip alarms.
+ * It is cleared with hysteresis, at half the threshold.
+ */
+
+#include <fnmatch.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "args.h"
+#include "sensord.h"
+
+#define ALERT_Z 1
+#define ALERT_SLOPE 2
+
+typedef struct {
+	double mean, var;
+	double slope;		/* per hour */
+	double last;
+	time_t lastTime;	/* 0 before the first value */
+	int age;		/* seconds of history, up to the half-life */
+	int series1, series2;	/* of a residual, -1 otherwise */
+	double slopeLimit;	/* 0 if none */
+	double minDeviation;
+	int alert;
+} AnomalyStats;
+
+static AnomalyStats *stats;
+static int numStats;
+static unsigned int generation;
+
+/* below these, deviations are sensor resolution noise */
+static double minDeviation(const SeriesDescriptor *series)
+{
+	switch (series->type) {
+	case DataType_voltage:
+		return 0.01;
+	case DataType_rpm:
+		return 10;
+	case DataType_temperature:
+		return 0.5;
+	default:
+		return 0.05;
+	}
+}
+
+static int findSeries(const char *name)
+{
+	int i;
+
+	for (i = 0; i < numSeries; i++)
+		if (!strcmp(knownSeries[i].name, name))
+			return i;
+	sensorLog(LOG_ERR, "Unknown series in residual: %s", name);
+	return -1;
+}
+
+static double slopeLimit(const char *name, const char *label)
+{
+	const struct anomalySlope *slope;
+	int i;
+
+	for (i = 0; i < sensord_args.numAnomalySlopes; i++) {
+		slope = &sensord_args.anomalySlopes[i];
+		if (!fnmatch(slope->pattern, name, 0) ||
+		    (label && !fnmatch(slope->pattern, label, 0)))
+			return slope->rate;
+	}
+	return 0;
+}
+
+/* The series changed, start learning again */
+static int anomalySetup(void)
+{
+	const struct anomalyResidual *residual;
+	char name[2 * RAW_LABEL_LENGTH + 2];
+	AnomalyStats *s;
+	int i;
+
+	free(stats);
+	numStats = numSeries + sensord_args.numAnomalyResiduals;
+	stats = calloc(numStats + 1, sizeof(*stats));
+	if (!stats) {
+		numStats = 0;
+		return -1;
+	}
+
+	for (i = 0; i < numSeries; i++) {
+		s = &stats[i];
+		s->series1 = s->series2 = -1;
+		s->slopeLimit = slopeLimit(knownSeries[i].name,
+					   knownSeries[i].label);
+		s->minDeviation = minDeviation(&knownSeries[i]);
+	}
+	for (i = 0; i < sensord_args.numAnomalyResiduals; i++) {
+		residual = &sensord_args.anomalyResiduals[i];
+		s = &stats[numSeries + i];
+		s->series1 = findSeries(residual->name1);
+		s->series2 = findSeries(residual->name2);
+		if (s->series1 < 0 || s->series2 < 0) {
+			s->series1 = s->series2 = -1;
+			continue;
+		}
+		snprintf(name, sizeof(name), "%s-%s", residual->name1,
+			 residual->name2);
+		s->slopeLimit = slopeLimit(name, NULL);
+		s->minDeviation = minDeviation(&knownSeries[s->series1]);
+	}
+
+	generation = seriesGeneration;
+	return 0;
+}
+
+static void describe(const AnomalyStats *s, int index, char *buf,
+		     size_t size)
+{
+	const SeriesDescriptor *series;
+	char chip[256];
+
+	if (index < numSeries) {
+		series = &knownSeries[index];
+		if (series->chip &&
+		    sensors_snprintf_chip_name(chip, sizeof(chip),
+					       series->chip) >= 0)
+			snprintf(buf, size, "Chip %s: %s", chip,
+				 series->label);
+		else
+			snprintf(buf, size, "%s", series->label);
+	} else {
+		snprintf(buf, size, "%s - %s",
+			 knownSeries[s->series1].label,
+			 knownSeries[s->series2].label);
+	}
+}
+
+static void report(const AnomalyStats *s, int index, int alert,
+		   double value, double z)
+{
+	char what[512];
+
+	describe(s, index, what, sizeof(what));
+	if (alert & ~s->alert & ALERT_Z)
+		sensorLog(LOG_ALERT, "Sensor anomaly: %s: %.2f is %.1f "
+			  "deviations off %.2f", what, value, z, s->mean);
+	if (alert & ~s->alert & ALERT_SLOPE)
+		sensorLog(LOG_ALERT, "Sensor anomaly: %s: %.2f changing by "
+			  "%+.2f per hour", what, value, s->slope);
+	if (s->alert && !alert)
+		sensorLog(LOG_INFO, "Sensor anomaly cleared: %s: %.2f", what,
+			  value);
+}
+
+static void update(AnomalyStats *s, int index, double value, time_t now)
+{
+	double alpha, deviation, diff, z, limit;
+	int dt, alert;
+
+	if (isnan(value))
+		return;
+	if (!s->lastTime) {
+		s->mean = s->last = value;
+		s->lastTime = now;
+		return;
+	}
+	dt = now - s->lastTime;
+	if (dt <= 0)
+		return;
+
+	/* test against what was learned so far, then learn */
+	deviation = sqrt(s->var);
+	if (deviation < s->minDeviation)
+		deviation = s->minDeviation;
+	z = (value - s->mean) / deviation;
+
+	alpha = 1 - exp2(-(double)dt / sensord_args.anomalyHalfLife);
+	diff = value - s->mean;
+	s->mean += alpha * diff;
+	s->var = (1 - alpha) * (s->var + alpha * diff * diff);
+	s->slope += alpha * ((value - s->last) * 3600 / dt - s->slope);
+	s->last = value;
+	s->lastTime = now;
+	if (s->age < sensord_args.anomalyHalfLife) {
+		s->age += dt;
+		return;
+	}
+
+	alert = s->alert;
+	if (sensord_args.anomalyZ) {
+		if (fabs(z) >= sensord_args.anomalyZ)
+			alert |= ALERT_Z;
+		else if (fabs(z) < sensord_args.anomalyZ / 2)
+			alert &= ~ALERT_Z;
+	}
+	if (s->slopeLimit) {
+		/* the sign of the limit is the direction */
+		limit = s->slope / s->slopeLimit;
+		if (limit >= 1)
+			alert |= ALERT_SLOPE;
+		else if (limit < 0.5)
+			alert &= ~ALERT_SLOPE;
+	}
+	if (alert != s->alert) {
+		report(s, index, alert, value, z);
+		s->alert = alert;
+	}
+}
+
+int anomalyUpdate(void)
+{
+	AnomalyStats *s;
+	time_t now = time(NULL);
+	double value;
+	int i, ret;
+
+	ret = sampleSeries();
+	if (!stats || generation != seriesGeneration) {
+		if (anomalySetup())
+			return -1;
+	}
+
+	for (i = 0; i < numStats; i++) {
+		s = &stats[i];
+		if (i < numSeries)
+			value = knownSeries[i].value;
+		else if (s->series1 >= 0)
+			value = knownSeries[s->series1].value -
+				knownSeries[s->series2].value;
+		else
+			continue;
+		update(s, i, value, now);
+	}
+
+	return ret;
+}
+
+void anomalyClose(void)
+{
+	free(stats);
+	stats = NULL;
+	numStats = 0;
+}
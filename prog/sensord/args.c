@@ -37,6 +37,15 @@ struct sensord_arguments sensord_args = {
  	.scanTime = 60,
  	.logTime = 30 * 60,
  	.rrdTime = 5 * 60,
+	.historyTime = 10,
+	.historyLength = 60 * 60,
+	.statsTime = 60 * 60,
+	.graphTime = 5 * 60,
+	.graphUrl = "/sensord",
+	.queryAddress = "127.0.0.1",
+	.streamTime = 10,
+	.anomalyHalfLife = 60 * 60,
+	.anomalyZ = 4,
  	.syslogFacility = LOG_DAEMON,
 };
 
@@ -60,6 +69,90 @@ static int parseTime(char *arg)
 	return value;
 }
 
+/* pattern=rate */
+static int parseAnomalySlope(char *arg)
+{
+	struct anomalySlope *slope;
+	char *rate, *end;
+
+	if (sensord_args.numAnomalySlopes == MAX_ANOMALY_RULES) {
+		fprintf(stderr, "Too many slope rules.\n");
+		return -1;
+	}
+	slope = &sensord_args.anomalySlopes[sensord_args.numAnomalySlopes];
+
+	rate = strrchr(arg, '=');
+	if (!rate || rate == arg) {
+		fprintf(stderr, "Error parsing slope rule `%s'.\n", arg);
+		return -1;
+	}
+	slope->rate = strtod(rate + 1, &end);
+	if (end == rate + 1 || *end || !slope->rate) {
+		fprintf(stderr, "Error parsing slope rule `%s'.\n", arg);
+		return -1;
+	}
+	*rate = '\0';
+	slope->pattern = arg;
+	sensord_args.numAnomalySlopes++;
+	return 0;
+}
+
+/* name1-name2; raw series names never contain a dash */
+static int parseAnomalyResidual(char *arg)
+{
+	struct anomalyResidual *residual;
+	char *dash;
+
+	if (sensord_args.numAnomalyResiduals == MAX_ANOMALY_RULES) {
+		fprintf(stderr, "Too many residuals.\n");
+		return -1;
+	}
+	residual = sensord_args.anomalyResiduals +
+		sensord_args.numAnomalyResiduals;
+
+	dash = strchr(arg, '-');
+	if (!dash || dash == arg || !dash[1] || strchr(dash + 1, '-')) {
+		fprintf(stderr, "Error parsing residual `%s'.\n", arg);
+		return -1;
+	}
+	*dash = '\0';
+	residual->name1 = arg;
+	residual->name2 = dash + 1;
+	sensord_args.numAnomalyResiduals++;
+	return 0;
+}
+
+static struct {
+	const char *name;
+	int mask;
+} hostMetricNames[] = {
+	{ "load", HOST_LOAD },
+	{ "cpufreq", HOST_CPUFREQ },
+	{ "pressure", HOST_PRESSURE },
+	{ "thermal", HOST_THERMAL },
+	{ "all", HOST_LOAD | HOST_CPUFREQ | HOST_PRESSURE | HOST_THERMAL },
+	{ NULL, 0 }
+};
+
+static int parseHostMetrics(char *arg)
+{
+	char *name, *save;
+	int i;
+
+	for (name = strtok_r(arg, ",", &save); name;
+	     name = strtok_r(NULL, ",", &save)) {
+		for (i = 0; hostMetricNames[i].name; i++)
+			if (!strcmp(name, hostMetricNames[i].name))
+				break;
+		if (!hostMetricNames[i].name) {
+			fprintf(stderr, "Unknown host metric `%s'.\n", name);
+			return -1;
+		}
+		sensord_args.hostMetrics |= hostMetricNames[i].mask;
+	}
+	return 0;
+}
+
 static struct {
 	const char *name;
 	int id;
@@ -100,6 +193,27 @@ static const char *daemonSyntax =
 	"  -f, --syslog-facility <f> -- syslog facility to use (default local4)\n"
 	"  -g, --rrd-cgi <img-dir>   -- output an RRD CGI script and exit\n"
 	"  -a, --load-average        -- include load average in RRD file\n"
+	"      --host-metrics <list> -- also sample load,cpufreq,pressure,thermal or all\n"
+	"      --graph-dir <dir>     -- render the RRD graphs into this directory (default <none>)\n"
+	"      --graph-interval <time> -- interval between rendering graphs (default 5m)\n"
+	"      --static-cgi          -- output a CGI script showing the rendered graphs and exit\n"
+	"      --graph-url <url>     -- where the CGI scripts find the graphs (default /sensord)\n"
+	"  -H, --history-file <file> -- recent history file (default <none>)\n"
+	"      --history-interval <time> -- interval between history samples (default 10s)\n"
+	"      --history-length <time>   -- time span kept in history file (default 1h)\n"
+	"      --dump-history        -- print the history file and exit\n"
+	"      --stats-interval <time> -- interval between logging statistics (default 1h)\n"
+	"      --query-port <port>   -- answer history queries over HTTP on this port (default <none>)\n"
+	"      --query-address <ip>  -- address of the query endpoint (default 127.0.0.1)\n"
+	"      --stream-interval <time> -- interval between frames pushed to subscribers (default 10s)\n"
+	"      --anomaly-interval <time> -- interval between anomaly detection samples (default <none>)\n"
+	"      --anomaly-half-life <time> -- half-life of the running statistics (default 1h)\n"
+	"      --anomaly-z <z>       -- alert when a value is this many deviations off its mean (default 4)\n"
+	"      --anomaly-slope <pattern=rate> -- alert when series change faster than rate per hour\n"
+	"      --anomaly-residual <name1-name2> -- also watch the difference of two series\n"
+	"      --align               -- run periodic work on wall-clock multiples of its interval\n"
+	"      --slack <time>        -- run work due within this time early to save wakeups (default 0)\n"
+	"      --wakeup-file <file>  -- publish the time of the next wakeup (default <none>)\n"
 	"  -d, --debug               -- display some debug information\n"
 	"  -v, --version             -- display version and exit\n"
 	"  -h, --help                -- display help and exit\n"
@@ -114,9 +228,37 @@ static const char *daemonSyntax =
 	"If unspecified, no RRD (round robin database) is used. If specified and the\n"
 	"file does not exist, it will be created. For RRD updates to be successful,\n"
 	"the RRD file configuration must EXACTLY match the sensors that are used. If\n"
-	"your configuration changes, delete the old RRD file and restart sensord.\n";
+	"your configuration changes, delete the old RRD file and restart sensord.\n"
+	"\n"
+	"If specified, the history file keeps the most recent raw readings of all\n"
+	"sensors across restarts. It is converted automatically when the sensors or\n"
+	"the history parameters change.\n";
+
+static const char *shortOptions = "i:l:t:Tf:r:c:p:advhg:H:";
 
-static const char *shortOptions = "i:l:t:Tf:r:c:p:advhg:";
+/* long options without a short equivalent */
+enum {
+	OPT_HISTORY_INTERVAL = 256,
+	OPT_HISTORY_LENGTH,
+	OPT_DUMP_HISTORY,
+	OPT_STATS_INTERVAL,
+	OPT_ALIGN,
+	OPT_SLACK,
+	OPT_WAKEUP_FILE,
+	OPT_GRAPH_DIR,
+	OPT_GRAPH_INTERVAL,
+	OPT_STATIC_CGI,
+	OPT_GRAPH_URL,
+	OPT_QUERY_PORT,
+	OPT_QUERY_ADDRESS,
+	OPT_STREAM_INTERVAL,
+	OPT_HOST_METRICS,
+	OPT_ANOMALY_INTERVAL,
+	OPT_ANOMALY_HALF_LIFE,
+	OPT_ANOMALY_Z,
+	OPT_ANOMALY_SLOPE,
+	OPT_ANOMALY_RESIDUAL,
+};
 
 static const struct option longOptions[] = {
 	{ "interval", required_argument, NULL, 'i' },
@@ -129,6 +271,27 @@ static const struct option longOptions[] = {
 	{ "pid-file", required_argument, NULL, 'p' },
 	{ "rrd-cgi", required_argument, NULL, 'g' },
 	{ "load-average", no_argument, NULL, 'a' },
+	{ "host-metrics", required_argument, NULL, OPT_HOST_METRICS },
+	{ "graph-dir", required_argument, NULL, OPT_GRAPH_DIR },
+	{ "graph-interval", required_argument, NULL, OPT_GRAPH_INTERVAL },
+	{ "static-cgi", no_argument, NULL, OPT_STATIC_CGI },
+	{ "graph-url", required_argument, NULL, OPT_GRAPH_URL },
+	{ "history-file", required_argument, NULL, 'H' },
+	{ "history-interval", required_argument, NULL, OPT_HISTORY_INTERVAL },
+	{ "history-length", required_argument, NULL, OPT_HISTORY_LENGTH },
+	{ "dump-history", no_argument, NULL, OPT_DUMP_HISTORY },
+	{ "stats-interval", required_argument, NULL, OPT_STATS_INTERVAL },
+	{ "query-port", required_argument, NULL, OPT_QUERY_PORT },
+	{ "query-address", required_argument, NULL, OPT_QUERY_ADDRESS },
+	{ "stream-interval", required_argument, NULL, OPT_STREAM_INTERVAL },
+	{ "anomaly-interval", required_argument, NULL, OPT_ANOMALY_INTERVAL },
+	{ "anomaly-half-life", required_argument, NULL, OPT_ANOMALY_HALF_LIFE },
+	{ "anomaly-z", required_argument, NULL, OPT_ANOMALY_Z },
+	{ "anomaly-slope", required_argument, NULL, OPT_ANOMALY_SLOPE },
+	{ "anomaly-residual", required_argument, NULL, OPT_ANOMALY_RESIDUAL },
+	{ "align", no_argument, NULL, OPT_ALIGN },
+	{ "slack", required_argument, NULL, OPT_SLACK },
+	{ "wakeup-file", required_argument, NULL, OPT_WAKEUP_FILE },
 	{ "debug", no_argument, NULL, 'd' },
 	{ "version", no_argument, NULL, 'v' },
 	{ "help", no_argument, NULL, 'h' },
@@ -170,7 +333,11 @@ int parseArgs(int argc, char **argv)
 				return -1;
 			break;
 		case 'a':
-			sensord_args.doLoad = 1;
+			sensord_args.hostMetrics |= HOST_LOAD;
+			break;
+		case OPT_HOST_METRICS:
+			if (parseHostMetrics(optarg))
+				return -1;
 			break;
 		case 'c':
 			sensord_args.cfgFile = optarg;
@@ -181,6 +348,90 @@ int parseArgs(int argc, char **argv)
 		case 'r':
 			sensord_args.rrdFile = optarg;
 			break;
+		case OPT_GRAPH_DIR:
+			sensord_args.graphDir = optarg;
+			break;
+		case OPT_GRAPH_INTERVAL:
+			if ((sensord_args.graphTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_STATIC_CGI:
+			sensord_args.doStaticCGI = 1;
+			break;
+		case OPT_GRAPH_URL:
+			sensord_args.graphUrl = optarg;
+			break;
+		case 'H':
+			sensord_args.historyFile = optarg;
+			break;
+		case OPT_HISTORY_INTERVAL:
+			if ((sensord_args.historyTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_HISTORY_LENGTH:
+			if ((sensord_args.historyLength = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_DUMP_HISTORY:
+			sensord_args.doDumpHistory = 1;
+			break;
+		case OPT_STATS_INTERVAL:
+			if ((sensord_args.statsTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_QUERY_PORT:
+			sensord_args.queryPort = atoi(optarg);
+			if (sensord_args.queryPort <= 0 ||
+			    sensord_args.queryPort > 65535) {
+				fprintf(stderr, "Error parsing port value `%s'.\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case OPT_QUERY_ADDRESS:
+			sensord_args.queryAddress = optarg;
+			break;
+		case OPT_STREAM_INTERVAL:
+			if ((sensord_args.streamTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_ANOMALY_INTERVAL:
+			if ((sensord_args.anomalyTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_ANOMALY_HALF_LIFE:
+			if ((sensord_args.anomalyHalfLife = parseTime(optarg)) <= 0) {
+				if (!sensord_args.anomalyHalfLife)
+					fprintf(stderr, "Error: Zero half-life.\n");
+				return -1;
+			}
+			break;
+		case OPT_ANOMALY_Z:
+			sensord_args.anomalyZ = atof(optarg);
+			if (sensord_args.anomalyZ < 0) {
+				fprintf(stderr, "Error parsing z-score `%s'.\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case OPT_ANOMALY_SLOPE:
+			if (parseAnomalySlope(optarg))
+				return -1;
+			break;
+		case OPT_ANOMALY_RESIDUAL:
+			if (parseAnomalyResidual(optarg))
+				return -1;
+			break;
+		case OPT_ALIGN:
+			sensord_args.doAlign = 1;
+			break;
+		case OPT_SLACK:
+			if ((sensord_args.slackTime = parseTime(optarg)) < 0)
+				return -1;
+			break;
+		case OPT_WAKEUP_FILE:
+			sensord_args.wakeupFile = optarg;
+			break;
 		case 'd':
 			sensord_args.debug = 1;
 			break;
@@ -219,8 +470,44 @@ int parseArgs(int argc, char **argv)
 		return -1;
 	}
 
+	if (sensord_args.doStaticCGI && !sensord_args.graphDir) {
+		fprintf(stderr,
+			"Error: Incompatible --static-cgi without --graph-dir.\n");
+		return -1;
+	}
+
+	if (sensord_args.graphDir && !sensord_args.doStaticCGI) {
+		if (!sensord_args.rrdFile) {
+			fprintf(stderr,
+				"Error: Incompatible --graph-dir without --rrd-file.\n");
+			return -1;
+		}
+		if (!sensord_args.graphTime) {
+			fprintf(stderr,
+				"Error: Incompatible --graph-dir without --graph-interval.\n");
+			return -1;
+		}
+		/* render right after an RRD update, never in between */
+		sensord_args.graphTime += sensord_args.rrdTime - 1;
+		sensord_args.graphTime -= sensord_args.graphTime %
+			sensord_args.rrdTime;
+	}
+
+	if (sensord_args.doDumpHistory && !sensord_args.historyFile) {
+		fprintf(stderr,
+			"Error: Incompatible --dump-history without --history-file.\n");
+		return -1;
+	}
+
+	if (sensord_args.historyFile && !sensord_args.historyTime) {
+		fprintf(stderr,
+			"Error: Incompatible --history-file without --history-interval.\n");
+		return -1;
+	}
+
 	if (!sensord_args.logTime && !sensord_args.scanTime &&
-	    !sensord_args.rrdFile) {
+	    !sensord_args.rrdFile && !sensord_args.historyFile &&
+	    !sensord_args.anomalyTime) {
 		fprintf(stderr,
 			"Error: No logging, alarm or RRD scanning.\n");
 		return -1;
@@ -4,6 +4,25 @@
 #include <lib/sensors.h>
 
 #define MAX_CHIP_NAMES 32
+#define MAX_ANOMALY_RULES 32
+
+/* host metrics sampled along with the sensors */
+#define HOST_LOAD 1
+#define HOST_CPUFREQ 2
+#define HOST_PRESSURE 4
+#define HOST_THERMAL 8
+
+/* alert when a series changes faster than rate per hour, in that direction */
+struct anomalySlope {
+	const char *pattern;
+	double rate;
+};
+
+/* a derived series, the difference between two series */
+struct anomalyResidual {
+	const char *name1;
+	const char *name2;
+};
 
 struct sensord_arguments {
 	int isDaemon;
@@ -11,15 +30,37 @@ struct sensord_arguments {
 	const char *pidFile;
 	const char *rrdFile;
 	const char *cgiDir;
+	const char *historyFile;
+	const char *wakeupFile;
+	const char *graphDir;
+	const char *graphUrl;
+	const char *queryAddress;
 	int scanTime;
 	int logTime;
 	int rrdTime;
 	int rrdNoAverage;
+	int historyTime;
+	int historyLength;
+	int statsTime;
+	int slackTime;
+	int graphTime;
+	int queryPort;
+	int streamTime;
+	int hostMetrics;
+	int anomalyTime;
+	int anomalyHalfLife;
+	double anomalyZ;
+	struct anomalySlope anomalySlopes[MAX_ANOMALY_RULES];
+	int numAnomalySlopes;
+	struct anomalyResidual anomalyResiduals[MAX_ANOMALY_RULES];
+	int numAnomalyResiduals;
 	int syslogFacility;
 	int doScan;
 	int doSet;
 	int doCGI;
-	int doLoad;
+	int doDumpHistory;
+	int doAlign;
+	int doStaticCGI;
 	int debug;
 	sensors_chip_name chipNames[MAX_CHIP_NAMES];
 	int numChipNames;
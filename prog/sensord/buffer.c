@@ -0,0 +1,143 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Output buffers and the JSON and URL helpers of the HTTP endpoints,
+ * shared by sensord and sensord-collector. Like frame.c, it does not
+ * depend on anything else in sensord.
+ */
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+
+void bufferPrintf(struct buffer *buf, const char *fmt, ...)
+{
+	va_list ap;
+	size_t size;
+	char *data;
+	int len;
+
+	if (!buf->size && buf->data)
+		return;		/* out of memory before */
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (buf->len + len < buf->size) {
+		buf->len += len;
+		return;
+	}
+
+	for (size = buf->size ? buf->size : 4096; size <= buf->len + len;)
+		size *= 2;
+	data = realloc(buf->data, size);
+	if (!data) {
+		/* remembered, and sent as a truncated answer */
+		buf->size = 0;
+		return;
+	}
+	buf->data = data;
+	buf->size = size;
+
+	va_start(ap, fmt);
+	vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+	va_end(ap);
+	buf->len += len;
+}
+
+void bufferAppend(struct buffer *buf, const void *data, size_t len)
+{
+	size_t size;
+	char *p;
+
+	if (buf->len + len > buf->size) {
+		for (size = buf->size ? buf->size : 4096;
+		     size < buf->len + len;)
+			size *= 2;
+		p = realloc(buf->data, size);
+		if (!p)
+			return;
+		buf->data = p;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+void bufferValue(struct buffer *buf, const char *sep, double value)
+{
+	if (isnan(value) || isinf(value))
+		bufferPrintf(buf, "%snull", sep);
+	else
+		bufferPrintf(buf, "%s%g", sep, value);
+}
+
+/* Names and labels come from the configuration, keep the JSON valid */
+void bufferString(struct buffer *buf, const char *s)
+{
+	bufferPrintf(buf, "\"");
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			bufferPrintf(buf, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			bufferPrintf(buf, "\\u%04x", *s);
+		else
+			bufferPrintf(buf, "%c", *s);
+	}
+	bufferPrintf(buf, "\"");
+}
+
+void bufferError(struct buffer *buf, const char *status,
+		 const char *error)
+{
+	buf->len = 0;
+	bufferPrintf(buf, "HTTP/1.0 %s\r\nContent-Type: application/json\r\n"
+		     "Connection: close\r\n\r\n{\"error\":", status);
+	bufferString(buf, error);
+	bufferPrintf(buf, "}\n");
+}
+
+void urlDecode(char *s)
+{
+	char *d = s;
+	unsigned int c;
+
+	for (; *s; s++) {
+		if (*s == '+') {
+			*d++ = ' ';
+		} else if (*s == '%' && sscanf(s + 1, "%2x", &c) == 1) {
+			*d++ = c;
+			s += 2;
+		} else {
+			*d++ = *s;
+		}
+	}
+	*d = '\0';
+}
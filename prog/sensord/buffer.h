@@ -0,0 +1,53 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#ifndef SENSORD_BUFFER_H
+#define SENSORD_BUFFER_H
+
+#include <stddef.h>
+
+/*
+ * A growable output buffer, in which the HTTP endpoints build their
+ * answers. If memory runs out, size drops to 0 and what was built so far
+ * is kept, to be sent as a truncated answer.
+ */
+struct buffer {
+	char *data;
+	size_t len, size;
+};
+
+extern void bufferPrintf(struct buffer *buf, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+extern void bufferAppend(struct buffer *buf, const void *data, size_t len);
+/* A JSON number, or null if it is not finite */
+extern void bufferValue(struct buffer *buf, const char *sep, double value);
+/* A JSON string */
+extern void bufferString(struct buffer *buf, const char *s);
+/* Replaces the buffer with an HTTP error, and its JSON description */
+extern void bufferError(struct buffer *buf, const char *status,
+			const char *error);
+
+/* Decodes a query parameter in place */
+extern void urlDecode(char *s);
+
+#endif	/* SENSORD_BUFFER_H */
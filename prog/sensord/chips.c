@@ -406,7 +406,10 @@ void freeKnownChips(void)
 {
 	int index0;
 
+	if (!knownChips)
+		return;
 	for (index0 = 0; knownChips[index0].features; index0++)
 		free(knownChips[index0].features);
 	free(knownChips);
+	knownChips = NULL;
 }
@@ -0,0 +1,1036 @@
+/*
+ * sensord-collector
+ *
+ * Gathers the live sweeps of many sensord instances and answers
+ * aggregate queries over them.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Every upstream is a sensord query endpoint, subscribed to with
+ * GET /stream and kept connected (with exponential backoff on errors).
+ * The latest value of every series of every upstream is kept in a
+ * hash map. Everything, upstreams and queries alike, is served by a
+ * single epoll loop.
+ *
+ * Queries are HTTP GET requests answered with JSON:
+ *
+ *   /aggregate?select=<patterns>&op=max|min|avg|sum|count&by=group|host
+ *   /latest?select=<patterns>
+ *   /upstreams
+ *
+ * where patterns are comma-separated shell patterns, matched against the
+ * series names and labels. Values older than the maximum age are left
+ * out, so a dead host does not hide a live one.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <getopt.h>
+#include <math.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "buffer.h"
+#include "frame.h"
+#include "version.h"
+
+#define ARRAY_SIZE(arr)	(int)(sizeof(arr) / sizeof((arr)[0]))
+
+#define MAX_CLIENTS 64
+#define REQUEST_MAX 2048
+/* larger frames are not accepted from upstreams */
+#define FRAME_MAX (1024 * 1024)
+#define BACKOFF_MAX 60
+/*
+ * An upstream is given up on, and reconnected to, when no frame came for
+ * SILENT_INTERVALS times the longest gap seen between two of its frames,
+ * and at least SILENT_MIN seconds; before two frames came, for the
+ * maximum age of the values.
+ */
+#define SILENT_INTERVALS 3
+#define SILENT_MIN 5
+/* TCP keepalive probes, for hosts which went away without a reset */
+#define KEEPALIVE_IDLE 30
+#define KEEPALIVE_INTERVAL 10
+#define KEEPALIVE_COUNT 3
+
+/* what an epoll event is about, in the upper half of its data */
+enum {
+	Kind_listen = 1,
+	Kind_upstream,
+	Kind_client
+};
+
+enum {
+	Up_idle,		/* waiting to reconnect */
+	Up_connecting,
+	Up_header,		/* request sent, reading the HTTP header */
+	Up_streaming
+};
+
+struct upstream {
+	char *group;
+	char *spec;			/* host:port, as given */
+	struct sockaddr_storage addr;
+	socklen_t addrLen;
+	int fd;
+	int state;
+	unsigned char *in;
+	size_t inLen, inSize;
+	time_t retry;
+	int backoff;
+	struct frameDecoder decoder;
+	struct entry **entries;		/* by series index */
+	time_t lastFrame;		/* time of the upstream */
+	double lastHeard;		/* our monotonic time */
+	unsigned long frames;		/* of values, on this connection */
+	double interval;		/* longest gap between them */
+};
+
+struct client {
+	int fd;				/* -1 if the slot is free */
+	char request[REQUEST_MAX + 1];
+	size_t requestLen;
+	struct buffer answer;
+	size_t sent;
+};
+
+/*
+ * The map from (upstream, series name) to the latest value is split in
+ * shards which grow independently, so that growing never rehashes more
+ * than a fraction of the entries at once and the loop does not stall
+ * when hundreds of upstreams connect together.
+ */
+#define SHARDS 16
+
+struct entry {
+	struct entry *next;
+	uint32_t hash;
+	int upstream;
+	double value;
+	int64_t time;
+	char *label;
+	char name[];
+};
+
+struct shard {
+	struct entry **buckets;
+	unsigned int size, count;
+};
+
+static struct shard shards[SHARDS];
+
+static struct upstream *upstreams;
+static int numUpstreams;
+static struct client clients[MAX_CLIENTS];
+static int listenFd = -1, epollFd = -1;
+
+static const char *listenAddress = "127.0.0.1";
+static int listenPort = 8766;
+static int maxAge = 60;
+static int debug;
+
+static volatile sig_atomic_t done;
+
+static void logMsg(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+/* Hash map */
+
+/* Seconds, not affected by changes of the wall clock */
+static double monotonic(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t hashKey(int upstream, const char *name)
+{
+	uint32_t hash = 2166136261u ^ (uint32_t)upstream;
+
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+	return hash;
+}
+
+static int shardGrow(struct shard *shard)
+{
+	struct entry **buckets, *entry, *next;
+	unsigned int size = shard->size ? shard->size * 2 : 64, i;
+
+	buckets = calloc(size, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+	for (i = 0; i < shard->size; i++) {
+		for (entry = shard->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->hash & (size - 1)];
+			buckets[entry->hash & (size - 1)] = entry;
+		}
+	}
+	free(shard->buckets);
+	shard->buckets = buckets;
+	shard->size = size;
+	return 0;
+}
+
+/* Find or add the entry of a series; NULL if out of memory */
+static struct entry *mapEntry(int upstream, const char *name,
+			      const char *label)
+{
+	uint32_t hash = hashKey(upstream, name);
+	struct shard *shard = &shards[hash >> 28];
+	struct entry *entry;
+	char *copy;
+
+	if (shard->size) {
+		for (entry = shard->buckets[hash & (shard->size - 1)]; entry;
+		     entry = entry->next) {
+			if (entry->hash == hash && entry->upstream == upstream &&
+			    !strcmp(entry->name, name))
+				break;
+		}
+	} else {
+		entry = NULL;
+	}
+
+	if (!entry) {
+		if (shard->count >= 2 * shard->size && shardGrow(shard))
+			return NULL;
+		entry = calloc(1, sizeof(*entry) + strlen(name) + 1);
+		if (!entry)
+			return NULL;
+		entry->value = NAN;
+		entry->hash = hash;
+		entry->upstream = upstream;
+		strcpy(entry->name, name);
+		entry->next = shard->buckets[hash & (shard->size - 1)];
+		shard->buckets[hash & (shard->size - 1)] = entry;
+		shard->count++;
+	}
+
+	if (!entry->label || strcmp(entry->label, label)) {
+		copy = strdup(label);
+		if (copy) {
+			free(entry->label);
+			entry->label = copy;
+		}
+	}
+	return entry;
+}
+
+static void mapForEach(void (*fn)(const struct entry *entry, void *data),
+		       void *data)
+{
+	const struct entry *entry;
+	unsigned int i;
+	int s;
+
+	for (s = 0; s < SHARDS; s++)
+		for (i = 0; i < shards[s].size; i++)
+			for (entry = shards[s].buckets[i]; entry;
+			     entry = entry->next)
+				fn(entry, data);
+}
+
+/* Upstreams */
+
+static int watch(int fd, uint32_t events, int kind, int index, int op)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.u64 = ((uint64_t)kind << 32) | (uint32_t)index;
+	return epoll_ctl(epollFd, op, fd, &ev);
+}
+
+static void upstreamFail(struct upstream *up, const char *what)
+{
+	if (debug || up->state == Up_streaming)
+		logMsg("%s: %s%s%s", up->spec, what, errno ? ": " : "",
+		       errno ? strerror(errno) : "");
+	if (up->fd >= 0)
+		close(up->fd);
+	up->fd = -1;
+	up->state = Up_idle;
+	up->inLen = 0;
+	/* the next connection starts with a new topology */
+	frameDecoderFree(&up->decoder);
+	up->retry = time(NULL) + up->backoff;
+	up->backoff = up->backoff * 2 > BACKOFF_MAX ? BACKOFF_MAX :
+		up->backoff * 2;
+}
+
+static void upstreamConnect(struct upstream *up, int index)
+{
+	int on = 1, idle = KEEPALIVE_IDLE, interval = KEEPALIVE_INTERVAL;
+	int count = KEEPALIVE_COUNT;
+
+	up->fd = socket(up->addr.ss_family, SOCK_STREAM, 0);
+	if (up->fd < 0 || fcntl(up->fd, F_SETFL, O_NONBLOCK)) {
+		upstreamFail(up, "socket");
+		return;
+	}
+	if (setsockopt(up->fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+	    setsockopt(up->fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle,
+		       sizeof(idle)) ||
+	    setsockopt(up->fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval,
+		       sizeof(interval)) ||
+	    setsockopt(up->fd, IPPROTO_TCP, TCP_KEEPCNT, &count,
+		       sizeof(count))) {
+		upstreamFail(up, "keepalive");
+		return;
+	}
+	up->lastHeard = monotonic();
+	up->frames = 0;
+	up->interval = 0;
+	if (connect(up->fd, (struct sockaddr *)&up->addr, up->addrLen) &&
+	    errno != EINPROGRESS) {
+		upstreamFail(up, "connect");
+		return;
+	}
+	up->state = Up_connecting;
+	if (watch(up->fd, EPOLLOUT, Kind_upstream, index, EPOLL_CTL_ADD))
+		upstreamFail(up, "epoll");
+}
+
+/*
+ * The topology maps the series indexes of the upstream to map entries;
+ * keyframes and deltas then only update the values.
+ */
+static int upstreamTopology(struct upstream *up, int index)
+{
+	const struct frameSeries *series;
+	struct entry **entries;
+	int i;
+
+	entries = realloc(up->entries, (up->decoder.numSeries + 1) *
+			  sizeof(*entries));
+	if (!entries)
+		return -1;
+	up->entries = entries;
+	for (i = 0; i < up->decoder.numSeries; i++) {
+		series = &up->decoder.series[i];
+		entries[i] = mapEntry(index, series->name, series->label);
+	}
+	return 0;
+}
+
+static int upstreamFrames(struct upstream *up, int index)
+{
+	const struct frameDecoder *decoder = &up->decoder;
+	size_t pos = 0;
+	int i, n, type;
+	double now;
+
+	while ((n = frameDecode(&up->decoder, up->in + pos, up->inLen - pos,
+				&type)) > 0) {
+		pos += n;
+		if (type == FrameType_topology) {
+			if (upstreamTopology(up, index))
+				return -1;
+		} else if (type == FrameType_key || type == FrameType_delta) {
+			for (i = 0; i < decoder->numSeries; i++) {
+				if (!up->entries[i])
+					continue;
+				if (decoder->series[i].changed)
+					up->entries[i]->value =
+						decoder->series[i].value;
+				up->entries[i]->time = decoder->time;
+			}
+			up->lastFrame = decoder->time;
+			up->backoff = 1;
+
+			now = monotonic();
+			if (up->frames++ && now - up->lastHeard > up->interval)
+				up->interval = now - up->lastHeard;
+			up->lastHeard = now;
+		}
+	}
+	if (n < 0)
+		return -1;
+
+	memmove(up->in, up->in + pos, up->inLen - pos);
+	up->inLen -= pos;
+	return 0;
+}
+
+static void upstreamRead(struct upstream *up, int index)
+{
+	unsigned char *in;
+	char *eoh;
+	size_t size;
+	ssize_t n;
+
+	for (;;) {
+		if (up->inLen == up->inSize) {
+			size = up->inSize ? up->inSize * 2 : 16384;
+			if (size > FRAME_MAX + FRAME_HEADER_SIZE + 4096) {
+				errno = 0;
+				upstreamFail(up, "frame too large");
+				return;
+			}
+			in = realloc(up->in, size + 1);
+			if (!in) {
+				upstreamFail(up, "out of memory");
+				return;
+			}
+			up->in = in;
+			up->inSize = size;
+		}
+
+		n = read(up->fd, up->in + up->inLen, up->inSize - up->inLen);
+		if (n < 0 && errno == EAGAIN)
+			return;
+		if (n <= 0) {
+			if (!n)
+				errno = 0;
+			upstreamFail(up, "connection closed");
+			return;
+		}
+		up->inLen += n;
+
+		if (up->state == Up_header) {
+			up->in[up->inLen] = '\0';
+			eoh = strstr((char *)up->in, "\r\n\r\n");
+			if (!eoh)
+				continue;
+			if (strncmp((char *)up->in, "HTTP/1.0 200", 12)) {
+				errno = 0;
+				upstreamFail(up, "subscription refused");
+				return;
+			}
+			eoh += 4;
+			up->inLen -= eoh - (char *)up->in;
+			memmove(up->in, eoh, up->inLen);
+			up->state = Up_streaming;
+			logMsg("%s: connected", up->spec);
+		}
+
+		if (upstreamFrames(up, index)) {
+			errno = 0;
+			upstreamFail(up, "invalid frame");
+			return;
+		}
+	}
+}
+
+/* A host which went away without closing the connection */
+static int upstreamSilent(const struct upstream *up, double now)
+{
+	double limit = up->interval * SILENT_INTERVALS;
+
+	if (up->frames < 2)
+		limit = maxAge;
+	else if (limit < SILENT_MIN)
+		limit = SILENT_MIN;
+	return now - up->lastHeard > limit;
+}
+
+static void upstreamEvent(int index, uint32_t events)
+{
+	static const char request[] = "GET /stream HTTP/1.0\r\n\r\n";
+	struct upstream *up = &upstreams[index];
+	socklen_t len = sizeof(int);
+	int err;
+
+	if (up->state == Up_connecting) {
+		if (getsockopt(up->fd, SOL_SOCKET, SO_ERROR, &err, &len) ||
+		    err) {
+			errno = err;
+			upstreamFail(up, "connect");
+			return;
+		}
+		/* small enough to always fit in an empty socket buffer */
+		if (send(up->fd, request, sizeof(request) - 1,
+			 MSG_NOSIGNAL) != sizeof(request) - 1 ||
+		    watch(up->fd, EPOLLIN, Kind_upstream, index,
+			  EPOLL_CTL_MOD)) {
+			upstreamFail(up, "send");
+			return;
+		}
+		up->state = Up_header;
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		upstreamRead(up, index);
+}
+
+/* Queries */
+
+static int selected(const char *select, const struct entry *entry)
+{
+	char patterns[REQUEST_MAX + 1], *pattern, *save;
+
+	if (!select || !*select)
+		return 1;
+	strcpy(patterns, select);
+	for (pattern = strtok_r(patterns, ",", &save); pattern;
+	     pattern = strtok_r(NULL, ",", &save))
+		if (!fnmatch(pattern, entry->name, 0) ||
+		    (entry->label && !fnmatch(pattern, entry->label, 0)))
+			return 1;
+	return 0;
+}
+
+static const char *upstreamHost(int index)
+{
+	return upstreams[index].decoder.host[0] ?
+		upstreams[index].decoder.host : upstreams[index].spec;
+}
+
+enum {
+	Op_max, Op_min, Op_avg, Op_sum, Op_count
+};
+
+static const char *opNames[] = { "max", "min", "avg", "sum", "count" };
+
+struct group {
+	const char *key;
+	double value;
+	unsigned long count;
+	const struct entry *best;	/* for max and min */
+};
+
+struct aggregate {
+	const char *select;
+	int op, byHost;
+	time_t oldest;
+	struct group *groups;
+	int numGroups, maxGroups;
+	struct buffer *buf;
+	int first;
+};
+
+static void aggregateEntry(const struct entry *entry, void *data)
+{
+	struct aggregate *agg = data;
+	struct group *group;
+	const char *key;
+	int i;
+
+	if (entry->time < agg->oldest || isnan(entry->value) ||
+	    !selected(agg->select, entry))
+		return;
+
+	key = agg->byHost ? upstreamHost(entry->upstream) :
+		upstreams[entry->upstream].group;
+	for (i = 0; i < agg->numGroups; i++)
+		if (!strcmp(agg->groups[i].key, key))
+			break;
+	if (i == agg->numGroups) {
+		if (i == agg->maxGroups)
+			return;	/* at most one per upstream, can't happen */
+		agg->numGroups++;
+		group = &agg->groups[i];
+		group->key = key;
+		group->value = entry->value;
+		group->count = 0;
+		group->best = entry;
+	}
+	group = &agg->groups[i];
+
+	switch (agg->op) {
+	case Op_max:
+		if (entry->value > group->value) {
+			group->value = entry->value;
+			group->best = entry;
+		}
+		break;
+	case Op_min:
+		if (entry->value < group->value) {
+			group->value = entry->value;
+			group->best = entry;
+		}
+		break;
+	default:
+		if (group->count)
+			group->value += entry->value;
+		break;
+	}
+	group->count++;
+}
+
+static void answerAggregate(struct buffer *buf, const char *select, int op,
+			    int byHost)
+{
+	struct aggregate agg;
+	const struct group *group;
+	int i;
+
+	memset(&agg, 0, sizeof(agg));
+	agg.select = select;
+	agg.op = op;
+	agg.byHost = byHost;
+	agg.oldest = time(NULL) - maxAge;
+	agg.maxGroups = numUpstreams;
+	agg.groups = calloc(numUpstreams, sizeof(*agg.groups));
+	if (!agg.groups)
+		return;
+	mapForEach(aggregateEntry, &agg);
+
+	bufferPrintf(buf, "{\"op\":\"%s\",\"by\":\"%s\",\"groups\":[",
+		     opNames[op], byHost ? "host" : "group");
+	for (i = 0; i < agg.numGroups; i++) {
+		group = &agg.groups[i];
+		bufferPrintf(buf, "%s{\"%s\":", i ? "," : "",
+			     byHost ? "host" : "group");
+		bufferString(buf, group->key);
+		bufferPrintf(buf, ",\"value\":");
+		if (op == Op_avg)
+			bufferValue(buf, "", group->value / group->count);
+		else if (op == Op_count)
+			bufferPrintf(buf, "%lu", group->count);
+		else
+			bufferValue(buf, "", group->value);
+		if (op == Op_max || op == Op_min) {
+			bufferPrintf(buf, ",\"host\":");
+			bufferString(buf, upstreamHost(group->best->upstream));
+			bufferPrintf(buf, ",\"series\":");
+			bufferString(buf, group->best->name);
+		}
+		bufferPrintf(buf, "}");
+	}
+	bufferPrintf(buf, "]}\n");
+	free(agg.groups);
+}
+
+static void latestEntry(const struct entry *entry, void *data)
+{
+	struct aggregate *agg = data;
+
+	if (entry->time < agg->oldest || !selected(agg->select, entry))
+		return;
+	bufferPrintf(agg->buf, "%s{\"group\":", agg->first ? "" : ",");
+	bufferString(agg->buf, upstreams[entry->upstream].group);
+	bufferPrintf(agg->buf, ",\"host\":");
+	bufferString(agg->buf, upstreamHost(entry->upstream));
+	bufferPrintf(agg->buf, ",\"name\":");
+	bufferString(agg->buf, entry->name);
+	bufferPrintf(agg->buf, ",\"label\":");
+	bufferString(agg->buf, entry->label ? entry->label : entry->name);
+	bufferPrintf(agg->buf, ",\"time\":%lld,\"value\":",
+		     (long long)entry->time);
+	bufferValue(agg->buf, "", entry->value);
+	bufferPrintf(agg->buf, "}");
+	agg->first = 0;
+}
+
+static void answerLatest(struct buffer *buf, const char *select)
+{
+	struct aggregate agg;
+
+	memset(&agg, 0, sizeof(agg));
+	agg.select = select;
+	agg.oldest = time(NULL) - maxAge;
+	agg.buf = buf;
+	agg.first = 1;
+
+	bufferPrintf(buf, "{\"series\":[");
+	mapForEach(latestEntry, &agg);
+	bufferPrintf(buf, "]}\n");
+}
+
+static void answerUpstreams(struct buffer *buf)
+{
+	static const char *states[] = {
+		"idle", "connecting", "connecting", "streaming"
+	};
+	const struct upstream *up;
+	int i;
+
+	bufferPrintf(buf, "{\"upstreams\":[");
+	for (i = 0; i < numUpstreams; i++) {
+		up = &upstreams[i];
+		bufferPrintf(buf, "%s{\"group\":", i ? "," : "");
+		bufferString(buf, up->group);
+		bufferPrintf(buf, ",\"address\":");
+		bufferString(buf, up->spec);
+		bufferPrintf(buf, ",\"host\":");
+		bufferString(buf, up->decoder.host);
+		bufferPrintf(buf, ",\"state\":\"%s\",\"series\":%d,"
+			     "\"frames\":%lu,\"lost\":%lu,\"last\":%lld}",
+			     states[up->state], up->decoder.numSeries,
+			     up->decoder.frames, up->decoder.lost,
+			     (long long)up->lastFrame);
+	}
+	bufferPrintf(buf, "]}\n");
+}
+
+static void answerRequest(struct client *client)
+{
+	struct buffer *buf = &client->answer;
+	char *path, *params, *param, *value, *end, *save;
+	const char *select = NULL;
+	int i, op = Op_max, byHost = 0;
+
+	path = client->request;
+	if (strncmp(path, "GET ", 4)) {
+		bufferError(buf, "405 Method Not Allowed", "only GET");
+		return;
+	}
+	path += 4;
+	end = strpbrk(path, " \r\n");
+	if (end)
+		*end = '\0';
+	params = strchr(path, '?');
+	if (params)
+		*params++ = '\0';
+
+	for (param = params ? strtok_r(params, "&", &save) : NULL; param;
+	     param = strtok_r(NULL, "&", &save)) {
+		value = strchr(param, '=');
+		if (!value) {
+			bufferError(buf, "400 Bad Request",
+				    "parameter without value");
+			return;
+		}
+		*value++ = '\0';
+		urlDecode(value);
+
+		if (!strcmp(param, "select")) {
+			select = value;
+		} else if (!strcmp(param, "op")) {
+			for (i = 0; i < ARRAY_SIZE(opNames); i++)
+				if (!strcmp(value, opNames[i]))
+					break;
+			if (i == ARRAY_SIZE(opNames)) {
+				bufferError(buf, "400 Bad Request",
+					    "unknown operation");
+				return;
+			}
+			op = i;
+		} else if (!strcmp(param, "by") &&
+			   (!strcmp(value, "group") || !strcmp(value, "host"))) {
+			byHost = !strcmp(value, "host");
+		} else {
+			bufferError(buf, "400 Bad Request",
+				    "unknown parameter");
+			return;
+		}
+	}
+
+	bufferPrintf(buf, "HTTP/1.0 200 OK\r\nContent-Type: application/json"
+		     "\r\nConnection: close\r\n\r\n");
+	if (!strcmp(path, "/aggregate"))
+		answerAggregate(buf, select, op, byHost);
+	else if (!strcmp(path, "/latest"))
+		answerLatest(buf, select);
+	else if (!strcmp(path, "/upstreams"))
+		answerUpstreams(buf);
+	else
+		bufferError(buf, "404 Not Found", "unknown path");
+}
+
+static void closeClient(int index)
+{
+	struct client *client = &clients[index];
+
+	close(client->fd);
+	free(client->answer.data);
+	memset(client, 0, sizeof(*client));
+	client->fd = -1;
+}
+
+static void acceptClients(void)
+{
+	int fd, i;
+
+	while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+		for (i = 0; i < MAX_CLIENTS; i++)
+			if (clients[i].fd < 0)
+				break;
+		if (i == MAX_CLIENTS || fcntl(fd, F_SETFL, O_NONBLOCK) ||
+		    watch(fd, EPOLLIN, Kind_client, i, EPOLL_CTL_ADD)) {
+			close(fd);
+			continue;
+		}
+		clients[i].fd = fd;
+	}
+}
+
+static void clientEvent(int index, uint32_t events)
+{
+	struct client *client = &clients[index];
+	ssize_t n;
+
+	if (events & EPOLLERR) {
+		closeClient(index);
+		return;
+	}
+
+	if (!client->answer.len) {
+		n = read(client->fd, client->request + client->requestLen,
+			 REQUEST_MAX - client->requestLen);
+		if (n < 0 && errno == EAGAIN)
+			return;
+		if (n <= 0) {
+			closeClient(index);
+			return;
+		}
+		client->requestLen += n;
+		client->request[client->requestLen] = '\0';
+		if (!strstr(client->request, "\r\n\r\n") &&
+		    !strstr(client->request, "\n\n") &&
+		    client->requestLen < REQUEST_MAX)
+			return;
+
+		answerRequest(client);
+		if (!client->answer.len ||
+		    watch(client->fd, EPOLLOUT, Kind_client, index,
+			  EPOLL_CTL_MOD)) {
+			closeClient(index);
+			return;
+		}
+	}
+
+	n = send(client->fd, client->answer.data + client->sent,
+		 client->answer.len - client->sent, MSG_NOSIGNAL);
+	if (n < 0 && errno == EAGAIN)
+		return;
+	if (n < 0 || (client->sent += n) == client->answer.len)
+		closeClient(index);
+}
+
+/* Setup */
+
+static int listenQueries(void)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(listenPort);
+	if (!inet_aton(listenAddress, &addr.sin_addr)) {
+		logMsg("Invalid address %s", listenAddress);
+		return -1;
+	}
+
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd < 0 ||
+	    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+	    bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listenFd, 64) || fcntl(listenFd, F_SETFL, O_NONBLOCK) ||
+	    watch(listenFd, EPOLLIN, Kind_listen, 0, EPOLL_CTL_ADD)) {
+		logMsg("Error listening on %s:%d: %s", listenAddress,
+		       listenPort, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* group/host:port */
+static int parseUpstream(struct upstream *up, char *arg)
+{
+	struct addrinfo hints, *res;
+	char *slash, *colon;
+	int err;
+
+	memset(up, 0, sizeof(*up));
+	frameDecoderInit(&up->decoder);
+	up->fd = -1;
+	up->backoff = 1;
+
+	slash = strchr(arg, '/');
+	colon = strrchr(arg, ':');
+	if (!slash || !colon || colon < slash) {
+		fprintf(stderr, "Invalid upstream `%s', expected "
+			"group/host:port.\n", arg);
+		return -1;
+	}
+	*slash = '\0';
+	up->group = arg;
+	up->spec = slash + 1;
+
+	*colon = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	err = getaddrinfo(slash + 1, colon + 1, &hints, &res);
+	*colon = ':';
+	if (err) {
+		fprintf(stderr, "Cannot resolve `%s': %s\n", up->spec,
+			gai_strerror(err));
+		return -1;
+	}
+	memcpy(&up->addr, res->ai_addr, res->ai_addrlen);
+	up->addrLen = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static void signalHandler(int sig)
+{
+	(void) sig; /* no warning */
+	done = 1;
+}
+
+static const char *syntax =
+	"Syntax: sensord-collector {options} group/host:port...\n"
+	"  -a, --address <ip>   -- address to answer queries on (default 127.0.0.1)\n"
+	"  -p, --port <port>    -- port to answer queries on (default 8766)\n"
+	"  -m, --max-age <sec>  -- ignore values older than this (default 60)\n"
+	"  -d, --debug          -- report every connection error\n"
+	"  -v, --version        -- display version and exit\n"
+	"  -h, --help           -- display help and exit\n"
+	"\n"
+	"Every upstream is the --query-port of a sensord instance, in a group\n"
+	"(for example a rack) which aggregate queries can be done by.\n";
+
+static const struct option longOptions[] = {
+	{ "address", required_argument, NULL, 'a' },
+	{ "port", required_argument, NULL, 'p' },
+	{ "max-age", required_argument, NULL, 'm' },
+	{ "debug", no_argument, NULL, 'd' },
+	{ "version", no_argument, NULL, 'v' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	struct epoll_event events[64];
+	struct sigaction sa;
+	time_t now, wake;
+	int c, i, n, timeout;
+
+	while ((c = getopt_long(argc, argv, "a:p:m:dvh", longOptions, NULL))
+	       != EOF) {
+		switch (c) {
+		case 'a':
+			listenAddress = optarg;
+			break;
+		case 'p':
+			listenPort = atoi(optarg);
+			break;
+		case 'm':
+			maxAge = atoi(optarg);
+			break;
+		case 'd':
+			debug = 1;
+			break;
+		case 'v':
+			printf("sensord-collector version %s\n", LM_VERSION);
+			exit(EXIT_SUCCESS);
+		case 'h':
+			printf("%s", syntax);
+			exit(EXIT_SUCCESS);
+		default:
+			fprintf(stderr, "%s", syntax);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind == argc || listenPort <= 0 || listenPort > 65535 ||
+	    maxAge <= 0) {
+		fprintf(stderr, "%s", syntax);
+		exit(EXIT_FAILURE);
+	}
+
+	numUpstreams = argc - optind;
+	upstreams = calloc(numUpstreams, sizeof(*upstreams));
+	if (!upstreams) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < numUpstreams; i++)
+		if (parseUpstream(&upstreams[i], argv[optind + i]))
+			exit(EXIT_FAILURE);
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signalHandler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	epollFd = epoll_create1(0);
+	if (epollFd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+	if (listenQueries())
+		exit(EXIT_FAILURE);
+
+	while (!done) {
+		now = time(NULL);
+		wake = now + 1;
+		for (i = 0; i < numUpstreams; i++) {
+			if (upstreams[i].state != Up_idle) {
+				if (upstreamSilent(&upstreams[i],
+						   monotonic())) {
+					errno = 0;
+					upstreamFail(&upstreams[i],
+						     "no frame received");
+				}
+				continue;
+			}
+			if (upstreams[i].retry <= now)
+				upstreamConnect(&upstreams[i], i);
+			else if (upstreams[i].retry < wake)
+				wake = upstreams[i].retry;
+		}
+		timeout = (wake - now) * 1000;
+
+		n = epoll_wait(epollFd, events, ARRAY_SIZE(events), timeout);
+		for (i = 0; i < n; i++) {
+			int kind = events[i].data.u64 >> 32;
+			int index = (uint32_t)events[i].data.u64;
+
+			if (kind == Kind_listen)
+				acceptClients();
+			else if (kind == Kind_upstream)
+				upstreamEvent(index, events[i].events);
+			else
+				clientEvent(index, events[i].events);
+		}
+	}
+
+	close(listenFd);
+	close(epollFd);
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * frame-bench
+ *
+ * Throughput benchmark of the sensord streaming protocol encoder and
+ * decoder, on synthetic sweeps.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Every series does a random walk in the steps of a real sensor (1 mV,
+ * 0.5 degree, 1 RPM), changing at a given rate per sweep; one in ten is
+ * unknown (NaN) from time to time. The sweeps are encoded as the server
+ * does, with a keyframe every 60, then decoded and checked bit for bit.
+ * The exit status is non-zero if any value does not match.
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame.h"
+
+#define BATCH 1000
+#define KEY_EVERY 60
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+	seed = seed * 1103515245u + 12345u;
+	return seed >> 8;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void walk(double *values, const struct frameSeriesInfo *info,
+		 int count, unsigned int rate)
+{
+	static const double steps[] = { 0.001, 1, 0.5 };
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (rnd() % 100 >= rate)
+			continue;
+		if (i % 10 == 9 && rnd() % 50 == 0) {
+			values[i] = isnan(values[i]) ? 0 : NAN;
+			continue;
+		}
+		if (isnan(values[i]))
+			continue;
+		values[i] += (rnd() & 1 ? 1 : -1) * steps[info[i].type] *
+			(1 + rnd() % 3);
+	}
+}
+
+static const char *syntax =
+	"Syntax: frame-bench {options}\n"
+	"  -s, --series <n>  -- number of series (default 200)\n"
+	"  -n, --sweeps <n>  -- number of sweeps (default 100000)\n"
+	"  -r, --rate <pct>  -- chance of a value changing per sweep "
+	"(default 20)\n";
+
+static const struct option longOptions[] = {
+	{ "series", required_argument, NULL, 's' },
+	{ "sweeps", required_argument, NULL, 'n' },
+	{ "rate", required_argument, NULL, 'r' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	struct frameSeriesInfo *info;
+	struct frameDecoder decoder;
+	char (*names)[16];
+	double *values, *sent, start, encodeTime = 0, decodeTime = 0;
+	uint64_t *prev;
+	unsigned char *stream;
+	size_t len, pos, size, keyBytes = 0, deltaBytes = 0, topology;
+	unsigned long keys = 0, deltas = 0, errors = 0;
+	long sweeps = 100000, sweep, b, batch;
+	int count = 200, c, i, n, type;
+	unsigned int rate = 20;
+
+	while ((c = getopt_long(argc, argv, "s:n:r:", longOptions, NULL))
+	       != EOF) {
+		switch (c) {
+		case 's':
+			count = atoi(optarg);
+			break;
+		case 'n':
+			sweeps = atol(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "%s", syntax);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (count <= 0 || count > 0xffff || sweeps <= 0 || rate > 100) {
+		fprintf(stderr, "%s", syntax);
+		exit(EXIT_FAILURE);
+	}
+
+	info = calloc(count, sizeof(*info));
+	names = calloc(count, sizeof(*names));
+	values = calloc(count, sizeof(*values));
+	sent = calloc((size_t)BATCH * count, sizeof(*sent));
+	prev = calloc(count, sizeof(*prev));
+	size = frameTopologyMax("bench", info, 0) + count * 64 +
+		(size_t)BATCH * (FRAME_HEADER_SIZE + count * FRAME_VALUE_MAX);
+	stream = malloc(size);
+	if (!info || !names || !values || !sent || !prev || !stream) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < count; i++) {
+		info[i].type = i % 3;
+		snprintf(names[i], sizeof(names[i]), "%s%d",
+			 info[i].type == 0 ? "in" : info[i].type == 1 ?
+			 "fan" : "temp", i / 3 + 1);
+		info[i].name = names[i];
+		info[i].label = names[i];
+		info[i].chip = "bench-isa-0290";
+		info[i].unit = info[i].type == 0 ? "V" :
+			info[i].type == 1 ? "RPM" : "C";
+		values[i] = info[i].type == 0 ? 1.2 + i * 0.01 :
+			info[i].type == 1 ? 2000 + i : 40 + i % 20;
+	}
+
+	frameDecoderInit(&decoder);
+	topology = frameEncodeTopology(stream, 0, 0, "bench", info, count);
+	if (frameDecode(&decoder, stream, topology, &type) != (int)topology ||
+	    type != FrameType_topology || decoder.numSeries != count) {
+		fprintf(stderr, "Topology frame not decoded\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (sweep = 0; sweep < sweeps; sweep += batch) {
+		batch = sweeps - sweep < BATCH ? sweeps - sweep : BATCH;
+
+		len = 0;
+		for (b = 0; b < batch; b++) {
+			walk(values, info, count, rate);
+			memcpy(sent + b * count, values,
+			       count * sizeof(*values));
+
+			start = now();
+			n = frameEncodeValues(stream + len,
+					      (sweep + b) % KEY_EVERY ?
+					      FrameType_delta : FrameType_key,
+					      sweep + b + 1, sweep + b, values,
+					      prev, count);
+			encodeTime += now() - start;
+			len += n;
+			if ((sweep + b) % KEY_EVERY) {
+				deltaBytes += n;
+				deltas++;
+			} else {
+				keyBytes += n;
+				keys++;
+			}
+		}
+
+		for (pos = 0, b = 0; b < batch; b++, pos += n) {
+			start = now();
+			n = frameDecode(&decoder, stream + pos, len - pos,
+					&type);
+			decodeTime += now() - start;
+			if (n <= 0 || !type) {
+				fprintf(stderr, "Frame %ld not decoded\n",
+					sweep + b);
+				exit(EXIT_FAILURE);
+			}
+			for (i = 0; i < count; i++)
+				if (memcmp(&decoder.series[i].value,
+					   &sent[b * count + i],
+					   sizeof(double)))
+					errors++;
+		}
+	}
+
+	printf("%d series, %ld sweeps, %u%% changing per sweep\n", count,
+	       sweeps, rate);
+	printf("topology: %lu bytes\n", (unsigned long)topology);
+	printf("keyframe: %.1f bytes (%lu)\n",
+	       keys ? (double)keyBytes / keys : 0., keys);
+	printf("delta:    %.1f bytes (%lu), %.1f%% of a keyframe\n",
+	       deltas ? (double)deltaBytes / deltas : 0., deltas,
+	       deltas && keyBytes ? 100. * deltaBytes / deltas /
+	       ((double)keyBytes / keys) : 0.);
+	printf("encode:   %.0f frames/s, %.1f MB/s of doubles\n",
+	       sweeps / encodeTime, sweeps * count * 8 / encodeTime / 1e6);
+	printf("decode:   %.0f frames/s, %.1f MB/s of doubles\n",
+	       sweeps / decodeTime, sweeps * count * 8 / decodeTime / 1e6);
+	printf("lost:     %lu, mismatches: %lu\n", decoder.lost, errors);
+
+	frameDecoderFree(&decoder);
+	free(stream);
+	free(prev);
+	free(sent);
+	free(values);
+	free(names);
+	free(info);
+	return errors || decoder.lost ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,383 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Encoder and decoder of the streaming protocol (see frame.h), shared by
+ * sensord, sensord-collector and other clients. It does not depend on
+ * anything else in sensord.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+
+static unsigned char *putU(unsigned char *p, uint64_t value, int bytes)
+{
+	while (bytes--) {
+		*p++ = value & 0xff;
+		value >>= 8;
+	}
+	return p;
+}
+
+static uint64_t getU(const unsigned char *p, int bytes)
+{
+	uint64_t value = 0;
+
+	while (bytes--)
+		value = (value << 8) | p[bytes];
+	return value;
+}
+
+static unsigned char *putHeader(unsigned char *p,
+				const struct frameHeader *header)
+{
+	memcpy(p, FRAME_MAGIC, 4);
+	p = putU(p + 4, header->version, 1);
+	p = putU(p, header->type, 1);
+	p = putU(p, header->count, 2);
+	p = putU(p, header->length, 4);
+	p = putU(p, header->seq, 4);
+	return putU(p, header->time, 8);
+}
+
+static unsigned char *putString(unsigned char *p, const char *s)
+{
+	size_t len = s ? strlen(s) : 0;
+
+	if (len > FRAME_STRING_MAX)
+		len = FRAME_STRING_MAX;
+	*p++ = len;
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static unsigned char *putVarint(unsigned char *p, uint32_t value)
+{
+	while (value >= 0x80) {
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+/* Only the bytes which differ from the previous value are sent */
+static unsigned char *putXor(unsigned char *p, uint64_t x)
+{
+	int lead = 0, trail = 0, i;
+
+	if (!x) {
+		*p++ = 8 << 4;
+		return p;
+	}
+	while (!(x >> (56 - 8 * lead) & 0xff))
+		lead++;
+	while (!(x >> (8 * trail) & 0xff))
+		trail++;
+
+	*p++ = lead << 4 | trail;
+	for (i = 7 - lead; i >= trail; i--)
+		*p++ = x >> (8 * i);
+	return p;
+}
+
+size_t frameTopologyMax(const char *host,
+			const struct frameSeriesInfo *series, int count)
+{
+	size_t size = FRAME_HEADER_SIZE + 1 + strlen(host);
+	int i;
+
+	for (i = 0; i < count; i++)
+		size += 5 + strlen(series[i].name) + strlen(series[i].label) +
+			strlen(series[i].chip) + strlen(series[i].unit);
+	return size;
+}
+
+size_t frameEncodeTopology(unsigned char *buf, uint32_t seq, int64_t time,
+			   const char *host,
+			   const struct frameSeriesInfo *series, int count)
+{
+	struct frameHeader header = {
+		FRAME_VERSION, FrameType_topology, count, 0, seq, time
+	};
+	unsigned char *p;
+	int i;
+
+	p = putString(buf + FRAME_HEADER_SIZE, host);
+	for (i = 0; i < count; i++) {
+		p = putString(p, series[i].name);
+		p = putString(p, series[i].label);
+		p = putString(p, series[i].chip);
+		p = putString(p, series[i].unit);
+		*p++ = series[i].type;
+	}
+	header.length = p - buf - FRAME_HEADER_SIZE;
+	putHeader(buf, &header);
+	return p - buf;
+}
+
+/*
+ * Encode a keyframe (all values) or a delta (only changed values) into
+ * buf, which has room for FRAME_HEADER_SIZE + count * FRAME_VALUE_MAX
+ * bytes. prev holds the bits of the previous values and is updated.
+ */
+size_t frameEncodeValues(unsigned char *buf, FrameType type, uint32_t seq,
+			 int64_t time, const double *values, uint64_t *prev,
+			 int count)
+{
+	struct frameHeader header = {
+		FRAME_VERSION, type, 0, 0, seq, time
+	};
+	unsigned char *p = buf + FRAME_HEADER_SIZE;
+	int i, last = -1;
+	uint64_t bits;
+
+	for (i = 0; i < count; i++) {
+		memcpy(&bits, &values[i], sizeof(bits));
+		if (type == FrameType_delta && bits == prev[i])
+			continue;
+		p = putVarint(p, i - last);
+		p = putXor(p, type == FrameType_key ? bits : bits ^ prev[i]);
+		prev[i] = bits;
+		last = i;
+		header.count++;
+	}
+	header.length = p - buf - FRAME_HEADER_SIZE;
+	putHeader(buf, &header);
+	return p - buf;
+}
+
+/* Decoding: the get functions return -1 past the end of the payload */
+
+struct cursor {
+	const unsigned char *p, *end;
+};
+
+static int getString(struct cursor *c, char *s)
+{
+	size_t len;
+
+	if (c->p >= c->end)
+		return -1;
+	len = *c->p++;
+	if (len > (size_t)(c->end - c->p))
+		return -1;
+	memcpy(s, c->p, len);
+	s[len] = '\0';
+	c->p += len;
+	return 0;
+}
+
+static char *getStringDup(struct cursor *c)
+{
+	char s[FRAME_STRING_MAX + 1];
+
+	return getString(c, s) ? NULL : strdup(s);
+}
+
+static int getVarint(struct cursor *c, uint32_t *value)
+{
+	int shift;
+
+	*value = 0;
+	for (shift = 0; shift < 35; shift += 7) {
+		if (c->p >= c->end)
+			return -1;
+		*value |= (uint32_t)(*c->p & 0x7f) << shift;
+		if (!(*c->p++ & 0x80))
+			return 0;
+	}
+	return -1;
+}
+
+static int getXor(struct cursor *c, uint64_t *x)
+{
+	int lead, trail, i;
+
+	if (c->p >= c->end)
+		return -1;
+	lead = *c->p >> 4;
+	trail = *c->p++ & 0x0f;
+	if (lead > 8 || trail > 8 || lead + trail > 8 ||
+	    c->end - c->p < 8 - lead - trail)
+		return -1;
+
+	*x = 0;
+	for (i = 7 - lead; i >= trail; i--)
+		*x |= (uint64_t)*c->p++ << (8 * i);
+	return 0;
+}
+
+void frameDecoderInit(struct frameDecoder *decoder)
+{
+	memset(decoder, 0, sizeof(*decoder));
+}
+
+static void freeSeries(struct frameDecoder *decoder)
+{
+	int i;
+
+	for (i = 0; i < decoder->numSeries; i++) {
+		free(decoder->series[i].name);
+		free(decoder->series[i].label);
+		free(decoder->series[i].chip);
+		free(decoder->series[i].unit);
+	}
+	free(decoder->series);
+	free(decoder->bits);
+	decoder->series = NULL;
+	decoder->bits = NULL;
+	decoder->numSeries = 0;
+}
+
+void frameDecoderFree(struct frameDecoder *decoder)
+{
+	freeSeries(decoder);
+	decoder->sync = FrameSync_topology;
+}
+
+static int decodeTopology(struct frameDecoder *decoder,
+			  const struct frameHeader *header, struct cursor *c)
+{
+	struct frameSeries *s;
+	unsigned int i;
+
+	freeSeries(decoder);
+	decoder->sync = FrameSync_topology;
+	if (getString(c, decoder->host))
+		return -1;
+
+	decoder->series = calloc(header->count + 1, sizeof(*decoder->series));
+	decoder->bits = calloc(header->count + 1, sizeof(*decoder->bits));
+	if (!decoder->series || !decoder->bits)
+		return -1;
+
+	for (i = 0; i < header->count; i++) {
+		s = &decoder->series[i];
+		decoder->numSeries++;
+		s->name = getStringDup(c);
+		s->label = getStringDup(c);
+		s->chip = getStringDup(c);
+		s->unit = getStringDup(c);
+		if (!s->name || !s->label || !s->chip || !s->unit ||
+		    c->p >= c->end)
+			return -1;
+		s->type = (signed char)*c->p++;
+	}
+
+	decoder->sync = FrameSync_key;
+	return 0;
+}
+
+static int decodeValues(struct frameDecoder *decoder,
+			const struct frameHeader *header, struct cursor *c)
+{
+	uint32_t gap;
+	uint64_t x;
+	unsigned int n;
+	int i, index = -1;
+
+	for (i = 0; i < decoder->numSeries; i++)
+		decoder->series[i].changed = 0;
+
+	for (n = 0; n < header->count; n++) {
+		if (getVarint(c, &gap) || getXor(c, &x) || !gap ||
+		    gap > (uint32_t)(decoder->numSeries - 1 - index))
+			return -1;
+		index += gap;
+		decoder->bits[index] = header->type == FrameType_key ? x :
+			decoder->bits[index] ^ x;
+		memcpy(&decoder->series[index].value, &decoder->bits[index],
+		       sizeof(double));
+		decoder->series[index].changed = 1;
+	}
+	return 0;
+}
+
+/*
+ * Decode the frame at the start of buf. Returns its size, 0 if more input
+ * is needed, or -1 if the stream is invalid. *type is set to the type of
+ * the frame, or 0 if it was skipped to get back in sync.
+ */
+int frameDecode(struct frameDecoder *decoder, const unsigned char *buf,
+		size_t len, int *type)
+{
+	struct frameHeader header;
+	struct cursor c;
+	size_t size;
+
+	*type = 0;
+	if (len < FRAME_HEADER_SIZE)
+		return memcmp(buf, FRAME_MAGIC, len < 4 ? len : 4) ? -1 : 0;
+	if (memcmp(buf, FRAME_MAGIC, 4) || buf[4] != FRAME_VERSION)
+		return -1;
+
+	header.version = buf[4];
+	header.type = buf[5];
+	header.count = getU(buf + 6, 2);
+	header.length = getU(buf + 8, 4);
+	header.seq = getU(buf + 12, 4);
+	header.time = (int64_t)getU(buf + 16, 8);
+	if (header.length > FRAME_LENGTH_MAX)
+		return -1;
+
+	size = FRAME_HEADER_SIZE + (size_t)header.length;
+	if (len < size)
+		return 0;
+	c.p = buf + FRAME_HEADER_SIZE;
+	c.end = buf + size;
+
+	switch (header.type) {
+	case FrameType_topology:
+		if (decodeTopology(decoder, &header, &c))
+			return -1;
+		break;
+	case FrameType_key:
+	case FrameType_delta:
+		if (decoder->sync == FrameSync_topology)
+			return size;
+		if (decoder->sync == FrameSync_ok &&
+		    header.seq != decoder->seq + 1) {
+			decoder->lost += header.seq - decoder->seq - 1;
+			decoder->sync = FrameSync_key;
+		}
+		if (header.type == FrameType_delta &&
+		    decoder->sync != FrameSync_ok)
+			return size;
+		if (decodeValues(decoder, &header, &c))
+			return -1;
+		decoder->sync = FrameSync_ok;
+		break;
+	default:
+		/* unknown frame types are skipped */
+		return size;
+	}
+
+	decoder->seq = header.seq;
+	decoder->time = header.time;
+	decoder->frames++;
+	*type = header.type;
+	return size;
+}
@@ -0,0 +1,139 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+#ifndef SENSORD_FRAME_H
+#define SENSORD_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * The sensord streaming protocol, spoken on GET /stream of the query
+ * endpoint after the HTTP header. All fixed-size integers are little
+ * endian.
+ *
+ * header:    "SNSF", u8 version, u8 type, u16 count, u32 length (of the
+ *            payload), u32 sequence, s64 time
+ * topology:  string host, then count times { string name, string label,
+ *            string chip, string unit, u8 type }
+ * keyframe:  count times { varint index gap, value }, for every series
+ * delta:     the same, only for the series which changed since the
+ *            previous frame
+ *
+ * A string is a u8 length followed by that many bytes. A varint is an
+ * unsigned LEB128 number; the index gap is the index of the series minus
+ * the index of the previous one in the frame, plus one if there is none.
+ * A value is the IEEE 754 bits of a double XORed with the previous value
+ * of the series (zero in a keyframe): a control byte holding the number
+ * of leading zero bytes in its upper and of trailing zero bytes in its
+ * lower four bits, followed by the remaining bytes, most significant
+ * first. Unknown values are NaN.
+ *
+ * A subscriber first gets a topology frame, then a keyframe; then one
+ * delta or keyframe per sweep. Sequence numbers go up by one per sweep;
+ * a gap means frames were dropped because the subscriber did not keep
+ * up, and deltas are to be ignored until the next keyframe. Keyframes are
+ * also sent periodically, and a new topology when the sensors change.
+ */
+
+#define FRAME_MAGIC "SNSF"
+#define FRAME_VERSION 2
+#define FRAME_HEADER_SIZE 24
+#define FRAME_STRING_MAX 255
+/* larger frames are a protocol error */
+#define FRAME_LENGTH_MAX (16 * 1024 * 1024)
+/* worst case size of one entry of a keyframe or delta */
+#define FRAME_VALUE_MAX (5 + 1 + 8)
+
+typedef enum {
+	FrameType_topology = 1,
+	FrameType_key,
+	FrameType_delta
+} FrameType;
+
+struct frameHeader {
+	int version;
+	int type;
+	unsigned int count;
+	uint32_t length;
+	uint32_t seq;
+	int64_t time;
+};
+
+/* Encoding */
+
+struct frameSeriesInfo {
+	const char *name;
+	const char *label;
+	const char *chip;
+	const char *unit;
+	int type;
+};
+
+extern size_t frameTopologyMax(const char *host,
+			       const struct frameSeriesInfo *series, int count);
+extern size_t frameEncodeTopology(unsigned char *buf, uint32_t seq,
+				  int64_t time, const char *host,
+				  const struct frameSeriesInfo *series,
+				  int count);
+extern size_t frameEncodeValues(unsigned char *buf, FrameType type,
+				uint32_t seq, int64_t time,
+				const double *values, uint64_t *prev,
+				int count);
+
+/* Decoding */
+
+struct frameSeries {
+	char *name;
+	char *label;
+	char *chip;
+	char *unit;
+	int type;
+	double value;
+	int changed;		/* by the last frame */
+};
+
+enum {
+	FrameSync_topology,	/* waiting for a topology */
+	FrameSync_key,		/* waiting for a keyframe */
+	FrameSync_ok
+};
+
+struct frameDecoder {
+	int sync;
+	uint32_t seq;
+	int64_t time;
+	char host[FRAME_STRING_MAX + 1];
+	int numSeries;
+	struct frameSeries *series;
+	uint64_t *bits;
+	unsigned long frames;
+	unsigned long lost;	/* sweeps missed, from sequence gaps */
+};
+
+extern void frameDecoderInit(struct frameDecoder *decoder);
+extern void frameDecoderFree(struct frameDecoder *decoder);
+extern int frameDecode(struct frameDecoder *decoder, const unsigned char *buf,
+		       size_t len, int *type);
+
+#endif	/* SENSORD_FRAME_H */
@@ -0,0 +1,332 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Host metrics, sampled in the same sweep as the sensors so that they
+ * share their timestamps: the load average, the frequency of every CPU,
+ * the pressure stall information and the thermal zones of the kernel.
+ *
+ * The files are discovered and opened once, along with the series, and
+ * then re-read with pread() at every sweep; a file holding several
+ * metrics (such as /proc/pressure/io) is only read once per sweep.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "args.h"
+#include "sensord.h"
+
+#define HOST_TEXT_MAX 256
+
+typedef struct {
+	char *path;
+	int fd;
+	unsigned int sweep;	/* when text was read */
+	int status;		/* of that read */
+	char text[HOST_TEXT_MAX];
+} HostFile;
+
+HostMetric *hostMetrics;
+int numHostMetrics;
+
+static HostFile *files;
+static int numFiles;
+static unsigned int sweep = 1;
+
+static int addFile(const char *path)
+{
+	HostFile *file;
+	int i, fd;
+
+	for (i = 0; i < numFiles; i++)
+		if (!strcmp(files[i].path, path))
+			return i;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	file = realloc(files, (numFiles + 1) * sizeof(*files));
+	if (!file) {
+		close(fd);
+		return -1;
+	}
+	files = file;
+	file = &files[numFiles];
+	memset(file, 0, sizeof(*file));
+	file->path = strdup(path);
+	file->fd = fd;
+	if (!file->path) {
+		close(fd);
+		return -1;
+	}
+	return numFiles++;
+}
+
+static int addMetric(const char *path, const char *name, const char *label,
+		     DataType type, const char *unit, const char *key,
+		     double scale)
+{
+	HostMetric *metric;
+	int file;
+
+	file = addFile(path);
+	if (file < 0)
+		return -1;
+	metric = realloc(hostMetrics,
+			 (numHostMetrics + 1) * sizeof(*hostMetrics));
+	if (!metric)
+		return -1;
+	hostMetrics = metric;
+	metric = &hostMetrics[numHostMetrics];
+	metric->name = strdup(name);
+	metric->label = strdup(label);
+	if (!metric->name || !metric->label) {
+		free(metric->name);
+		free(metric->label);
+		return -1;
+	}
+	metric->type = type;
+	metric->unit = unit;
+	metric->file = file;
+	metric->key = key;
+	metric->scale = scale;
+	numHostMetrics++;
+	return 0;
+}
+
+static int compareInts(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* The numbers n of the entries called <prefix>n, sorted */
+static int numberedEntries(const char *dir, const char *prefix, int **numbers)
+{
+	struct dirent *entry;
+	size_t len = strlen(prefix);
+	int count = 0, *n;
+	char *end;
+	long number;
+	DIR *d;
+
+	*numbers = NULL;
+	d = opendir(dir);
+	if (!d)
+		return 0;
+	while ((entry = readdir(d))) {
+		if (strncmp(entry->d_name, prefix, len))
+			continue;
+		number = strtol(entry->d_name + len, &end, 10);
+		if (end == entry->d_name + len || *end || number < 0)
+			continue;
+		n = realloc(*numbers, (count + 1) * sizeof(**numbers));
+		if (!n)
+			break;
+		*numbers = n;
+		n[count++] = number;
+	}
+	closedir(d);
+
+	qsort(*numbers, count, sizeof(**numbers), compareInts);
+	return count;
+}
+
+static void addCpuFreq(void)
+{
+	char path[128], name[RAW_LABEL_LENGTH + 1], label[64];
+	int i, count, *cpus;
+
+	count = numberedEntries("/sys/devices/system/cpu", "cpu", &cpus);
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/"
+			 "cpufreq/scaling_cur_freq", cpus[i]);
+		snprintf(name, sizeof(name), "cpu%d_freq", cpus[i]);
+		snprintf(label, sizeof(label), "CPU%d Frequency", cpus[i]);
+		/* kHz to MHz */
+		addMetric(path, name, label, DataType_other, "MHz", NULL,
+			  0.001);
+	}
+	free(cpus);
+}
+
+/* "some avg10=1.64 avg60=..." */
+static int parsePressure(const char *text, const char *key, double *value)
+{
+	size_t len = strlen(key);
+	const char *line, *avg;
+
+	for (line = text; line; line = strchr(line, '\n')) {
+		if (*line == '\n')
+			line++;
+		if (strncmp(line, key, len) || line[len] != ' ')
+			continue;
+		avg = strstr(line, "avg10=");
+		if (!avg)
+			return -1;
+		return sscanf(avg + 6, "%lf", value) == 1 ? 0 : -1;
+	}
+	return -1;
+}
+
+static void addPressure(void)
+{
+	static const char *resources[] = { "cpu", "memory", "io" };
+	static const char *kinds[] = { "some", "full" };
+	char path[64], name[RAW_LABEL_LENGTH + 1], label[64];
+	char text[HOST_TEXT_MAX];
+	double value;
+	size_t n;
+	FILE *f;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(resources); i++) {
+		snprintf(path, sizeof(path), "/proc/pressure/%s",
+			 resources[i]);
+		/* older kernels have no "full" line for the CPU */
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		n = fread(text, 1, sizeof(text) - 1, f);
+		text[n] = '\0';
+		fclose(f);
+
+		for (j = 0; j < ARRAY_SIZE(kinds); j++) {
+			if (parsePressure(text, kinds[j], &value))
+				continue;
+			snprintf(name, sizeof(name), "psi_%s_%s",
+				 resources[i], kinds[j]);
+			snprintf(label, sizeof(label), "Pressure %s %s",
+				 resources[i], kinds[j]);
+			addMetric(path, name, label, DataType_other, "%",
+				  kinds[j], 1);
+		}
+	}
+}
+
+static void addThermal(void)
+{
+	char path[128], name[RAW_LABEL_LENGTH + 1], label[64], type[32];
+	int i, count, *zones;
+	FILE *f;
+
+	count = numberedEntries("/sys/class/thermal", "thermal_zone", &zones);
+	for (i = 0; i < count; i++) {
+		snprintf(path, sizeof(path), "/sys/class/thermal/"
+			 "thermal_zone%d/type", zones[i]);
+		f = fopen(path, "r");
+		if (!f || !fgets(type, sizeof(type), f))
+			strcpy(type, "unknown");
+		if (f)
+			fclose(f);
+		type[strcspn(type, "\n")] = '\0';
+
+		snprintf(path, sizeof(path), "/sys/class/thermal/"
+			 "thermal_zone%d/temp", zones[i]);
+		snprintf(name, sizeof(name), "thermal_zone%d", zones[i]);
+		snprintf(label, sizeof(label), "Zone %d %s", zones[i], type);
+		addMetric(path, name, label, DataType_temperature, "C",
+			  NULL, 0.001);
+	}
+	free(zones);
+}
+
+int initHostMetrics(void)
+{
+	freeHostMetrics();
+
+	if ((sensord_args.hostMetrics & HOST_LOAD) &&
+	    addMetric("/proc/loadavg", LOADAVG, LOAD_AVERAGE,
+		      DataType_other, "", NULL, 1)) {
+		sensorLog(LOG_ERR, "Error opening `/proc/loadavg': %s",
+			  strerror(errno));
+		return 1;
+	}
+	if (sensord_args.hostMetrics & HOST_CPUFREQ)
+		addCpuFreq();
+	if (sensord_args.hostMetrics & HOST_PRESSURE)
+		addPressure();
+	if (sensord_args.hostMetrics & HOST_THERMAL)
+		addThermal();
+	return 0;
+}
+
+void freeHostMetrics(void)
+{
+	int i;
+
+	for (i = 0; i < numHostMetrics; i++) {
+		free(hostMetrics[i].name);
+		free(hostMetrics[i].label);
+	}
+	for (i = 0; i < numFiles; i++) {
+		close(files[i].fd);
+		free(files[i].path);
+	}
+	free(hostMetrics);
+	free(files);
+	hostMetrics = NULL;
+	files = NULL;
+	numHostMetrics = numFiles = 0;
+}
+
+/* The files are read again in the next sweep */
+void hostNewSweep(void)
+{
+	sweep++;
+}
+
+int readHostMetric(const HostMetric *metric, double *value)
+{
+	HostFile *file = &files[metric->file];
+	ssize_t n;
+
+	if (file->sweep != sweep) {
+		n = pread(file->fd, file->text, sizeof(file->text) - 1, 0);
+		if (n < 0) {
+			sensorLog(LOG_ERR, "Error reading `%s': %s",
+				  file->path, strerror(errno));
+			file->status = -1;
+		} else {
+			file->text[n] = '\0';
+			file->status = 0;
+		}
+		file->sweep = sweep;
+	}
+	if (file->status)
+		return 1;
+
+	if (metric->key ? parsePressure(file->text, metric->key, value) :
+	    sscanf(file->text, "%lf", value) != 1) {
+		sensorLog(LOG_ERR, "Error parsing `%s'", file->path);
+		return 2;
+	}
+	*value *= metric->scale;
+	return 0;
+}
@@ -29,11 +29,66 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "sensord.h"
 #include "lib/error.h"
 
-static int loadConfig(const char *cfgPath, int reload)
+/*
+ * The configuration file is read into memory, and parsed from there: the
+ * reload check and the switch then see the same contents, even if the
+ * file changes in between, and we can go back to the configuration in
+ * use if the switch fails anyway.
+ */
+static char *cfgData, *newCfgData;
+static size_t cfgSize, newCfgSize;
+
+static int readConfig(const char *cfgPath, char **data, size_t *size)
+{
+	FILE *fp;
+	char *buf = NULL, *tmp;
+	size_t len = 0, alloc = 0, n;
+
+	fp = fopen(cfgPath, "r");
+	if (!fp) {
+		sensorLog(LOG_ERR, "Error opening config file %s: %s",
+			  cfgPath, strerror(errno));
+		return -1;
+	}
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? 2 * alloc : 4096;
+			tmp = realloc(buf, alloc);
+			if (!tmp) {
+				sensorLog(LOG_ERR, "Error reading config file"
+					  " %s: %s", cfgPath, strerror(ENOMEM));
+				free(buf);
+				fclose(fp);
+				return -1;
+			}
+			buf = tmp;
+		}
+		n = fread(buf + len, 1, alloc - len, fp);
+		len += n;
+	} while (n);
+
+	if (ferror(fp)) {
+		sensorLog(LOG_ERR, "Error reading config file %s", cfgPath);
+		free(buf);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	*data = buf;
+	*size = len;
+	return 0;
+}
+
+static int loadConfig(const char *cfgPath, char *data, size_t size,
+		      int reload)
 {
 	int ret;
  	FILE *fp;
@@ -55,10 +110,10 @@ static int loadConfig(const char *cfgPath, int reload)
  		return 0;
  	}
 
- 	fp = fopen(cfgPath, "r");
+ 	fp = fmemopen(data, size, "r");
  	if (!fp) {
  		sensorLog(LOG_ERR, "Error opening config file %s: %s",
- 			  strerror(errno));
+ 			  cfgPath, strerror(errno));
  		return -1;
  	}
 
@@ -81,25 +136,134 @@ static int loadConfig(const char *cfgPath, int reload)
 int loadLib(const char *cfgPath)
 {
 	int ret;
-	ret = loadConfig(cfgPath, 0);
+
+	if (cfgPath && readConfig(cfgPath, &cfgData, &cfgSize))
+		return -1;
+	ret = loadConfig(cfgPath, cfgData, cfgSize, 0);
 	if (!ret)
 		ret = initKnownChips();
+	if (!ret)
+		ret = initKnownSeries();
 	return ret;
 }
 
-int reloadLib(const char *cfgPath)
+/*
+ * Reloading happens in two steps. First the new configuration is loaded
+ * in a child process, which has its own copy of the library state, so
+ * that a broken configuration file never affects the running daemon.
+ * Only if that succeeds do we switch over, between two sweeps. The chip
+ * and series tables point into the library state, so they can't outlive
+ * it: they are rebuilt after the switch, from the previous configuration
+ * if the new one fails to load after all.
+ */
+static pid_t checkPid = -1;
+
+int reloadLibStart(const char *cfgPath)
 {
-	int ret;
+	if (checkPid != -1)
+		return 0;	/* already in progress */
+
+	if (cfgPath && readConfig(cfgPath, &newCfgData, &newCfgSize))
+		return -1;
+
+	checkPid = fork();
+	if (checkPid == -1) {
+		sensorLog(LOG_ERR, "Error starting configuration check: %s",
+			  strerror(errno));
+		free(newCfgData);
+		newCfgData = NULL;
+		return -1;
+	}
+
+	if (!checkPid) {
+		int ret = loadConfig(cfgPath, newCfgData, newCfgSize, 1);
+		if (!ret)
+			ret = initKnownChips();
+		if (!ret)
+			ret = initKnownSeries();
+		_exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	sensorLog(LOG_INFO, "configuration check started");
+	return 0;
+}
+
+int reloadLibPending(void)
+{
+	return checkPid != -1;
+}
+
+static int switchConfig(const char *cfgPath, char *data, size_t size)
+{
+	freeKnownSeries();
 	freeKnownChips();
-	ret = loadConfig(cfgPath, 1);
-	if (!ret)
-		ret = initKnownChips();
-	return ret;
+	if (loadConfig(cfgPath, data, size, 1))
+		return -1;
+	if (initKnownChips() || initKnownSeries())
+		return -1;
+	return 0;
+}
+
+/*
+ * Returns 1 while the check runs, 0 once the chip and series tables were
+ * rebuilt (from the new configuration, or from the previous one if the
+ * switch failed), -1 if the check failed and nothing changed, and -2 if
+ * no configuration could be loaded at all, leaving the tables empty.
+ */
+int reloadLibPoll(const char *cfgPath)
+{
+	pid_t pid;
+	int status;
+
+	if (checkPid == -1)
+		return -1;
+
+	pid = waitpid(checkPid, &status, WNOHANG);
+	if (pid == 0)
+		return 1;
+	checkPid = -1;
+
+	if (pid == -1 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != EXIT_SUCCESS) {
+		sensorLog(LOG_NOTICE, "configuration check failed, keeping "
+			  "current configuration");
+		free(newCfgData);
+		newCfgData = NULL;
+		return -1;
+	}
+
+	if (!switchConfig(cfgPath, newCfgData, newCfgSize)) {
+		free(cfgData);
+		cfgData = newCfgData;
+		cfgSize = newCfgSize;
+		newCfgData = NULL;
+		sensorLog(LOG_INFO, "configuration reloaded");
+		return 0;
+	}
+	free(newCfgData);
+	newCfgData = NULL;
+
+	sensorLog(LOG_ERR, "configuration switch failed, going back to the "
+		  "previous configuration");
+	if (!switchConfig(cfgPath, cfgData, cfgSize))
+		return 0;
+
+	/* Leave valid (if empty) chip and series lists */
+	freeKnownSeries();
+	freeKnownChips();
+	if (!initKnownChips())
+		initKnownSeries();
+	sensorLog(LOG_ERR, "no configuration loaded, history and stream "
+		  "stopped until the next reload");
+	return -2;
 }
 
 int unloadLib(void)
 {
+	freeKnownSeries();
 	freeKnownChips();
 	sensors_cleanup();
+	free(cfgData);
+	cfgData = NULL;
 	return 0;
 }
@@ -0,0 +1,711 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Query endpoint: a minimal HTTP/1.0 server answering range queries over
+ * the stored history with JSON, for dashboards.
+ *
+ *   GET /series?select=temp*,fan1&start=-86400&end=0&resolution=300
+ *
+ * select is a comma-separated list of shell patterns matched against the
+ * series names (default: all). start and end are Unix times, or relative
+ * to now if not positive (default: the last hour). The answer comes from
+ * the coarsest archive whose step does not exceed the resolution: the
+ * history ring, the RRD base archive, or the hourly RRD rollups. The
+ * default resolution aims at about QUERY_POINTS points.
+ *
+ *   GET /stream
+ *
+ * turns the connection into a subscription: after the HTTP header, binary
+ * frames (see frame.h) are pushed at every stream interval: the topology
+ * of the series once, then only the values which changed, with periodic
+ * keyframes. A subscriber which does not keep up misses frames, and gets
+ * a keyframe once it has caught up.
+ *
+ *   GET /stats
+ *
+ * answers the self-metrics of stats.c: the duration, lateness and missed
+ * deadlines of every task, and the sweep duration histogram.
+ *
+ * Everything runs in the main loop: sockets are non-blocking, and an
+ * answer is built in memory and then sent as the socket accepts it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "args.h"
+#include "buffer.h"
+#include "frame.h"
+#include "sensord.h"
+
+#define QUERY_MAX_CLIENTS 32
+#define QUERY_REQUEST_MAX 2048
+#define QUERY_POINTS 150
+#define QUERY_HOUR 3600
+/* bytes not yet sent to a subscriber before frames are skipped */
+#define QUERY_STREAM_MAX (256 * 1024)
+/* sweeps between two keyframes */
+#define QUERY_KEY_EVERY 60
+
+struct client {
+	int fd;
+	char request[QUERY_REQUEST_MAX + 1];
+	size_t requestLen;
+	struct buffer answer;
+	size_t sent;
+	int subscriber;
+	int needTopology, needKey;
+};
+
+/* what the subscribers were last sent */
+static struct {
+	unsigned int generation;	/* of the series */
+	int count;
+	struct frameSeriesInfo *info;
+	char (*chips)[64];
+	double *values;
+	uint64_t *bits;			/* of the previous values */
+	uint32_t seq;
+	int sinceKey;
+} stream;
+
+static int listenFd = -1;
+static struct client clients[QUERY_MAX_CLIENTS];
+static int numClients;
+static char hostName[FRAME_STRING_MAX + 1];
+
+int queryInit(void)
+{
+	struct sockaddr_in addr;
+	int one = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(sensord_args.queryPort);
+	if (!inet_aton(sensord_args.queryAddress, &addr.sin_addr)) {
+		sensorLog(LOG_ERR, "Invalid query address %s",
+			  sensord_args.queryAddress);
+		return -1;
+	}
+
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		sensorLog(LOG_ERR, "Error creating query socket: %s",
+			  strerror(errno));
+		return -1;
+	}
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    listen(listenFd, 16) ||
+	    fcntl(listenFd, F_SETFL, O_NONBLOCK)) {
+		sensorLog(LOG_ERR, "Error listening on %s:%d: %s",
+			  sensord_args.queryAddress, sensord_args.queryPort,
+			  strerror(errno));
+		close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+
+	if (gethostname(hostName, sizeof(hostName) - 1))
+		strcpy(hostName, "localhost");
+
+	sensorLog(LOG_DEBUG, "query endpoint on %s:%d",
+		  sensord_args.queryAddress, sensord_args.queryPort);
+	return 0;
+}
+
+static void streamFree(void)
+{
+	free(stream.info);
+	free(stream.chips);
+	free(stream.values);
+	free(stream.bits);
+	memset(&stream, 0, sizeof(stream));
+}
+
+static void closeClient(int i)
+{
+	close(clients[i].fd);
+	free(clients[i].answer.data);
+	clients[i] = clients[--numClients];
+}
+
+void queryClose(void)
+{
+	while (numClients)
+		closeClient(0);
+	streamFree();
+	if (listenFd >= 0)
+		close(listenFd);
+	listenFd = -1;
+}
+
+static void acceptClients(void)
+{
+	struct client *client;
+	int fd;
+
+	while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+		if (numClients == QUERY_MAX_CLIENTS ||
+		    fcntl(fd, F_SETFL, O_NONBLOCK)) {
+			close(fd);
+			continue;
+		}
+		client = &clients[numClients++];
+		memset(client, 0, sizeof(*client));
+		client->fd = fd;
+	}
+}
+
+struct query {
+	char *select;
+	time_t start, end;
+	long resolution;
+};
+
+static int selected(const struct query *query, const char *name)
+{
+	char patterns[QUERY_REQUEST_MAX + 1], *pattern, *save;
+
+	if (!query->select || !*query->select)
+		return 1;
+	strcpy(patterns, query->select);
+	for (pattern = strtok_r(patterns, ",", &save); pattern;
+	     pattern = strtok_r(NULL, ",", &save))
+		if (!fnmatch(pattern, name, 0))
+			return 1;
+	return 0;
+}
+
+static const char *seriesLabel(const char *name)
+{
+	int i;
+
+	for (i = 0; i < numSeries; i++)
+		if (!strcmp(knownSeries[i].name, name))
+			return knownSeries[i].label;
+	return name;
+}
+
+/* Parse the query string; returns an error message or NULL */
+static const char *parseQuery(char *params, struct query *query)
+{
+	char *param, *value, *save, *end;
+	time_t now = time(NULL);
+	long n;
+
+	query->select = NULL;
+	query->start = -QUERY_HOUR;
+	query->end = 0;
+	query->resolution = 0;
+
+	for (param = strtok_r(params, "&", &save); param;
+	     param = strtok_r(NULL, "&", &save)) {
+		value = strchr(param, '=');
+		if (!value)
+			return "parameter without value";
+		*value++ = '\0';
+		urlDecode(value);
+
+		if (!strcmp(param, "select")) {
+			query->select = value;
+			continue;
+		}
+		n = strtol(value, &end, 10);
+		if (!*value || *end)
+			return "invalid number";
+		if (!strcmp(param, "start"))
+			query->start = n;
+		else if (!strcmp(param, "end"))
+			query->end = n;
+		else if (!strcmp(param, "resolution") && n > 0)
+			query->resolution = n;
+		else
+			return "unknown parameter";
+	}
+
+	if (query->start <= 0)
+		query->start += now;
+	if (query->end <= 0)
+		query->end += now;
+	if (query->start >= query->end)
+		return "empty time range";
+	if (!query->resolution)
+		query->resolution = (query->end - query->start) / QUERY_POINTS;
+	return NULL;
+}
+
+struct ringAnswer {
+	struct buffer *buf;
+	const struct query *query;
+	int column, first;
+};
+
+static void ringTime(void *data, time_t t, const double *values)
+{
+	struct ringAnswer *answer = data;
+
+	(void) values; /* no warning */
+	bufferPrintf(answer->buf, "%s%ld", answer->first ? "" : ",", (long)t);
+	answer->first = 0;
+}
+
+static void ringValue(void *data, time_t t, const double *values)
+{
+	struct ringAnswer *answer = data;
+
+	(void) t; /* no warning */
+	bufferValue(answer->buf, answer->first ? "" : ",",
+		    values[answer->column]);
+	answer->first = 0;
+}
+
+/* Raw samples from the history ring, one time stamp per sample */
+static void answerRing(struct buffer *buf, const struct query *query)
+{
+	struct ringAnswer answer = { buf, query, 0, 1 };
+	int i, first = 1;
+
+	bufferPrintf(buf, "{\"source\":\"history\",\"step\":%d,\"times\":[",
+		     sensord_args.historyTime);
+	ringFetch(query->start, query->end, ringTime, &answer);
+	bufferPrintf(buf, "],\"series\":[");
+
+	for (i = 0; i < numSeries; i++) {
+		if (!selected(query, knownSeries[i].name))
+			continue;
+		bufferPrintf(buf, "%s{\"name\":", first ? "" : ",");
+		bufferString(buf, knownSeries[i].name);
+		bufferPrintf(buf, ",\"label\":");
+		bufferString(buf, knownSeries[i].label);
+		bufferPrintf(buf, ",\"values\":[");
+		answer.column = i;
+		answer.first = 1;
+		ringFetch(query->start, query->end, ringValue, &answer);
+		bufferPrintf(buf, "]}");
+		first = 0;
+	}
+	bufferPrintf(buf, "]}\n");
+}
+
+static int answerRrd(struct buffer *buf, const struct query *query,
+		     unsigned long step)
+{
+	time_t start = query->start, end = query->end;
+	unsigned long count, rows, row, i;
+	char **names;
+	double *data;
+	int first = 1;
+
+	/* boundaries of the archive, for RRD to pick it */
+	start -= start % step;
+	end -= end % step;
+	if (end <= start)
+		end = start + step;
+	if (rrdFetch(&start, &end, &step, &count, &names, &data))
+		return -1;
+	rows = (end - start) / step;
+
+	bufferPrintf(buf, "{\"source\":\"rrd\",\"step\":%lu,\"times\":[",
+		     step);
+	for (row = 0; row < rows; row++)
+		bufferPrintf(buf, "%s%ld", row ? "," : "",
+			     (long)(start + (row + 1) * step));
+	bufferPrintf(buf, "],\"series\":[");
+
+	for (i = 0; i < count; i++) {
+		if (!selected(query, names[i]))
+			continue;
+		bufferPrintf(buf, "%s{\"name\":", first ? "" : ",");
+		bufferString(buf, names[i]);
+		bufferPrintf(buf, ",\"label\":");
+		bufferString(buf, seriesLabel(names[i]));
+		bufferPrintf(buf, ",\"values\":[");
+		for (row = 0; row < rows; row++)
+			bufferValue(buf, row ? "," : "",
+				    data[row * count + i]);
+		bufferPrintf(buf, "]}");
+		first = 0;
+	}
+	bufferPrintf(buf, "]}\n");
+
+	rrdFetchFree(count, names, data);
+	return 0;
+}
+
+/*
+ * Pick the coarsest archive which is at least as fine as the requested
+ * resolution, or the finest one if they are all coarser. Returns its step,
+ * 0 for the history ring, or -1 if there is no history at all.
+ */
+static long chooseArchive(const struct query *query)
+{
+	time_t oldest = ringOldest();
+	long best = -1;
+
+	/* the ring unless it starts too late and there is something else */
+	if (sensord_args.historyFile && oldest &&
+	    (query->start >= oldest || !sensord_args.rrdFile))
+		best = 0;
+	if (sensord_args.rrdFile) {
+		if (best < 0 || sensord_args.rrdTime <= query->resolution)
+			best = sensord_args.rrdTime;
+		if (sensord_args.rrdTime < QUERY_HOUR &&
+		    QUERY_HOUR <= query->resolution)
+			best = QUERY_HOUR;
+	}
+	return best;
+}
+
+static void answerRequest(struct client *client)
+{
+	struct buffer *buf = &client->answer;
+	struct query query;
+	char *path, *params, *end, none[] = "";
+	const char *error;
+	long archive;
+
+	path = client->request;
+	if (strncmp(path, "GET ", 4)) {
+		bufferError(buf, "405 Method Not Allowed", "only GET");
+		return;
+	}
+	path += 4;
+	end = strpbrk(path, " \r\n");
+	if (end)
+		*end = '\0';
+	params = strchr(path, '?');
+	if (params)
+		*params++ = '\0';
+
+	if (!strcmp(path, "/stream")) {
+		bufferPrintf(buf, "HTTP/1.0 200 OK\r\nContent-Type: "
+			     "application/octet-stream\r\n\r\n");
+		client->subscriber = 1;
+		client->needTopology = 1;
+		return;
+	}
+	if (!strcmp(path, "/stats")) {
+		char stats[4096];
+
+		if (statsJson(stats, sizeof(stats)) >= (int)sizeof(stats)) {
+			bufferError(buf, "500 Internal Server Error",
+				    "statistics too large");
+			return;
+		}
+		bufferPrintf(buf, "HTTP/1.0 200 OK\r\nContent-Type: "
+			     "application/json\r\nConnection: close\r\n\r\n%s",
+			     stats);
+		return;
+	}
+	if (strcmp(path, "/series")) {
+		bufferError(buf, "404 Not Found", "unknown path");
+		return;
+	}
+	if ((error = parseQuery(params ? params : none, &query))) {
+		bufferError(buf, "400 Bad Request", error);
+		return;
+	}
+
+	bufferPrintf(buf, "HTTP/1.0 200 OK\r\nContent-Type: application/json"
+		     "\r\nConnection: close\r\n\r\n");
+	archive = chooseArchive(&query);
+	if (archive < 0)
+		bufferError(buf, "404 Not Found", "no stored history");
+	else if (!archive)
+		answerRing(buf, &query);
+	else if (answerRrd(buf, &query, archive))
+		bufferError(buf, "500 Internal Server Error",
+			    "error reading RRD file");
+}
+
+static int readRequest(struct client *client)
+{
+	char discard[256];
+	ssize_t n;
+
+	/* subscribers have nothing more to say, but may hang up */
+	if (client->subscriber) {
+		n = read(client->fd, discard, sizeof(discard));
+		return n > 0 || (n < 0 && errno == EAGAIN) ? 0 : -1;
+	}
+
+	n = read(client->fd, client->request + client->requestLen,
+		 QUERY_REQUEST_MAX - client->requestLen);
+	if (n <= 0)
+		return n < 0 && errno == EAGAIN ? 0 : -1;
+	client->requestLen += n;
+	client->request[client->requestLen] = '\0';
+
+	/* only the request line matters, headers are ignored */
+	if (strstr(client->request, "\r\n\r\n") ||
+	    strstr(client->request, "\n\n") ||
+	    client->requestLen == QUERY_REQUEST_MAX)
+		answerRequest(client);
+	return 0;
+}
+
+static int writeAnswer(struct client *client)
+{
+	ssize_t n;
+
+	/* no SIGPIPE if the client went away */
+	n = send(client->fd, client->answer.data + client->sent,
+		 client->answer.len - client->sent, MSG_NOSIGNAL);
+	if (n < 0)
+		return errno == EAGAIN ? 0 : -1;
+	client->sent += n;
+	if (client->sent < client->answer.len)
+		return 0;
+	if (!client->subscriber)
+		return -1;
+	client->answer.len = client->sent = 0;
+	return 0;
+}
+
+/* Fill in the descriptors to wait for; returns their number */
+int queryFds(struct pollfd *fds, int size)
+{
+	int i, n = 0;
+
+	if (listenFd < 0 || size < 1 + numClients)
+		return 0;
+
+	fds[n].fd = listenFd;
+	fds[n++].events = POLLIN;
+	for (i = 0; i < numClients; i++) {
+		fds[n].fd = clients[i].fd;
+		fds[n++].events = clients[i].answer.len ? POLLOUT : POLLIN;
+	}
+	return n;
+}
+
+/* Serve the descriptors returned by queryFds() which are ready */
+void queryEvents(const struct pollfd *fds, int count)
+{
+	int i, j, ret;
+
+	if (!count)
+		return;
+
+	/* from the last one, as closing a client moves the last one */
+	for (i = count - 1; i > 0; i--) {
+		if (!fds[i].revents)
+			continue;
+		for (j = 0; j < numClients; j++)
+			if (clients[j].fd == fds[i].fd)
+				break;
+		if (j == numClients)
+			continue;
+
+		if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			ret = -1;
+		else if (fds[i].revents & POLLOUT)
+			ret = writeAnswer(&clients[j]);
+		else
+			ret = readRequest(&clients[j]);
+		if (ret)
+			closeClient(j);
+	}
+
+	if (fds[0].revents & POLLIN)
+		acceptClients();
+}
+
+static const char *seriesUnit(const SeriesDescriptor *series)
+{
+	if (series->host)
+		return series->host->unit;
+	switch (series->type) {
+	case DataType_voltage:
+		return "V";
+	case DataType_rpm:
+		return "RPM";
+	case DataType_temperature:
+		return "C";
+	default:
+		return "";
+	}
+}
+
+/* Describe the series again after they changed */
+static int streamSetup(void)
+{
+	const SeriesDescriptor *series;
+	int i;
+
+	streamFree();
+	stream.info = calloc(numSeries + 1, sizeof(*stream.info));
+	stream.chips = calloc(numSeries + 1, sizeof(*stream.chips));
+	stream.values = calloc(numSeries + 1, sizeof(*stream.values));
+	stream.bits = calloc(numSeries + 1, sizeof(*stream.bits));
+	if (!stream.info || !stream.chips || !stream.values || !stream.bits) {
+		streamFree();
+		return -1;
+	}
+
+	for (i = 0; i < numSeries && i < 0xffff; i++) {
+		series = &knownSeries[i];
+		if (series->chip &&
+		    sensors_snprintf_chip_name(stream.chips[i],
+					       sizeof(stream.chips[i]),
+					       series->chip) < 0)
+			stream.chips[i][0] = '\0';
+		stream.info[i].name = series->name;
+		stream.info[i].label = series->label;
+		stream.info[i].chip = stream.chips[i];
+		stream.info[i].unit = seriesUnit(series);
+		stream.info[i].type = series->type;
+	}
+	stream.count = i;
+	stream.generation = seriesGeneration;
+	stream.sinceKey = 0;
+	return 0;
+}
+
+static int frameBuffer(struct buffer *buf, size_t size)
+{
+	char *data;
+
+	if (size <= buf->size)
+		return 0;
+	data = realloc(buf->data, size);
+	if (!data)
+		return -1;
+	buf->data = data;
+	buf->size = size;
+	return 0;
+}
+
+/*
+ * Push the current value of every series to the subscribers: a delta with
+ * the values which changed since the previous sweep, or a keyframe for
+ * the subscribers which just came in, lost frames or every
+ * QUERY_KEY_EVERY sweeps, preceded by the topology if it is new to them.
+ * A subscriber which does not keep up misses frames rather than
+ * buffering without bound.
+ */
+int queryPush(void)
+{
+	static struct buffer topology, key, delta;
+	struct client *client;
+	time_t now;
+	size_t size;
+	int i, ret, subscribers = 0, needTopology = 0, needKey = 0;
+
+	for (i = 0; i < numClients; i++) {
+		subscribers += clients[i].subscriber;
+		needTopology |= clients[i].needTopology;
+		needKey |= clients[i].needKey;
+	}
+	if (!subscribers)
+		return 0;
+
+	ret = sampleSeries();
+
+	if (!stream.info || stream.generation != seriesGeneration) {
+		if (streamSetup())
+			return -1;
+		for (i = 0; i < numClients; i++) {
+			clients[i].needTopology = clients[i].subscriber;
+			needTopology |= clients[i].needTopology;
+		}
+	}
+	for (i = 0; i < stream.count; i++)
+		stream.values[i] = knownSeries[i].value;
+
+	size = FRAME_HEADER_SIZE + stream.count * FRAME_VALUE_MAX;
+	if (frameBuffer(&key, size) || frameBuffer(&delta, size))
+		return -1;
+
+	now = time(NULL);
+	stream.seq++;
+	if (++stream.sinceKey >= QUERY_KEY_EVERY) {
+		stream.sinceKey = 0;
+		for (i = 0; i < numClients; i++) {
+			clients[i].needKey = clients[i].subscriber;
+			needKey |= clients[i].needKey;
+		}
+	}
+	if (needTopology) {
+		size = frameTopologyMax(hostName, stream.info, stream.count);
+		if (frameBuffer(&topology, size))
+			return -1;
+		topology.len = frameEncodeTopology((unsigned char *)
+						   topology.data, stream.seq,
+						   now, hostName, stream.info,
+						   stream.count);
+	}
+	/* the delta updates the previous values, so it goes first */
+	delta.len = frameEncodeValues((unsigned char *)delta.data,
+				      FrameType_delta, stream.seq, now,
+				      stream.values, stream.bits,
+				      stream.count);
+	if (needTopology || needKey)
+		key.len = frameEncodeValues((unsigned char *)key.data,
+					    FrameType_key, stream.seq, now,
+					    stream.values, stream.bits,
+					    stream.count);
+
+	for (i = 0; i < numClients; i++) {
+		client = &clients[i];
+		if (!client->subscriber)
+			continue;
+		size = client->needKey || client->needTopology ?
+			key.len : delta.len;
+		if (client->needTopology)
+			size += topology.len;
+		if (client->answer.len - client->sent + size >
+		    QUERY_STREAM_MAX) {
+			/* the sequence gap tells the subscriber */
+			if (!client->needKey)
+				sensorLog(LOG_NOTICE, "Slow subscriber, "
+					  "skipping frames");
+			client->needKey = 1;
+			continue;
+		}
+		if (client->needTopology)
+			bufferAppend(&client->answer, topology.data,
+				     topology.len);
+		if (client->needKey || client->needTopology)
+			bufferAppend(&client->answer, key.data, key.len);
+		else
+			bufferAppend(&client->answer, delta.data, delta.len);
+		client->needTopology = client->needKey = 0;
+	}
+
+	return ret;
+}
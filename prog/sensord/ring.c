@@ -0,0 +1,452 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * History ring: the most recent raw samples of every series, kept in a
+ * fixed-size memory-mapped file so that they survive a restart of the
+ * daemon and can be inspected after a crash.
+ *
+ * The file starts with a versioned header, followed by the names of
+ * the series (one column each), followed by numSlots slots. A slot is
+ * a time stamp and one double per series. Writing a sample is a plain
+ * store into the mapping; the slot time stamp is written last and the
+ * sample counter incremented after it, so that a reader never sees a
+ * partially written slot as valid. Dirty pages are handed to the kernel
+ * with an asynchronous msync() once in a while.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "args.h"
+#include "sensord.h"
+
+#define RING_MAGIC "sensring"
+#define RING_VERSION 1
+
+/* seconds between two asynchronous flushes of the mapping */
+#define RING_FLUSH_TIME 60
+
+struct ringHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;	/* offset of the first slot */
+	uint32_t numSeries;
+	uint32_t numSlots;
+	uint32_t step;		/* nominal seconds between two samples */
+	uint32_t slotSize;
+	uint64_t count;		/* samples written since creation */
+};
+
+struct ringSlot {
+	int64_t time;		/* 0 if the slot was never written */
+	double values[];
+};
+
+struct ring {
+	struct ringHeader *header;
+	size_t size;
+};
+
+static struct ring ring;
+static time_t lastFlush;
+
+static size_t ringHeaderSize(uint32_t count)
+{
+	size_t size = sizeof(struct ringHeader) +
+		count * (RAW_LABEL_LENGTH + 1);
+
+	/* keep the slots aligned */
+	return (size + 7) & ~(size_t)7;
+}
+
+static char *ringName(struct ringHeader *header, uint32_t i)
+{
+	return (char *)(header + 1) + i * (RAW_LABEL_LENGTH + 1);
+}
+
+static struct ringSlot *ringSlot(struct ringHeader *header, uint64_t n)
+{
+	return (struct ringSlot *)((char *)header + header->headerSize +
+				   (n % header->numSlots) * header->slotSize);
+}
+
+static int ringValid(const struct ringHeader *header, size_t size)
+{
+	if (size < sizeof(struct ringHeader) ||
+	    memcmp(header->magic, RING_MAGIC, sizeof(header->magic)) ||
+	    header->version != RING_VERSION || !header->numSlots ||
+	    header->headerSize != ringHeaderSize(header->numSeries) ||
+	    header->slotSize != sizeof(struct ringSlot) +
+				header->numSeries * sizeof(double))
+		return 0;
+	return size >= header->headerSize +
+		(size_t)header->numSlots * header->slotSize;
+}
+
+static int ringMap(struct ring *r, const char *path, int writable)
+{
+	struct stat sb;
+	void *addr;
+	int fd;
+
+	fd = open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &sb)) {
+		close(fd);
+		return -1;
+	}
+	addr = mmap(NULL, sb.st_size, PROT_READ | (writable ? PROT_WRITE : 0),
+		    MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	r->header = addr;
+	r->size = sb.st_size;
+	return 0;
+}
+
+static void ringUnmap(struct ring *r)
+{
+	if (r->header)
+		munmap(r->header, r->size);
+	r->header = NULL;
+	r->size = 0;
+}
+
+/* Create an empty ring file for the current series at path */
+static int ringCreate(struct ring *r, const char *path)
+{
+	struct ringHeader *header;
+	uint32_t numSlots, i;
+	size_t headerSize, slotSize;
+	int fd;
+
+	numSlots = sensord_args.historyLength / sensord_args.historyTime;
+	if (!numSlots)
+		numSlots = 1;
+	headerSize = ringHeaderSize(numSeries);
+	slotSize = sizeof(struct ringSlot) + numSeries * sizeof(double);
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, headerSize + numSlots * slotSize)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	if (ringMap(r, path, 1))
+		return -1;
+
+	header = r->header;
+	header->version = RING_VERSION;
+	header->headerSize = headerSize;
+	header->numSeries = numSeries;
+	header->numSlots = numSlots;
+	header->step = sensord_args.historyTime;
+	header->slotSize = slotSize;
+	header->count = 0;
+	for (i = 0; i < header->numSeries; i++)
+		strcpy(ringName(header, i), knownSeries[i].name);
+	/* magic last, so that a half-initialized file is not valid */
+	memcpy(header->magic, RING_MAGIC, sizeof(header->magic));
+
+	return 0;
+}
+
+/* Does the old ring have exactly the layout we would create now? */
+static int ringMatches(struct ringHeader *header)
+{
+	uint32_t i, numSlots;
+
+	numSlots = sensord_args.historyLength / sensord_args.historyTime;
+	if (!numSlots)
+		numSlots = 1;
+	if (header->numSeries != (uint32_t)numSeries ||
+	    header->numSlots != numSlots ||
+	    header->step != (uint32_t)sensord_args.historyTime)
+		return 0;
+
+	for (i = 0; i < header->numSeries; i++)
+		if (strcmp(ringName(header, i), knownSeries[i].name))
+			return 0;
+	return 1;
+}
+
+/*
+ * Copy the most recent samples of the old ring into the new one, matching
+ * series by name. Series which do not exist in the old ring are unknown.
+ */
+static void ringMigrate(struct ringHeader *to, struct ringHeader *from)
+{
+	const struct ringSlot *src;
+	struct ringSlot *dst;
+	uint64_t n, first;
+	uint32_t i, j;
+	int *map;
+
+	map = malloc(to->numSeries * sizeof(int));
+	if (!map)
+		return;
+	for (i = 0; i < to->numSeries; i++) {
+		map[i] = -1;
+		for (j = 0; j < from->numSeries; j++) {
+			if (!strcmp(ringName(to, i), ringName(from, j))) {
+				map[i] = j;
+				break;
+			}
+		}
+	}
+
+	first = from->count > from->numSlots ? from->count - from->numSlots : 0;
+	if (from->count - first > to->numSlots)
+		first = from->count - to->numSlots;
+
+	for (n = first; n < from->count; n++) {
+		src = ringSlot(from, n);
+		if (!src->time)
+			continue;
+		dst = ringSlot(to, to->count);
+		for (i = 0; i < to->numSeries; i++)
+			dst->values[i] = map[i] < 0 ? NAN :
+				src->values[map[i]];
+		dst->time = src->time;
+		to->count++;
+	}
+
+	free(map);
+}
+
+int ringInit(void)
+{
+	struct ring old = { NULL, 0 };
+	char *tmpPath;
+	int ret;
+
+	sensorLog(LOG_DEBUG, "history ring init");
+
+	if (!ringMap(&old, sensord_args.historyFile, 1)) {
+		if (ringValid(old.header, old.size) &&
+		    ringMatches(old.header)) {
+			ring = old;
+			sensorLog(LOG_INFO, "Recovered %llu samples from "
+				  "history file %s", (unsigned long long)
+				  (ring.header->count < ring.header->numSlots ?
+				   ring.header->count : ring.header->numSlots),
+				  sensord_args.historyFile);
+			return 0;
+		}
+		if (!ringValid(old.header, old.size)) {
+			sensorLog(LOG_NOTICE, "Ignoring invalid history "
+				  "file %s", sensord_args.historyFile);
+			ringUnmap(&old);
+		}
+	} else if (errno != ENOENT && errno != EINVAL) {
+		/* EINVAL: empty file, which cannot be mapped */
+		sensorLog(LOG_ERR, "Error opening history file %s: %s",
+			  sensord_args.historyFile, strerror(errno));
+		return -1;
+	}
+
+	/* Build the new ring next to the old one and switch atomically */
+	tmpPath = malloc(strlen(sensord_args.historyFile) + 5);
+	if (!tmpPath) {
+		ringUnmap(&old);
+		return -1;
+	}
+	sprintf(tmpPath, "%s.new", sensord_args.historyFile);
+
+	ret = ringCreate(&ring, tmpPath);
+	if (ret) {
+		sensorLog(LOG_ERR, "Error creating history file %s: %s",
+			  tmpPath, strerror(errno));
+	} else {
+		if (old.header) {
+			ringMigrate(ring.header, old.header);
+			sensorLog(LOG_INFO, "Converted history file %s, "
+				  "kept %llu samples", sensord_args.historyFile,
+				  (unsigned long long)ring.header->count);
+		}
+		ret = rename(tmpPath, sensord_args.historyFile);
+		if (ret) {
+			sensorLog(LOG_ERR, "Error renaming %s: %s", tmpPath,
+				  strerror(errno));
+			ringUnmap(&ring);
+			unlink(tmpPath);
+		}
+	}
+
+	ringUnmap(&old);
+	free(tmpPath);
+	return ret;
+}
+
+int ringUpdate(void)
+{
+	struct ringHeader *header = ring.header;
+	struct ringSlot *slot;
+	uint32_t i;
+	time_t now;
+	int ret;
+
+	if (!header)
+		return -1;
+
+	ret = sampleSeries();
+	now = time(NULL);
+
+	slot = ringSlot(header, header->count);
+	slot->time = 0;
+	__sync_synchronize();
+	for (i = 0; i < header->numSeries; i++)
+		slot->values[i] = knownSeries[i].value;
+	__sync_synchronize();
+	slot->time = now;
+	__sync_synchronize();
+	header->count++;
+
+	if (now - lastFlush >= RING_FLUSH_TIME) {
+		if (msync(header, ring.size, MS_ASYNC))
+			sensorLog(LOG_ERR, "Error flushing history file: %s",
+				  strerror(errno));
+		lastFlush = now;
+	}
+
+	return ret;
+}
+
+void ringClose(void)
+{
+	if (ring.header)
+		msync(ring.header, ring.size, MS_SYNC);
+	ringUnmap(&ring);
+}
+
+/* Time of the oldest sample still in the ring, 0 if there is none */
+time_t ringOldest(void)
+{
+	struct ringHeader *header = ring.header;
+	uint64_t first;
+
+	if (!header || !header->count)
+		return 0;
+	first = header->count > header->numSlots ?
+		header->count - header->numSlots : 0;
+	return ringSlot(header, first)->time;
+}
+
+/*
+ * Call fn for every sample between start and end, oldest first. The values
+ * are in the order of knownSeries. Returns the number of samples, or -1
+ * if there is no ring.
+ */
+int ringFetch(time_t start, time_t end,
+	      void (*fn)(void *data, time_t t, const double *values),
+	      void *data)
+{
+	struct ringHeader *header = ring.header;
+	const struct ringSlot *slot;
+	uint64_t n, first;
+	int count = 0;
+
+	if (!header || header->numSeries != (uint32_t)numSeries)
+		return -1;
+
+	first = header->count > header->numSlots ?
+		header->count - header->numSlots : 0;
+	for (n = first; n < header->count; n++) {
+		slot = ringSlot(header, n);
+		if (slot->time < start || slot->time > end)
+			continue;
+		fn(data, slot->time, slot->values);
+		count++;
+	}
+
+	return count;
+}
+
+/* Print the content of a history file, oldest sample first */
+int ringDump(void)
+{
+	struct ring r = { NULL, 0 };
+	struct ringHeader *header;
+	const struct ringSlot *slot;
+	uint64_t n, first;
+	uint32_t i;
+
+	if (ringMap(&r, sensord_args.historyFile, 0)) {
+		fprintf(stderr, "Error opening history file %s: %s\n",
+			sensord_args.historyFile, strerror(errno));
+		return -1;
+	}
+	header = r.header;
+	if (!ringValid(header, r.size)) {
+		fprintf(stderr, "Error: %s is not a valid history file\n",
+			sensord_args.historyFile);
+		ringUnmap(&r);
+		return -1;
+	}
+
+	printf("# version %u, %u series, %u slots, step %us, "
+	       "%llu samples written\n", header->version, header->numSeries,
+	       header->numSlots, header->step,
+	       (unsigned long long)header->count);
+	printf("time");
+	for (i = 0; i < header->numSeries; i++)
+		printf(",%s", ringName(header, i));
+	printf("\n");
+
+	first = header->count > header->numSlots ?
+		header->count - header->numSlots : 0;
+	for (n = first; n < header->count; n++) {
+		slot = ringSlot(header, n);
+		if (!slot->time)
+			continue;
+		printf("%lld", (long long)slot->time);
+		for (i = 0; i < header->numSeries; i++) {
+			if (isnan(slot->values[i]))
+				printf(",U");
+			else
+				printf(",%g", slot->values[i]);
+		}
+		printf("\n");
+	}
+
+	ringUnmap(&r);
+	return 0;
+}
@@ -33,6 +33,8 @@
  */
 
 #include <errno.h>
+#include <math.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -46,97 +48,26 @@
 #include "args.h"
 #include "sensord.h"
 
-#define DO_READ 0
-#define DO_SCAN 1
-#define DO_SET 2
-#define DO_RRD 3
-
 /* one integer */
 #define STEP_BUFF 64
 /* RRA:AVERAGE:0.5:1:12345 */
 #define RRA_BUFF 256
 /* weak: max sensors for RRD .. TODO: fix */
 #define MAX_RRD_SENSORS 256
-/* weak: max raw label length .. TODO: fix */
-#define RAW_LABEL_LENGTH 32
 /* DS:label:GAUGE:900:U:U | :3000 .. TODO: fix */
 #define RRD_BUFF 64
 
-char rrdBuff[MAX_RRD_SENSORS * RRD_BUFF + 1];
+static char rrdBuff[MAX_RRD_SENSORS * RRD_BUFF + 1];
 static char rrdLabels[MAX_RRD_SENSORS][RAW_LABEL_LENGTH + 1];
 
-#define LOADAVG "loadavg"
-#define LOAD_AVERAGE "Load Average"
+/* data sources present in the RRD file, and the update template */
+static char rrdSources[MAX_RRD_SENSORS][RAW_LABEL_LENGTH + 1];
+static int rrdNumSources;
+static char rrdTemplate[MAX_RRD_SENSORS * (RAW_LABEL_LENGTH + 1) + 1];
 
 typedef void (*FeatureFN) (void *data, const char *rawLabel, const char *label,
 			   const FeatureDescriptor *feature);
 
-static char rrdNextChar(char c)
-{
-	if (c == '9') {
-		return 'A';
-	} else if (c == 'Z') {
-		return 'a';
-	} else if (c == 'z') {
-		return 0;
-	} else {
-		return c + 1;
-	}
-}
-
-static void rrdCheckLabel(const char *rawLabel, int index0)
-{
-	char *buffer = rrdLabels[index0];
-	int i, j, okay;
-
-	i = 0;
-	/* contrain raw label to [A-Za-z0-9_] */
-	while ((i < RAW_LABEL_LENGTH) && rawLabel[i]) {
-		char c = rawLabel[i];
-		if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))
-		    || ((c >= '0') && (c <= '9')) || (c == '_')) {
-			buffer[i] = c;
-		} else {
-			buffer[i] = '_';
-		}
-		++i;
-	}
-	buffer[i] = '\0';
-
-	j = 0;
-	okay = (i > 0);
-
-	/* locate duplicates */
-	while (okay && (j < index0))
-		okay = strcmp(rrdLabels[j++], buffer);
-
-	/* uniquify duplicate labels with _? or _?? */
-	while (!okay) {
-		if (!buffer[i]) {
-			if (i > RAW_LABEL_LENGTH - 3)
-				i = RAW_LABEL_LENGTH - 3;
-			buffer[i] = '_';
-			buffer[i + 1] = '0';
-			buffer[i + 2] = '\0';
-		} else if (!buffer[i + 2]) {
-			if (!(buffer[i + 1] = rrdNextChar(buffer[i + 1]))) {
-				buffer[i + 1] = '0';
-				buffer[i + 2] = '0';
-				buffer[i + 3] = '\0';
-			}
-		} else {
-			if (!(buffer[i + 2] = rrdNextChar(buffer[i + 2]))) {
-				buffer[i + 1] = rrdNextChar(buffer[i + 1]);
-				buffer[i + 2] = '0';
-			}
-		}
-		j = 0;
-		okay = 1;
-		while (okay && (j < index0))
-			okay = strcmp(rrdLabels[j ++], buffer);
-	}
-}
-
 /* Returns the number of features processed, or -1 on error */
 static int _applyToFeatures(FeatureFN fn, void *data,
 			    const sensors_chip_name *chip,
@@ -160,7 +91,7 @@ static int _applyToFeatures(FeatureFN fn, void *data,
 			return -1;
 		}
 
-		rrdCheckLabel(rawLabel, labelOffset + i);
+		checkLabel(rrdLabels, rawLabel, labelOffset + i);
 		fn(data, rrdLabels[labelOffset + i], label, feature);
 		free(label);
 	}
@@ -254,21 +185,122 @@ static void rrdGetSensors_DS(void *_data, const char *rawLabel,
 
 static int rrdGetSensors(const char **argv)
 {
-	int ret = 0;
+	int ret = 0, i;
 	struct ds data = { 0, argv};
 	ret = applyToFeatures(rrdGetSensors_DS, &data);
-	if (!ret && sensord_args.doLoad)
-		rrdGetSensors_DS(&data, LOADAVG, LOAD_AVERAGE, NULL);
+	for (i = 0; !ret && i < numSeries && data.num < MAX_RRD_SENSORS; i++)
+		if (knownSeries[i].host)
+			rrdGetSensors_DS(&data, knownSeries[i].name,
+					 knownSeries[i].label, NULL);
 	return ret ? -1 : data.num;
 }
 
+/* Learn the names of the data sources from the RRD file itself */
+static int rrdLoadSources(void)
+{
+	time_t start, end;
+	unsigned long step, ds_cnt, i;
+	char **ds_namv;
+	rrd_value_t *data;
+	const char *argv[] = {
+		"sensord", sensord_args.rrdFile,
+		sensord_args.rrdNoAverage ? "LAST" : "AVERAGE", NULL
+	};
+
+	if (rrd_fetch(3, (char **) /* WEAK */ argv, &start, &end, &step,
+		      &ds_cnt, &ds_namv, &data) == -1) {
+		sensorLog(LOG_ERR, "Error reading RRD file: %s: %s",
+			  sensord_args.rrdFile, rrd_get_error());
+		return -1;
+	}
+
+	rrdNumSources = 0;
+	for (i = 0; i < ds_cnt; i++) {
+		if (rrdNumSources < MAX_RRD_SENSORS) {
+			snprintf(rrdSources[rrdNumSources], RAW_LABEL_LENGTH + 1,
+				 "%s", ds_namv[i]);
+			rrdNumSources++;
+		}
+		free(ds_namv[i]);
+	}
+	free(ds_namv);
+	free(data);
+
+	return 0;
+}
+
+static int rrdHasSource(const char *name)
+{
+	int i;
+
+	for (i = 0; i < rrdNumSources; i++)
+		if (!strcmp(rrdSources[i], name))
+			return 1;
+	return 0;
+}
+
+/*
+ * Updates name the data sources explicitly, so sensors which appear or
+ * disappear (for example after a configuration reload) do not break the
+ * updates of the others. Warn about the ones which can't be recorded.
+ */
+void rrdCheckSeries(void)
+{
+	int i;
+
+	for (i = 0; i < numSeries; i++)
+		if (!rrdHasSource(knownSeries[i].name))
+			sensorLog(LOG_NOTICE, "Sensor %s is not in RRD file "
+				  "%s, not recorded", knownSeries[i].name,
+				  sensord_args.rrdFile);
+}
+
+/*
+ * Read [start, end] from the archive closest to the given resolution; RRD
+ * moves start and end to the boundaries of the archive it picked. The
+ * values are row-major, one row per step, and freed by rrdFetchFree().
+ */
+int rrdFetch(time_t *start, time_t *end, unsigned long *step,
+	     unsigned long *count, char ***names, double **data)
+{
+	char startBuff[STEP_BUFF], endBuff[STEP_BUFF], stepBuff[STEP_BUFF];
+	const char *argv[] = {
+		"sensord", sensord_args.rrdFile,
+		sensord_args.rrdNoAverage ? "LAST" : "AVERAGE",
+		"-r", stepBuff, "-s", startBuff, "-e", endBuff, NULL
+	};
+
+	sprintf(stepBuff, "%lu", *step);
+	sprintf(startBuff, "%ld", (long)*start);
+	sprintf(endBuff, "%ld", (long)*end);
+
+	rrd_clear_error();
+	if (rrd_fetch(9, (char **) /* WEAK */ argv, start, end, step, count,
+		      names, data) == -1) {
+		sensorLog(LOG_ERR, "Error reading RRD file: %s: %s",
+			  sensord_args.rrdFile, rrd_get_error());
+		return -1;
+	}
+	return 0;
+}
+
+void rrdFetchFree(unsigned long count, char **names, double *data)
+{
+	unsigned long i;
+
+	for (i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+	free(data);
+}
+
 int rrdInit(void)
 {
 	int ret;
 	struct stat sb;
-	char stepBuff[STEP_BUFF], rraBuff[RRA_BUFF];
+	char stepBuff[STEP_BUFF], rraBuff[RRA_BUFF], hourBuff[RRA_BUFF];
 	int argc = 4, num;
-	const char *argv[6 + MAX_RRD_SENSORS] = {
+	const char *argv[7 + MAX_RRD_SENSORS] = {
 		"sensord", sensord_args.rrdFile, "-s", stepBuff
 	};
 
@@ -297,6 +329,14 @@ int rrdInit(void)
 
 		argc += num;
 		argv[argc++] = rraBuff;
+		/* hourly rollups for a year, for queries over long ranges */
+		if (sensord_args.rrdTime < 3600 &&
+		    !(3600 % sensord_args.rrdTime)) {
+			sprintf(hourBuff, "RRA:%s:%f:%d:%d",
+				sensord_args.rrdNoAverage ? "LAST" : "AVERAGE",
+				0.5, 3600 / sensord_args.rrdTime, 366 * 24);
+			argv[argc++] = hourBuff;
+		}
 		argv[argc] = NULL;
 
 		ret = rrd_create(argc, (char**) argv);
@@ -307,12 +347,15 @@ int rrdInit(void)
 		}
 	}
 
+	if (rrdLoadSources())
+		return -1;
+	rrdCheckSeries();
+
 	sensorLog(LOG_DEBUG, "sensor RRD initialized");
 	return 0;
 }
 
 #define RRDCGI "/usr/bin/rrdcgi"
-#define WWWDIR "/sensord"
 
 struct gr {
 	DataType type;
@@ -427,44 +470,226 @@ static struct gr graphs[] = {
 	}
 };
 
+/* The load average goes with the temperatures, which it drives */
+static int rrdIsLoadAvg(const SeriesDescriptor *series)
+{
+	return series->host && !strcmp(series->host->name, LOADAVG);
+}
+
+static void rrdCGI_hostMetrics(struct gr *graph, FeatureFN fn)
+{
+	const SeriesDescriptor *series;
+	int i;
+
+	for (i = 0; i < numSeries; i++) {
+		series = &knownSeries[i];
+		if (series->host && (series->type == graph->type ||
+				     (graph->loadAvg && rrdIsLoadAvg(series))))
+			fn(graph, series->name, series->label, NULL);
+	}
+}
+
 int rrdUpdate(void)
 {
-	int ret = rrdChips ();
-
-	if (!ret && sensord_args.doLoad) {
-		FILE *loadavg;
-		if (!(loadavg = fopen("/proc/loadavg", "r"))) {
-			sensorLog(LOG_ERR,
-				  "Error opening `/proc/loadavg': %s",
-				  strerror(errno));
-			ret = 1;
-		} else {
-			float value;
-			if (fscanf(loadavg, "%f", &value) != 1) {
-				sensorLog(LOG_ERR,
-					  "Error reading load average");
-				ret = 2;
-			} else {
-				sprintf(rrdBuff + strlen(rrdBuff), ":%f",
-					value);
-			}
-			fclose(loadavg);
-		}
+	const SeriesDescriptor *series;
+	const char *value;
+	char *tmpl = rrdTemplate;
+	char *vals = rrdBuff;
+	int i, num = 0, ret;
+
+	ret = sampleSeries();
+
+	vals += sprintf(vals, "N");
+	for (i = 0; i < numSeries && num < MAX_RRD_SENSORS; i++) {
+		series = &knownSeries[i];
+		if (!rrdHasSource(series->name))
+			continue;
+
+		if (isnan(series->value))
+			value = "U";
+		else if (series->feature)
+			value = series->feature->rrd(&series->value);
+		else
+			value = NULL;
+
+		tmpl += sprintf(tmpl, "%s%s", num ? ":" : "", series->name);
+		if (value)
+			vals += sprintf(vals, ":%s", value);
+		else
+			vals += sprintf(vals, ":%f", series->value);
+		num++;
 	}
-	if (!ret) {
+
+	if (!num) {
+		sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
+			  sensord_args.rrdFile, "No sensors to record");
+		return -1;
+	} else {
 		const char *argv[] = {
-			"sensord", sensord_args.rrdFile, rrdBuff, NULL
+			"sensord", "-t", rrdTemplate, sensord_args.rrdFile,
+			rrdBuff, NULL
 		};
-		if ((ret = rrd_update(3, (char **) /* WEAK */ argv))) {
+		double start = statsNow();
+
+		if (rrd_update(5, (char **) /* WEAK */ argv)) {
 			sensorLog(LOG_ERR, "Error updating RRD file: %s: %s",
 				  sensord_args.rrdFile, rrd_get_error());
+			ret = -1;
 		}
+		statsRrdUpdate(statsNow() - start);
 	}
 	sensorLog(LOG_DEBUG, "sensor rrd updated");
 
 	return ret;
 }
 
+/* Graph arguments are built per render, and freed afterwards */
+static char *rrdGraphArg(const char *fmt, ...)
+{
+	va_list ap;
+	char *arg;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	arg = malloc(len + 1);
+	if (!arg)
+		return NULL;
+	va_start(ap, fmt);
+	vsnprintf(arg, len + 1, fmt, ap);
+	va_end(ap);
+	return arg;
+}
+
+/* Labels are free text, but a colon ends a field in a graph element */
+static void rrdGraphEscape(char *buffer, size_t size, const char *label)
+{
+	size_t i = 0;
+
+	for (; *label && i + 2 < size; label++) {
+		if (*label == ':')
+			buffer[i++] = '\\';
+		buffer[i++] = *label;
+	}
+	buffer[i] = '\0';
+}
+
+static int rrdGraphOne(const struct gr *graph)
+{
+	const SeriesDescriptor *series;
+	const char **argv;
+	char **elems, *options, *opt, *tmpPath = NULL, *path = NULL;
+	char label[2 * RAW_LABEL_LENGTH + 1], **prdata = NULL;
+	int argc = 0, num = 0, i, xsize, ysize, ret = -1;
+	double ymin, ymax;
+
+	/* fixed arguments, the options, and two elements per series */
+	argv = calloc(32 + 2 * numSeries, sizeof(char *));
+	elems = calloc(2 * numSeries + 1, sizeof(char *));
+	options = strdup(graph->options);
+	path = rrdGraphArg("%s/%s.png", sensord_args.graphDir, graph->image);
+	tmpPath = rrdGraphArg("%s/%s.png.new", sensord_args.graphDir,
+			      graph->image);
+	if (!argv || !elems || !options || !path || !tmpPath)
+		goto out;
+
+	argv[argc++] = "sensord";
+	argv[argc++] = tmpPath;
+	argv[argc++] = "-a";
+	argv[argc++] = "PNG";
+	argv[argc++] = "-h";
+	argv[argc++] = "200";
+	argv[argc++] = "-w";
+	argv[argc++] = "800";
+	argv[argc++] = "-v";
+	argv[argc++] = graph->axisTitle;
+	argv[argc++] = "-t";
+	argv[argc++] = graph->title;
+	argv[argc++] = "-x";
+	argv[argc++] = graph->axisDefn;
+	for (opt = strtok(options, " "); opt && argc < 30;
+	     opt = strtok(NULL, " "))
+		argv[argc++] = opt;
+
+	for (i = 0; i < numSeries; i++) {
+		series = &knownSeries[i];
+		if (!rrdHasSource(series->name) ||
+		    (series->type != graph->type &&
+		     !(graph->loadAvg && rrdIsLoadAvg(series))))
+			continue;
+
+		rrdGraphEscape(label, sizeof(label), series->label);
+		elems[num++] = rrdGraphArg("DEF:%s=%s:%s:%s", series->name,
+					   sensord_args.rrdFile, series->name,
+					   sensord_args.rrdNoAverage ?
+					   "LAST" : "AVERAGE");
+		elems[num++] = rrdGraphArg("LINE2:%s#%.6x:%s", series->name,
+					   rrdCGI_color(series->label), label);
+		if (!elems[num - 2] || !elems[num - 1])
+			goto out;
+		argv[argc++] = elems[num - 2];
+		argv[argc++] = elems[num - 1];
+	}
+	if (!num) {
+		/* nothing of this type, don't keep a stale graph around */
+		unlink(path);
+		ret = 0;
+		goto out;
+	}
+
+	rrd_clear_error();
+	if (rrd_graph(argc, (char **) /* WEAK */ argv, &prdata, &xsize,
+		      &ysize, NULL, &ymin, &ymax)) {
+		sensorLog(LOG_ERR, "Error rendering graph %s: %s", path,
+			  rrd_get_error());
+		unlink(tmpPath);
+		goto out;
+	}
+	if (prdata) {
+		for (i = 0; prdata[i]; i++)
+			free(prdata[i]);
+		free(prdata);
+	}
+
+	/* viewers always see a complete image */
+	if (rename(tmpPath, path)) {
+		sensorLog(LOG_ERR, "Error renaming %s: %s", tmpPath,
+			  strerror(errno));
+		unlink(tmpPath);
+		goto out;
+	}
+	ret = 0;
+
+out:
+	for (i = 0; i < num; i++)
+		free(elems[i]);
+	free(elems);
+	free(argv);
+	free(options);
+	free(tmpPath);
+	free(path);
+	return ret;
+}
+
+/*
+ * Render all graphs into the graph directory, once per interval for all
+ * viewers, instead of on every page view.
+ */
+int rrdGraph(void)
+{
+	int i, ret = 0;
+
+	sensorLog(LOG_DEBUG, "sensor graphs started");
+	for (i = 0; i < ARRAY_SIZE(graphs); i++)
+		if (rrdGraphOne(&graphs[i]))
+			ret = -1;
+	sensorLog(LOG_DEBUG, "sensor graphs finished");
+
+	return ret;
+}
+
 int rrdCGI(void)
 {
 	int ret = 0, i;
@@ -478,21 +703,22 @@ int rrdCGI(void)
 
 		printf("<h2>%s</h2>\n", graph->h2);
 		printf("<p>\n<RRD::GRAPH %s/%s.png\n\t--imginfo '"
-		       "<img src=" WWWDIR "/%%s width=%%lu height=%%lu>'"
+		       "<img src=%s/%%s width=%%lu height=%%lu>'"
 		       "\n\t-a PNG\n\t-h 200 -w 800\n",
-		       sensord_args.cgiDir, graph->image);
+		       sensord_args.cgiDir, graph->image,
+		       sensord_args.graphUrl);
 
 		printf("\t--lazy\n\t-v '%s'\n\t-t '%s'\n\t-x '%s'\n\t%s",
 		       graph->axisTitle, graph->title, graph->axisDefn,
 		       graph->options);
 		if (!ret)
 			ret = applyToFeatures(rrdCGI_DEF, graph);
-		if (!ret && sensord_args.doLoad && graph->loadAvg)
-			rrdCGI_DEF(graph, LOADAVG, LOAD_AVERAGE, NULL);
+		if (!ret)
+			rrdCGI_hostMetrics(graph, rrdCGI_DEF);
 		if (!ret)
 			ret = applyToFeatures(rrdCGI_LINE, graph);
-		if (!ret && sensord_args.doLoad && graph->loadAvg)
-			rrdCGI_LINE(graph, LOADAVG, LOAD_AVERAGE, NULL);
+		if (!ret)
+			rrdCGI_hostMetrics(graph, rrdCGI_LINE);
 		printf (">\n</p>\n");
 	}
 	printf("<p>\n<small><b>sensord</b> by "
@@ -505,3 +731,53 @@ int rrdCGI(void)
 
 	return ret;
 }
+
+/* Single-quotes a string for the shell */
+static void rrdShellQuote(const char *s)
+{
+	putchar('\'');
+	for (; *s; s++) {
+		if (*s == '\'')
+			fputs("'\\''", stdout);
+		else
+			putchar(*s);
+	}
+	putchar('\'');
+}
+
+/*
+ * A CGI script which serves a static page, showing the graphs rendered
+ * by the daemon. It does not need rrdcgi, and costs nothing per view.
+ * Graphs the daemon removed, having no series of their type, are left
+ * out of the page when it is served.
+ */
+int rrdStaticCGI(void)
+{
+	int i;
+
+	printf("#!/bin/sh\n\n"
+	       "printf 'Content-Type: text/html\\n\\n'\n"
+	       "cat <<'EOF'\n<html>\n"
+	       "<head>\n<title>sensord</title>\n"
+	       "<meta http-equiv=\"refresh\" content=\"%d\">\n</head>\n"
+	       "<body>\n<h1>sensord</h1>\nEOF\n", sensord_args.graphTime);
+
+	for (i = 0; i < ARRAY_SIZE(graphs); i++) {
+		printf("if [ -e ");
+		rrdShellQuote(sensord_args.graphDir);
+		printf("/%s.png ]; then cat <<'EOF'\n"
+		       "<h2>%s</h2>\n<p>\n<img src=\"%s/%s.png\">\n</p>\n"
+		       "EOF\nfi\n", graphs[i].image, graphs[i].h2,
+		       sensord_args.graphUrl, graphs[i].image);
+	}
+
+	printf("cat <<'EOF'\n<p>\n<small><b>sensord</b> by "
+	       "<a href=\"mailto:merlin@merlin.org\">Merlin Hughes</a>"
+	       ", all credit to the "
+	       "<a href=\"http://www.lm-sensors.org/\">lm_sensors</a> "
+	       "crew.</small>\n</p>\n");
+
+	printf("</body>\n</html>\nEOF\n");
+
+	return 0;
+}
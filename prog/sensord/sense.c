@@ -30,10 +30,10 @@
 #include "sensord.h"
 #include "lib/error.h"
 
-#define DO_READ 0
-#define DO_SCAN 1
-#define DO_SET 2
-#define DO_RRD 3
+/* actions; DO_READ and DO_SCAN can be combined into a single sweep */
+#define DO_READ 1
+#define DO_SCAN 2
+#define DO_SET 4
 
 static const char *chipName(const sensors_chip_name *chip)
 {
@@ -94,7 +94,7 @@ static int do_features(const sensors_chip_name *chip,
 	alrm = get_flag(chip, feature->alarmNumber);
 	if (alrm == -1)
 		return -1;
-	if (action == DO_SCAN && !alrm)
+	if (!(action & DO_READ) && !alrm)
 		return 0;
 
 	for (i = 0; feature->dataNumbers[i] >= 0; i++) {
@@ -109,18 +109,6 @@ static int do_features(const sensors_chip_name *chip,
 		}
 	}
 
-	/* For RRD, we don't need anything else */
-	if (action == DO_RRD) {
-		if (feature->rrd) {
-			const char *rrded = feature->rrd(val);
-
-			sprintf(rrdBuff + strlen(rrdBuff), ":%s",
-				rrded ? rrded : "U");
-		}
-
-		return 0;
-	}
-
 	/* For scanning and logging, we need extra information */
 	beep = get_flag(chip, feature->beepNumber);
 	if (beep == -1)
@@ -142,9 +130,9 @@ static int do_features(const sensors_chip_name *chip,
 		return -1;
 	}
 
-	if (action == DO_READ)
+	if (action & DO_READ)
 		sensorLog(LOG_INFO, "  %s: %s", label, formatted);
-	else
+	if ((action & DO_SCAN) && alrm)
 		sensorLog(LOG_ALERT, "Sensor alarm: Chip %s: %s: %s",
 			  chipName(chip), label, formatted);
 
@@ -159,7 +147,7 @@ static int doKnownChip(const sensors_chip_name *chip,
 	const FeatureDescriptor *features = descriptor->features;
 	int i, ret = 0;
 
-	if (action == DO_READ) {
+	if (action & DO_READ) {
 		ret = idChip(chip);
 		if (ret)
 			return ret;
@@ -193,7 +181,7 @@ static int setChip(const sensors_chip_name *chip)
 static int doChip(const sensors_chip_name *chip, int action)
 {
 	int ret = 0;
-	if (action == DO_SET) {
+	if (action & DO_SET) {
 		ret = setChip(chip);
 	} else {
 		int index0, chipindex = -1;
@@ -211,8 +199,12 @@ static int doChip(const sensors_chip_name *chip, int action)
 		}
 
 		if (chipindex >= 0) {
+			double start = statsNow();
+
 			ret = doKnownChip(chip, &knownChips[chipindex],
 					  action);
+			statsAdd(&knownChips[chipindex].readTime,
+				 statsNow() - start);
 		}
 	}
 	return ret;
@@ -257,28 +249,25 @@ int scanChips(void)
 	return ret;
 }
 
-int setChips(void)
+/* Log all readings and alert on alarms, reading every sensor only once */
+int readScanChips(void)
 {
 	int ret = 0;
 
-	sensorLog(LOG_DEBUG, "sensor set started");
-	ret = doChips(DO_SET);
-	sensorLog(LOG_DEBUG, "sensor set finished");
+	sensorLog(LOG_DEBUG, "sensor read and sweep started");
+	ret = doChips(DO_READ | DO_SCAN);
+	sensorLog(LOG_DEBUG, "sensor read and sweep finished");
 
 	return ret;
 }
 
-/* TODO: loadavg entry */
-
-int rrdChips(void)
+int setChips(void)
 {
 	int ret = 0;
 
-	strcpy(rrdBuff, "N");
-
-	sensorLog(LOG_DEBUG, "sensor rrd started");
-	ret = doChips(DO_RRD);
-	sensorLog(LOG_DEBUG, "sensor rrd finished");
+	sensorLog(LOG_DEBUG, "sensor set started");
+	ret = doChips(DO_SET);
+	sensorLog(LOG_DEBUG, "sensor set finished");
 
 	return ret;
 }
@@ -24,12 +24,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <limits.h>
 #include <string.h>
+#include <poll.h>
 #include <signal.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/prctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -40,6 +41,10 @@ static int logOpened = 0;
 
 static volatile sig_atomic_t done = 0;
 static volatile sig_atomic_t reload = 0;
+static volatile sig_atomic_t dumpStats = 0;
+
+/* a configuration reload failed, and left no series to record */
+static int noConfig = 0;
 
 #define LOG_BUFFER 4096
 
@@ -72,67 +77,306 @@ static void signalHandler(int sig)
 	case SIGHUP:
 		reload = 1;
 		break;
+	case SIGUSR1:
+		dumpStats = 1;
+		break;
+	}
+}
+
+/*
+ * Periodic tasks. Deadlines are wall-clock times in seconds. With
+ * --align, every task runs on multiples of its interval, so tasks with
+ * related intervals (and other programs doing the same) wake up the
+ * CPU together. The RRD update is always aligned, as RRD expects, and
+ * so is graph rendering, which must follow an update.
+ */
+struct task {
+	TaskId id;		/* Task_count: not measured */
+	int strict;		/* never run before the deadline */
+	int (*run)(void);
+	const char *error;
+	int interval;		/* 0 if disabled */
+	time_t next;
+};
+
+static int logStats(void)
+{
+	statsLog();
+	return 0;
+}
+
+static struct task tasks[] = {
+	{ Task_scan, 0, scanChips, "sensor scan error (%d)", 0, 0 },
+	{ Task_log, 0, readChips, "sensor read error (%d)", 0, 0 },
+	{ Task_history, 0, ringUpdate, "history update error (%d)", 0, 0 },
+	{ Task_rrd, 1, rrdUpdate, "rrd update error (%d)", 0, 0 },
+	{ Task_graph, 1, rrdGraph, "rrd graph error (%d)", 0, 0 },
+	{ Task_stream, 0, queryPush, "stream error (%d)", 0, 0 },
+	{ Task_anomaly, 0, anomalyUpdate, "anomaly detection error (%d)", 0, 0 },
+	{ Task_count, 0, logStats, NULL, 0, 0 },
+};
+
+static struct task *findTask(TaskId id)
+{
+	struct task *task;
+
+	for (task = tasks; task->id != id; task++)
+		;
+	return task;
+}
+
+/* Task_count is the statistics task */
+static int taskInterval(TaskId id)
+{
+	switch (id) {
+	case Task_scan:
+		return sensord_args.scanTime;
+	case Task_log:
+		return sensord_args.logTime;
+	case Task_rrd:
+		return sensord_args.rrdFile ? sensord_args.rrdTime : 0;
+	case Task_history:
+		return sensord_args.historyFile ? sensord_args.historyTime : 0;
+	case Task_graph:
+		return sensord_args.graphDir ? sensord_args.graphTime : 0;
+	case Task_stream:
+		return sensord_args.queryPort ? sensord_args.streamTime : 0;
+	case Task_anomaly:
+		return sensord_args.anomalyTime;
+	case Task_count:
+		return sensord_args.statsTime;
+	}
+	return 0;
+}
+
+static time_t taskNext(const struct task *task, time_t from)
+{
+	if (sensord_args.doAlign || task->strict)
+		return from - from % task->interval + task->interval;
+	return from + task->interval;
+}
+
+static void initTasks(time_t now)
+{
+	struct task *task;
+
+	for (task = tasks; task < tasks + ARRAY_SIZE(tasks); task++) {
+		task->interval = taskInterval(task->id);
+		/*
+		 * First RRD update at next RRD timeslot to prevent failures
+		 * due one timeslot updated twice on restart for example.
+		 * Statistics are only logged after a full interval.
+		 */
+		if (task->strict || task->id == Task_count)
+			task->next = task->interval ? taskNext(task, now) : 0;
+		else
+			task->next = now;
+	}
+}
+
+static int taskDue(const struct task *task, time_t now)
+{
+	if (!task->interval)
+		return 0;
+	return task->next <= now + (task->strict ? 0 : sensord_args.slackTime);
+}
+
+static void advanceTask(struct task *task, time_t now)
+{
+	time_t limit = now + (task->strict ? 0 : sensord_args.slackTime);
+
+	/* we may have run early (slack) or late (slow sweep) */
+	task->next = taskNext(task, task->next > now ? task->next : now);
+	/* do not run again for a deadline this sweep already covered */
+	while (task->next <= limit)
+		task->next = taskNext(task, task->next);
+}
+
+/*
+ * Run every task due now or within the slack window in a single sweep.
+ * The tasks share one reading of the series, and a scan due together
+ * with a log is folded into it, as logging reads all sensors anyway.
+ */
+static int runTasks(time_t now)
+{
+	struct task *task;
+	int (*run)(void);
+	int scanDue = taskDue(findTask(Task_scan), now);
+	int logDue = taskDue(findTask(Task_log), now);
+	int ret = 0;
+
+	newSweep();
+
+	for (task = tasks; task < tasks + ARRAY_SIZE(tasks); task++) {
+		if (!taskDue(task, now))
+			continue;
+		if (noConfig && (task->id == Task_history ||
+				 task->id == Task_stream)) {
+			advanceTask(task, now);
+			continue;
+		}
+
+		run = task->run;
+		if (task->id == Task_scan && logDue) {
+			advanceTask(task, now);
+			continue;
+		}
+		if (task->id == Task_log && scanDue)
+			run = readScanChips;
+
+		if (task->id != Task_count)
+			statsTaskBegin(task->id, task->interval);
+		if ((ret = run()))
+			sensorLog(LOG_NOTICE, task->error, ret);
+		if (task->id != Task_count)
+			statsTaskEnd(task->id);
+		advanceTask(task, now);
+	}
+
+	return ret;
+}
+
+static time_t nextWakeup(time_t now)
+{
+	const struct task *task;
+	time_t next = 0;
+
+	for (task = tasks; task < tasks + ARRAY_SIZE(tasks); task++) {
+		if (!task->interval)
+			continue;
+		if (!next || task->next < next)
+			next = task->next;
 	}
+
+	return next ? next : now + 3600;
+}
+
+/*
+ * Publish the time of the next wakeup, so that other periodic jobs on
+ * this host can run in the same one. Only written when it changes.
+ */
+static void writeWakeup(time_t next)
+{
+	static time_t written;
+	char *tmpPath;
+	FILE *file;
+
+	if (!sensord_args.wakeupFile || next == written)
+		return;
+
+	tmpPath = malloc(strlen(sensord_args.wakeupFile) + 5);
+	if (!tmpPath)
+		return;
+	sprintf(tmpPath, "%s.new", sensord_args.wakeupFile);
+
+	if (!(file = fopen(tmpPath, "w"))) {
+		sensorLog(LOG_ERR, "Error opening %s: %s", tmpPath,
+			  strerror(errno));
+	} else {
+		fprintf(file, "%ld\n", (long)next);
+		if (fclose(file) || rename(tmpPath, sensord_args.wakeupFile))
+			sensorLog(LOG_ERR, "Error writing %s: %s",
+				  sensord_args.wakeupFile, strerror(errno));
+		else
+			written = next;
+	}
+
+	free(tmpPath);
+}
+
+/*
+ * Sleep until the given wall-clock time, or until a query came in or a
+ * signal arrived; then we look again.
+ */
+static void waitUntil(time_t next)
+{
+	struct pollfd fds[64];
+	struct timespec ts;
+	long timeout;
+	int n;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	timeout = (next - ts.tv_sec) * 1000 - ts.tv_nsec / 1000000;
+	if (timeout < 0)
+		timeout = 0;
+
+	n = queryFds(fds, ARRAY_SIZE(fds));
+	if (poll(fds, n, timeout) > 0)
+		queryEvents(fds, n);
+}
+
+/* Follow the new series after a configuration reload */
+static void reloaded(int status)
+{
+	int ret;
+
+	if (status == -2) {
+		/* Do not convert the history to the empty series */
+		ringClose();
+		noConfig = 1;
+		return;
+	}
+	if (status)
+		return;
+
+	noConfig = 0;
+	/* The series may have changed, convert the history */
+	if (sensord_args.historyFile) {
+		ringClose();
+		if ((ret = ringInit()))
+			sensorLog(LOG_NOTICE, "history file error (%d)", ret);
+	}
+	if (sensord_args.rrdFile)
+		rrdCheckSeries();
 }
 
 static int sensord(void)
 {
+	struct task *task;
+	time_t now, next;
 	int ret = 0;
-	int scanValue = 0, logValue = 0;
-	/*
-	 * First RRD update at next RRD timeslot to prevent failures due
-	 * one timeslot updated twice on restart for example.
-	 */
-	int rrdValue = sensord_args.rrdTime - time(NULL) %
-		sensord_args.rrdTime;
 
 	sensorLog(LOG_INFO, "sensord started");
 
+	/* let the kernel batch our timer with other wakeups */
+	if (sensord_args.slackTime &&
+	    prctl(PR_SET_TIMERSLACK, sensord_args.slackTime * 1000000000UL))
+		sensorLog(LOG_NOTICE, "Error setting timer slack: %s",
+			  strerror(errno));
+
+	initTasks(time(NULL));
+
 	while (!done) {
 		if (reload) {
-			ret = reloadLib(sensord_args.cfgFile);
-			if (ret)
+			if ((ret = reloadLibStart(sensord_args.cfgFile)))
 				sensorLog(LOG_NOTICE, "configuration reload"
 					  " error");
 			reload = 0;
 		}
-		if (sensord_args.scanTime && (scanValue <= 0)) {
-			if ((ret = scanChips()))
-				sensorLog(LOG_NOTICE,
-					  "sensor scan error (%d)", ret);
-			scanValue += sensord_args.scanTime;
-		}
-		if (sensord_args.logTime && (logValue <= 0)) {
-			if ((ret = readChips()))
-				sensorLog(LOG_NOTICE,
-					  "sensor read error (%d)", ret);
-			logValue += sensord_args.logTime;
-		}
-		if (sensord_args.rrdTime && sensord_args.rrdFile &&
-		    (rrdValue <= 0)) {
-			if ((ret = rrdUpdate()))
-				sensorLog(LOG_NOTICE,
-					  "rrd update error (%d)", ret);
-			/*
-			 * The amount of time to wait is computed using the
-			 * same method as in RRD instead of simply adding the
-			 * interval.
-			 */
-			rrdValue = sensord_args.rrdTime - time(NULL) %
-				sensord_args.rrdTime;
-		}
-		if (!done) {
-			int a = sensord_args.logTime ? logValue : INT_MAX;
-			int b = sensord_args.scanTime ? scanValue : INT_MAX;
-			int c = (sensord_args.rrdTime && sensord_args.rrdFile)
-				? rrdValue : INT_MAX;
-			int sleepTime = (a < b) ? ((a < c) ? a : c) :
-				((b < c) ? b : c);
-			sleep(sleepTime);
-			scanValue -= sleepTime;
-			logValue -= sleepTime;
-			rrdValue -= sleepTime;
+		if (reloadLibPending())
+			reloaded(reloadLibPoll(sensord_args.cfgFile));
+		if (dumpStats) {
+			statsLog();
+			dumpStats = 0;
 		}
+
+		now = time(NULL);
+		/* the clock went back: do not wait for the old deadlines */
+		for (task = tasks; task < tasks + ARRAY_SIZE(tasks); task++)
+			if (task->interval && task->next > now + task->interval)
+				task->next = taskNext(task, now);
+
+		ret = runTasks(now);
+		if (done)
+			break;
+
+		next = nextWakeup(now);
+		writeWakeup(next);
+		/* check for the end of a configuration check */
+		if (reloadLibPending() && next > time(NULL) + 1)
+			next = time(NULL) + 1;
+
+		waitUntil(next);
 	}
 
 	sensorLog(LOG_INFO, "sensord stopped");
@@ -169,6 +413,13 @@ static void install_sighandler(void)
 			strerror(errno));
 		exit(EXIT_FAILURE);
 	}
+
+	ret = sigaction(SIGUSR1, &new, NULL);
+	if (ret == -1) {
+		fprintf(stderr, "Could not set sighandler for SIGUSR1: %s\n",
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 }
 
 static void daemonize(void)
@@ -237,6 +488,20 @@ int main(int argc, char **argv)
 	    parseChips(argc, argv))
 		exit(EXIT_FAILURE);
 
+	/* Post-mortem inspection, does not need the library */
+	if (sensord_args.doDumpHistory) {
+		ret = ringDump();
+		freeChips();
+		exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	/* The page only refers to the graphs rendered by the daemon */
+	if (sensord_args.doStaticCGI) {
+		ret = rrdStaticCGI();
+		freeChips();
+		exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
 	if (loadLib(sensord_args.cfgFile)) {
 		freeChips();
 		exit(EXIT_FAILURE);
@@ -256,9 +521,17 @@ int main(int argc, char **argv)
 	if (sensord_args.doCGI) {
 		ret = rrdCGI();
 	} else {
+		if ((sensord_args.historyFile && ringInit()) ||
+		    (sensord_args.queryPort && queryInit())) {
+			freeChips();
+			exit(EXIT_FAILURE);
+		}
 		daemonize();
 		ret = sensord();
 		undaemonize();
+		queryClose();
+		ringClose();
+		anomalyClose();
 	}
 
 	freeChips();
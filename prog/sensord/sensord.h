@@ -21,6 +21,8 @@
  * MA 02110-1301 USA.
  */
 
+#include <time.h>
+
 #include "lib/sensors.h"
 
 #define ARRAY_SIZE(arr)	(int)(sizeof(arr) / sizeof((arr)[0]))
@@ -36,22 +38,29 @@ extern void freeChips(void);
 /* from lib.c */
 
 extern int loadLib(const char *cfgPath);
-extern int reloadLib(const char *cfgPath);
+extern int reloadLibStart(const char *cfgPath);
+extern int reloadLibPending(void);
+extern int reloadLibPoll(const char *cfgPath);
 extern int unloadLib(void);
 
 /* from sense.c */
 
 extern int readChips(void);
 extern int scanChips(void);
+extern int readScanChips(void);
 extern int setChips(void);
-extern int rrdChips(void);
 
 /* from rrd.c */
 
-extern char rrdBuff[];
 extern int rrdInit(void);
+extern void rrdCheckSeries(void);
 extern int rrdUpdate(void);
+extern int rrdFetch(time_t *start, time_t *end, unsigned long *step,
+		    unsigned long *count, char ***names, double **data);
+extern void rrdFetchFree(unsigned long count, char **names, double *data);
+extern int rrdGraph(void);
 extern int rrdCGI(void);
+extern int rrdStaticCGI(void);
 
 /* from chips.c */
 
@@ -79,11 +88,113 @@ typedef struct {
 	int dataNumbers[MAX_DATA + 1];
 } FeatureDescriptor;
 
+typedef struct {
+	unsigned long count;
+	double total;		/* seconds */
+	double max;
+} TimeStats;
+
 typedef struct {
 	const sensors_chip_name *name;
 	FeatureDescriptor *features;
+	TimeStats readTime;
 } ChipDescriptor;
 
 extern ChipDescriptor * knownChips;
 extern int initKnownChips(void);
 extern void freeKnownChips(void);
+
+/* from host.c */
+
+typedef struct {
+	char *name;
+	char *label;
+	DataType type;
+	const char *unit;
+	int file;
+	const char *key;		/* of a pressure line, or NULL */
+	double scale;
+} HostMetric;
+
+extern HostMetric *hostMetrics;
+extern int numHostMetrics;
+extern int initHostMetrics(void);
+extern void freeHostMetrics(void);
+extern void hostNewSweep(void);
+extern int readHostMetric(const HostMetric *metric, double *value);
+
+/* from series.c */
+
+/* weak: max raw label length .. TODO: fix */
+#define RAW_LABEL_LENGTH 32
+
+#define LOADAVG "loadavg"
+#define LOAD_AVERAGE "Load Average"
+
+typedef struct {
+	const sensors_chip_name *chip;	/* NULL for host metrics */
+	ChipDescriptor *desc;
+	const FeatureDescriptor *feature;
+	const HostMetric *host;		/* NULL for chip features */
+	DataType type;
+	const char *name;		/* unique raw label, as used in RRD */
+	char *label;
+	double value;			/* last sample, NaN if unknown */
+} SeriesDescriptor;
+
+extern SeriesDescriptor *knownSeries;
+extern int numSeries;
+extern unsigned int seriesGeneration;
+extern void checkLabel(char labels[][RAW_LABEL_LENGTH + 1],
+		       const char *rawLabel, int index0);
+extern int initKnownSeries(void);
+extern void freeKnownSeries(void);
+extern void newSweep(void);
+extern int sampleSeries(void);
+
+/* from ring.c */
+
+extern int ringInit(void);
+extern int ringUpdate(void);
+extern void ringClose(void);
+extern time_t ringOldest(void);
+extern int ringFetch(time_t start, time_t end,
+		     void (*fn)(void *data, time_t t, const double *values),
+		     void *data);
+extern int ringDump(void);
+
+/* from anomaly.c */
+
+extern int anomalyUpdate(void);
+extern void anomalyClose(void);
+
+/* from query.c */
+
+struct pollfd;
+
+extern int queryInit(void);
+extern void queryClose(void);
+extern int queryFds(struct pollfd *fds, int size);
+extern void queryEvents(const struct pollfd *fds, int count);
+extern int queryPush(void);
+
+/* from stats.c */
+
+typedef enum {
+	Task_scan = 0,
+	Task_log,
+	Task_rrd,
+	Task_history,
+	Task_graph,
+	Task_stream,
+	Task_anomaly,
+	Task_count
+} TaskId;
+
+extern double statsNow(void);
+extern void statsAdd(TimeStats *stats, double seconds);
+extern void statsTaskBegin(TaskId id, int interval);
+extern void statsTaskEnd(TaskId id);
+extern void statsRrdUpdate(double seconds);
+extern void statsLog(void);
+extern int statsJson(char *buf, size_t size);
@@ -0,0 +1,281 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * A series is one numeric value sampled per sweep: the main input of
+ * every feature that is also stored in the RRD, plus the requested host
+ * metrics (see host.c). Series are enumerated in the same order, and named
+ * with the same raw labels, as the RRD data sources.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "args.h"
+#include "sensord.h"
+#include "lib/error.h"
+
+SeriesDescriptor *knownSeries;
+int numSeries;
+/* bumped whenever the series table is rebuilt */
+unsigned int seriesGeneration;
+
+static char (*seriesNames)[RAW_LABEL_LENGTH + 1];
+
+/* tasks running in the same sweep share one reading of every series */
+static int sampled, sampleStatus;
+
+void newSweep(void)
+{
+	sampled = 0;
+	hostNewSweep();
+}
+
+static char nextLabelChar(char c)
+{
+	if (c == '9') {
+		return 'A';
+	} else if (c == 'Z') {
+		return 'a';
+	} else if (c == 'z') {
+		return 0;
+	} else {
+		return c + 1;
+	}
+}
+
+void checkLabel(char labels[][RAW_LABEL_LENGTH + 1], const char *rawLabel,
+		int index0)
+{
+	char *buffer = labels[index0];
+	int i, j, okay;
+
+	i = 0;
+	/* contrain raw label to [A-Za-z0-9_] */
+	while ((i < RAW_LABEL_LENGTH) && rawLabel[i]) {
+		char c = rawLabel[i];
+		if (((c >= 'A') && (c <= 'Z')) || ((c >= 'a') && (c <= 'z'))
+		    || ((c >= '0') && (c <= '9')) || (c == '_')) {
+			buffer[i] = c;
+		} else {
+			buffer[i] = '_';
+		}
+		++i;
+	}
+	buffer[i] = '\0';
+
+	j = 0;
+	okay = (i > 0);
+
+	/* locate duplicates */
+	while (okay && (j < index0))
+		okay = strcmp(labels[j++], buffer);
+
+	/* uniquify duplicate labels with _? or _?? */
+	while (!okay) {
+		if (!buffer[i]) {
+			if (i > RAW_LABEL_LENGTH - 3)
+				i = RAW_LABEL_LENGTH - 3;
+			buffer[i] = '_';
+			buffer[i + 1] = '0';
+			buffer[i + 2] = '\0';
+		} else if (!buffer[i + 2]) {
+			if (!(buffer[i + 1] = nextLabelChar(buffer[i + 1]))) {
+				buffer[i + 1] = '0';
+				buffer[i + 2] = '0';
+				buffer[i + 3] = '\0';
+			}
+		} else {
+			if (!(buffer[i + 2] = nextLabelChar(buffer[i + 2]))) {
+				buffer[i + 1] = nextLabelChar(buffer[i + 1]);
+				buffer[i + 2] = '0';
+			}
+		}
+		j = 0;
+		okay = 1;
+		while (okay && (j < index0))
+			okay = strcmp(labels[j ++], buffer);
+	}
+}
+
+/* Calls fn for every series-worthy feature and metric; returns the count */
+static int enumerateSeries(void (*fn)(int index0, ChipDescriptor *desc,
+				      const FeatureDescriptor *feature,
+				      const HostMetric *host))
+{
+	const sensors_chip_name *chip, *chip_arg;
+	const FeatureDescriptor *features;
+	int i, j, k, n, count = 0;
+
+	for (j = 0; j < sensord_args.numChipNames; j++) {
+		chip_arg = &sensord_args.chipNames[j];
+		i = 0;
+		while ((chip = sensors_get_detected_chips(chip_arg, &i))) {
+			for (n = 0; knownChips[n].features; n++)
+				if (knownChips[n].name == chip)
+					break;
+			features = knownChips[n].features;
+			if (!features)
+				continue;
+
+			for (k = 0; features[k].format; k++) {
+				if (!features[k].rrd)
+					continue;
+				if (fn)
+					fn(count, &knownChips[n],
+					   &features[k], NULL);
+				count++;
+			}
+		}
+	}
+	for (n = 0; n < numHostMetrics; n++) {
+		if (fn)
+			fn(count, NULL, NULL, &hostMetrics[n]);
+		count++;
+	}
+	return count;
+}
+
+static void fillSeries(int index0, ChipDescriptor *desc,
+		       const FeatureDescriptor *feature, const HostMetric *host)
+{
+	SeriesDescriptor *series = &knownSeries[index0];
+
+	series->chip = desc ? desc->name : NULL;
+	series->desc = desc;
+	series->feature = feature;
+	series->host = host;
+	series->name = seriesNames[index0];
+	series->value = NAN;
+	if (feature) {
+		series->type = feature->type;
+		series->label = sensors_get_label(series->chip,
+						  feature->feature);
+		checkLabel(seriesNames, feature->feature->name, index0);
+	} else {
+		series->type = host->type;
+		series->label = strdup(host->label);
+		checkLabel(seriesNames, host->name, index0);
+	}
+}
+
+int initKnownSeries(void)
+{
+	int i, count;
+
+	if (initHostMetrics())
+		return 1;
+	count = enumerateSeries(NULL);
+
+	knownSeries = calloc(count + 1, sizeof(SeriesDescriptor));
+	seriesNames = calloc(count + 1, sizeof(*seriesNames));
+	if (!knownSeries || !seriesNames) {
+		free(knownSeries);
+		free(seriesNames);
+		knownSeries = NULL;
+		seriesNames = NULL;
+		freeHostMetrics();
+		return 1;
+	}
+
+	numSeries = enumerateSeries(fillSeries);
+	for (i = 0; i < numSeries; i++) {
+		if (!knownSeries[i].label) {
+			sensorLog(LOG_ERR, "Error getting sensor label: %s",
+				  knownSeries[i].name);
+			freeKnownSeries();
+			return 1;
+		}
+	}
+
+	seriesGeneration++;
+	return 0;
+}
+
+void freeKnownSeries(void)
+{
+	int i;
+
+	for (i = 0; i < numSeries; i++)
+		free(knownSeries[i].label);
+	free(knownSeries);
+	free(seriesNames);
+	knownSeries = NULL;
+	seriesNames = NULL;
+	numSeries = 0;
+	freeHostMetrics();
+}
+
+/* Reads the current value of every series; unreadable ones become NaN */
+int sampleSeries(void)
+{
+	SeriesDescriptor *series;
+	ChipDescriptor *desc = NULL;
+	double start = 0;
+	int i, err, ret = 0;
+
+	if (sampled)
+		return sampleStatus;
+
+	for (i = 0; i < numSeries; i++) {
+		series = &knownSeries[i];
+
+		/* series of one chip are contiguous */
+		if (series->desc != desc) {
+			if (desc)
+				statsAdd(&desc->readTime, statsNow() - start);
+			desc = series->desc;
+			start = statsNow();
+		}
+
+		if (series->host) {
+			if (readHostMetric(series->host, &series->value)) {
+				series->value = NAN;
+				ret = 1;
+			}
+			continue;
+		}
+
+		err = sensors_get_value(series->chip,
+					series->feature->dataNumbers[0],
+					&series->value);
+		if (err) {
+			sensorLog(LOG_ERR, "Error getting sensor data: "
+				  "%s/#%d: %s", series->chip->prefix,
+				  series->feature->dataNumbers[0],
+				  sensors_strerror(err));
+			series->value = NAN;
+			ret = 1;
+		}
+	}
+	if (desc)
+		statsAdd(&desc->readTime, statsNow() - start);
+
+	sampled = 1;
+	sampleStatus = ret;
+	return ret;
+}
@@ -0,0 +1,253 @@
+/*
+ * sensord-soak.so
+ *
+ * Preloaded into sensord by sensord-soak: shows it a synthetic sysfs
+ * tree instead of /sys, with slow and failing sensor reads.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Every path under /sys is looked up under $SENSORD_SOAK_ROOT instead,
+ * and statfs() of /sys claims it is sysfs, so that libsensors and sensord
+ * run unmodified and unprivileged. Reads of the *_input attributes take
+ * $SENSORD_SOAK_LATENCY microseconds, fail with EIO with a chance of
+ * $SENSORD_SOAK_ERRORS per thousand, and return the value of the file
+ * plus some noise, so that the values move as real ones do.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/vfs.h>
+
+#define SYSFS_MAGIC 0x62656572
+
+static const char *root;
+static long latency;		/* microseconds */
+static long errorRate;		/* per thousand */
+static unsigned int seed = 1;
+
+static FILE *(*realFopen)(const char *, const char *);
+static int (*realOpen)(const char *, int, ...);
+static DIR *(*realOpendir)(const char *);
+static int (*realStat)(const char *, struct stat *);
+static int (*realXstat)(int, const char *, struct stat *);
+static ssize_t (*realReadlink)(const char *, char *, size_t);
+static int (*realStatfs)(const char *, struct statfs *);
+
+static void __attribute__((constructor)) init(void)
+{
+	const char *s;
+
+	realFopen = dlsym(RTLD_NEXT, "fopen");
+	realOpen = dlsym(RTLD_NEXT, "open");
+	realOpendir = dlsym(RTLD_NEXT, "opendir");
+	realStat = dlsym(RTLD_NEXT, "stat");
+	realXstat = dlsym(RTLD_NEXT, "__xstat");
+	realReadlink = dlsym(RTLD_NEXT, "readlink");
+	realStatfs = dlsym(RTLD_NEXT, "statfs");
+
+	root = getenv("SENSORD_SOAK_ROOT");
+	if ((s = getenv("SENSORD_SOAK_LATENCY")))
+		latency = atol(s);
+	if ((s = getenv("SENSORD_SOAK_ERRORS")))
+		errorRate = atol(s);
+	seed = getpid();
+}
+
+/* The path to use instead of path, or path itself */
+static const char *redirect(const char *path, char *buf)
+{
+	if (!root || !path || strncmp(path, "/sys", 4) ||
+	    (path[4] != '/' && path[4] != '\0'))
+		return path;
+	snprintf(buf, PATH_MAX, "%s%s", root, path + 4);
+	return buf;
+}
+
+static int isInput(const char *path)
+{
+	size_t len = strlen(path);
+
+	return len > 6 && !strcmp(path + len - 6, "_input");
+}
+
+/* A sensor read: the value of the file, give or take a few steps */
+
+struct cookie {
+	char text[32];
+	size_t len, pos;
+};
+
+static ssize_t inputRead(void *c, char *buf, size_t size)
+{
+	struct cookie *cookie = c;
+	size_t n;
+
+	if (cookie->pos == 0) {
+		if (latency)
+			usleep(latency);
+		if ((long)(rand_r(&seed) % 1000) < errorRate) {
+			errno = EIO;
+			return -1;
+		}
+	}
+	n = cookie->len - cookie->pos;
+	if (n > size)
+		n = size;
+	memcpy(buf, cookie->text + cookie->pos, n);
+	cookie->pos += n;
+	return n;
+}
+
+static int inputClose(void *c)
+{
+	free(c);
+	return 0;
+}
+
+static FILE *openInput(const char *path, const char *mode)
+{
+	static const cookie_io_functions_t io = {
+		.read = inputRead,
+		.close = inputClose,
+	};
+	struct cookie *cookie;
+	const char *name;
+	long value, step;
+	FILE *f;
+
+	f = realFopen(path, mode);
+	if (!f || mode[0] != 'r')
+		return f;
+	if (fscanf(f, "%ld", &value) != 1) {
+		fclose(f);
+		errno = EIO;
+		return NULL;
+	}
+	fclose(f);
+
+	name = strrchr(path, '/') + 1;
+	step = !strncmp(name, "temp", 4) ? 500 :
+		!strncmp(name, "fan", 3) ? 15 : 8;
+	cookie = malloc(sizeof(*cookie));
+	if (!cookie)
+		return NULL;
+	cookie->len = snprintf(cookie->text, sizeof(cookie->text), "%ld\n",
+			       value + step * (rand_r(&seed) % 5 - 2));
+	cookie->pos = 0;
+
+	f = fopencookie(cookie, mode, io);
+	if (!f)
+		free(cookie);
+	return f;
+}
+
+FILE *fopen(const char *path, const char *mode)
+{
+	char buf[PATH_MAX];
+	const char *real = redirect(path, buf);
+
+	if (real != path && isInput(real))
+		return openInput(real, mode);
+	return realFopen(real, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode)
+{
+	return fopen(path, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+	char buf[PATH_MAX];
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return realOpen(redirect(path, buf), flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, int);
+		va_end(ap);
+	}
+	return open(path, flags, mode);
+}
+
+DIR *opendir(const char *path)
+{
+	char buf[PATH_MAX];
+
+	return realOpendir(redirect(path, buf));
+}
+
+int stat(const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	return realStat(redirect(path, buf), st);
+}
+
+/* what stat() calls before glibc 2.33 */
+int __xstat(int ver, const char *path, struct stat *st);
+int __xstat(int ver, const char *path, struct stat *st)
+{
+	char buf[PATH_MAX];
+
+	return realXstat(ver, redirect(path, buf), st);
+}
+
+ssize_t readlink(const char *path, char *link, size_t size)
+{
+	char buf[PATH_MAX];
+
+	return realReadlink(redirect(path, buf), link, size);
+}
+
+int statfs(const char *path, struct statfs *st)
+{
+	char buf[PATH_MAX];
+	int ret;
+
+	ret = realStatfs(redirect(path, buf), st);
+	if (!ret && root && !strcmp(path, "/sys"))
+		st->f_type = SYSFS_MAGIC;
+	return ret;
+}
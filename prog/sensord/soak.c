@@ -0,0 +1,767 @@
+/*
+ * sensord-soak
+ *
+ * End-to-end benchmark and soak test of sensord, against a synthetic
+ * hwmon tree, run unprivileged in a temporary directory.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * The tree holds the given number of ISA chips with four voltages, two
+ * fans and three temperatures each, with their limits. sensord runs with
+ * sensord-soak.so preloaded (see soak-preload.c), which makes it look at
+ * the tree instead of /sys and slows down or fails the sensor reads as
+ * asked. Every sink runs at the same interval: syslog, the history ring,
+ * the RRD, the stream and the anomaly detection; the graphs less often.
+ *
+ * While it runs, the stream is subscribed to, as a client would, and
+ * the CPU time and resident size of sensord are sampled from /proc. At
+ * the end, the task statistics are fetched from GET /stats. The report
+ * gives the CPU time per sweep, the RSS growth past the warm-up, the late
+ * and missed deadlines and the lag of every sink, and the delay of the
+ * stream frames after their (aligned) deadline.
+ *
+ * The exit status is non-zero if sensord died or the stream stalled.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "frame.h"
+
+#define SAMPLE_EVERY 5		/* seconds between two /proc samples */
+#define ISA_BASE 0x1000
+
+static struct {
+	const char *sensord;
+	const char *preload;
+	int chips;
+	long latency;
+	long errors;
+	int duration;
+	int interval;
+	int graphInterval;
+	int port;
+	int noRrd;
+	int keep;
+} opt = {
+	.chips = 200,
+	.duration = 60,
+	.interval = 1,
+	.graphInterval = 60,
+	.port = 8779,
+};
+
+static char dir[PATH_MAX / 2];
+static pid_t pid;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int writeFile(const char *path, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int writeFile(const char *path, const char *fmt, ...)
+{
+	va_list ap;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f) {
+		fprintf(stderr, "Error creating `%s': %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+	return fclose(f);
+}
+
+static int makeDir(const char *path)
+{
+	if (mkdir(path, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Error creating `%s': %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* root/class/hwmon/hwmonN, with a device link for a distinct address */
+static int makeChip(int n)
+{
+	static const struct {
+		const char *name;
+		long value;
+	} attrs[] = {
+		{ "in0_input", 1200 }, { "in0_min", 1100 }, { "in0_max", 1300 },
+		{ "in1_input", 3300 }, { "in1_min", 3130 }, { "in1_max", 3470 },
+		{ "in2_input", 5000 }, { "in2_min", 4750 }, { "in2_max", 5250 },
+		{ "in3_input", 12000 }, { "in3_min", 11400 },
+		{ "in3_max", 12600 },
+		{ "fan1_input", 2400 }, { "fan1_min", 600 },
+		{ "fan2_input", 1800 }, { "fan2_min", 600 },
+		{ "temp1_input", 40000 }, { "temp1_max", 80000 },
+		{ "temp2_input", 45000 }, { "temp2_max", 85000 },
+		{ "temp3_input", 35000 }, { "temp3_max", 70000 },
+		{ "temp3_crit", 95000 },
+	};
+	char path[PATH_MAX], target[64];
+	int i;
+
+	snprintf(path, sizeof(path), "%s/devices/soak/9191-%04x", dir,
+		 ISA_BASE + n);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/class/hwmon/hwmon%d", dir, n);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/class/hwmon/hwmon%d/device", dir, n);
+	snprintf(target, sizeof(target), "../../../devices/soak/9191-%04x",
+		 ISA_BASE + n);
+	if (symlink(target, path)) {
+		fprintf(stderr, "Error creating `%s': %s\n", path,
+			strerror(errno));
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/class/hwmon/hwmon%d/name", dir, n);
+	if (writeFile(path, "soak\n"))
+		return -1;
+
+	for (i = 0; i < (int)(sizeof(attrs) / sizeof(attrs[0])); i++) {
+		snprintf(path, sizeof(path), "%s/class/hwmon/hwmon%d/%s", dir,
+			 n, attrs[i].name);
+		/* a little different on every chip */
+		if (writeFile(path, "%ld\n", attrs[i].value + n % 7 *
+			      (attrs[i].value / 100)))
+			return -1;
+	}
+	return 0;
+}
+
+static int makeTree(void)
+{
+	const char *tmp = getenv("TMPDIR");
+	char path[PATH_MAX], *real;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/sensord-soak.XXXXXX",
+		 tmp ? tmp : "/tmp");
+	/* sensord runs in /, the paths given to it must be absolute */
+	if (!mkdtemp(path) || !(real = realpath(path, NULL))) {
+		fprintf(stderr, "Error creating a temporary directory: %s\n",
+			strerror(errno));
+		return -1;
+	}
+	if (strlen(real) >= sizeof(dir)) {
+		fprintf(stderr, "Temporary directory name too long\n");
+		free(real);
+		return -1;
+	}
+	strcpy(dir, real);
+	free(real);
+
+	snprintf(path, sizeof(path), "%s/class", dir);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/class/hwmon", dir);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/devices", dir);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/devices/soak", dir);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/graphs", dir);
+	if (makeDir(path))
+		return -1;
+	snprintf(path, sizeof(path), "%s/sensors.conf", dir);
+	if (writeFile(path, "# no configuration, all chips and features\n"))
+		return -1;
+
+	for (i = 0; i < opt.chips; i++)
+		if (makeChip(i))
+			return -1;
+	return 0;
+}
+
+static int removeEntry(const char *path, const struct stat *st, int flag,
+		       struct FTW *ftw)
+{
+	(void)st;
+	(void)flag;
+	(void)ftw;
+	return remove(path);
+}
+
+static void removeTree(void)
+{
+	if (!dir[0])
+		return;
+	if (opt.keep)
+		printf("kept:      %s\n", dir);
+	else
+		nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static char *format(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static char *format(const char *fmt, ...)
+{
+	va_list ap;
+	char *s;
+
+	va_start(ap, fmt);
+	if (vasprintf(&s, fmt, ap) < 0)
+		s = NULL;
+	va_end(ap);
+	return s;
+}
+
+/* In the child: every sink at the same interval */
+static void execSensord(void)
+{
+	char *argv[40];
+	int argc = 0;
+
+#define ARG(...) (argv[argc++] = format(__VA_ARGS__))
+	ARG("sensord");
+	ARG("-c");
+	ARG("%s/sensors.conf", dir);
+	ARG("-p");
+	ARG("%s/sensord.pid", dir);
+	ARG("-i");
+	ARG("%d", opt.interval);
+	ARG("-l");
+	ARG("%d", opt.interval);
+	ARG("-a");
+	ARG("-H");
+	ARG("%s/history.ring", dir);
+	ARG("--history-interval");
+	ARG("%d", opt.interval);
+	ARG("--query-address");
+	ARG("127.0.0.1");
+	ARG("--query-port");
+	ARG("%d", opt.port);
+	ARG("--stream-interval");
+	ARG("%d", opt.interval);
+	ARG("--anomaly-interval");
+	ARG("%d", opt.interval);
+	ARG("--align");
+	if (!opt.noRrd) {
+		ARG("-r");
+		ARG("%s/sensord.rrd", dir);
+		ARG("-t");
+		ARG("%d", opt.interval);
+		ARG("--graph-dir");
+		ARG("%s/graphs", dir);
+		ARG("--graph-interval");
+		ARG("%d", opt.graphInterval);
+	}
+#undef ARG
+	argv[argc] = NULL;
+
+	setenv("LD_PRELOAD", opt.preload, 1);
+	setenv("SENSORD_SOAK_ROOT", dir, 1);
+	setenv("SENSORD_SOAK_LATENCY", format("%ld", opt.latency), 1);
+	setenv("SENSORD_SOAK_ERRORS", format("%ld", opt.errors), 1);
+	execv(opt.sensord, argv);
+	fprintf(stderr, "Error running `%s': %s\n", opt.sensord,
+		strerror(errno));
+	_exit(127);
+}
+
+static int startSensord(void)
+{
+	char pidFile[PATH_MAX];
+	int status, i;
+	pid_t child;
+	FILE *f;
+
+	snprintf(pidFile, sizeof(pidFile), "%s/sensord.pid", dir);
+	child = fork();
+	if (child < 0) {
+		perror("fork()");
+		return -1;
+	}
+	if (!child)
+		execSensord();
+
+	/* sensord forks into the background once it is set up */
+	if (waitpid(child, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status)) {
+		fprintf(stderr, "sensord did not start\n");
+		return -1;
+	}
+	for (i = 0; i < 50; i++) {
+		f = fopen(pidFile, "r");
+		if (f) {
+			if (fscanf(f, "%d", &pid) != 1)
+				pid = 0;
+			fclose(f);
+		}
+		if (pid > 0)
+			return 0;
+		usleep(100000);
+	}
+	fprintf(stderr, "No PID in `%s'\n", pidFile);
+	return -1;
+}
+
+static void stopSensord(void)
+{
+	int i;
+
+	if (pid <= 0 || kill(pid, SIGTERM))
+		return;
+	for (i = 0; i < 100 && !kill(pid, 0); i++)
+		usleep(100000);
+}
+
+static int connectQuery(const char *request)
+{
+	struct sockaddr_in addr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opt.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    write(fd, request, strlen(request)) != (ssize_t)strlen(request)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* The body of the answer to GET path, or NULL */
+static char *fetch(const char *path)
+{
+	char request[256], *data = NULL, *body, *p;
+	size_t len = 0, size = 0;
+	ssize_t n;
+	int fd;
+
+	snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", path);
+	fd = connectQuery(request);
+	if (fd < 0)
+		return NULL;
+	for (;;) {
+		if (len + 4096 > size) {
+			size = 2 * size + 4096;
+			p = realloc(data, size + 1);
+			if (!p)
+				break;
+			data = p;
+		}
+		n = read(fd, data + len, size - len);
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	if (!data)
+		return NULL;
+	data[len] = '\0';
+
+	body = strstr(data, "\r\n\r\n");
+	if (!body || strncmp(data, "HTTP/1.0 200", 12)) {
+		free(data);
+		return NULL;
+	}
+	memmove(data, body + 4, strlen(body + 4) + 1);
+	return data;
+}
+
+/* The subscription to the stream */
+
+static struct {
+	int fd;
+	unsigned char *buf;
+	size_t len, size;
+	int header;		/* HTTP header read */
+	struct frameDecoder decoder;
+	unsigned long frames, errors;
+	double lagTotal, lagMax;
+} stream = { .fd = -1 };
+
+static int streamRead(void)
+{
+	unsigned char *p;
+	ssize_t n;
+	size_t pos = 0;
+	int size, type;
+	double lag;
+
+	if (stream.len == stream.size) {
+		p = realloc(stream.buf, 2 * stream.size + 65536);
+		if (!p)
+			return -1;
+		stream.buf = p;
+		stream.size = 2 * stream.size + 65536;
+	}
+	n = read(stream.fd, stream.buf + stream.len,
+		 stream.size - stream.len);
+	if (n <= 0)
+		return -1;
+	stream.len += n;
+
+	if (!stream.header) {
+		p = memmem(stream.buf, stream.len, "\r\n\r\n", 4);
+		if (!p)
+			return 0;
+		pos = p + 4 - stream.buf;
+		stream.header = 1;
+	}
+
+	while (pos < stream.len) {
+		size = frameDecode(&stream.decoder, stream.buf + pos,
+				   stream.len - pos, &type);
+		if (size < 0) {
+			stream.errors++;
+			return -1;
+		}
+		if (!size)
+			break;
+		pos += size;
+		if (type != FrameType_key && type != FrameType_delta)
+			continue;
+
+		/* with --align, the frame time is the deadline */
+		lag = now() - stream.decoder.time;
+		stream.frames++;
+		stream.lagTotal += lag;
+		if (lag > stream.lagMax)
+			stream.lagMax = lag;
+	}
+	memmove(stream.buf, stream.buf + pos, stream.len - pos);
+	stream.len -= pos;
+	return 0;
+}
+
+/* /proc samples of sensord */
+
+struct sample {
+	double time;
+	double cpu;		/* seconds, user and system */
+	long rss;		/* kB */
+};
+
+static int sampleProc(struct sample *s)
+{
+	char path[64], line[256], *p;
+	unsigned long utime, stime;
+	FILE *f;
+
+	s->time = now();
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	p = fgets(line, sizeof(line), f) ? strrchr(line, ')') : NULL;
+	fclose(f);
+	/* state is field 3; utime and stime are 14 and 15 */
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+			 "%*u %lu %lu", &utime, &stime) != 2)
+		return -1;
+	s->cpu = (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	s->rss = -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmRSS: %ld", &s->rss) == 1)
+			break;
+	fclose(f);
+	return s->rss < 0 ? -1 : 0;
+}
+
+/* Report */
+
+static const char *jsonNumber(const char *obj, const char *key, double *value)
+{
+	char pattern[64];
+	const char *p;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+	p = strstr(obj, pattern);
+	if (!p || sscanf(p + strlen(pattern), "%lf", value) != 1)
+		*value = 0;
+	return p;
+}
+
+static void reportTasks(const char *stats)
+{
+	const char *task, *end;
+	char name[32], obj[512];
+	double runs, avg, max, late, missed, maxLag;
+	size_t len;
+
+	printf("%-8s %8s %9s %9s %6s %7s %8s\n", "sink", "runs", "avg ms",
+	       "max ms", "late", "missed", "max lag");
+	task = strstr(stats, "\"tasks\":[");
+	while (task && (task = strstr(task, "{\"name\":\""))) {
+		end = strchr(task, '}');
+		if (!end)
+			break;
+		len = end - task < (long)sizeof(obj) - 1 ?
+			(size_t)(end - task) : sizeof(obj) - 1;
+		memcpy(obj, task, len);
+		obj[len] = '\0';
+		task = end;
+
+		if (sscanf(obj, "{\"name\":\"%31[^\"]", name) != 1)
+			continue;
+		jsonNumber(obj, "runs", &runs);
+		jsonNumber(obj, "avg_ms", &avg);
+		jsonNumber(obj, "max_ms", &max);
+		jsonNumber(obj, "late", &late);
+		jsonNumber(obj, "missed", &missed);
+		jsonNumber(obj, "max_lag", &maxLag);
+		printf("%-8s %8.0f %9.3f %9.3f %6.0f %7.0f %7.3fs\n", name,
+		       runs, avg, max, late, missed, maxLag);
+	}
+}
+
+static const char *syntax =
+	"Syntax: sensord-soak {options}\n"
+	"  -s, --sensord <file>     -- sensord to run (default: next to "
+	"this program)\n"
+	"  -P, --preload <file>     -- sensord-soak.so (default: next to "
+	"this program)\n"
+	"  -c, --chips <n>          -- synthetic chips (default 200)\n"
+	"  -l, --latency <us>       -- duration of a sensor read (default 0)\n"
+	"  -e, --errors <n>         -- failing sensor reads per thousand "
+	"(default 0)\n"
+	"  -d, --duration <s>       -- length of the run (default 60)\n"
+	"  -i, --interval <s>       -- interval of every sink (default 1)\n"
+	"  -g, --graph-interval <s> -- interval of the graphs (default 60)\n"
+	"  -p, --port <n>           -- query port (default 8779)\n"
+	"  -R, --no-rrd             -- no RRD and graphs\n"
+	"  -k, --keep               -- keep the temporary directory\n";
+
+static const struct option longOptions[] = {
+	{ "sensord", required_argument, NULL, 's' },
+	{ "preload", required_argument, NULL, 'P' },
+	{ "chips", required_argument, NULL, 'c' },
+	{ "latency", required_argument, NULL, 'l' },
+	{ "errors", required_argument, NULL, 'e' },
+	{ "duration", required_argument, NULL, 'd' },
+	{ "interval", required_argument, NULL, 'i' },
+	{ "graph-interval", required_argument, NULL, 'g' },
+	{ "port", required_argument, NULL, 'p' },
+	{ "no-rrd", no_argument, NULL, 'R' },
+	{ "keep", no_argument, NULL, 'k' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* name, in the directory of this program */
+static char *besideSelf(const char *name)
+{
+	char self[PATH_MAX], *path, *slash;
+	ssize_t n;
+
+	n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (n < 0)
+		return NULL;
+	self[n] = '\0';
+	slash = strrchr(self, '/');
+	if (slash)
+		*slash = '\0';
+	path = malloc(strlen(self) + strlen(name) + 2);
+	if (path)
+		sprintf(path, "%s/%s", self, name);
+	return path;
+}
+
+int main(int argc, char **argv)
+{
+	struct sample first, warm, last, s;
+	struct pollfd pfd;
+	double start, end, nextSample, growth;
+	unsigned long sweeps;
+	long rssMax = 0;
+	char *stats;
+	int c, ret = EXIT_FAILURE, dead = 0;
+
+	while ((c = getopt_long(argc, argv, "s:P:c:l:e:d:i:g:p:Rk",
+				longOptions, NULL)) != EOF) {
+		switch (c) {
+		case 's':
+			opt.sensord = optarg;
+			break;
+		case 'P':
+			opt.preload = optarg;
+			break;
+		case 'c':
+			opt.chips = atoi(optarg);
+			break;
+		case 'l':
+			opt.latency = atol(optarg);
+			break;
+		case 'e':
+			opt.errors = atol(optarg);
+			break;
+		case 'd':
+			opt.duration = atoi(optarg);
+			break;
+		case 'i':
+			opt.interval = atoi(optarg);
+			break;
+		case 'g':
+			opt.graphInterval = atoi(optarg);
+			break;
+		case 'p':
+			opt.port = atoi(optarg);
+			break;
+		case 'R':
+			opt.noRrd = 1;
+			break;
+		case 'k':
+			opt.keep = 1;
+			break;
+		default:
+			fprintf(stderr, "%s", syntax);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (opt.chips <= 0 || opt.chips > 0xefff || opt.latency < 0 ||
+	    opt.errors < 0 || opt.errors > 1000 || opt.duration <= 0 ||
+	    opt.interval <= 0 || opt.graphInterval <= 0 ||
+	    opt.port <= 0 || opt.port > 65535) {
+		fprintf(stderr, "%s", syntax);
+		exit(EXIT_FAILURE);
+	}
+	if (!opt.sensord)
+		opt.sensord = besideSelf("sensord");
+	if (!opt.preload)
+		opt.preload = besideSelf("sensord-soak.so");
+	if (!opt.sensord || !opt.preload) {
+		fprintf(stderr, "Error locating sensord\n");
+		exit(EXIT_FAILURE);
+	}
+
+	frameDecoderInit(&stream.decoder);
+	if (makeTree() || startSensord() || sampleProc(&first))
+		goto exit;
+
+	/* the query endpoint opens once the chips are known */
+	for (c = 0; c < 50 && stream.fd < 0; c++) {
+		stream.fd = connectQuery("GET /stream HTTP/1.0\r\n\r\n");
+		if (stream.fd < 0)
+			usleep(100000);
+	}
+	if (stream.fd < 0) {
+		fprintf(stderr, "Error subscribing to the stream\n");
+		goto exit;
+	}
+
+	start = now();
+	end = start + opt.duration;
+	nextSample = start + SAMPLE_EVERY;
+	warm = last = first;
+	pfd.fd = stream.fd;
+	pfd.events = POLLIN;
+	while (now() < end) {
+		if (poll(&pfd, 1, 200) > 0 && streamRead()) {
+			fprintf(stderr, "Stream closed or invalid\n");
+			break;
+		}
+		if (now() < nextSample)
+			continue;
+		nextSample += SAMPLE_EVERY;
+		if (sampleProc(&s)) {
+			fprintf(stderr, "sensord died\n");
+			dead = 1;
+			break;
+		}
+		/* growth is measured past the first tenth of the run */
+		if (s.time - start < opt.duration / 10. + SAMPLE_EVERY)
+			warm = s;
+		if (s.rss > rssMax)
+			rssMax = s.rss;
+		last = s;
+	}
+
+	stats = dead ? NULL : fetch("/stats");
+
+	printf("sensord:   %d chips, %d series, every %d s for %d s\n",
+	       opt.chips, stream.decoder.numSeries, opt.interval,
+	       opt.duration);
+	printf("reads:     %ld us latency, %ld/1000 failing\n", opt.latency,
+	       opt.errors);
+	sweeps = stream.frames + stream.decoder.lost;
+	printf("cpu:       %.3f s, %.2f ms per sweep\n", last.cpu - first.cpu,
+	       sweeps ? (last.cpu - first.cpu) * 1000 / sweeps : 0.);
+	growth = last.time > warm.time ? (last.rss - warm.rss) * 3600. /
+		(last.time - warm.time) : 0;
+	printf("rss:       %ld kB at start, %ld kB at end, %ld kB max, "
+	       "%+.0f kB/h after warm-up\n", first.rss, last.rss, rssMax,
+	       growth);
+	printf("stream:    %lu frames, %lu lost, avg %.3f s, max %.3f s "
+	       "after the deadline\n", stream.frames, stream.decoder.lost,
+	       stream.frames ? stream.lagTotal / stream.frames : 0.,
+	       stream.lagMax);
+	if (stats)
+		reportTasks(stats);
+	else
+		fprintf(stderr, "Error fetching /stats\n");
+	free(stats);
+
+	if (!dead && stream.frames && !stream.errors)
+		ret = EXIT_SUCCESS;
+exit:
+	if (stream.fd >= 0)
+		close(stream.fd);
+	frameDecoderFree(&stream.decoder);
+	free(stream.buf);
+	stopSensord();
+	removeTree();
+	return ret;
+}
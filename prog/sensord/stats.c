@@ -0,0 +1,222 @@
+/*
+ * sensord
+ *
+ * A daemon that periodically logs sensor information to syslog.
+ *
+ * Copyright (c) 1999-2002 Merlin Hughes <merlin@merlin.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ */
+
+/*
+ * Self-metrics: how long the periodic tasks take, whether they run on
+ * time, and how long individual chips and the RRD take. Everything is
+ * a handful of counters updated once per task run or chip read.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "args.h"
+#include "sensord.h"
+
+/* A task is late if it starts more than this after its deadline */
+#define LATE_TOLERANCE 1.0
+
+struct taskStats {
+	const char *name;
+	int interval;
+	double due;		/* monotonic time of the next deadline */
+	double start;
+	unsigned long late;
+	unsigned long missed;
+	double lag;		/* last start delay, seconds */
+	double maxLag;
+	TimeStats run;
+};
+
+static struct taskStats tasks[Task_count] = {
+	[Task_scan] = { .name = "scan" },
+	[Task_log] = { .name = "log" },
+	[Task_rrd] = { .name = "rrd" },
+	[Task_history] = { .name = "history" },
+	[Task_graph] = { .name = "graph" },
+	[Task_stream] = { .name = "stream" },
+	[Task_anomaly] = { .name = "anomaly" },
+};
+
+/* Upper bounds of the sweep duration histogram buckets, in ms */
+static const double sweepBuckets[] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+
+static unsigned long sweepHistogram[ARRAY_SIZE(sweepBuckets) + 1];
+static TimeStats rrdUpdateTime;
+
+double statsNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void statsAdd(TimeStats *stats, double seconds)
+{
+	stats->count++;
+	stats->total += seconds;
+	if (seconds > stats->max)
+		stats->max = seconds;
+}
+
+void statsTaskBegin(TaskId id, int interval)
+{
+	struct taskStats *task = &tasks[id];
+	double now = statsNow();
+
+	task->start = now;
+	if (task->interval != interval || !task->due) {
+		/* first run, or interval changed: nothing to compare to */
+		task->interval = interval;
+		task->lag = 0;
+		task->due = now + interval;
+		return;
+	}
+
+	task->lag = now > task->due ? now - task->due : 0;
+	if (task->lag > task->maxLag)
+		task->maxLag = task->lag;
+	if (task->lag > LATE_TOLERANCE)
+		task->late++;
+	if (interval && task->lag >= interval) {
+		/* whole intervals skipped */
+		task->missed += (unsigned long)(task->lag / interval);
+		task->due += interval * (int)(task->lag / interval);
+	}
+	task->due += interval;
+}
+
+void statsTaskEnd(TaskId id)
+{
+	struct taskStats *task = &tasks[id];
+	double elapsed = statsNow() - task->start;
+	int i;
+
+	statsAdd(&task->run, elapsed);
+
+	for (i = 0; i < ARRAY_SIZE(sweepBuckets); i++)
+		if (elapsed * 1000 < sweepBuckets[i])
+			break;
+	sweepHistogram[i]++;
+}
+
+void statsRrdUpdate(double seconds)
+{
+	statsAdd(&rrdUpdateTime, seconds);
+}
+
+static double avgMs(const TimeStats *stats)
+{
+	return stats->count ? stats->total * 1000 / stats->count : 0;
+}
+
+/* Periodic summary, at the level of regular sensor readings */
+void statsLog(void)
+{
+	char chip[256];
+	int i;
+
+	for (i = 0; i < Task_count; i++) {
+		const struct taskStats *task = &tasks[i];
+
+		if (!task->run.count)
+			continue;
+		sensorLog(LOG_INFO, "Stats: %s: %lu runs, avg %.1f ms, "
+			  "max %.1f ms, %lu late, %lu missed, max lag %.1f s",
+			  task->name, task->run.count, avgMs(&task->run),
+			  task->run.max * 1000, task->late, task->missed,
+			  task->maxLag);
+	}
+
+	sensorLog(LOG_INFO, "Stats: sweeps (ms) <1: %lu, <2: %lu, <5: %lu, "
+		  "<10: %lu, <20: %lu, <50: %lu, <100: %lu, <200: %lu, "
+		  "<500: %lu, <1000: %lu, more: %lu",
+		  sweepHistogram[0], sweepHistogram[1], sweepHistogram[2],
+		  sweepHistogram[3], sweepHistogram[4], sweepHistogram[5],
+		  sweepHistogram[6], sweepHistogram[7], sweepHistogram[8],
+		  sweepHistogram[9], sweepHistogram[10]);
+
+	if (rrdUpdateTime.count)
+		sensorLog(LOG_INFO, "Stats: rrd: %lu updates, avg %.1f ms, "
+			  "max %.1f ms", rrdUpdateTime.count,
+			  avgMs(&rrdUpdateTime), rrdUpdateTime.max * 1000);
+
+	for (i = 0; knownChips && knownChips[i].features; i++) {
+		const TimeStats *read = &knownChips[i].readTime;
+
+		if (!read->count ||
+		    sensors_snprintf_chip_name(chip, sizeof(chip),
+					       knownChips[i].name) < 0)
+			continue;
+		sensorLog(LOG_INFO, "Stats: chip %s: %lu reads, avg %.2f ms, "
+			  "max %.2f ms", chip, read->count, avgMs(read),
+			  read->max * 1000);
+	}
+}
+
+/*
+ * The same counters as a JSON object, for GET /stats of the query
+ * endpoint. Returns the length, which is at least size if buf was too
+ * small.
+ */
+int statsJson(char *buf, size_t size)
+{
+	size_t len = 0;
+	int i, first = 1;
+
+#define PRINT(...) \
+	len += snprintf(buf + len, len < size ? size - len : 0, __VA_ARGS__)
+
+	PRINT("{\"tasks\":[");
+	for (i = 0; i < Task_count; i++) {
+		const struct taskStats *task = &tasks[i];
+
+		if (!task->run.count)
+			continue;
+		PRINT("%s{\"name\":\"%s\",\"interval\":%d,\"runs\":%lu,"
+		      "\"avg_ms\":%.3f,\"max_ms\":%.3f,\"late\":%lu,"
+		      "\"missed\":%lu,\"lag\":%.3f,\"max_lag\":%.3f}",
+		      first ? "" : ",", task->name, task->interval,
+		      task->run.count, avgMs(&task->run),
+		      task->run.max * 1000, task->late, task->missed,
+		      task->lag, task->maxLag);
+		first = 0;
+	}
+	PRINT("],\"sweeps\":{\"buckets_ms\":[");
+	for (i = 0; i < ARRAY_SIZE(sweepBuckets); i++)
+		PRINT("%s%g", i ? "," : "", sweepBuckets[i]);
+	PRINT("],\"counts\":[");
+	for (i = 0; i <= ARRAY_SIZE(sweepBuckets); i++)
+		PRINT("%s%lu", i ? "," : "", sweepHistogram[i]);
+	PRINT("]},\"rrd\":{\"updates\":%lu,\"avg_ms\":%.3f,\"max_ms\":%.3f}}\n",
+	      rrdUpdateTime.count, avgMs(&rrdUpdateTime),
+	      rrdUpdateTime.max * 1000);
+
+#undef PRINT
+	return len;
+}